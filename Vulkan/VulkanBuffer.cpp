@@ -57,4 +57,16 @@ uint32_t ComputeEngine::GetMemoryType(VkPhysicalDevice physical_device, uint32_t
     }
     assert(0 && "Memory properties are not supported by this device");
     return -1;
+}
+
+bool ComputeEngine::HasMemoryProperties(VkPhysicalDevice physical_device, VkMemoryPropertyFlags properties)
+{
+    VkPhysicalDeviceMemoryProperties memory_properties;
+    vkGetPhysicalDeviceMemoryProperties(physical_device, &memory_properties);
+    for (uint32_t i = 0; i < memory_properties.memoryTypeCount; ++i)
+    {
+        if ((memory_properties.memoryTypes[i].propertyFlags & properties) == properties)
+            return true;
+    }
+    return false;
 }
\ No newline at end of file
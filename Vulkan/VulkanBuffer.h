@@ -13,6 +13,7 @@ namespace ComputeEngine
     void DestroyBuffer(SupportedDevice supported_device, VulkanBuffer vulkan_buffer);
     VulkanBuffer CreateBuffer(SupportedDevice supported_device, uint32_t buffer_size, VkMemoryPropertyFlags memory_properties);
     uint32_t GetMemoryType(VkPhysicalDevice physical_device, uint32_t memory_type_bits, VkMemoryPropertyFlags properties);
+    bool HasMemoryProperties(VkPhysicalDevice physical_device, VkMemoryPropertyFlags properties);
 };
 
 #include "VulkanBuffer.cpp"
@@ -4,17 +4,13 @@ void ComputeEngine::DestroyCommandBuffer(ComputeEngine::SupportedDevice supporte
     vkDestroyCommandPool(supported_device.device, command_buffer.command_pool, nullptr);
 }
 
-ComputeEngine::VulkanCommandBuffer ComputeEngine::CreateCommandBuffer(
-    ComputeEngine::SupportedDevice supported_device,
-    ComputeEngine::VulkanPipeline pipeline,
-    ComputeEngine::VulkanDescriptor descriptor,
-    uint32_t work_group_x, uint32_t work_group_y, uint32_t work_group_z
-){
+ComputeEngine::VulkanCommandBuffer ComputeEngine::CreateCommandBuffer(ComputeEngine::SupportedDevice supported_device)
+{
     //Create command pool info
     VkCommandPoolCreateInfo command_pool_info = {};
     {
         command_pool_info.sType                         = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-        command_pool_info.flags                         = 0;
+        command_pool_info.flags                         = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT; // allow re-recording the command buffer.
         command_pool_info.queueFamilyIndex              = supported_device.queue_index;
     }
 
@@ -36,26 +32,85 @@ ComputeEngine::VulkanCommandBuffer ComputeEngine::CreateCommandBuffer(
     result = vkAllocateCommandBuffers(supported_device.device, &command_buffer_allocate_info, &command_buffer);
     assert(result == VK_SUCCESS && "Could not allocate command buffers");
 
+    return { command_pool, command_buffer };
+}
+
+ComputeEngine::VulkanCommandBuffer ComputeEngine::CreateCommandBuffer(
+    ComputeEngine::SupportedDevice supported_device,
+    ComputeEngine::VulkanPipeline pipeline,
+    ComputeEngine::VulkanDescriptor descriptor,
+    uint32_t work_group_x, uint32_t work_group_y, uint32_t work_group_z
+){
+    VulkanCommandBuffer command_buffer = CreateCommandBuffer(supported_device);
+    RecordCommandBuffer(command_buffer, pipeline, descriptor, nullptr, 0, work_group_x, work_group_y, work_group_z);
+    return command_buffer;
+}
+
+void ComputeEngine::RecordCommandBuffer(
+    ComputeEngine::VulkanCommandBuffer command_buffer,
+    ComputeEngine::VulkanPipeline pipeline,
+    ComputeEngine::VulkanDescriptor descriptor,
+    const void* push_constants, uint32_t push_constants_size,
+    uint32_t work_group_x, uint32_t work_group_y, uint32_t work_group_z
+){
+    RecordCommandBuffer(command_buffer, descriptor, {
+        { pipeline, push_constants, push_constants_size, work_group_x, work_group_y, work_group_z }
+    });
+}
+
+void ComputeEngine::RecordCommandBuffer(
+    ComputeEngine::VulkanCommandBuffer command_buffer,
+    ComputeEngine::VulkanDescriptor descriptor,
+    std::vector<ComputeEngine::VulkanDispatch> dispatches
+){
     //Setup command buffer begin info to use allocated command buffer
     VkCommandBufferBeginInfo begin_info = {};
     {
         begin_info.sType                                = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-        begin_info.flags                                = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT; // the buffer is only submitted and used once in this application.
+        begin_info.flags                                = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT; // the buffer is submitted once per recording.
     }
-    //Begin command buffer
-    result = vkBeginCommandBuffer(command_buffer, &begin_info); // start recording commands.
+    //Begin command buffer (implicitly resets a previous recording)
+    VkResult result = vkBeginCommandBuffer(command_buffer.command_buffer, &begin_info); // start recording commands.
     assert(result == VK_SUCCESS && "Could not begin command buffer");
 
-    //Bind pipeline and descriptor to command buffer
-    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline.pipeline);
-    vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline.pipeline_layout, 0, 1, &descriptor.descriptor_set, 0, NULL);
+    for (uint32_t i = 0; i < dispatches.size(); i++)
+    {
+        const VulkanDispatch& dispatch = dispatches[i];
 
-    //Dispatch command and give work group size
-    vkCmdDispatch(command_buffer, work_group_x, work_group_y, work_group_z);
+        //Make the previous dispatch's writes visible to this one
+        if (i > 0)
+        {
+            VkMemoryBarrier memory_barrier = {};
+            {
+                memory_barrier.sType                    = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+                memory_barrier.srcAccessMask            = VK_ACCESS_SHADER_WRITE_BIT;
+                memory_barrier.dstAccessMask            = VK_ACCESS_SHADER_READ_BIT;
+            }
+            vkCmdPipelineBarrier(command_buffer.command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &memory_barrier, 0, NULL, 0, NULL);
+        }
+
+        //Bind pipeline and descriptor to command buffer
+        vkCmdBindPipeline(command_buffer.command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, dispatch.pipeline.pipeline);
+        vkCmdBindDescriptorSets(command_buffer.command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, dispatch.pipeline.pipeline_layout, 0, 1, &descriptor.descriptor_set, 0, NULL);
+
+        //Upload push constants
+        if (dispatch.push_constants_size > 0)
+            vkCmdPushConstants(command_buffer.command_buffer, dispatch.pipeline.pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, dispatch.push_constants_size, dispatch.push_constants);
+
+        //Dispatch command and give work group size
+        vkCmdDispatch(command_buffer.command_buffer, dispatch.work_group_x, dispatch.work_group_y, dispatch.work_group_z);
+    }
+
+    //Make shader writes visible to the host once the fence is signaled
+    VkMemoryBarrier memory_barrier = {};
+    {
+        memory_barrier.sType                            = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        memory_barrier.srcAccessMask                    = VK_ACCESS_SHADER_WRITE_BIT;
+        memory_barrier.dstAccessMask                    = VK_ACCESS_HOST_READ_BIT;
+    }
+    vkCmdPipelineBarrier(command_buffer.command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &memory_barrier, 0, NULL, 0, NULL);
 
     //End command buffer
-    result = vkEndCommandBuffer(command_buffer);
+    result = vkEndCommandBuffer(command_buffer.command_buffer);
     assert(result == VK_SUCCESS && "Could not end command buffer");
-
-    return { command_pool, command_buffer  };
 }
\ No newline at end of file
@@ -9,9 +9,25 @@ namespace ComputeEngine
         VkCommandBuffer command_buffer;
     };
 
+    //One kernel dispatch of a command buffer, later dispatches see what earlier ones wrote
+    struct VulkanDispatch
+    {
+        VulkanPipeline      pipeline;
+        const void*         push_constants;
+        uint32_t            push_constants_size;
+        uint32_t            work_group_x;
+        uint32_t            work_group_y;
+        uint32_t            work_group_z;
+    };
+
     void DestroyCommandBuffer(SupportedDevice support_device, VulkanCommandBuffer command_buffer);
+    VulkanCommandBuffer CreateCommandBuffer(SupportedDevice support_device);
     VulkanCommandBuffer CreateCommandBuffer(SupportedDevice support_device, VulkanPipeline pipeline, VulkanDescriptor descriptor,
-        uint32_t work_group_x, uint32_t work_group_y, uint32_t work_group_z);    
+        uint32_t work_group_x, uint32_t work_group_y, uint32_t work_group_z);
+    void RecordCommandBuffer(VulkanCommandBuffer command_buffer, VulkanPipeline pipeline, VulkanDescriptor descriptor,
+        const void* push_constants, uint32_t push_constants_size,
+        uint32_t work_group_x, uint32_t work_group_y, uint32_t work_group_z);
+    void RecordCommandBuffer(VulkanCommandBuffer command_buffer, VulkanDescriptor descriptor, std::vector<VulkanDispatch> dispatches);
 };
 
 #include "VulkanCommandBuffer.cpp"
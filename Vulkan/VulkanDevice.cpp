@@ -1,6 +1,11 @@
 std::vector<ComputeEngine::SupportedDevice> ComputeEngine::CreateDevices(VkInstance instance)
 {
-    std::vector<SupportedPhysicalDevice> physical_devices = FindPhysicalDevices(instance);
+    return CreateDevices(instance, VK_API_VERSION_1_0);
+}
+
+std::vector<ComputeEngine::SupportedDevice> ComputeEngine::CreateDevices(VkInstance instance, uint32_t api_version)
+{
+    std::vector<SupportedPhysicalDevice> physical_devices = FindPhysicalDevices(instance, api_version);
     std::vector<SupportedDevice> devices(physical_devices.size());
     for (int i = 0; i < physical_devices.size(); i++)
     {
@@ -10,7 +15,7 @@ std::vector<ComputeEngine::SupportedDevice> ComputeEngine::CreateDevices(VkInsta
     return devices;
 }
 
-std::vector<ComputeEngine::SupportedPhysicalDevice> ComputeEngine::FindPhysicalDevices(VkInstance instance)
+std::vector<ComputeEngine::SupportedPhysicalDevice> ComputeEngine::FindPhysicalDevices(VkInstance instance, uint32_t api_version)
 {
     //Get number of compute device (GPU)
     uint32_t device_count;
@@ -31,8 +36,10 @@ std::vector<ComputeEngine::SupportedPhysicalDevice> ComputeEngine::FindPhysicalD
             //Get GPU properties (name, api e.t.c.)
             VkPhysicalDeviceProperties device_properties;
             vkGetPhysicalDeviceProperties(devices[i], &device_properties);
+            //Get optional features the GPU supports (subgroups, 8/16-bit types e.t.c.)
+            DeviceCapabilities capabilities = GetDeviceCapabilities(devices[i], api_version);
             //Add supported GPUs to the list
-            supported_devices.push_back({ devices[i], queue_index, device_properties });
+            supported_devices.push_back({ devices[i], queue_index, device_properties, capabilities });
         }
     }
 
@@ -57,20 +64,64 @@ ComputeEngine::SupportedDevice ComputeEngine::CreateDevice(SupportedPhysicalDevi
         queue_create_info.pQueuePriorities          = &queue_priorities;
     }
     
+    //Enable every optional feature the device reported as supported
+    //(feature structs and extension names must stay alive until vkCreateDevice)
+    DeviceCapabilities capabilities = physical_device.capabilities;
+    std::vector<const char*> extension_names = device_extension_names;
+    VkPhysicalDeviceShaderFloat16Int8Features   float16_int8_features = {};
+    VkPhysicalDevice8BitStorageFeatures         storage_8bit_features = {};
+    VkPhysicalDevice16BitStorageFeatures        storage_16bit_features = {};
+    VkPhysicalDeviceFeatures2                   device_features = {};
+    {
+        void* next = nullptr;
+        if (capabilities.flags & (DEVICE_CAPABILITY_SHADER_FLOAT16 | DEVICE_CAPABILITY_SHADER_INT8))
+        {
+            float16_int8_features.sType                     = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SHADER_FLOAT16_INT8_FEATURES;
+            float16_int8_features.pNext                     = next;
+            float16_int8_features.shaderFloat16             = (capabilities.flags & DEVICE_CAPABILITY_SHADER_FLOAT16) ? VK_TRUE : VK_FALSE;
+            float16_int8_features.shaderInt8                = (capabilities.flags & DEVICE_CAPABILITY_SHADER_INT8) ? VK_TRUE : VK_FALSE;
+            next = &float16_int8_features;
+            if (capabilities.api_version < VK_API_VERSION_1_2)
+                extension_names.push_back(VK_KHR_SHADER_FLOAT16_INT8_EXTENSION_NAME);
+        }
+        if (capabilities.flags & DEVICE_CAPABILITY_STORAGE_BUFFER_8BIT)
+        {
+            storage_8bit_features.sType                     = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_8BIT_STORAGE_FEATURES;
+            storage_8bit_features.pNext                     = next;
+            storage_8bit_features.storageBuffer8BitAccess   = VK_TRUE;
+            next = &storage_8bit_features;
+            if (capabilities.api_version < VK_API_VERSION_1_2)
+                extension_names.push_back(VK_KHR_8BIT_STORAGE_EXTENSION_NAME);
+        }
+        if (capabilities.flags & DEVICE_CAPABILITY_STORAGE_BUFFER_16BIT)
+        {
+            storage_16bit_features.sType                    = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_16BIT_STORAGE_FEATURES;
+            storage_16bit_features.pNext                    = next;
+            storage_16bit_features.storageBuffer16BitAccess = VK_TRUE;
+            next = &storage_16bit_features;
+        }
+
+        device_features.sType                           = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        device_features.pNext                           = next;
+        device_features.features.shaderInt16            = (capabilities.flags & DEVICE_CAPABILITY_SHADER_INT16) ? VK_TRUE : VK_FALSE;
+        device_features.features.shaderFloat64          = (capabilities.flags & DEVICE_CAPABILITY_SHADER_FLOAT64) ? VK_TRUE : VK_FALSE;
+    }
+
     //Create device create info using queue create info
     VkDeviceCreateInfo  device_create_info = {};
     {
-        //Don't need any extra features for computational work load
-        VkPhysicalDeviceFeatures device_features = {};
-
         device_create_info.sType                    = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
         device_create_info.enabledLayerCount        = device_layer_names.size();
         device_create_info.ppEnabledLayerNames      = device_layer_names.data();
-        device_create_info.enabledExtensionCount    = device_extension_names.size();
-        device_create_info.ppEnabledExtensionNames  = device_extension_names.data();
+        device_create_info.enabledExtensionCount    = extension_names.size();
+        device_create_info.ppEnabledExtensionNames  = extension_names.data();
         device_create_info.queueCreateInfoCount     = 1;
         device_create_info.pQueueCreateInfos        = &queue_create_info;
-        device_create_info.pEnabledFeatures         = &device_features;
+        //Feature chains need 1.1, on 1.0 only the core features can be enabled
+        if (capabilities.api_version >= VK_API_VERSION_1_1)
+            device_create_info.pNext                = &device_features;
+        else
+            device_create_info.pEnabledFeatures     = &device_features.features;
     }
     //Get Device from Physical Device
     VkDevice device = VK_NULL_HANDLE;
@@ -80,7 +131,7 @@ ComputeEngine::SupportedDevice ComputeEngine::CreateDevice(SupportedPhysicalDevi
     VkQueue queue;
     vkGetDeviceQueue(device, physical_device.queue_index, 0, &queue);
 
-    return { physical_device.physical_device, device, physical_device.queue_index, queue, physical_device.device_properties };
+    return { physical_device.physical_device, device, physical_device.queue_index, queue, physical_device.device_properties, physical_device.capabilities };
 }
 
 uint32_t ComputeEngine::GetQueueFamilyIndex(VkPhysicalDevice physical_device)
@@ -179,4 +230,123 @@ bool ComputeEngine::CheckDeviceSupport(VkPhysicalDevice physical_device)
     }
 
     return true;
+}
+
+bool ComputeEngine::CheckDeviceExtensionSupport(VkPhysicalDevice physical_device, const char* extension_name)
+{
+    //Get extension supported count
+    uint32_t ext_count;
+    vkEnumerateDeviceExtensionProperties(physical_device, nullptr, &ext_count, nullptr);
+
+    //Get list of extensions supported
+    std::vector<VkExtensionProperties> ext_properties(ext_count);
+    vkEnumerateDeviceExtensionProperties(physical_device, nullptr, &ext_count, ext_properties.data());
+
+    for (uint32_t i = 0; i < ext_count; i++)
+    {
+        if (std::string(extension_name) == std::string(ext_properties[i].extensionName))
+            return true;
+    }
+    return false;
+}
+
+ComputeEngine::DeviceCapabilities ComputeEngine::GetDeviceCapabilities(VkPhysicalDevice physical_device, uint32_t api_version)
+{
+    DeviceCapabilities capabilities = {};
+
+    //Use whichever version is lower, the instance's or the device's (patch version is ignored)
+    VkPhysicalDeviceProperties device_properties;
+    vkGetPhysicalDeviceProperties(physical_device, &device_properties);
+    uint32_t device_version = VK_MAKE_VERSION(VK_VERSION_MAJOR(device_properties.apiVersion), VK_VERSION_MINOR(device_properties.apiVersion), 0);
+    capabilities.api_version = device_version < api_version ? device_version : api_version;
+
+    //Vulkan 1.0 features
+    VkPhysicalDeviceFeatures device_features;
+    vkGetPhysicalDeviceFeatures(physical_device, &device_features);
+    if (device_features.shaderInt16)
+        capabilities.flags |= DEVICE_CAPABILITY_SHADER_INT16;
+    if (device_features.shaderFloat64)
+        capabilities.flags |= DEVICE_CAPABILITY_SHADER_FLOAT64;
+
+    //Everything else is queried through vkGetPhysicalDevice*2 which is core in 1.1
+    if (capabilities.api_version < VK_API_VERSION_1_1)
+        return capabilities;
+
+    //vkCmdDispatchBase is core in 1.1
+    capabilities.flags |= DEVICE_CAPABILITY_DISPATCH_BASE;
+
+    {//Subgroups
+        VkPhysicalDeviceSubgroupProperties subgroup_properties = {};
+        VkPhysicalDeviceProperties2 device_properties2 = {};
+        {
+            subgroup_properties.sType               = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_PROPERTIES;
+            device_properties2.sType                = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+            device_properties2.pNext                = &subgroup_properties;
+        }
+        vkGetPhysicalDeviceProperties2(physical_device, &device_properties2);
+
+        //Only subgroup operations usable from compute shaders are of interest
+        if (subgroup_properties.supportedStages & VK_SHADER_STAGE_COMPUTE_BIT)
+        {
+            VkSubgroupFeatureFlags operations = subgroup_properties.supportedOperations;
+            capabilities.subgroup_size = subgroup_properties.subgroupSize;
+            if (operations & VK_SUBGROUP_FEATURE_BASIC_BIT)
+                capabilities.flags |= DEVICE_CAPABILITY_SUBGROUP_BASIC;
+            if (operations & VK_SUBGROUP_FEATURE_VOTE_BIT)
+                capabilities.flags |= DEVICE_CAPABILITY_SUBGROUP_VOTE;
+            if (operations & VK_SUBGROUP_FEATURE_ARITHMETIC_BIT)
+                capabilities.flags |= DEVICE_CAPABILITY_SUBGROUP_ARITHMETIC;
+            if (operations & VK_SUBGROUP_FEATURE_BALLOT_BIT)
+                capabilities.flags |= DEVICE_CAPABILITY_SUBGROUP_BALLOT;
+            if (operations & VK_SUBGROUP_FEATURE_SHUFFLE_BIT)
+                capabilities.flags |= DEVICE_CAPABILITY_SUBGROUP_SHUFFLE;
+        }
+    }
+
+    {//8/16-bit storage and float16/int8 arithmetic
+        //16-bit storage is core in 1.1, the others are core in 1.2 and extensions on 1.1
+        bool has_float16_int8 = capabilities.api_version >= VK_API_VERSION_1_2 || CheckDeviceExtensionSupport(physical_device, VK_KHR_SHADER_FLOAT16_INT8_EXTENSION_NAME);
+        bool has_8bit_storage = capabilities.api_version >= VK_API_VERSION_1_2 || CheckDeviceExtensionSupport(physical_device, VK_KHR_8BIT_STORAGE_EXTENSION_NAME);
+
+        VkPhysicalDeviceShaderFloat16Int8Features   float16_int8_features = {};
+        VkPhysicalDevice8BitStorageFeatures         storage_8bit_features = {};
+        VkPhysicalDevice16BitStorageFeatures        storage_16bit_features = {};
+        VkPhysicalDeviceFeatures2                   device_features2 = {};
+        {
+            void* next = nullptr;
+            if (has_float16_int8)
+            {
+                float16_int8_features.sType         = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SHADER_FLOAT16_INT8_FEATURES;
+                float16_int8_features.pNext         = next;
+                next = &float16_int8_features;
+            }
+            if (has_8bit_storage)
+            {
+                storage_8bit_features.sType         = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_8BIT_STORAGE_FEATURES;
+                storage_8bit_features.pNext         = next;
+                next = &storage_8bit_features;
+            }
+            storage_16bit_features.sType            = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_16BIT_STORAGE_FEATURES;
+            storage_16bit_features.pNext            = next;
+            device_features2.sType                  = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+            device_features2.pNext                  = &storage_16bit_features;
+        }
+        vkGetPhysicalDeviceFeatures2(physical_device, &device_features2);
+
+        if (float16_int8_features.shaderFloat16)
+            capabilities.flags |= DEVICE_CAPABILITY_SHADER_FLOAT16;
+        if (float16_int8_features.shaderInt8)
+            capabilities.flags |= DEVICE_CAPABILITY_SHADER_INT8;
+        if (storage_8bit_features.storageBuffer8BitAccess)
+            capabilities.flags |= DEVICE_CAPABILITY_STORAGE_BUFFER_8BIT;
+        if (storage_16bit_features.storageBuffer16BitAccess)
+            capabilities.flags |= DEVICE_CAPABILITY_STORAGE_BUFFER_16BIT;
+    }
+
+    return capabilities;
+}
+
+bool ComputeEngine::HasCapabilities(ComputeEngine::SupportedDevice supported_device, ComputeEngine::DeviceCapabilityFlags capabilities)
+{
+    return (supported_device.capabilities.flags & capabilities) == capabilities;
 }
\ No newline at end of file
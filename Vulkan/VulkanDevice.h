@@ -6,11 +6,37 @@ namespace ComputeEngine
     std::vector<const char*> device_layer_names         = { "VK_LAYER_LUNARG_standard_validation" };
     std::vector<const char*> device_extension_names     = {  };
 
+    //Optional features a device may support, enabled at device creation when available
+    enum DeviceCapabilityBits
+    {
+        DEVICE_CAPABILITY_SUBGROUP_BASIC            = 0x00000001,
+        DEVICE_CAPABILITY_SUBGROUP_VOTE             = 0x00000002,
+        DEVICE_CAPABILITY_SUBGROUP_ARITHMETIC       = 0x00000004,
+        DEVICE_CAPABILITY_SUBGROUP_BALLOT           = 0x00000008,
+        DEVICE_CAPABILITY_SUBGROUP_SHUFFLE          = 0x00000010,
+        DEVICE_CAPABILITY_SHADER_FLOAT16            = 0x00000020,
+        DEVICE_CAPABILITY_SHADER_INT8               = 0x00000040,
+        DEVICE_CAPABILITY_SHADER_INT16              = 0x00000080,
+        DEVICE_CAPABILITY_SHADER_FLOAT64            = 0x00000100,
+        DEVICE_CAPABILITY_STORAGE_BUFFER_8BIT       = 0x00000200,
+        DEVICE_CAPABILITY_STORAGE_BUFFER_16BIT      = 0x00000400,
+        DEVICE_CAPABILITY_DISPATCH_BASE             = 0x00000800
+    };
+    typedef uint32_t DeviceCapabilityFlags;
+
+    struct DeviceCapabilities
+    {
+        uint32_t                        api_version;    //min(instance version, device version)
+        DeviceCapabilityFlags           flags;
+        uint32_t                        subgroup_size;  //0 if subgroups are not usable from compute shaders
+    };
+
     struct SupportedPhysicalDevice
     {
         VkPhysicalDevice                physical_device;
         uint32_t                        queue_index;
         VkPhysicalDeviceProperties      device_properties;
+        DeviceCapabilities              capabilities;
     };
 
     struct SupportedDevice
@@ -20,14 +46,19 @@ namespace ComputeEngine
         uint32_t                        queue_index;
         VkQueue                         queue;
         VkPhysicalDeviceProperties      device_properties;
+        DeviceCapabilities              capabilities;
     };
 
     std::vector<SupportedDevice> CreateDevices(VkInstance instance);
-    std::vector<SupportedPhysicalDevice> FindPhysicalDevices(VkInstance instance);
+    std::vector<SupportedDevice> CreateDevices(VkInstance instance, uint32_t api_version);
+    std::vector<SupportedPhysicalDevice> FindPhysicalDevices(VkInstance instance, uint32_t api_version);
     void DestroyDevices(std::vector<SupportedDevice> devices);
     SupportedDevice CreateDevice(SupportedPhysicalDevice physical_device);
     uint32_t GetQueueFamilyIndex(VkPhysicalDevice physical_device);
     bool CheckDeviceSupport(VkPhysicalDevice physical_device);
+    bool CheckDeviceExtensionSupport(VkPhysicalDevice physical_device, const char* extension_name);
+    DeviceCapabilities GetDeviceCapabilities(VkPhysicalDevice physical_device, uint32_t api_version);
+    bool HasCapabilities(SupportedDevice supported_device, DeviceCapabilityFlags capabilities);
 };
 
 #include "VulkanDevice.cpp"
@@ -20,6 +20,8 @@ ComputeEngine::VulkanInstance ComputeEngine::CreateVulkanInstance(PFN_vkDebugRep
 {
     //Get Supported Layers & Extensions
     CheckInstanceSupport();
+    //Negotiate vulkan version with the loader
+    uint32_t api_version = GetInstanceApiVersion();
 
     //Create application info
     VkApplicationInfo       application_info = {};
@@ -29,7 +31,7 @@ ComputeEngine::VulkanInstance ComputeEngine::CreateVulkanInstance(PFN_vkDebugRep
         application_info.applicationVersion                 = VK_MAKE_VERSION(1, 0, 0);
         application_info.pEngineName                        = "Compute Engine";
         application_info.engineVersion                      = VK_MAKE_VERSION(1, 0, 0);
-        application_info.apiVersion                         = VK_API_VERSION_1_0;
+        application_info.apiVersion                         = api_version;
     }
 
     //Create instance info using application info
@@ -52,7 +54,7 @@ ComputeEngine::VulkanInstance ComputeEngine::CreateVulkanInstance(PFN_vkDebugRep
     VkDebugReportCallbackEXT debug_report_callback = CreateDebugCallback(instance, debug_report_callback_func);
 
     //Return vulkan instance
-    return { instance, debug_report_callback };
+    return { instance, debug_report_callback, api_version };
 }
 
 VkDebugReportCallbackEXT ComputeEngine::CreateDebugCallback(VkInstance instance, PFN_vkDebugReportCallbackEXT debug_report_callback_func)
@@ -143,4 +145,20 @@ void ComputeEngine::CheckInstanceSupport()
             }
         }
     }
+}
+
+uint32_t ComputeEngine::GetInstanceApiVersion()
+{
+    //`vkEnumerateInstanceVersion` only exists on 1.1+ loaders, a missing function means 1.0
+    auto EnumerateInstanceVersion = (PFN_vkEnumerateInstanceVersion)vkGetInstanceProcAddr(VK_NULL_HANDLE, "vkEnumerateInstanceVersion");
+    if (EnumerateInstanceVersion == nullptr)
+        return VK_API_VERSION_1_0;
+
+    uint32_t loader_version = VK_API_VERSION_1_0;
+    VkResult result = EnumerateInstanceVersion(&loader_version);
+    assert(result == VK_SUCCESS && "Could not get instance version");
+
+    //Use the highest version both the loader and the engine support (patch version is ignored)
+    loader_version = VK_MAKE_VERSION(VK_VERSION_MAJOR(loader_version), VK_VERSION_MINOR(loader_version), 0);
+    return loader_version < instance_max_api_version ? loader_version : instance_max_api_version;
 }
\ No newline at end of file
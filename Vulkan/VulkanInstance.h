@@ -7,10 +7,13 @@ namespace ComputeEngine
     {
         VkInstance                  vulkan_instance;
         VkDebugReportCallbackEXT    debug_report_callback;
+        uint32_t                    api_version;
     };
 
     std::vector<const char*> instance_layer_names       = { "VK_LAYER_LUNARG_standard_validation" };
     std::vector<const char*> instance_extension_names   = { VK_EXT_DEBUG_REPORT_EXTENSION_NAME };
+    //Highest vulkan version the engine knows how to use, the instance is created with min(loader version, this)
+    uint32_t                 instance_max_api_version   = VK_API_VERSION_1_2;
 
     void DestroyVulkanInstance(VulkanInstance instance);
     void DestroyDebugCallback(VkInstance instance, VkDebugReportCallbackEXT debug_callback);
@@ -18,6 +21,7 @@ namespace ComputeEngine
     VulkanInstance CreateVulkanInstance(PFN_vkDebugReportCallbackEXT debug_report_callback_func);
     VkDebugReportCallbackEXT CreateDebugCallback(VkInstance instance, PFN_vkDebugReportCallbackEXT debug_report_callback_func);
     void CheckInstanceSupport();
+    uint32_t GetInstanceApiVersion();
 };
 
 //Debug callback function
@@ -7,6 +7,25 @@ void ComputeEngine::DestroyPipeline(ComputeEngine::SupportedDevice supported_dev
 
 ComputeEngine::VulkanPipeline ComputeEngine::CreatePipeline(ComputeEngine::SupportedDevice supported_device, ComputeEngine::VulkanDescriptor descriptor, const char* shader_path)
 {
+    return CreatePipeline(supported_device, descriptor, shader_path, {});
+}
+
+ComputeEngine::VulkanPipeline ComputeEngine::CreatePipeline(
+    ComputeEngine::SupportedDevice supported_device,
+    ComputeEngine::VulkanDescriptor descriptor,
+    const char* shader_path,
+    std::vector<ComputeEngine::SpecializationConstant> specialization_constants
+){
+    return CreatePipeline(supported_device, descriptor, shader_path, specialization_constants, 0);
+}
+
+ComputeEngine::VulkanPipeline ComputeEngine::CreatePipeline(
+    ComputeEngine::SupportedDevice supported_device,
+    ComputeEngine::VulkanDescriptor descriptor,
+    const char* shader_path,
+    std::vector<ComputeEngine::SpecializationConstant> specialization_constants,
+    uint32_t push_constants_size
+){
     //Get shader code from file
     uint32_t file_length;
     uint32_t* code = ReadShaderFile(file_length, shader_path);
@@ -25,6 +44,29 @@ ComputeEngine::VulkanPipeline ComputeEngine::CreatePipeline(ComputeEngine::Suppo
     //Delete shader code stored in memory
     delete[] code;
 
+    //Device capabilities are always passed, constant ids a shader doesn't declare are ignored
+    std::vector<SpecializationConstant> constants = specialization_constants;
+    std::vector<SpecializationConstant> capability_constants = GetCapabilityConstants(supported_device);
+    constants.insert(constants.end(), capability_constants.begin(), capability_constants.end());
+
+    //Map every constant id to its 32-bit value
+    std::vector<VkSpecializationMapEntry> map_entries(constants.size());
+    for (uint32_t i = 0; i < constants.size(); i++)
+    {
+        map_entries[i].constantID                   = constants[i].constant_id;
+        map_entries[i].offset                       = i * sizeof(SpecializationConstant) + offsetof(SpecializationConstant, value);
+        map_entries[i].size                         = sizeof(uint32_t);
+    }
+
+    //Setup specialization info using map entries
+    VkSpecializationInfo specialization_info = {};
+    {
+        specialization_info.mapEntryCount           = map_entries.size();
+        specialization_info.pMapEntries             = map_entries.data();
+        specialization_info.dataSize                = constants.size() * sizeof(SpecializationConstant);
+        specialization_info.pData                   = constants.data();
+    }
+
     //Setup shader stage create info
     VkPipelineShaderStageCreateInfo shader_stage_info = {};
     {
@@ -32,6 +74,15 @@ ComputeEngine::VulkanPipeline ComputeEngine::CreatePipeline(ComputeEngine::Suppo
         shader_stage_info.stage                     = VK_SHADER_STAGE_COMPUTE_BIT;
         shader_stage_info.module                    = compute_shader_module;
         shader_stage_info.pName                     = "main";
+        shader_stage_info.pSpecializationInfo       = &specialization_info;
+    }
+
+    //Setup push constant range, all push constants go to the compute stage
+    VkPushConstantRange push_constant_range = {};
+    {
+        push_constant_range.stageFlags              = VK_SHADER_STAGE_COMPUTE_BIT;
+        push_constant_range.offset                  = 0;
+        push_constant_range.size                    = push_constants_size;
     }
 
     //Setup pipeline layout using descriptor
@@ -40,6 +91,8 @@ ComputeEngine::VulkanPipeline ComputeEngine::CreatePipeline(ComputeEngine::Suppo
         pipeline_layout_info.sType                  = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
         pipeline_layout_info.setLayoutCount         = 1;
         pipeline_layout_info.pSetLayouts            = &descriptor.descriptor_layout; 
+        pipeline_layout_info.pushConstantRangeCount = push_constants_size > 0 ? 1 : 0;
+        pipeline_layout_info.pPushConstantRanges    = &push_constant_range;
     }
 
     //Create pipeline layout
@@ -51,6 +104,8 @@ ComputeEngine::VulkanPipeline ComputeEngine::CreatePipeline(ComputeEngine::Suppo
     VkComputePipelineCreateInfo pipeline_create_info = {};
     {
         pipeline_create_info.sType                  = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+        //Allow vkCmdDispatchBase with a non-zero base work group where supported
+        pipeline_create_info.flags                  = HasCapabilities(supported_device, DEVICE_CAPABILITY_DISPATCH_BASE) ? VK_PIPELINE_CREATE_DISPATCH_BASE : 0;
         pipeline_create_info.stage                  = shader_stage_info;
         pipeline_create_info.layout                 = pipeline_layout;
     }
@@ -63,6 +118,26 @@ ComputeEngine::VulkanPipeline ComputeEngine::CreatePipeline(ComputeEngine::Suppo
     return { compute_shader_module, pipeline_layout, pipeline };
 }
 
+std::vector<ComputeEngine::SpecializationConstant> ComputeEngine::GetCapabilityConstants(ComputeEngine::SupportedDevice supported_device)
+{
+    return {
+        { CAPABILITY_FLAGS_CONSTANT_ID, supported_device.capabilities.flags },
+        { SUBGROUP_SIZE_CONSTANT_ID,    supported_device.capabilities.subgroup_size }
+    };
+}
+
+const char* ComputeEngine::SelectShaderVariant(ComputeEngine::SupportedDevice supported_device, std::vector<ComputeEngine::ShaderVariant> variants)
+{
+    //Variants are listed fastest first, pick the first one the device can run
+    for (uint32_t i = 0; i < variants.size(); i++)
+    {
+        if (HasCapabilities(supported_device, variants[i].required_capabilities))
+            return variants[i].shader_path;
+    }
+    assert(0 && "No shader variant is supported by this device");
+    return nullptr;
+}
+
 uint32_t* ComputeEngine::ReadShaderFile(uint32_t& length, const char* filename)
 {
     FILE* fp = fopen(filename, "rb");
@@ -3,6 +3,23 @@
 
 namespace ComputeEngine
 {
+    //Specialization constant ids the engine fills in with device capabilities on every pipeline
+    //e.g. `layout(constant_id = 100) const uint DEVICE_CAPABILITIES = 0;`
+    const uint32_t CAPABILITY_FLAGS_CONSTANT_ID     = 100;
+    const uint32_t SUBGROUP_SIZE_CONSTANT_ID        = 101;
+
+    struct SpecializationConstant
+    {
+        uint32_t            constant_id;
+        uint32_t            value;
+    };
+
+    struct ShaderVariant
+    {
+        const char*             shader_path;
+        DeviceCapabilityFlags   required_capabilities;
+    };
+
     struct VulkanPipeline
     {
         VkShaderModule      shader_module;
@@ -11,7 +28,13 @@ namespace ComputeEngine
     };
 
     void DestroyPipeline(SupportedDevice supported_device, VulkanPipeline pipeline);
-    VulkanPipeline CreatePipeline(SupportedDevice supported_device, VulkanDescriptor descriptor, const char* shader_path);    
+    VulkanPipeline CreatePipeline(SupportedDevice supported_device, VulkanDescriptor descriptor, const char* shader_path);
+    VulkanPipeline CreatePipeline(SupportedDevice supported_device, VulkanDescriptor descriptor, const char* shader_path,
+        std::vector<SpecializationConstant> specialization_constants);
+    VulkanPipeline CreatePipeline(SupportedDevice supported_device, VulkanDescriptor descriptor, const char* shader_path,
+        std::vector<SpecializationConstant> specialization_constants, uint32_t push_constants_size);
+    std::vector<SpecializationConstant> GetCapabilityConstants(SupportedDevice supported_device);
+    const char* SelectShaderVariant(SupportedDevice supported_device, std::vector<ShaderVariant> variants);
     uint32_t* ReadShaderFile(uint32_t& length, const char* filename);
 };
 
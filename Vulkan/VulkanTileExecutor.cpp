@@ -0,0 +1,130 @@
+ComputeEngine::StageTimings ComputeEngine::RenderTilesPipelined(
+    ComputeEngine::SupportedDevice supported_device,
+    ComputeEngine::VulkanTileScheduler& scheduler,
+    ComputeEngine::VulkanPipeline pipeline,
+    uint32_t image_width, uint32_t image_height, uint32_t work_group_size, uint32_t queue_depth,
+    ComputeEngine::TileReadback readback,
+    ComputeEngine::TileEncode encode
+){
+    return RenderTilesPipelined(supported_device, scheduler, pipeline, nullptr, image_width, image_height, work_group_size, queue_depth, readback, encode);
+}
+
+ComputeEngine::StageTimings ComputeEngine::RenderTilesPipelined(
+    ComputeEngine::SupportedDevice supported_device,
+    ComputeEngine::VulkanTileScheduler& scheduler,
+    ComputeEngine::VulkanPipeline pipeline,
+    const ComputeEngine::VulkanPipeline* filter_pipeline,
+    uint32_t image_width, uint32_t image_height, uint32_t work_group_size, uint32_t queue_depth,
+    ComputeEngine::TileReadback readback,
+    ComputeEngine::TileEncode encode
+){
+    StageTimings timings = {};
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    TileQueue queue;
+    queue.capacity = queue_depth > 0 ? queue_depth : 1;
+    queue.finished = false;
+    queue.stopped = false;
+
+    //Encode stage, tiles arrive in the order they were rendered
+    std::thread encode_thread([&]()
+    {
+        while (true)
+        {
+            //Wait for a tile or for the render to finish
+            std::chrono::steady_clock::time_point idle_start = std::chrono::steady_clock::now();
+            std::unique_lock<std::mutex> lock(queue.mutex);
+            queue.changed.wait(lock, [&]() { return !queue.work.empty() || queue.finished; });
+            timings.encode_idle += SecondsSince(idle_start);
+            if (queue.work.empty())
+                break;
+
+            TileWork work = std::move(queue.work.front());
+            queue.work.pop_front();
+            lock.unlock();
+            queue.changed.notify_all(); //room in the queue for the readback stage
+
+            std::chrono::steady_clock::time_point encode_start = std::chrono::steady_clock::now();
+            bool keep_going = encode(work);
+            timings.encode += SecondsSince(encode_start);
+
+            //Give the tile buffer back so the readback stage doesn't allocate a new one
+            lock.lock();
+            queue.free_buffers.push_back(std::move(work.data));
+            if (!keep_going)
+            {
+                //Tiles still queued are dropped, the readback stage stops at its next tile
+                queue.stopped = true;
+                queue.work.clear();
+                lock.unlock();
+                queue.changed.notify_all();
+                break;
+            }
+        }
+    });
+
+    //Render and readback stages, the GPU keeps rendering newer tiles in the other slots meanwhile
+    double sink_time = 0.0;
+    RenderTiles(supported_device, scheduler, pipeline, filter_pipeline, image_width, image_height, work_group_size, [&](const RenderedTile& tile) -> bool
+    {
+        std::chrono::steady_clock::time_point sink_start = std::chrono::steady_clock::now();
+
+        TileWork work;
+        work.info = tile.info;
+        work.tile_index = tile.tile_index;
+        {
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (queue.stopped)
+                return false;
+            if (!queue.free_buffers.empty())
+            {
+                work.data = std::move(queue.free_buffers.back());
+                queue.free_buffers.pop_back();
+            }
+        }
+
+        std::chrono::steady_clock::time_point readback_start = std::chrono::steady_clock::now();
+        readback(tile, work.data);
+        timings.readback += SecondsSince(readback_start);
+
+        //Back-pressure, a full queue holds this slot so the GPU stops getting new tiles too
+        std::chrono::steady_clock::time_point stall_start = std::chrono::steady_clock::now();
+        std::unique_lock<std::mutex> lock(queue.mutex);
+        queue.changed.wait(lock, [&]() { return queue.work.size() < queue.capacity || queue.stopped; });
+        timings.readback_stall += SecondsSince(stall_start);
+        if (queue.stopped)
+            return false;
+        queue.work.push_back(std::move(work));
+        lock.unlock();
+        queue.changed.notify_all();
+
+        timings.tile_count++;
+        sink_time += SecondsSince(sink_start);
+        return true;
+    });
+    timings.gpu_wait = SecondsSince(start) - sink_time;
+
+    //Let the encode stage drain the queue
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.finished = true;
+    }
+    queue.changed.notify_all();
+    encode_thread.join();
+
+    timings.total = SecondsSince(start);
+    return timings;
+}
+
+void ComputeEngine::PrintStageTimings(ComputeEngine::StageTimings timings)
+{
+    std::cout << "Rendered " << timings.tile_count << " tiles in " << timings.total * 1000.0 << " ms" << std::endl;
+    std::cout << "      gpu wait:       " << timings.gpu_wait * 1000.0 << " ms" << std::endl;
+    std::cout << "      readback:       " << timings.readback * 1000.0 << " ms (" << timings.readback_stall * 1000.0 << " ms stalled on encode)" << std::endl;
+    std::cout << "      encode:         " << timings.encode * 1000.0 << " ms (" << timings.encode_idle * 1000.0 << " ms idle)" << std::endl;
+}
+
+double ComputeEngine::SecondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
\ No newline at end of file
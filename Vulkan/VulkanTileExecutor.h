@@ -0,0 +1,54 @@
+#ifndef _VULKAN_TILE_EXECUTOR
+#define _VULKAN_TILE_EXECUTOR
+
+namespace ComputeEngine
+{
+    //Tile handed from the readback stage to the encode stage
+    struct TileWork
+    {
+        TileInfo                    info;
+        uint32_t                    tile_index;
+        std::vector<unsigned char>  data;
+    };
+
+    //Readback stage, runs on the render thread while the tile's slot is held and copies the mapped tile into `data`
+    typedef std::function<void(const RenderedTile& tile, std::vector<unsigned char>& data)> TileReadback;
+    //Encode stage, runs on its own thread and receives tiles in render order. Returns false to stop the render.
+    typedef std::function<bool(TileWork& work)> TileEncode;
+
+    //Bounded queue between the readback and encode stages
+    struct TileQueue
+    {
+        std::mutex                                  mutex;
+        std::condition_variable                     changed;
+        std::deque<TileWork>                        work;
+        std::vector<std::vector<unsigned char>>     free_buffers;   //tile buffers given back by the encode stage
+        uint32_t                                    capacity;
+        bool                                        finished;
+        bool                                        stopped;        //the encode stage failed, no more tiles are rendered
+    };
+
+    //Seconds spent in each stage of a pipelined render
+    struct StageTimings
+    {
+        double                      gpu_wait;       //render thread submitting tiles and waiting on fences
+        double                      readback;       //inside the readback stage
+        double                      readback_stall; //readback blocked on a full encode queue (back-pressure)
+        double                      encode;         //inside the encode stage
+        double                      encode_idle;    //encode thread waiting for tiles
+        double                      total;          //wall clock time of the whole render
+        uint32_t                    tile_count;
+    };
+
+    StageTimings RenderTilesPipelined(SupportedDevice supported_device, VulkanTileScheduler& scheduler, VulkanPipeline pipeline,
+        uint32_t image_width, uint32_t image_height, uint32_t work_group_size, uint32_t queue_depth,
+        TileReadback readback, TileEncode encode);
+    StageTimings RenderTilesPipelined(SupportedDevice supported_device, VulkanTileScheduler& scheduler, VulkanPipeline pipeline,
+        const VulkanPipeline* filter_pipeline, uint32_t image_width, uint32_t image_height, uint32_t work_group_size, uint32_t queue_depth,
+        TileReadback readback, TileEncode encode);
+    void PrintStageTimings(StageTimings timings);
+    double SecondsSince(std::chrono::steady_clock::time_point start);
+};
+
+#include "VulkanTileExecutor.cpp"
+#endif
\ No newline at end of file
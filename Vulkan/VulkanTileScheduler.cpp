@@ -0,0 +1,177 @@
+void ComputeEngine::DestroyTileScheduler(ComputeEngine::SupportedDevice supported_device, ComputeEngine::VulkanTileScheduler scheduler)
+{
+    for (uint32_t i = 0; i < scheduler.slots.size(); i++)
+    {
+        TileSlot slot = scheduler.slots[i];
+        DestroyFence(supported_device, slot.fence);
+        DestroyCommandBuffer(supported_device, slot.command_buffer);
+        DestroyDescriptorSet(supported_device, slot.descriptor);
+        vkUnmapMemory(supported_device.device, slot.buffer.device_memory);
+        DestroyBuffer(supported_device, slot.buffer);
+    }
+}
+
+ComputeEngine::VulkanTileScheduler ComputeEngine::CreateTileScheduler(
+    ComputeEngine::SupportedDevice supported_device,
+    uint32_t tile_width, uint32_t tile_height, uint32_t pixel_size, uint32_t slot_count
+){
+    return CreateTileScheduler(supported_device, tile_width, tile_height, pixel_size, slot_count, 0);
+}
+
+ComputeEngine::VulkanTileScheduler ComputeEngine::CreateTileScheduler(
+    ComputeEngine::SupportedDevice supported_device,
+    uint32_t tile_width, uint32_t tile_height, uint32_t pixel_size, uint32_t slot_count,
+    uint32_t filtered_pixel_size
+){
+    //A filter kernel needs the row above the tile too, and writes its scanlines after the rendered rows
+    uint32_t row_pitch = GetTileRowPitch(tile_width, pixel_size);
+    uint32_t buffer_size = row_pitch * tile_height;
+    if (filtered_pixel_size > 0)
+        buffer_size += row_pitch + tile_height * GetFilteredRowPitch(tile_width, filtered_pixel_size);
+
+    //Tiles are read back by the CPU, reading uncached memory is very slow so prefer cached memory
+    VkMemoryPropertyFlags memory_properties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    if (HasMemoryProperties(supported_device.physical_device, memory_properties | VK_MEMORY_PROPERTY_HOST_CACHED_BIT))
+        memory_properties |= VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+
+    //Create slots, memory used is bounded by slot_count tiles no matter how big the image is
+    std::vector<TileSlot> slots(slot_count);
+    for (uint32_t i = 0; i < slot_count; i++)
+    {
+        TileSlot& slot = slots[i];
+        slot.buffer             = CreateBuffer(supported_device, buffer_size, memory_properties);
+        slot.descriptor         = CreateDescriptorSet(supported_device, slot.buffer, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+        slot.command_buffer     = CreateCommandBuffer(supported_device);
+        slot.fence              = CreateFence(supported_device);
+        slot.in_flight          = false;
+
+        //Keep tile buffers mapped for the lifetime of the scheduler
+        VkResult result = vkMapMemory(supported_device.device, slot.buffer.device_memory, 0, VK_WHOLE_SIZE, 0, &slot.mapped_memory);
+        assert(result == VK_SUCCESS && "Could not map tile buffer");
+    }
+
+    return { tile_width, tile_height, pixel_size, filtered_pixel_size, slots };
+}
+
+void ComputeEngine::RenderTiles(
+    ComputeEngine::SupportedDevice supported_device,
+    ComputeEngine::VulkanTileScheduler& scheduler,
+    ComputeEngine::VulkanPipeline pipeline,
+    uint32_t image_width, uint32_t image_height, uint32_t work_group_size,
+    ComputeEngine::TileSink sink
+){
+    RenderTiles(supported_device, scheduler, pipeline, nullptr, image_width, image_height, work_group_size, sink);
+}
+
+void ComputeEngine::RenderTiles(
+    ComputeEngine::SupportedDevice supported_device,
+    ComputeEngine::VulkanTileScheduler& scheduler,
+    ComputeEngine::VulkanPipeline pipeline,
+    const ComputeEngine::VulkanPipeline* filter_pipeline,
+    uint32_t image_width, uint32_t image_height, uint32_t work_group_size,
+    ComputeEngine::TileSink sink
+){
+    //PNG filter types are chosen per image row, so filtered tiles must span the whole width
+    assert((filter_pipeline != nullptr) == (scheduler.filtered_pixel_size > 0) && "Filter pipeline and scheduler don't match");
+    assert((filter_pipeline == nullptr || scheduler.tile_width >= image_width) && "Filtered tiles must be as wide as the image");
+
+    uint32_t tiles_x = (image_width + scheduler.tile_width - 1) / scheduler.tile_width;
+    uint32_t tiles_y = (image_height + scheduler.tile_height - 1) / scheduler.tile_height;
+    uint32_t tile_count = tiles_x * tiles_y;
+    uint32_t slot_count = scheduler.slots.size();
+
+    uint32_t tile_index = 0;
+    for (; tile_index < tile_count; tile_index++)
+    {
+        //Slots are used round robin, so a busy slot always holds the oldest tile in flight
+        TileSlot& slot = scheduler.slots[tile_index % slot_count];
+        if (slot.in_flight && !FinishTile(supported_device, scheduler, slot, sink))
+            break;
+
+        //Setup tile position and size
+        TileInfo tile = {};
+        {
+            tile.offset_x                       = (tile_index % tiles_x) * scheduler.tile_width;
+            tile.offset_y                       = (tile_index / tiles_x) * scheduler.tile_height;
+            tile.width                          = std::min(scheduler.tile_width, image_width - tile.offset_x);
+            tile.height                         = std::min(scheduler.tile_height, image_height - tile.offset_y);
+            tile.image_width                    = image_width;
+            tile.image_height                   = image_height;
+        }
+
+        //Record tile dispatch and submit it, the GPU works on it while older tiles are handed to the sink
+        if (filter_pipeline == nullptr)
+        {
+            RecordCommandBuffer(
+                slot.command_buffer, pipeline, slot.descriptor, &tile, sizeof(TileInfo),
+                (tile.width + work_group_size - 1) / work_group_size, (tile.height + work_group_size - 1) / work_group_size, 1 //gpu work groups x,y,z
+            );
+        }
+        else
+        {
+            //Render the row above the tile again so its first row can be filtered, then filter one row per work group
+            TileInfo render_tile = tile;
+            uint32_t apron = tile.offset_y > 0 ? 1 : 0;
+            render_tile.offset_y -= apron;
+            render_tile.height += apron;
+            RecordCommandBuffer(slot.command_buffer, slot.descriptor, {
+                { pipeline, &render_tile, sizeof(TileInfo),
+                    (render_tile.width + work_group_size - 1) / work_group_size, (render_tile.height + work_group_size - 1) / work_group_size, 1 },
+                { *filter_pipeline, &tile, sizeof(TileInfo), 1, tile.height, 1 }
+            });
+        }
+        SubmitCommand(supported_device, slot.command_buffer, slot.fence);
+        slot.tile = tile;
+        slot.tile_index = tile_index;
+        slot.in_flight = true;
+    }
+
+    //Finish remaining tiles, oldest first. Once the sink stopped, they are only waited for.
+    bool stopped = tile_index < tile_count;
+    for (uint32_t i = 0; i < slot_count; i++)
+    {
+        TileSlot& slot = scheduler.slots[(tile_index + i) % slot_count];
+        if (slot.in_flight && !FinishTile(supported_device, scheduler, slot, stopped ? TileSink() : sink))
+            stopped = true;
+    }
+}
+
+bool ComputeEngine::FinishTile(
+    ComputeEngine::SupportedDevice supported_device,
+    ComputeEngine::VulkanTileScheduler& scheduler,
+    ComputeEngine::TileSlot& slot,
+    ComputeEngine::TileSink sink
+){
+    //Use fence to wait for gpu to finish the tile
+    VkResult result = vkWaitForFences(supported_device.device, 1, &slot.fence, VK_TRUE, UINT64_MAX);
+    assert(result == VK_SUCCESS && "Could not wait for tile fence");
+    result = vkResetFences(supported_device.device, 1, &slot.fence);
+    assert(result == VK_SUCCESS && "Could not reset tile fence");
+    slot.in_flight = false;
+    if (!sink)
+        return false;
+
+    //Hand the tile to the sink, the slot can be reused once it returns
+    RenderedTile rendered_tile = { slot.tile, slot.tile_index, slot.mapped_memory, GetTileRowPitch(slot.tile.width, scheduler.pixel_size), nullptr, 0 };
+    if (scheduler.filtered_pixel_size > 0)
+    {
+        //Rendered rows start with the one above the tile, the filtered scanlines follow them
+        uint32_t apron = slot.tile.offset_y > 0 ? 1 : 0;
+        rendered_tile.data = (const unsigned char*)slot.mapped_memory + (size_t)apron * rendered_tile.row_pitch;
+        rendered_tile.filtered_data = (const unsigned char*)rendered_tile.data + (size_t)slot.tile.height * rendered_tile.row_pitch;
+        rendered_tile.filtered_row_pitch = GetFilteredRowPitch(slot.tile.width, scheduler.filtered_pixel_size);
+    }
+    return sink(rendered_tile);
+}
+
+uint32_t ComputeEngine::GetTileRowPitch(uint32_t width, uint32_t pixel_size)
+{
+    //Kernels write whole uints, so rows of pixels smaller than that are padded
+    return (width * pixel_size + 3) / 4 * 4;
+}
+
+uint32_t ComputeEngine::GetFilteredRowPitch(uint32_t width, uint32_t filtered_pixel_size)
+{
+    //Filter type byte and the filtered pixels, padded so the kernel only writes whole uints
+    return (1 + width * filtered_pixel_size + 3) / 4 * 4;
+}
\ No newline at end of file
@@ -0,0 +1,67 @@
+#ifndef _VULKAN_TILE_SCHEDULER
+#define _VULKAN_TILE_SCHEDULER
+
+namespace ComputeEngine
+{
+    //Push constants of a tile, must match `TileInfo` in the kernel
+    struct TileInfo
+    {
+        uint32_t            offset_x;       //first pixel of the tile in the image
+        uint32_t            offset_y;
+        uint32_t            width;          //tile size in pixels (edge tiles can be smaller)
+        uint32_t            height;
+        uint32_t            image_width;    //size of the whole image
+        uint32_t            image_height;
+    };
+
+    //Finished tile handed to the sink, `data` is mapped memory only valid during the sink call
+    struct RenderedTile
+    {
+        TileInfo            info;
+        uint32_t            tile_index;     //tiles are numbered row by row
+        const void*         data;
+        uint32_t            row_pitch;      //bytes between two rows of the tile
+        const void*         filtered_data;  //PNG scanlines of the tile filtered on the GPU, nullptr if not filtered
+        uint32_t            filtered_row_pitch;
+    };
+
+    //Returns false to stop rendering, tiles still in flight are waited for but not handed over
+    typedef std::function<bool(const RenderedTile& tile)> TileSink;
+
+    //Buffer, descriptor, command buffer and fence a tile is rendered with, reused round robin
+    struct TileSlot
+    {
+        VulkanBuffer        buffer;
+        VulkanDescriptor    descriptor;
+        VulkanCommandBuffer command_buffer;
+        VkFence             fence;
+        void*               mapped_memory;
+        bool                in_flight;
+        TileInfo            tile;
+        uint32_t            tile_index;
+    };
+
+    struct VulkanTileScheduler
+    {
+        uint32_t                tile_width;
+        uint32_t                tile_height;
+        uint32_t                pixel_size;
+        uint32_t                filtered_pixel_size;    //bytes per pixel of the scanlines a filter kernel writes, 0 without one
+        std::vector<TileSlot>   slots;
+    };
+
+    void DestroyTileScheduler(SupportedDevice supported_device, VulkanTileScheduler scheduler);
+    VulkanTileScheduler CreateTileScheduler(SupportedDevice supported_device, uint32_t tile_width, uint32_t tile_height, uint32_t pixel_size, uint32_t slot_count);
+    VulkanTileScheduler CreateTileScheduler(SupportedDevice supported_device, uint32_t tile_width, uint32_t tile_height, uint32_t pixel_size, uint32_t slot_count,
+        uint32_t filtered_pixel_size);
+    void RenderTiles(SupportedDevice supported_device, VulkanTileScheduler& scheduler, VulkanPipeline pipeline,
+        uint32_t image_width, uint32_t image_height, uint32_t work_group_size, TileSink sink);
+    void RenderTiles(SupportedDevice supported_device, VulkanTileScheduler& scheduler, VulkanPipeline pipeline, const VulkanPipeline* filter_pipeline,
+        uint32_t image_width, uint32_t image_height, uint32_t work_group_size, TileSink sink);
+    uint32_t GetTileRowPitch(uint32_t width, uint32_t pixel_size);
+    uint32_t GetFilteredRowPitch(uint32_t width, uint32_t filtered_pixel_size);
+    bool FinishTile(SupportedDevice supported_device, VulkanTileScheduler& scheduler, TileSlot& slot, TileSink sink);
+};
+
+#include "VulkanTileScheduler.cpp"
+#endif
\ No newline at end of file
@@ -34,6 +34,35 @@ Rename this file to lodepng.cpp to use it for C++, or to lodepng.c to use it for
 #include <stdio.h>
 #include <stdlib.h>
 
+#ifdef LODEPNG_COMPILE_THREADS
+#include <atomic>
+#include <thread>
+#include <vector>
+#endif /*LODEPNG_COMPILE_THREADS*/
+
+#ifdef LODEPNG_COMPILE_MMAP
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif /*LODEPNG_COMPILE_MMAP*/
+
+#ifdef LODEPNG_COMPILE_SIMD
+#include <immintrin.h>
+/*functions using these are compiled for that instruction set only, and may only be called after
+checking LODEPNG_CPU_SUPPORTS, so the rest of the code runs on any x86 CPU*/
+#define LODEPNG_TARGET_SSE2 __attribute__((target("sse2")))
+#define LODEPNG_TARGET_SSSE3 __attribute__((target("ssse3")))
+#define LODEPNG_TARGET_AVX2 __attribute__((target("avx2")))
+#define LODEPNG_TARGET_PCLMUL __attribute__((target("sse2,pclmul")))
+/*the runtime check, can be defined before including lodepng.h to hide instruction sets the CPU has, so
+that a test can run every dispatch tier on one machine. feature is a string literal like "avx2".*/
+#ifndef LODEPNG_CPU_SUPPORTS
+#define LODEPNG_CPU_SUPPORTS(feature) __builtin_cpu_supports(feature)
+#endif
+#endif /*LODEPNG_COMPILE_SIMD*/
+
 #if defined(_MSC_VER) && (_MSC_VER >= 1310) /*Visual Studio: A few warning types are not desired here.*/
 #pragma warning( disable : 4244 ) /*implicit conversions: not warned by gcc -Wall -Wextra and requires too much casts*/
 #pragma warning( disable : 4996 ) /*VS does not like fopen, but fopen_s is not standard C so unusable here*/
@@ -132,6 +161,22 @@ About uivector, ucvector and string:
 -As with many other structs in this file, the init and cleanup functions serve as ctor and dtor.
 */
 
+/*
+Allocates through the given allocator of an encoder context, or with lodepng_realloc and lodepng_free
+if it is NULL. Only the vectors and hash tables owned by an encoder context are given an allocator.
+*/
+static void* lodepng_allocator_realloc(const LodePNGAllocator* allocator, void* ptr, size_t oldsize, size_t newsize)
+{
+  if(!allocator) return lodepng_realloc(ptr, newsize);
+  return allocator->realloc_func(ptr, oldsize, newsize, allocator->user);
+}
+
+static void lodepng_allocator_free(const LodePNGAllocator* allocator, void* ptr, size_t size)
+{
+  if(!allocator) lodepng_free(ptr);
+  else if(ptr) allocator->free_func(ptr, size, allocator->user);
+}
+
 #ifdef LODEPNG_COMPILE_ZLIB
 /*dynamic vector of unsigned ints*/
 typedef struct uivector
@@ -139,13 +184,15 @@ typedef struct uivector
   unsigned* data;
   size_t size; /*size in number of unsigned longs*/
   size_t allocsize; /*allocated size in bytes*/
+  const LodePNGAllocator* allocator; /*NULL for lodepng_realloc and lodepng_free*/
 } uivector;
 
 static void uivector_cleanup(void* p)
 {
-  ((uivector*)p)->size = ((uivector*)p)->allocsize = 0;
-  lodepng_free(((uivector*)p)->data);
-  ((uivector*)p)->data = NULL;
+  uivector* v = (uivector*)p;
+  lodepng_allocator_free(v->allocator, v->data, v->allocsize);
+  v->size = v->allocsize = 0;
+  v->data = NULL;
 }
 
 /*returns 1 if success, 0 if failure ==> nothing done*/
@@ -154,7 +201,7 @@ static unsigned uivector_reserve(uivector* p, size_t allocsize)
   if(allocsize > p->allocsize)
   {
     size_t newsize = (allocsize > p->allocsize * 2) ? allocsize : (allocsize * 3 / 2);
-    void* data = lodepng_realloc(p->data, newsize);
+    void* data = lodepng_allocator_realloc(p->allocator, p->data, p->allocsize, newsize);
     if(data)
     {
       p->allocsize = newsize;
@@ -186,6 +233,7 @@ static void uivector_init(uivector* p)
 {
   p->data = NULL;
   p->size = p->allocsize = 0;
+  p->allocator = NULL;
 }
 
 #ifdef LODEPNG_COMPILE_ENCODER
@@ -207,6 +255,7 @@ typedef struct ucvector
   unsigned char* data;
   size_t size; /*used size*/
   size_t allocsize; /*allocated size*/
+  const LodePNGAllocator* allocator; /*NULL for lodepng_realloc and lodepng_free*/
 } ucvector;
 
 /*returns 1 if success, 0 if failure ==> nothing done*/
@@ -215,7 +264,7 @@ static unsigned ucvector_reserve(ucvector* p, size_t allocsize)
   if(allocsize > p->allocsize)
   {
     size_t newsize = (allocsize > p->allocsize * 2) ? allocsize : (allocsize * 3 / 2);
-    void* data = lodepng_realloc(p->data, newsize);
+    void* data = lodepng_allocator_realloc(p->allocator, p->data, p->allocsize, newsize);
     if(data)
     {
       p->allocsize = newsize;
@@ -238,15 +287,17 @@ static unsigned ucvector_resize(ucvector* p, size_t size)
 
 static void ucvector_cleanup(void* p)
 {
-  ((ucvector*)p)->size = ((ucvector*)p)->allocsize = 0;
-  lodepng_free(((ucvector*)p)->data);
-  ((ucvector*)p)->data = NULL;
+  ucvector* v = (ucvector*)p;
+  lodepng_allocator_free(v->allocator, v->data, v->allocsize);
+  v->size = v->allocsize = 0;
+  v->data = NULL;
 }
 
 static void ucvector_init(ucvector* p)
 {
   p->data = NULL;
   p->size = p->allocsize = 0;
+  p->allocator = NULL;
 }
 #endif /*LODEPNG_COMPILE_PNG*/
 
@@ -257,6 +308,7 @@ static void ucvector_init_buffer(ucvector* p, unsigned char* buffer, size_t size
 {
   p->data = buffer;
   p->allocsize = p->size = size;
+  p->allocator = NULL;
 }
 #endif /*LODEPNG_COMPILE_ZLIB*/
 
@@ -341,6 +393,59 @@ static void lodepng_add32bitInt(ucvector* buffer, unsigned value)
 }
 #endif /*LODEPNG_COMPILE_ENCODER*/
 
+/* ////////////////////////////////////////////////////////////////////////// */
+/* / Threads                                                                / */
+/* ////////////////////////////////////////////////////////////////////////// */
+
+#if defined(LODEPNG_COMPILE_THREADS) && defined(LODEPNG_COMPILE_ENCODER)
+/*the amount of threads a numthreads setting stands for, 0 means one per CPU core*/
+static unsigned lodepng_get_num_threads(unsigned numthreads)
+{
+  if(numthreads == 0) numthreads = std::thread::hardware_concurrency();
+  return numthreads ? numthreads : 1; /*hardware_concurrency returns 0 if it doesn't know*/
+}
+
+typedef struct ParallelTasks
+{
+  void (*task)(void* context, size_t index, unsigned thread);
+  void* context;
+  size_t count;
+  std::atomic<size_t> next; /*index of the next task that no thread took yet*/
+} ParallelTasks;
+
+static void runParallelTasks(ParallelTasks* tasks, unsigned thread)
+{
+  for(;;)
+  {
+    size_t index = tasks->next++;
+    if(index >= tasks->count) break;
+    tasks->task(tasks->context, index, thread);
+  }
+}
+
+/*
+Calls task(context, i, thread) for each i from 0 to count - 1 on up to numthreads threads, the
+calling thread included, and returns when all are done. Tasks are taken in increasing
+order, so the lowest indices finish first. thread is the number of the thread running the
+task, below numthreads, so that tasks can use scratch memory per thread.
+*/
+static void lodepng_run_parallel(void (*task)(void*, size_t, unsigned), void* context, size_t count,
+                                 unsigned numthreads)
+{
+  ParallelTasks tasks;
+  std::vector<std::thread> threads;
+  size_t i;
+  tasks.task = task;
+  tasks.context = context;
+  tasks.count = count;
+  tasks.next = 0;
+  if(numthreads > count) numthreads = (unsigned)count;
+  for(i = 1; i < numthreads; ++i) threads.push_back(std::thread(runParallelTasks, &tasks, (unsigned)i));
+  runParallelTasks(&tasks, 0);
+  for(i = 0; i != threads.size(); ++i) threads[i].join();
+}
+#endif /*defined(LODEPNG_COMPILE_THREADS) && defined(LODEPNG_COMPILE_ENCODER)*/
+
 /* ////////////////////////////////////////////////////////////////////////// */
 /* / File IO                                                                / */
 /* ////////////////////////////////////////////////////////////////////////// */
@@ -396,6 +501,75 @@ unsigned lodepng_load_file(unsigned char** out, size_t* outsize, const char* fil
   return lodepng_buffer_file(*out, (size_t)size, filename);
 }
 
+#ifdef LODEPNG_COMPILE_MMAP
+/*
+Writes all of data to fd, with pwrite at *offset which is advanced, or with write if *offset is -1.
+Returns 1 if it failed. Short writes and interrupted calls are retried.
+*/
+static unsigned lodepng_write_fd(int fd, long long* offset, const unsigned char* data, size_t size)
+{
+  while(size != 0)
+  {
+    ssize_t written = *offset < 0 ? write(fd, data, size) : pwrite(fd, data, size, (off_t)*offset);
+    if(written < 0)
+    {
+      if(errno == EINTR) continue;
+      return 1;
+    }
+    if(*offset >= 0) *offset += written;
+    data += written;
+    size -= (size_t)written;
+  }
+  return 0;
+}
+
+/*write given buffer to the file, overwriting the file, it doesn't append to it.*/
+unsigned lodepng_save_file(const unsigned char* buffer, size_t buffersize, const char* filename)
+{
+  long long offset = 0;
+  unsigned error;
+  int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  if(fd < 0) return 79;
+  error = lodepng_write_fd(fd, &offset, buffer, buffersize);
+  if(close(fd) != 0) error = 1;
+  return error ? 79 : 0;
+}
+
+unsigned lodepng_map_file(const unsigned char** out, size_t* outsize, const char* filename)
+{
+  struct stat st;
+  void* data;
+  int fd = open(filename, O_RDONLY);
+  *out = 0;
+  *outsize = 0;
+  if(fd < 0) return 78;
+  if(fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+  {
+    close(fd);
+    return 78;
+  }
+  if(st.st_size == 0) /*mmap can't map 0 bytes*/
+  {
+    close(fd);
+    return 0;
+  }
+
+  data = mmap(0, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd); /*the mapping stays valid without the descriptor*/
+  if(data == MAP_FAILED) return 78;
+  /*the decoder goes through the file front to back, so the kernel can read ahead aggressively*/
+  madvise(data, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+  *out = (const unsigned char*)data;
+  *outsize = (size_t)st.st_size;
+  return 0;
+}
+
+void lodepng_unmap_file(const unsigned char* buffer, size_t buffersize)
+{
+  if(buffer) munmap((void*)buffer, buffersize);
+}
+#else /*LODEPNG_COMPILE_MMAP*/
 /*write given buffer to the file, overwriting the file, it doesn't append to it.*/
 unsigned lodepng_save_file(const unsigned char* buffer, size_t buffersize, const char* filename)
 {
@@ -407,6 +581,27 @@ unsigned lodepng_save_file(const unsigned char* buffer, size_t buffersize, const
   return 0;
 }
 
+unsigned lodepng_map_file(const unsigned char** out, size_t* outsize, const char* filename)
+{
+  unsigned char* buffer = 0;
+  unsigned error = lodepng_load_file(&buffer, outsize, filename);
+  if(error)
+  {
+    lodepng_free(buffer);
+    buffer = 0;
+    *outsize = 0;
+  }
+  *out = buffer;
+  return error;
+}
+
+void lodepng_unmap_file(const unsigned char* buffer, size_t buffersize)
+{
+  (void)buffersize;
+  lodepng_free((void*)buffer);
+}
+#endif /*LODEPNG_COMPILE_MMAP*/
+
 #endif /*LODEPNG_COMPILE_DISK*/
 
 /* ////////////////////////////////////////////////////////////////////////// */
@@ -416,49 +611,147 @@ unsigned lodepng_save_file(const unsigned char* buffer, size_t buffersize, const
 /* ////////////////////////////////////////////////////////////////////////// */
 
 #ifdef LODEPNG_COMPILE_ZLIB
+/*reverses the order of the num (at most 16) lowest bits*/
+static unsigned reverseBits(unsigned bits, unsigned num)
+{
+  bits = ((bits & 0x5555u) << 1) | ((bits >> 1) & 0x5555u);
+  bits = ((bits & 0x3333u) << 2) | ((bits >> 2) & 0x3333u);
+  bits = ((bits & 0x0f0fu) << 4) | ((bits >> 4) & 0x0f0fu);
+  bits = ((bits & 0x00ffu) << 8) | ((bits >> 8) & 0x00ffu);
+  return bits >> (16 - num);
+}
+
 #ifdef LODEPNG_COMPILE_ENCODER
-/*TODO: this ignores potential out of memory errors*/
-#define addBitToStream(/*size_t**/ bitpointer, /*ucvector**/ bitstream, /*unsigned char*/ bit)\
-{\
-  /*add a new byte at the end*/\
-  if(((*bitpointer) & 7) == 0) ucvector_push_back(bitstream, (unsigned char)0);\
-  /*earlier bit of huffman code is in a lesser significant bit of an earlier byte*/\
-  (bitstream->data[bitstream->size - 1]) |= (bit << ((*bitpointer) & 0x7));\
-  ++(*bitpointer);\
+/*
+Writes bits to a deflate stream. They are gathered in a 64-bit accumulator and stored to the ucvector
+32 at a time, instead of one by one. The ucvector and bit pointer are those the deflate functions pass
+around: the last byte may be partially filled, and bp is only up to date again after BitWriter_finish.
+*/
+typedef struct BitWriter
+{
+  ucvector* out;
+  size_t* bp;
+  unsigned long long bits; /*bits not stored yet, the first one in the least significant bit*/
+  unsigned numbits; /*amount of bits not stored yet, less than 32 between calls*/
+  unsigned error;
+} BitWriter;
+
+static void BitWriter_init(BitWriter* writer, ucvector* out, size_t* bp)
+{
+  writer->out = out;
+  writer->bp = bp;
+  writer->bits = 0;
+  writer->numbits = (unsigned)(*bp & 7);
+  writer->error = 0;
+  /*the partially filled last byte goes back in the accumulator, its unused bits are zero*/
+  if(writer->numbits) writer->bits = out->data[--out->size];
 }
 
-static void addBitsToStream(size_t* bitpointer, ucvector* bitstream, unsigned value, size_t nbits)
+/*makes room for at least size more bytes, so that storing them does not reallocate*/
+static void BitWriter_reserve(BitWriter* writer, size_t size)
 {
-  size_t i;
-  for(i = 0; i != nbits; ++i) addBitToStream(bitpointer, bitstream, (unsigned char)((value >> i) & 1));
+  if(!ucvector_reserve(writer->out, writer->out->size + size)) writer->error = 83; /*alloc fail*/
 }
 
-static void addBitsToStreamReversed(size_t* bitpointer, ucvector* bitstream, unsigned value, size_t nbits)
+static void BitWriter_store32(BitWriter* writer)
 {
-  size_t i;
-  for(i = 0; i != nbits; ++i) addBitToStream(bitpointer, bitstream, (unsigned char)((value >> (nbits - 1 - i)) & 1));
+  ucvector* out = writer->out;
+  if(out->size + 4 > out->allocsize && !ucvector_reserve(out, out->size + 4)) writer->error = 83; /*alloc fail*/
+  else
+  {
+    out->data[out->size + 0] = (unsigned char)(writer->bits);
+    out->data[out->size + 1] = (unsigned char)(writer->bits >> 8);
+    out->data[out->size + 2] = (unsigned char)(writer->bits >> 16);
+    out->data[out->size + 3] = (unsigned char)(writer->bits >> 24);
+    out->size += 4;
+  }
+  writer->bits >>= 32;
+  writer->numbits -= 32;
+}
+
+/*adds the nbits (at most 32) lowest bits of value, the least significant one first. Higher bits must be 0.*/
+static void addBits(BitWriter* writer, unsigned value, unsigned nbits)
+{
+  writer->bits |= (unsigned long long)value << writer->numbits;
+  writer->numbits += nbits;
+  if(writer->numbits >= 32) BitWriter_store32(writer);
+}
+
+/*stores the remaining bits, padding the last byte with zeroes, and updates the bit pointer*/
+static unsigned BitWriter_finish(BitWriter* writer)
+{
+  size_t bitsize = writer->out->size * 8 + writer->numbits;
+  while(writer->numbits != 0 && !writer->error)
+  {
+    if(!ucvector_push_back(writer->out, (unsigned char)writer->bits)) writer->error = 83; /*alloc fail*/
+    writer->bits >>= 8;
+    writer->numbits = writer->numbits > 8 ? writer->numbits - 8 : 0;
+  }
+  *writer->bp = bitsize;
+  return writer->error;
 }
 #endif /*LODEPNG_COMPILE_ENCODER*/
 
 #ifdef LODEPNG_COMPILE_DECODER
 
-#define READBIT(bitpointer, bitstream) ((bitstream[bitpointer >> 3] >> (bitpointer & 0x7)) & (unsigned char)1)
+/*
+Reads bits from a deflate stream. ensureBits loads the 64 bits from the byte of bp on into buffer, so
+that at least 57 bits can be peeked and advanced over before it is needed again. Bits past the end of
+the data read as 0: callers check bp against bitsize afterwards instead of before every bit.
+*/
+typedef struct BitReader
+{
+  const unsigned char* data;
+  size_t size; /*size of data in bytes*/
+  size_t bitsize; /*size of data in bits*/
+  size_t bp; /*bit pointer, current byte is bp >> 3, current bit is bp & 0x7 (from lsb to msb of the byte)*/
+  unsigned long long buffer; /*the bits from bp on, the next one in the least significant bit*/
+} BitReader;
 
-static unsigned char readBitFromStream(size_t* bitpointer, const unsigned char* bitstream)
+static void BitReader_init(BitReader* reader, const unsigned char* data, size_t size)
 {
-  unsigned char result = (unsigned char)(READBIT(*bitpointer, bitstream));
-  ++(*bitpointer);
-  return result;
+  reader->data = data;
+  reader->size = size;
+  reader->bitsize = size * 8;
+  reader->bp = 0;
+  reader->buffer = 0;
 }
 
-static unsigned readBitsFromStream(size_t* bitpointer, const unsigned char* bitstream, size_t nbits)
+static void ensureBits(BitReader* reader)
 {
-  unsigned result = 0, i;
-  for(i = 0; i != nbits; ++i)
+  size_t start = reader->bp >> 3;
+  const unsigned char* p = reader->data + start;
+  unsigned long long buffer = 0;
+  if(start + 8 <= reader->size)
+  {
+    buffer = (unsigned long long)p[0] | ((unsigned long long)p[1] << 8) | ((unsigned long long)p[2] << 16)
+           | ((unsigned long long)p[3] << 24) | ((unsigned long long)p[4] << 32) | ((unsigned long long)p[5] << 40)
+           | ((unsigned long long)p[6] << 48) | ((unsigned long long)p[7] << 56);
+  }
+  else
   {
-    result += ((unsigned)READBIT(*bitpointer, bitstream)) << i;
-    ++(*bitpointer);
+    size_t i;
+    for(i = 0; start + i < reader->size; ++i) buffer |= (unsigned long long)p[i] << (8 * i);
   }
+  reader->buffer = buffer >> (reader->bp & 7);
+}
+
+/*the next nbits (at most 32) bits, without advancing*/
+static unsigned peekBits(const BitReader* reader, unsigned nbits)
+{
+  return (unsigned)(reader->buffer & ((1ull << nbits) - 1u));
+}
+
+static void advanceBits(BitReader* reader, unsigned nbits)
+{
+  reader->buffer >>= nbits;
+  reader->bp += nbits;
+}
+
+static unsigned readBits(BitReader* reader, unsigned nbits)
+{
+  unsigned result = peekBits(reader, nbits);
+  advanceBits(reader, nbits);
   return result;
 }
 #endif /*LODEPNG_COMPILE_DECODER*/
@@ -475,6 +768,8 @@ static unsigned readBitsFromStream(size_t* bitpointer, const unsigned char* bits
 #define NUM_DISTANCE_SYMBOLS 32
 /*the code length codes. 0-15: code lengths, 16: copy previous 3-6 times, 17: 3-10 zeros, 18: 11-138 zeros*/
 #define NUM_CODE_LENGTH_CODES 19
+/*the longest length a length code can give*/
+static const size_t MAX_SUPPORTED_DEFLATE_LENGTH = 258;
 
 /*the base lengths represented by codes 257-285*/
 static const unsigned LENGTHBASE[29]
@@ -508,11 +803,15 @@ Huffman tree struct, containing multiple representations of the tree
 */
 typedef struct HuffmanTree
 {
-  unsigned* tree2d;
   unsigned* tree1d;
   unsigned* lengths; /*the lengths of the codes of the 1d-tree*/
   unsigned maxbitlen; /*maximum number of bits a single code can get*/
   unsigned numcodes; /*number of symbols in the alphabet = number of codes*/
+  /*decoding lookup table, indexed by the next HUFFMAN_FIRSTBITS bits of the stream. For codes that are
+  longer, table_len is the longest code with that prefix and table_value the start of a second table,
+  indexed by the bits after the prefix. Other entries hold the code length and the symbol.*/
+  unsigned char* table_len;
+  unsigned short* table_value;
 } HuffmanTree;
 
 /*function used for debug purposes to draw the tree in ascii art with C++*/
@@ -530,74 +829,110 @@ static void HuffmanTree_draw(HuffmanTree* tree)
 
 static void HuffmanTree_init(HuffmanTree* tree)
 {
-  tree->tree2d = 0;
   tree->tree1d = 0;
   tree->lengths = 0;
+  tree->table_len = 0;
+  tree->table_value = 0;
 }
 
 static void HuffmanTree_cleanup(HuffmanTree* tree)
 {
-  lodepng_free(tree->tree2d);
   lodepng_free(tree->tree1d);
   lodepng_free(tree->lengths);
+  lodepng_free(tree->table_len);
+  lodepng_free(tree->table_value);
 }
 
-/*the tree representation used by the decoder. return value is error*/
-static unsigned HuffmanTree_make2DTree(HuffmanTree* tree)
+/*the first lookup of huffmanDecodeSymbol takes this many bits, longer codes need a second one*/
+#define HUFFMAN_FIRSTBITS 9u
+/*table_value of entries no code leads to*/
+#define HUFFMAN_INVALIDSYMBOL 65535u
+
+/*the lookup tables used by the decoder. return value is error*/
+static unsigned HuffmanTree_makeTable(HuffmanTree* tree)
 {
-  unsigned nodefilled = 0; /*up to which node it is filled*/
-  unsigned treepos = 0; /*position in the tree (1 of the numcodes columns)*/
-  unsigned n, i;
+  const unsigned headsize = 1u << HUFFMAN_FIRSTBITS;
+  const unsigned mask = headsize - 1u;
+  unsigned maxlens[1u << HUFFMAN_FIRSTBITS]; /*longest code per first table entry*/
+  size_t i, size, pointer;
 
-  tree->tree2d = (unsigned*)lodepng_malloc(tree->numcodes * 2 * sizeof(unsigned));
-  if(!tree->tree2d) return 83; /*alloc fail*/
+  for(i = 0; i != headsize; ++i) maxlens[i] = 0;
+  for(i = 0; i != tree->numcodes; ++i)
+  {
+    unsigned l = tree->lengths[i];
+    unsigned index;
+    if(l <= HUFFMAN_FIRSTBITS) continue;
+    index = reverseBits(tree->tree1d[i] >> (l - HUFFMAN_FIRSTBITS), HUFFMAN_FIRSTBITS);
+    if(l > maxlens[index]) maxlens[index] = l;
+  }
+  size = headsize;
+  for(i = 0; i != headsize; ++i)
+  {
+    if(maxlens[i] > HUFFMAN_FIRSTBITS) size += (size_t)1u << (maxlens[i] - HUFFMAN_FIRSTBITS);
+  }
 
-  /*
-  convert tree1d[] to tree2d[][]. In the 2D array, a value of 32767 means
-  uninited, a value >= numcodes is an address to another bit, a value < numcodes
-  is a code. The 2 rows are the 2 possible bit values (0 or 1), there are as
-  many columns as codes - 1.
-  A good huffman tree has N * 2 - 1 nodes, of which N - 1 are internal nodes.
-  Here, the internal nodes are stored (what their 0 and 1 option point to).
-  There is only memory for such good tree currently, if there are more nodes
-  (due to too long length codes), error 55 will happen
-  */
-  for(n = 0; n < tree->numcodes * 2; ++n)
+  tree->table_len = (unsigned char*)lodepng_malloc(size * sizeof(unsigned char));
+  tree->table_value = (unsigned short*)lodepng_malloc(size * sizeof(unsigned short));
+  if(!tree->table_len || !tree->table_value) return 83; /*alloc fail*/
+  for(i = 0; i != size; ++i) tree->table_len[i] = 16; /*16 here means the entry isn't filled yet*/
+
+  /*first table entries of long codes point to their second table*/
+  pointer = headsize;
+  for(i = 0; i != headsize; ++i)
   {
-    tree->tree2d[n] = 32767; /*32767 here means the tree2d isn't filled there yet*/
+    if(maxlens[i] <= HUFFMAN_FIRSTBITS) continue;
+    tree->table_len[i] = (unsigned char)maxlens[i];
+    tree->table_value[i] = (unsigned short)pointer;
+    pointer += (size_t)1u << (maxlens[i] - HUFFMAN_FIRSTBITS);
   }
 
-  for(n = 0; n < tree->numcodes; ++n) /*the codes*/
+  /*the stream holds the codes starting from their most significant bit, so the tables are indexed by the
+  reversed code. A code shorter than the index repeats for every value of the bits after it.*/
+  for(i = 0; i != tree->numcodes; ++i)
   {
-    for(i = 0; i != tree->lengths[n]; ++i) /*the bits for this code*/
+    unsigned l = tree->lengths[i];
+    unsigned reverse, j, num;
+    if(l == 0) continue;
+    reverse = reverseBits(tree->tree1d[i], l);
+    if(l <= HUFFMAN_FIRSTBITS)
     {
-      unsigned char bit = (unsigned char)((tree->tree1d[n] >> (tree->lengths[n] - i - 1)) & 1);
-      /*oversubscribed, see comment in lodepng_error_text*/
-      if(treepos > 2147483647 || treepos + 2 > tree->numcodes) return 55;
-      if(tree->tree2d[2 * treepos + bit] == 32767) /*not yet filled in*/
+      num = 1u << (HUFFMAN_FIRSTBITS - l);
+      for(j = 0; j != num; ++j)
       {
-        if(i + 1 == tree->lengths[n]) /*last bit*/
-        {
-          tree->tree2d[2 * treepos + bit] = n; /*put the current code in it*/
-          treepos = 0;
-        }
-        else
-        {
-          /*put address of the next step in here, first that address has to be found of course
-          (it's just nodefilled + 1)...*/
-          ++nodefilled;
-          /*addresses encoded with numcodes added to it*/
-          tree->tree2d[2 * treepos + bit] = nodefilled + tree->numcodes;
-          treepos = nodefilled;
-        }
+        unsigned index = reverse | (j << l);
+        /*oversubscribed, see comment in lodepng_error_text*/
+        if(tree->table_len[index] != 16) return 55;
+        tree->table_len[index] = (unsigned char)l;
+        tree->table_value[index] = (unsigned short)i;
+      }
+    }
+    else
+    {
+      unsigned index = reverse & mask;
+      unsigned tablebits = tree->table_len[index] - HUFFMAN_FIRSTBITS; /*log2 of the second table size*/
+      unsigned start = tree->table_value[index];
+      if(tree->table_len[index] < l) return 55; /*a shorter code has the same prefix, oversubscribed*/
+      num = 1u << (tablebits - (l - HUFFMAN_FIRSTBITS));
+      for(j = 0; j != num; ++j)
+      {
+        unsigned index2 = start + ((reverse >> HUFFMAN_FIRSTBITS) | (j << (l - HUFFMAN_FIRSTBITS)));
+        if(tree->table_len[index2] != 16) return 55;
+        tree->table_len[index2] = (unsigned char)l;
+        tree->table_value[index2] = (unsigned short)i;
       }
-      else treepos = tree->tree2d[2 * treepos + bit] - tree->numcodes;
     }
   }
 
-  for(n = 0; n < tree->numcodes * 2; ++n)
+  /*bit combinations no code starts with, which an incomplete tree has, decode to an invalid symbol. Their
+  length is smaller than HUFFMAN_FIRSTBITS in the first table and larger in the second ones, like valid
+  entries there, so that huffmanDecodeSymbol can treat them alike.*/
+  for(i = 0; i != size; ++i)
   {
-    if(tree->tree2d[n] == 32767) tree->tree2d[n] = 0; /*remove possible remaining 32767's*/
+    if(tree->table_len[i] == 16)
+    {
+      tree->table_len[i] = (unsigned char)(i < headsize ? 1 : HUFFMAN_FIRSTBITS + 1);
+      tree->table_value[i] = HUFFMAN_INVALIDSYMBOL;
+    }
   }
 
   return 0;
@@ -644,7 +979,7 @@ static unsigned HuffmanTree_makeFromLengths2(HuffmanTree* tree)
   uivector_cleanup(&blcount);
   uivector_cleanup(&nextcode);
 
-  if(!error) return HuffmanTree_make2DTree(tree);
+  if(!error) return HuffmanTree_makeTable(tree);
   else return error;
 }
 
@@ -941,27 +1276,25 @@ static unsigned generateFixedDistanceTree(HuffmanTree* tree)
 #ifdef LODEPNG_COMPILE_DECODER
 
 /*
-returns the code, or (unsigned)(-1) if error happened
-inbitlength is the length of the complete buffer, in bits (so its byte length times 8)
+returns the symbol, or HUFFMAN_INVALIDSYMBOL for a bit combination no code of the tree starts with.
+The reader must have at least 15 bits buffered. Past the end of the input it decodes zero bits, so the
+caller checks the bit pointer afterwards.
 */
-static unsigned huffmanDecodeSymbol(const unsigned char* in, size_t* bp,
-                                    const HuffmanTree* codetree, size_t inbitlength)
+static unsigned huffmanDecodeSymbol(BitReader* reader, const HuffmanTree* codetree)
 {
-  unsigned treepos = 0, ct;
-  for(;;)
+  unsigned index = peekBits(reader, HUFFMAN_FIRSTBITS);
+  unsigned l = codetree->table_len[index];
+  unsigned value = codetree->table_value[index];
+  if(l <= HUFFMAN_FIRSTBITS)
   {
-    if(*bp >= inbitlength) return (unsigned)(-1); /*error: end of input memory reached without endcode*/
-    /*
-    decode the symbol from the tree. The "readBitFromStream" code is inlined in
-    the expression below because this is the biggest bottleneck while decoding
-    */
-    ct = codetree->tree2d[(treepos << 1) + READBIT(*bp, in)];
-    ++(*bp);
-    if(ct < codetree->numcodes) return ct; /*the symbol is decoded, return it*/
-    else treepos = ct - codetree->numcodes; /*symbol not yet decoded, instead move tree position*/
-
-    if(treepos >= codetree->numcodes) return (unsigned)(-1); /*error: it appeared outside the codetree*/
+    advanceBits(reader, l);
+    return value;
   }
+  /*a long code: the first table entry points to a second table for the bits after the prefix*/
+  advanceBits(reader, HUFFMAN_FIRSTBITS);
+  index = value + peekBits(reader, l - HUFFMAN_FIRSTBITS);
+  advanceBits(reader, codetree->table_len[index] - HUFFMAN_FIRSTBITS);
+  return codetree->table_value[index];
 }
 #endif /*LODEPNG_COMPILE_DECODER*/
 
@@ -980,13 +1313,12 @@ static void getTreeInflateFixed(HuffmanTree* tree_ll, HuffmanTree* tree_d)
 }
 
 /*get the tree of a deflated block with dynamic tree, the tree itself is also Huffman compressed with a known tree*/
-static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
-                                      const unsigned char* in, size_t* bp, size_t inlength)
+static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d, BitReader* reader)
 {
   /*make sure that length values that aren't filled in will be 0, or a wrong tree will be generated*/
   unsigned error = 0;
   unsigned n, HLIT, HDIST, HCLEN, i;
-  size_t inbitlength = inlength * 8;
+  size_t inbitlength = reader->bitsize;
 
   /*see comments in deflateDynamic for explanation of the context and these variables, it is analogous*/
   unsigned* bitlen_ll = 0; /*lit,len code lengths*/
@@ -995,16 +1327,17 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
   unsigned* bitlen_cl = 0;
   HuffmanTree tree_cl; /*the code tree for code length codes (the huffman tree for compressed huffman trees)*/
 
-  if((*bp) + 14 > (inlength << 3)) return 49; /*error: the bit pointer is or will go past the memory*/
+  if(reader->bp + 14 > inbitlength) return 49; /*error: the bit pointer is or will go past the memory*/
 
+  ensureBits(reader);
   /*number of literal/length codes + 257. Unlike the spec, the value 257 is added to it here already*/
-  HLIT =  readBitsFromStream(bp, in, 5) + 257;
+  HLIT =  readBits(reader, 5) + 257;
   /*number of distance codes. Unlike the spec, the value 1 is added to it here already*/
-  HDIST = readBitsFromStream(bp, in, 5) + 1;
+  HDIST = readBits(reader, 5) + 1;
   /*number of code length codes. Unlike the spec, the value 4 is added to it here already*/
-  HCLEN = readBitsFromStream(bp, in, 4) + 4;
+  HCLEN = readBits(reader, 4) + 4;
 
-  if((*bp) + HCLEN * 3 > (inlength << 3)) return 50; /*error: the bit pointer is or will go past the memory*/
+  if(reader->bp + HCLEN * 3 > inbitlength) return 50; /*error: the bit pointer is or will go past the memory*/
 
   HuffmanTree_init(&tree_cl);
 
@@ -1017,7 +1350,8 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
 
     for(i = 0; i != NUM_CODE_LENGTH_CODES; ++i)
     {
-      if(i < HCLEN) bitlen_cl[CLCL_ORDER[i]] = readBitsFromStream(bp, in, 3);
+      if(i % 16 == 0) ensureBits(reader); /*16 lengths of 3 bits fit in the buffer*/
+      if(i < HCLEN) bitlen_cl[CLCL_ORDER[i]] = readBits(reader, 3);
       else bitlen_cl[CLCL_ORDER[i]] = 0; /*if not, it must stay 0*/
     }
 
@@ -1035,7 +1369,10 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
     i = 0;
     while(i < HLIT + HDIST)
     {
-      unsigned code = huffmanDecodeSymbol(in, bp, &tree_cl, inbitlength);
+      unsigned code;
+      ensureBits(reader); /*a code length code and its repeat bits are at most 14 bits*/
+      code = huffmanDecodeSymbol(reader, &tree_cl);
+      if(reader->bp > inbitlength) ERROR_BREAK(10); /*error: end of input memory reached without endcode*/
       if(code <= 15) /*a length code*/
       {
         if(i < HLIT) bitlen_ll[i] = code;
@@ -1049,8 +1386,8 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
 
         if(i == 0) ERROR_BREAK(54); /*can't repeat previous if i is 0*/
 
-        if((*bp + 2) > inbitlength) ERROR_BREAK(50); /*error, bit pointer jumps past memory*/
-        replength += readBitsFromStream(bp, in, 2);
+        if((reader->bp + 2) > inbitlength) ERROR_BREAK(50); /*error, bit pointer jumps past memory*/
+        replength += readBits(reader, 2);
 
         if(i < HLIT + 1) value = bitlen_ll[i - 1];
         else value = bitlen_d[i - HLIT - 1];
@@ -1066,8 +1403,8 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
       else if(code == 17) /*repeat "0" 3-10 times*/
       {
         unsigned replength = 3; /*read in the bits that indicate repeat length*/
-        if((*bp + 3) > inbitlength) ERROR_BREAK(50); /*error, bit pointer jumps past memory*/
-        replength += readBitsFromStream(bp, in, 3);
+        if((reader->bp + 3) > inbitlength) ERROR_BREAK(50); /*error, bit pointer jumps past memory*/
+        replength += readBits(reader, 3);
 
         /*repeat this value in the next lengths*/
         for(n = 0; n < replength; ++n)
@@ -1082,8 +1419,8 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
       else if(code == 18) /*repeat "0" 11-138 times*/
       {
         unsigned replength = 11; /*read in the bits that indicate repeat length*/
-        if((*bp + 7) > inbitlength) ERROR_BREAK(50); /*error, bit pointer jumps past memory*/
-        replength += readBitsFromStream(bp, in, 7);
+        if((reader->bp + 7) > inbitlength) ERROR_BREAK(50); /*error, bit pointer jumps past memory*/
+        replength += readBits(reader, 7);
 
         /*repeat this value in the next lengths*/
         for(n = 0; n < replength; ++n)
@@ -1095,15 +1432,10 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
           ++i;
         }
       }
-      else /*if(code == (unsigned)(-1))*/ /*huffmanDecodeSymbol returns (unsigned)(-1) in case of error*/
+      else /*if(code == HUFFMAN_INVALIDSYMBOL)*/
       {
-        if(code == (unsigned)(-1))
-        {
-          /*return error code 10 or 11 depending on the situation that happened in huffmanDecodeSymbol
-          (10=no endcode, 11=wrong jump outside of tree)*/
-          error = (*bp) > inbitlength ? 10 : 11;
-        }
-        else error = 16; /*unexisting code, this can never happen*/
+        /*error code 11: a bit combination that is not a code of the tree, like a wrong jump outside of it*/
+        error = code == HUFFMAN_INVALIDSYMBOL ? 11 : 16; /*16: unexisting code, this can never happen*/
         break;
       }
     }
@@ -1127,94 +1459,121 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
   return error;
 }
 
+/*bytes past its output position that inflateHuffmanBlock may need allocated. An output buffer reserved
+with this much room beyond the size of the decompressed data is never reallocated by lodepng_inflatev.*/
+#define INFLATE_OUTPUT_SLACK (2 + MAX_SUPPORTED_DEFLATE_LENGTH + 7)
+
 /*inflate a block with dynamic of fixed Huffman tree*/
-static unsigned inflateHuffmanBlock(ucvector* out, const unsigned char* in, size_t* bp,
-                                    size_t* pos, size_t inlength, unsigned btype)
+static unsigned inflateHuffmanBlock(ucvector* out, BitReader* reader, size_t* pos, unsigned btype)
 {
   unsigned error = 0;
   HuffmanTree tree_ll; /*the huffman tree for literal and length codes*/
   HuffmanTree tree_d; /*the huffman tree for distance codes*/
-  size_t inbitlength = inlength * 8;
+  size_t inbitlength = reader->bitsize;
+  BitReader local;
+  size_t outpos;
+  unsigned char* outdata;
 
   HuffmanTree_init(&tree_ll);
   HuffmanTree_init(&tree_d);
 
   if(btype == 1) getTreeInflateFixed(&tree_ll, &tree_d);
-  else if(btype == 2) error = getTreeInflateDynamic(&tree_ll, &tree_d, in, bp, inlength);
+  else if(btype == 2) error = getTreeInflateDynamic(&tree_ll, &tree_d, reader);
 
+  /*the decoding state is kept in locals: stores to out->data could alias the structs the others are in*/
+  local = *reader;
+  outpos = *pos;
+  outdata = out->data;
   while(!error) /*decode all symbols until end reached, breaks at end code*/
   {
-    /*code_ll is literal, length or end code*/
-    unsigned code_ll = huffmanDecodeSymbol(in, bp, &tree_ll, inbitlength);
+    unsigned code_ll; /*code_ll is literal, length or end code*/
+
+    /*one iteration writes at most two literals and a match, and the 8 byte copies of a match write up to 7
+    bytes past its end. With room for that, the output is written without checking its size.*/
+    if(outpos + INFLATE_OUTPUT_SLACK > out->allocsize)
+    {
+      if(!ucvector_reserve(out, outpos + INFLATE_OUTPUT_SLACK)) ERROR_BREAK(83 /*alloc fail*/);
+      outdata = out->data;
+    }
+
+    /*57 buffered bits are enough for three literals, so up to three are decoded at once*/
+    ensureBits(&local);
+    code_ll = huffmanDecodeSymbol(&local, &tree_ll);
+    if(code_ll <= 255)
+    {
+      outdata[outpos++] = (unsigned char)code_ll;
+      code_ll = huffmanDecodeSymbol(&local, &tree_ll);
+      if(code_ll <= 255)
+      {
+        outdata[outpos++] = (unsigned char)code_ll;
+        code_ll = huffmanDecodeSymbol(&local, &tree_ll);
+      }
+    }
+    if(local.bp > inbitlength) ERROR_BREAK(10); /*error: end of input memory reached without endcode*/
+
     if(code_ll <= 255) /*literal symbol*/
     {
-      /*ucvector_push_back would do the same, but for some reason the two lines below run 10% faster*/
-      if(!ucvector_resize(out, (*pos) + 1)) ERROR_BREAK(83 /*alloc fail*/);
-      out->data[*pos] = (unsigned char)code_ll;
-      ++(*pos);
+      outdata[outpos++] = (unsigned char)code_ll;
     }
     else if(code_ll >= FIRST_LENGTH_CODE_INDEX && code_ll <= LAST_LENGTH_CODE_INDEX) /*length code*/
     {
       unsigned code_d, distance;
-      unsigned numextrabits_l, numextrabits_d; /*extra bits for length and distance*/
-      size_t start, forward, backward, length;
+      size_t length, n;
+      unsigned char* dest;
+      const unsigned char* source;
 
-      /*part 1: get length base*/
-      length = LENGTHBASE[code_ll - FIRST_LENGTH_CODE_INDEX];
+      /*the length extra bits, distance code and distance extra bits take at most 33 bits*/
+      ensureBits(&local);
 
-      /*part 2: get extra bits and add the value of that to length*/
-      numextrabits_l = LENGTHEXTRA[code_ll - FIRST_LENGTH_CODE_INDEX];
-      if((*bp + numextrabits_l) > inbitlength) ERROR_BREAK(51); /*error, bit pointer will jump past memory*/
-      length += readBitsFromStream(bp, in, numextrabits_l);
+      /*part 1 and 2: get length base and add the value of the extra bits to it*/
+      length = LENGTHBASE[code_ll - FIRST_LENGTH_CODE_INDEX];
+      length += readBits(&local, LENGTHEXTRA[code_ll - FIRST_LENGTH_CODE_INDEX]);
 
       /*part 3: get distance code*/
-      code_d = huffmanDecodeSymbol(in, bp, &tree_d, inbitlength);
-      if(code_d > 29)
-      {
-        if(code_ll == (unsigned)(-1)) /*huffmanDecodeSymbol returns (unsigned)(-1) in case of error*/
-        {
-          /*return error code 10 or 11 depending on the situation that happened in huffmanDecodeSymbol
-          (10=no endcode, 11=wrong jump outside of tree)*/
-          error = (*bp) > inlength * 8 ? 10 : 11;
-        }
-        else error = 18; /*error: invalid distance code (30-31 are never used)*/
-        break;
-      }
-      distance = DISTANCEBASE[code_d];
+      code_d = huffmanDecodeSymbol(&local, &tree_d);
+      if(code_d > 29) ERROR_BREAK(18); /*error: invalid distance code (30-31 are never used)*/
 
-      /*part 4: get extra bits from distance*/
-      numextrabits_d = DISTANCEEXTRA[code_d];
-      if((*bp + numextrabits_d) > inbitlength) ERROR_BREAK(51); /*error, bit pointer will jump past memory*/
-      distance += readBitsFromStream(bp, in, numextrabits_d);
+      /*part 4: get distance base and add the value of the extra bits to it*/
+      distance = DISTANCEBASE[code_d];
+      distance += readBits(&local, DISTANCEEXTRA[code_d]);
+      if(local.bp > inbitlength) ERROR_BREAK(51); /*error, bit pointer jumped past memory*/
 
       /*part 5: fill in all the out[n] values based on the length and dist*/
-      start = (*pos);
-      if(distance > start) ERROR_BREAK(52); /*too long backward distance*/
-      backward = start - distance;
-
-      if(!ucvector_resize(out, (*pos) + length)) ERROR_BREAK(83 /*alloc fail*/);
-      if (distance < length) {
-        for(forward = 0; forward < length; ++forward)
-        {
-          out->data[(*pos)++] = out->data[backward++];
-        }
-      } else {
-        memcpy(out->data + *pos, out->data + backward, length);
-        *pos += length;
+      if(distance > outpos) ERROR_BREAK(52); /*too long backward distance*/
+      dest = outdata + outpos;
+      source = dest - distance;
+      if(distance >= length) memcpy(dest, source, length);
+      else if(distance >= 8)
+      {
+        /*each 8 byte copy only reads bytes that were written before it*/
+        for(n = 0; n < length; n += 8) memcpy(dest + n, source + n, 8);
+      }
+      else if(distance == 1) memset(dest, source[0], length);
+      else
+      {
+        /*the match repeats with period distance, so it can as well be copied from the multiple of distance
+        back that is at least 8, once the bytes up to there are written*/
+        size_t period = distance * ((8 + distance - 1) / distance);
+        for(n = 0; n != length && n < period - distance; ++n) dest[n] = source[n];
+        for(; n < length; n += 8) memcpy(dest + n, dest + n - period, 8);
       }
+      outpos += length;
     }
     else if(code_ll == 256)
     {
       break; /*end code, break the loop*/
     }
-    else /*if(code == (unsigned)(-1))*/ /*huffmanDecodeSymbol returns (unsigned)(-1) in case of error*/
+    else /*if(code_ll == HUFFMAN_INVALIDSYMBOL)*/
     {
-      /*return error code 10 or 11 depending on the situation that happened in huffmanDecodeSymbol
-      (10=no endcode, 11=wrong jump outside of tree)*/
-      error = ((*bp) > inlength * 8) ? 10 : 11;
+      /*error code 11: a bit combination that is not a code of the tree, like a wrong jump outside of it.
+      Fixed trees also have the codes 286 and 287, which are not used.*/
+      error = 11;
       break;
     }
   }
+  *reader = local;
+  *pos = outpos;
+  out->size = outpos;
 
   HuffmanTree_cleanup(&tree_ll);
   HuffmanTree_cleanup(&tree_d);
@@ -1222,17 +1581,18 @@ static unsigned inflateHuffmanBlock(ucvector* out, const unsigned char* in, size
   return error;
 }
 
-static unsigned inflateNoCompression(ucvector* out, const unsigned char* in, size_t* bp, size_t* pos, size_t inlength)
+static unsigned inflateNoCompression(ucvector* out, BitReader* reader, size_t* pos)
 {
   size_t p;
-  unsigned LEN, NLEN, n, error = 0;
+  unsigned LEN, NLEN;
+  const unsigned char* in = reader->data;
+  size_t inlength = reader->size;
 
   /*go to first boundary of byte*/
-  while(((*bp) & 0x7) != 0) ++(*bp);
-  p = (*bp) / 8; /*byte position*/
+  p = (reader->bp + 7) / 8; /*byte position*/
 
   /*read LEN (2 bytes) and NLEN (2 bytes)*/
-  if(p + 4 >= inlength) return 52; /*error, bit pointer will jump past memory*/
+  if(p + 4 > inlength) return 52; /*error, bit pointer will jump past memory*/
   LEN = in[p] + 256u * in[p + 1]; p += 2;
   NLEN = in[p] + 256u * in[p + 1]; p += 2;
 
@@ -1243,36 +1603,39 @@ static unsigned inflateNoCompression(ucvector* out, const unsigned char* in, siz
 
   /*read the literal data: LEN bytes are now stored in the out buffer*/
   if(p + LEN > inlength) return 23; /*error: reading outside of in buffer*/
-  for(n = 0; n < LEN; ++n) out->data[(*pos)++] = in[p++];
+  if(LEN) memcpy(out->data + (*pos), in + p, LEN);
+  (*pos) += LEN;
+  p += LEN;
 
-  (*bp) = p * 8;
+  reader->bp = p * 8;
 
-  return error;
+  return 0;
 }
 
 static unsigned lodepng_inflatev(ucvector* out,
                                  const unsigned char* in, size_t insize,
                                  const LodePNGDecompressSettings* settings)
 {
-  /*bit pointer in the "in" data, current byte is bp >> 3, current bit is bp & 0x7 (from lsb to msb of the byte)*/
-  size_t bp = 0;
+  BitReader reader;
   unsigned BFINAL = 0;
   size_t pos = 0; /*byte position in the out buffer*/
   unsigned error = 0;
 
   (void)settings;
 
+  BitReader_init(&reader, in, insize);
+
   while(!BFINAL)
   {
     unsigned BTYPE;
-    if(bp + 2 >= insize * 8) return 52; /*error, bit pointer will jump past memory*/
-    BFINAL = readBitFromStream(&bp, in);
-    BTYPE = 1u * readBitFromStream(&bp, in);
-    BTYPE += 2u * readBitFromStream(&bp, in);
+    if(reader.bp + 2 >= reader.bitsize) return 52; /*error, bit pointer will jump past memory*/
+    ensureBits(&reader);
+    BFINAL = readBits(&reader, 1);
+    BTYPE = readBits(&reader, 2);
 
     if(BTYPE == 3) return 20; /*error: invalid BTYPE*/
-    else if(BTYPE == 0) error = inflateNoCompression(out, in, &bp, &pos, insize); /*no compression*/
-    else error = inflateHuffmanBlock(out, in, &bp, &pos, insize, BTYPE); /*compression, BTYPE 01 or 10*/
+    else if(BTYPE == 0) error = inflateNoCompression(out, &reader, &pos); /*no compression*/
+    else error = inflateHuffmanBlock(out, &reader, &pos, BTYPE); /*compression, BTYPE 01 or 10*/
 
     if(error) return error;
   }
@@ -1293,34 +1656,184 @@ unsigned lodepng_inflate(unsigned char** out, size_t* outsize,
   return error;
 }
 
-static unsigned inflate(unsigned char** out, size_t* outsize,
-                        const unsigned char* in, size_t insize,
-                        const LodePNGDecompressSettings* settings)
+static unsigned inflatev(ucvector* out,
+                         const unsigned char* in, size_t insize,
+                         const LodePNGDecompressSettings* settings)
 {
   if(settings->custom_inflate)
   {
-    return settings->custom_inflate(out, outsize, in, insize, settings);
+    unsigned error = settings->custom_inflate(&out->data, &out->size, in, insize, settings);
+    out->allocsize = out->size;
+    return error;
   }
   else
   {
-    return lodepng_inflate(out, outsize, in, insize, settings);
+    return lodepng_inflatev(out, in, insize, settings);
   }
 }
 
 #endif /*LODEPNG_COMPILE_DECODER*/
 
+/* ////////////////////////////////////////////////////////////////////////// */
+/* / Adler32                                                                  */
+/* ////////////////////////////////////////////////////////////////////////// */
+
+#ifdef LODEPNG_COMPILE_SIMD
+/*
+Adler-32 of blocks of 32 bytes. Per block, s1 grows by the sum of the bytes (psadbw), and s2 by 32 times
+s1 before the block plus the bytes weighted 32 down to 1 (pmaddubsw). The 32 times s1 are summed up in ps
+and added at the end. After at most 173 blocks, 5536 bytes, the sums are reduced modulo 65521 before they
+can overflow. len must be a multiple of 32.
+*/
+static LODEPNG_TARGET_SSSE3 unsigned adler32SSSE3(unsigned adler, const unsigned char* data, size_t len)
+{
+  const __m128i tap1 = _mm_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17);
+  const __m128i tap2 = _mm_setr_epi8(16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i ones = _mm_set1_epi16(1);
+  unsigned s1 = adler & 0xffff;
+  unsigned s2 = (adler >> 16) & 0xffff;
+  size_t blocks = len / 32;
+
+  while(blocks > 0)
+  {
+    unsigned n = blocks > 173 ? 173 : (unsigned)blocks;
+    __m128i ps = _mm_cvtsi32_si128((int)(s1 * n));
+    __m128i v1 = zero;
+    __m128i v2 = _mm_cvtsi32_si128((int)s2);
+    blocks -= n;
+    while(n > 0)
+    {
+      __m128i bytes1 = _mm_loadu_si128((const __m128i*)&data[0]);
+      __m128i bytes2 = _mm_loadu_si128((const __m128i*)&data[16]);
+      ps = _mm_add_epi32(ps, v1);
+      v1 = _mm_add_epi32(v1, _mm_add_epi32(_mm_sad_epu8(bytes1, zero), _mm_sad_epu8(bytes2, zero)));
+      v2 = _mm_add_epi32(v2, _mm_madd_epi16(_mm_maddubs_epi16(bytes1, tap1), ones));
+      v2 = _mm_add_epi32(v2, _mm_madd_epi16(_mm_maddubs_epi16(bytes2, tap2), ones));
+      data += 32;
+      --n;
+    }
+    v2 = _mm_add_epi32(v2, _mm_slli_epi32(ps, 5));
+    /*add up the lanes, the sums of psadbw are in lanes 0 and 2 only*/
+    v1 = _mm_add_epi32(v1, _mm_shuffle_epi32(v1, _MM_SHUFFLE(1, 0, 3, 2)));
+    v2 = _mm_add_epi32(v2, _mm_shuffle_epi32(v2, _MM_SHUFFLE(2, 3, 0, 1)));
+    v2 = _mm_add_epi32(v2, _mm_shuffle_epi32(v2, _MM_SHUFFLE(1, 0, 3, 2)));
+    s1 = (s1 + (unsigned)_mm_cvtsi128_si32(v1)) % 65521;
+    s2 = (unsigned)_mm_cvtsi128_si32(v2) % 65521;
+  }
+
+  return (s2 << 16) | s1;
+}
+
+/*the same as adler32SSSE3 with one 32 byte block per 256-bit register*/
+static LODEPNG_TARGET_AVX2 unsigned adler32AVX2(unsigned adler, const unsigned char* data, size_t len)
+{
+  const __m256i tap = _mm256_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17,
+                                       16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i ones = _mm256_set1_epi16(1);
+  unsigned s1 = adler & 0xffff;
+  unsigned s2 = (adler >> 16) & 0xffff;
+  size_t blocks = len / 32;
+
+  while(blocks > 0)
+  {
+    unsigned n = blocks > 173 ? 173 : (unsigned)blocks;
+    __m256i ps = _mm256_setr_epi32((int)(s1 * n), 0, 0, 0, 0, 0, 0, 0);
+    __m256i v1 = zero;
+    __m256i v2 = _mm256_setr_epi32((int)s2, 0, 0, 0, 0, 0, 0, 0);
+    __m128i r1, r2;
+    blocks -= n;
+    while(n > 0)
+    {
+      __m256i bytes = _mm256_loadu_si256((const __m256i*)data);
+      ps = _mm256_add_epi32(ps, v1);
+      v1 = _mm256_add_epi32(v1, _mm256_sad_epu8(bytes, zero));
+      v2 = _mm256_add_epi32(v2, _mm256_madd_epi16(_mm256_maddubs_epi16(bytes, tap), ones));
+      data += 32;
+      --n;
+    }
+    v2 = _mm256_add_epi32(v2, _mm256_slli_epi32(ps, 5));
+    r1 = _mm_add_epi32(_mm256_castsi256_si128(v1), _mm256_extracti128_si256(v1, 1));
+    r2 = _mm_add_epi32(_mm256_castsi256_si128(v2), _mm256_extracti128_si256(v2, 1));
+    r1 = _mm_add_epi32(r1, _mm_shuffle_epi32(r1, _MM_SHUFFLE(1, 0, 3, 2)));
+    r2 = _mm_add_epi32(r2, _mm_shuffle_epi32(r2, _MM_SHUFFLE(2, 3, 0, 1)));
+    r2 = _mm_add_epi32(r2, _mm_shuffle_epi32(r2, _MM_SHUFFLE(1, 0, 3, 2)));
+    s1 = (s1 + (unsigned)_mm_cvtsi128_si32(r1)) % 65521;
+    s2 = (unsigned)_mm_cvtsi128_si32(r2) % 65521;
+  }
+
+  return (s2 << 16) | s1;
+}
+#endif /*LODEPNG_COMPILE_SIMD*/
+
+static unsigned update_adler32(unsigned adler, const unsigned char* data, unsigned len)
+{
+  unsigned s1, s2;
+
+#ifdef LODEPNG_COMPILE_SIMD
+  if(len >= 32 && (LODEPNG_CPU_SUPPORTS("avx2") || LODEPNG_CPU_SUPPORTS("ssse3")))
+  {
+    unsigned blocks = len & ~31u;
+    if(LODEPNG_CPU_SUPPORTS("avx2")) adler = adler32AVX2(adler, data, blocks);
+    else adler = adler32SSSE3(adler, data, blocks);
+    data += blocks;
+    len -= blocks;
+  }
+#endif /*LODEPNG_COMPILE_SIMD*/
+
+  s1 = adler & 0xffff;
+  s2 = (adler >> 16) & 0xffff;
+  while(len > 0)
+  {
+    /*at least 5550 sums can be done before the sums overflow, saving a lot of module divisions*/
+    unsigned amount = len > 5550 ? 5550 : len;
+    len -= amount;
+    while(amount > 0)
+    {
+      s1 += (*data++);
+      s2 += s1;
+      --amount;
+    }
+    s1 %= 65521;
+    s2 %= 65521;
+  }
+
+  return (s2 << 16) | s1;
+}
+
+/*Return the adler32 of the bytes data[0..len-1]*/
+static unsigned adler32(const unsigned char* data, unsigned len)
+{
+  return update_adler32(1L, data, len);
+}
+
+/*Appending len2 bytes adds len2 times the first sum to the second sum, the rest are plain additions modulo 65521.*/
+unsigned lodepng_adler32_combine(unsigned adler1, unsigned adler2, size_t len2)
+{
+  unsigned rem = (unsigned)(len2 % 65521);
+  unsigned s1 = adler1 & 0xffff;
+  unsigned s2 = (rem * s1) % 65521; /*65520 * 65520 still fits in 32 bits*/
+  s1 += (adler2 & 0xffff) + 65521 - 1;
+  s2 += ((adler1 >> 16) & 0xffff) + ((adler2 >> 16) & 0xffff) + 65521 - rem;
+  if(s1 >= 65521) s1 -= 65521;
+  if(s1 >= 65521) s1 -= 65521;
+  if(s2 >= 65521 * 2) s2 -= 65521 * 2;
+  if(s2 >= 65521) s2 -= 65521;
+  return (s2 << 16) | s1;
+}
+
+
 #ifdef LODEPNG_COMPILE_ENCODER
 
 /* ////////////////////////////////////////////////////////////////////////// */
 /* / Deflator (Compressor)                                                  / */
 /* ////////////////////////////////////////////////////////////////////////// */
 
-static const size_t MAX_SUPPORTED_DEFLATE_LENGTH = 258;
-
-/*bitlen is the size in bits of the code*/
-static void addHuffmanSymbol(size_t* bp, ucvector* compressed, unsigned code, unsigned bitlen)
+/*bitlen is the size in bits of the code, huffman codes are stored starting from their most significant bit*/
+static void addHuffmanSymbol(BitWriter* writer, unsigned code, unsigned bitlen)
 {
-  addBitsToStreamReversed(bp, compressed, code, bitlen);
+  addBits(writer, reverseBits(code, bitlen), bitlen);
 }
 
 /*search the index in the array, that has the largest value smaller than or equal to the given value,
@@ -1359,10 +1872,15 @@ static void addLengthDistance(uivector* values, size_t length, size_t distance)
   uivector_push_back(values, extra_distance);
 }
 
-/*3 bytes of data get encoded into two bytes. The hash cannot use more than 3
-bytes as input because 3 is the minimum match length for deflate*/
-static const unsigned HASH_NUM_VALUES = 65536;
-static const unsigned HASH_BIT_MASK = 65535; /*HASH_NUM_VALUES - 1, but C90 does not like that as initializer*/
+/*
+The hash chains link positions whose next 4 bytes have the same multiplicative hash, which spreads the
+mostly small filtered PNG bytes over the table far better than a shift and xor does. Matches of only 3
+bytes come from a separate small table, with per hash value a bucket of the last few positions.
+All positions are stored circularly as pos & (windowsize - 1).
+*/
+static const unsigned HASH_BITS = 15;
+static const unsigned HASH_NUM_VALUES = 32768; /*1 << HASH_BITS, but C90 does not like that as initializer*/
+static const unsigned HASH3_BUCKET_SIZE = 2;
 
 typedef struct Hash
 {
@@ -1370,102 +1888,262 @@ typedef struct Hash
   /*circular pos to prev circular pos*/
   unsigned short* chain;
   int* val; /*circular pos to hash value*/
+  int* head3; /*3 byte hash value to its bucket of the most recent circular positions, newest first*/
+  unsigned windowsize; /*size of chain and val*/
+  const LodePNGAllocator* allocator; /*NULL for lodepng_realloc and lodepng_free*/
 
-  /*TODO: do this not only for zeros but for any repeated byte. However for PNG
-  it's always going to be the zeros that dominate, so not important for PNG*/
-  int* headz; /*similar to head, but for chainz*/
-  unsigned short* chainz; /*those with same amount of zeros*/
-  unsigned short* zeros; /*length of zeros streak, used as a second hash chain*/
+  /*The lz77 encoded data of the current deflate block, represented with integers since there will also be
+  length and distance codes in it. Kept here so that its memory is reused by the following blocks.*/
+  uivector lz77;
 } Hash;
 
-static unsigned hash_init(Hash* hash, unsigned windowsize)
+/*empties the hash table, which keeps its memory, so it can be used for the next data*/
+static void hash_reset(Hash* hash)
 {
   unsigned i;
-  hash->head = (int*)lodepng_malloc(sizeof(int) * HASH_NUM_VALUES);
-  hash->val = (int*)lodepng_malloc(sizeof(int) * windowsize);
-  hash->chain = (unsigned short*)lodepng_malloc(sizeof(unsigned short) * windowsize);
+  for(i = 0; i != HASH_NUM_VALUES; ++i) hash->head[i] = -1;
+  for(i = 0; i != hash->windowsize; ++i) hash->val[i] = -1;
+  for(i = 0; i != hash->windowsize; ++i) hash->chain[i] = i; /*same value as index indicates uninitialized*/
+  for(i = 0; i != HASH_NUM_VALUES * HASH3_BUCKET_SIZE; ++i) hash->head3[i] = -1;
+}
 
-  hash->zeros = (unsigned short*)lodepng_malloc(sizeof(unsigned short) * windowsize);
-  hash->headz = (int*)lodepng_malloc(sizeof(int) * (MAX_SUPPORTED_DEFLATE_LENGTH + 1));
-  hash->chainz = (unsigned short*)lodepng_malloc(sizeof(unsigned short) * windowsize);
+/*allocator may be NULL for lodepng_realloc and lodepng_free. Must be cleaned up also on error.*/
+static unsigned hash_init(Hash* hash, unsigned windowsize, const LodePNGAllocator* allocator)
+{
+  hash->windowsize = windowsize;
+  hash->allocator = allocator;
+  uivector_init(&hash->lz77);
+  hash->lz77.allocator = allocator;
+  hash->head = (int*)lodepng_allocator_realloc(allocator, 0, 0, sizeof(int) * HASH_NUM_VALUES);
+  hash->val = (int*)lodepng_allocator_realloc(allocator, 0, 0, sizeof(int) * windowsize);
+  hash->chain = (unsigned short*)lodepng_allocator_realloc(allocator, 0, 0, sizeof(unsigned short) * windowsize);
+  hash->head3 = (int*)lodepng_allocator_realloc(allocator, 0, 0, sizeof(int) * HASH_NUM_VALUES * HASH3_BUCKET_SIZE);
 
-  if(!hash->head || !hash->chain || !hash->val  || !hash->headz|| !hash->chainz || !hash->zeros)
+  if(!hash->head || !hash->chain || !hash->val || !hash->head3)
   {
     return 83; /*alloc fail*/
   }
 
-  /*initialize hash table*/
-  for(i = 0; i != HASH_NUM_VALUES; ++i) hash->head[i] = -1;
-  for(i = 0; i != windowsize; ++i) hash->val[i] = -1;
-  for(i = 0; i != windowsize; ++i) hash->chain[i] = i; /*same value as index indicates uninitialized*/
-
-  for(i = 0; i <= MAX_SUPPORTED_DEFLATE_LENGTH; ++i) hash->headz[i] = -1;
-  for(i = 0; i != windowsize; ++i) hash->chainz[i] = i; /*same value as index indicates uninitialized*/
-
+  hash_reset(hash);
   return 0;
 }
 
 static void hash_cleanup(Hash* hash)
 {
-  lodepng_free(hash->head);
-  lodepng_free(hash->val);
-  lodepng_free(hash->chain);
+  lodepng_allocator_free(hash->allocator, hash->head, sizeof(int) * HASH_NUM_VALUES);
+  lodepng_allocator_free(hash->allocator, hash->val, sizeof(int) * hash->windowsize);
+  lodepng_allocator_free(hash->allocator, hash->chain, sizeof(unsigned short) * hash->windowsize);
+  lodepng_allocator_free(hash->allocator, hash->head3, sizeof(int) * HASH_NUM_VALUES * HASH3_BUCKET_SIZE);
+  uivector_cleanup(&hash->lz77);
+}
 
-  lodepng_free(hash->zeros);
-  lodepng_free(hash->headz);
-  lodepng_free(hash->chainz);
+static void hashes_cleanup(Hash* hashes, unsigned numhashes, const LodePNGAllocator* allocator)
+{
+  unsigned i;
+  for(i = 0; i != numhashes; ++i) hash_cleanup(&hashes[i]);
+  lodepng_allocator_free(allocator, hashes, sizeof(Hash) * numhashes);
 }
 
+/*
+Grows the array of hash tables in *hashes to at least count, one for each thread deflating, all
+initialized with windowsize. *numhashes is their amount, and 0 for an empty array. The hash tables
+already there are kept if they have this windowsize, otherwise they are all replaced.
+*/
+static unsigned hashes_reserve(Hash** hashes, unsigned* numhashes, unsigned count, unsigned windowsize,
+                               const LodePNGAllocator* allocator)
+{
+  Hash* grown;
+  unsigned i, error = 0;
 
+  if(*numhashes != 0 && (*hashes)[0].windowsize != windowsize)
+  {
+    hashes_cleanup(*hashes, *numhashes, allocator);
+    *hashes = 0;
+    *numhashes = 0;
+  }
+  if(*numhashes >= count) return 0;
 
-static unsigned getHash(const unsigned char* data, size_t size, size_t pos)
-{
-  unsigned result = 0;
-  if(pos + 2 < size)
+  grown = (Hash*)lodepng_allocator_realloc(allocator, *hashes, sizeof(Hash) * *numhashes, sizeof(Hash) * count);
+  if(!grown) return 83; /*alloc fail, the old array is still there*/
+  for(i = *numhashes; i != count && !error; ++i) error = hash_init(&grown[i], windowsize, allocator);
+  if(error)
   {
-    /*A simple shift and xor hash is used. Since the data of PNGs is dominated
-    by zeroes due to the filters, a better hash does not have a significant
-    effect on speed in traversing the chain, and causes more time spend on
-    calculating the hash.*/
-    result ^= (unsigned)(data[pos + 0] << 0u);
-    result ^= (unsigned)(data[pos + 1] << 4u);
-    result ^= (unsigned)(data[pos + 2] << 8u);
-  } else {
-    size_t amount, i;
-    if(pos >= size) return 0;
-    amount = size - pos;
-    for(i = 0; i != amount; ++i) result ^= (unsigned)(data[pos + i] << (i * 8u));
+    /*also the failed one, up to i, must be cleaned up*/
+    unsigned j;
+    for(j = 0; j != i; ++j) hash_cleanup(&grown[j]);
+    lodepng_allocator_free(allocator, grown, sizeof(Hash) * count);
+    *hashes = 0;
+    *numhashes = 0;
+    return error;
   }
-  return result & HASH_BIT_MASK;
+  *hashes = grown;
+  *numhashes = count;
+  return 0;
 }
 
-static unsigned countZeros(const unsigned char* data, size_t size, size_t pos)
+/*hash of the 4 bytes at data, the caller checks that there are 4*/
+static unsigned getHash(const unsigned char* data)
 {
-  const unsigned char* start = data + pos;
-  const unsigned char* end = start + MAX_SUPPORTED_DEFLATE_LENGTH;
-  if(end > data + size) end = data + size;
-  data = start;
-  while(data != end && *data == 0) ++data;
-  /*subtracting two addresses returned as 32-bit number (max value is MAX_SUPPORTED_DEFLATE_LENGTH)*/
-  return (unsigned)(data - start);
+  unsigned v = data[0] | ((unsigned)data[1] << 8) | ((unsigned)data[2] << 16) | ((unsigned)data[3] << 24);
+  return ((v * 2654435761u) & 0xffffffffu) >> (32 - HASH_BITS);
 }
 
-/*wpos = pos & (windowsize - 1)*/
-static void updateHashChain(Hash* hash, size_t wpos, unsigned hashval, unsigned short numzeros)
+/*hash of the 3 bytes at data, the caller checks that there are 3*/
+static unsigned getHash3(const unsigned char* data)
 {
-  hash->val[wpos] = (int)hashval;
-  if(hash->head[hashval] != -1) hash->chain[wpos] = hash->head[hashval];
-  hash->head[hashval] = wpos;
+  unsigned v = data[0] | ((unsigned)data[1] << 8) | ((unsigned)data[2] << 16);
+  return ((v * 2654435761u) & 0xffffffffu) >> (32 - HASH_BITS);
+}
 
-  hash->zeros[wpos] = numzeros;
-  if(hash->headz[numzeros] != -1) hash->chainz[wpos] = hash->headz[numzeros];
-  hash->headz[numzeros] = wpos;
+/*puts position pos in the hash table, size is where the input ends*/
+static void updateHashChain(Hash* hash, const unsigned char* in, size_t pos, size_t size, unsigned windowsize)
+{
+  int wpos = (int)(pos & (windowsize - 1));
+  if(pos + 3 <= size)
+  {
+    int* bucket = &hash->head3[getHash3(&in[pos]) * HASH3_BUCKET_SIZE];
+    unsigned i;
+    for(i = HASH3_BUCKET_SIZE - 1; i != 0; --i) bucket[i] = bucket[i - 1];
+    bucket[0] = wpos;
+  }
+  if(pos + 4 <= size)
+  {
+    unsigned hashval = getHash(&in[pos]);
+    hash->val[wpos] = (int)hashval;
+    if(hash->head[hashval] != -1) hash->chain[wpos] = hash->head[hashval];
+    hash->head[hashval] = wpos;
+  }
+  else hash->val[wpos] = -1; /*ends the chains that still lead to this position*/
 }
 
-/*
-LZ77-encode the data. Return value is error code. The input are raw bytes, the output
-is in the form of unsigned integers with codes representing for example literal bytes, or
-length/distance pairs.
+/*amount of equal bytes at fore and back, up to foreend*/
+static unsigned matchLength(const unsigned char* fore, const unsigned char* back, const unsigned char* foreend)
+{
+  const unsigned char* start = fore;
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+  /*compare 8 bytes at once, the lowest set bit of the xor is the first difference*/
+  while(foreend - fore >= 8)
+  {
+    unsigned long long a, b;
+    memcpy(&a, fore, 8);
+    memcpy(&b, back, 8);
+    if(a != b) return (unsigned)(fore - start) + (unsigned)__builtin_ctzll(a ^ b) / 8;
+    fore += 8;
+    back += 8;
+  }
+#endif /*little endian gcc or clang*/
+  while(fore != foreend && *fore == *back)
+  {
+    ++fore;
+    ++back;
+  }
+  return (unsigned)(fore - start);
+}
+
+/*
+Finds the longest match for position pos among the positions in the hash table, which must not contain
+pos itself yet. Sets length to 0 if there is none of at least 3 bytes.
+*/
+static void findLongestMatch(unsigned* length, unsigned* offset, Hash* hash, const unsigned char* in,
+                             size_t pos, size_t size, unsigned windowsize,
+                             unsigned maxchainlength, unsigned nicematch)
+{
+  unsigned wpos = (unsigned)(pos & (windowsize - 1));
+  const unsigned char* foreptr = &in[pos];
+  const unsigned char* lastptr = &in[size < pos + MAX_SUPPORTED_DEFLATE_LENGTH ? size : pos + MAX_SUPPORTED_DEFLATE_LENGTH];
+  unsigned maxlength = (unsigned)(lastptr - foreptr);
+  unsigned current_offset, current_length, prev_offset;
+  unsigned chainlength = 0;
+  unsigned i, hashval, run, shift;
+  int hashpos;
+
+  *length = 0;
+  *offset = 0;
+  if(maxlength < 3) return;
+
+  /*the bucket of 3 byte matches, which the 4 byte chains below cannot find*/
+  for(i = 0; i != HASH3_BUCKET_SIZE; ++i)
+  {
+    hashpos = hash->head3[getHash3(foreptr) * HASH3_BUCKET_SIZE + i];
+    if(hashpos == -1) break;
+    current_offset = (wpos - (unsigned)hashpos) & (windowsize - 1);
+    if(current_offset == 0) continue;
+    current_length = matchLength(foreptr, foreptr - current_offset, lastptr);
+    if(current_length > *length)
+    {
+      *length = current_length;
+      *offset = current_offset;
+    }
+  }
+  if(maxlength < 4 || *length >= nicematch || *length == maxlength) return;
+
+  hashval = getHash(foreptr);
+  run = matchLength(foreptr + 1, foreptr, lastptr) + 1;
+  if(run >= 4)
+  {
+    /*in a run of one byte, the chain holds every position of every recent run of that byte, which in filtered
+    PNG data is most of the window. A match as long as the run comes from the byte before, or from the end of
+    the most recent run of the same byte, which is 4 bytes after the head of the chain.*/
+    current_offset = 0;
+    if(pos > 0 && foreptr[-1] == foreptr[0]) current_offset = 1;
+    else if(hash->head[hashval] != -1 && hash->val[hash->head[hashval]] == (int)hashval)
+    {
+      current_offset = ((wpos - (unsigned)hash->head[hashval]) & (windowsize - 1)) - 4 + run;
+      if(current_offset >= windowsize || current_offset > pos) current_offset = 0;
+    }
+    if(current_offset != 0)
+    {
+      current_length = matchLength(foreptr, foreptr - current_offset, lastptr);
+      if(current_length > *length)
+      {
+        *length = current_length;
+        *offset = current_offset;
+      }
+    }
+    if(run == maxlength || *length >= nicematch || *length == maxlength) return;
+
+    /*a longer match also has the byte after the run, so it is in the much shorter chain of the last 3 bytes
+    of the run and the byte after it, at the same offset*/
+    shift = run - 3;
+    wpos = (wpos + shift) & (windowsize - 1);
+    hashval = getHash(foreptr + shift);
+  }
+  else shift = 0;
+
+  /*search for the longest string*/
+  hashpos = hash->head[hashval];
+  prev_offset = 0;
+  /*the val check stops at outdated hash values, which happen if a value was not encountered in the whole last window*/
+  while(hashpos != -1 && hash->val[hashpos] == (int)hashval && chainlength++ < maxchainlength)
+  {
+    current_offset = (wpos - (unsigned)hashpos) & (windowsize - 1);
+    /*stop at the position a whole window back, and when went completely around the circular buffer. In a run,
+    offsets up to the shift would be positions that are not in the table yet.*/
+    if(current_offset <= shift || current_offset < prev_offset) break;
+    prev_offset = current_offset;
+    /*a longer match must at least have the byte after the longest one so far in common*/
+    if(current_offset <= pos && foreptr[*length] == (foreptr - current_offset)[*length])
+    {
+      current_length = matchLength(foreptr, foreptr - current_offset, lastptr);
+      if(current_length > *length)
+      {
+        *length = current_length; /*the longest length*/
+        *offset = current_offset; /*the offset that is related to this longest length*/
+        /*jump out once a length of max length is found (speed gain). This also jumps
+        out if length is MAX_SUPPORTED_DEFLATE_LENGTH*/
+        if(current_length >= nicematch || current_length == maxlength) break;
+      }
+    }
+
+    if(hashpos == hash->chain[hashpos]) break;
+    hashpos = hash->chain[hashpos];
+  }
+}
+
+/*
+LZ77-encode the data. Return value is error code. The input are raw bytes, the output
+is in the form of unsigned integers with codes representing for example literal bytes, or
+length/distance pairs.
 It uses a hash table technique to let it encode faster. When doing LZ77 encoding, a
 sliding window (of windowsize) is used, and all past bytes in that window can be used as
 the "dictionary". A brute force search through all possible distances would be slow, and
@@ -1473,114 +2151,30 @@ this hash technique is one out of several ways to speed this up.
 */
 static unsigned encodeLZ77(uivector* out, Hash* hash,
                            const unsigned char* in, size_t inpos, size_t insize, unsigned windowsize,
-                           unsigned minmatch, unsigned nicematch, unsigned lazymatching)
+                           unsigned minmatch, unsigned nicematch, unsigned lazymatching, unsigned maxchainlength)
 {
   size_t pos;
+  size_t hashed = inpos; /*the first position that is not in the hash table yet*/
   unsigned i, error = 0;
-  /*for large window lengths, assume the user wants no compression loss. Otherwise, max hash chain length speedup.*/
-  unsigned maxchainlength = windowsize >= 8192 ? windowsize : windowsize / 8;
   unsigned maxlazymatch = windowsize >= 8192 ? MAX_SUPPORTED_DEFLATE_LENGTH : 64;
 
-  unsigned usezeros = 1; /*not sure if setting it to false for windowsize < 8192 is better or worse*/
-  unsigned numzeros = 0;
-
   unsigned offset; /*the offset represents the distance in LZ77 terminology*/
   unsigned length;
   unsigned lazy = 0;
   unsigned lazylength = 0, lazyoffset = 0;
-  unsigned hashval;
-  unsigned current_offset, current_length;
-  unsigned prev_offset;
-  const unsigned char *lastptr, *foreptr, *backptr;
-  unsigned hashpos;
 
   if(windowsize == 0 || windowsize > 32768) return 60; /*error: windowsize smaller/larger than allowed*/
   if((windowsize & (windowsize - 1)) != 0) return 90; /*error: must be power of two*/
 
   if(nicematch > MAX_SUPPORTED_DEFLATE_LENGTH) nicematch = MAX_SUPPORTED_DEFLATE_LENGTH;
+  /*for large window lengths, assume the user wants no compression loss. Otherwise, max hash chain length speedup.*/
+  if(maxchainlength == 0) maxchainlength = windowsize >= 8192 ? windowsize : windowsize / 8;
 
   for(pos = inpos; pos < insize; ++pos)
   {
-    size_t wpos = pos & (windowsize - 1); /*position for in 'circular' hash buffers*/
-    unsigned chainlength = 0;
-
-    hashval = getHash(in, insize, pos);
-
-    if(usezeros && hashval == 0)
-    {
-      if(numzeros == 0) numzeros = countZeros(in, insize, pos);
-      else if(pos + numzeros > insize || in[pos + numzeros - 1] != 0) --numzeros;
-    }
-    else
-    {
-      numzeros = 0;
-    }
-
-    updateHashChain(hash, wpos, hashval, numzeros);
-
     /*the length and offset found for the current position*/
-    length = 0;
-    offset = 0;
-
-    hashpos = hash->chain[wpos];
-
-    lastptr = &in[insize < pos + MAX_SUPPORTED_DEFLATE_LENGTH ? insize : pos + MAX_SUPPORTED_DEFLATE_LENGTH];
-
-    /*search for the longest string*/
-    prev_offset = 0;
-    for(;;)
-    {
-      if(chainlength++ >= maxchainlength) break;
-      current_offset = hashpos <= wpos ? wpos - hashpos : wpos - hashpos + windowsize;
-
-      if(current_offset < prev_offset) break; /*stop when went completely around the circular buffer*/
-      prev_offset = current_offset;
-      if(current_offset > 0)
-      {
-        /*test the next characters*/
-        foreptr = &in[pos];
-        backptr = &in[pos - current_offset];
-
-        /*common case in PNGs is lots of zeros. Quickly skip over them as a speedup*/
-        if(numzeros >= 3)
-        {
-          unsigned skip = hash->zeros[hashpos];
-          if(skip > numzeros) skip = numzeros;
-          backptr += skip;
-          foreptr += skip;
-        }
-
-        while(foreptr != lastptr && *backptr == *foreptr) /*maximum supported length by deflate is max length*/
-        {
-          ++backptr;
-          ++foreptr;
-        }
-        current_length = (unsigned)(foreptr - &in[pos]);
-
-        if(current_length > length)
-        {
-          length = current_length; /*the longest length*/
-          offset = current_offset; /*the offset that is related to this longest length*/
-          /*jump out once a length of max length is found (speed gain). This also jumps
-          out if length is MAX_SUPPORTED_DEFLATE_LENGTH*/
-          if(current_length >= nicematch) break;
-        }
-      }
-
-      if(hashpos == hash->chain[hashpos]) break;
-
-      if(numzeros >= 3 && length > numzeros)
-      {
-        hashpos = hash->chainz[hashpos];
-        if(hash->zeros[hashpos] != numzeros) break;
-      }
-      else
-      {
-        hashpos = hash->chain[hashpos];
-        /*outdated hash value, happens if particular value was not encountered in whole last window*/
-        if(hash->val[hashpos] != (int)hashval) break;
-      }
-    }
+    findLongestMatch(&length, &offset, hash, in, pos, insize, windowsize, maxchainlength, nicematch);
+    if(hashed == pos) updateHashChain(hash, in, hashed++, insize, windowsize);
 
     if(lazymatching)
     {
@@ -1604,9 +2198,7 @@ static unsigned encodeLZ77(uivector* out, Hash* hash,
         {
           length = lazylength;
           offset = lazyoffset;
-          hash->head[hashval] = -1; /*the same hashchain update will be done, this ensures no wrong alteration*/
-          hash->headz[numzeros] = -1; /*idem*/
-          --pos;
+          --pos; /*pos is in the hash table already, the loop below skips it*/
         }
       }
     }
@@ -1629,18 +2221,7 @@ static unsigned encodeLZ77(uivector* out, Hash* hash,
       for(i = 1; i < length; ++i)
       {
         ++pos;
-        wpos = pos & (windowsize - 1);
-        hashval = getHash(in, insize, pos);
-        if(usezeros && hashval == 0)
-        {
-          if(numzeros == 0) numzeros = countZeros(in, insize, pos);
-          else if(pos + numzeros > insize || in[pos + numzeros - 1] != 0) --numzeros;
-        }
-        else
-        {
-          numzeros = 0;
-        }
-        updateHashChain(hash, wpos, hashval, numzeros);
+        if(hashed == pos) updateHashChain(hash, in, hashed++, insize, windowsize);
       }
     }
   } /*end of the loop through each character of input*/
@@ -1648,21 +2229,69 @@ static unsigned encodeLZ77(uivector* out, Hash* hash,
   return error;
 }
 
+/*
+LZ77-encodes the data with LDS_RLE: only runs of the same byte as the one before are encoded, as
+length/distance pairs with distance 1. The byte before inpos is used if there is one.
+*/
+static unsigned encodeRLE(uivector* out, const unsigned char* in, size_t inpos, size_t insize, unsigned minmatch)
+{
+  size_t pos = inpos;
+  if(minmatch < 3) minmatch = 3;
+  while(pos < insize)
+  {
+    unsigned length = 0;
+    if(pos > 0)
+    {
+      const unsigned char* lastptr = &in[insize - pos < MAX_SUPPORTED_DEFLATE_LENGTH ?
+                                         insize : pos + MAX_SUPPORTED_DEFLATE_LENGTH];
+      length = matchLength(&in[pos], &in[pos - 1], lastptr);
+    }
+    if(length >= minmatch)
+    {
+      addLengthDistance(out, length, 1);
+      pos += length;
+    }
+    else
+    {
+      if(!uivector_push_back(out, in[pos])) return 83; /*alloc fail*/
+      ++pos;
+    }
+  }
+  return 0;
+}
+
+/*whether the settings ask for any LZ77 matching at all*/
+static unsigned useLZ77(const LodePNGCompressSettings* settings)
+{
+  return settings->use_lz77 && settings->strategy != LDS_HUFFMAN_ONLY;
+}
+
+/*LZ77-encodes in[inpos, insize) with the strategy of the settings, for which useLZ77 must be true*/
+static unsigned encodeLZ77Strategy(uivector* out, Hash* hash, const unsigned char* in, size_t inpos, size_t insize,
+                                   const LodePNGCompressSettings* settings)
+{
+  if(settings->strategy == LDS_RLE) return encodeRLE(out, in, inpos, insize, settings->minmatch);
+  return encodeLZ77(out, hash, in, inpos, insize, settings->windowsize, settings->minmatch,
+                    settings->nicematch, settings->lazymatching, settings->maxchainlength);
+}
+
 /* /////////////////////////////////////////////////////////////////////////// */
 
-static unsigned deflateNoCompression(ucvector* out, const unsigned char* data, size_t datasize)
+/*final: whether the last block written gets BFINAL set, otherwise more blocks follow*/
+static unsigned deflateNoCompression(ucvector* out, const unsigned char* data, size_t datasize, unsigned final)
 {
   /*non compressed deflate block data: 1 bit BFINAL,2 bits BTYPE,(5 bits): it jumps to start of next byte,
   2 bytes LEN, 2 bytes NLEN, LEN bytes literal DATA*/
 
   size_t i, j, numdeflateblocks = (datasize + 65534) / 65535;
   unsigned datapos = 0;
+  if(numdeflateblocks == 0 && final) numdeflateblocks = 1; /*empty input still needs a final block*/
   for(i = 0; i != numdeflateblocks; ++i)
   {
     unsigned BFINAL, BTYPE, LEN, NLEN;
     unsigned char firstbyte;
 
-    BFINAL = (i == numdeflateblocks - 1);
+    BFINAL = final && (i == numdeflateblocks - 1);
     BTYPE = 0;
 
     firstbyte = (unsigned char)(BFINAL + ((BTYPE & 1) << 1) + ((BTYPE & 2) << 1));
@@ -1692,14 +2321,26 @@ write the lz77-encoded data, which has lit, len and dist codes, to compressed st
 tree_ll: the tree for lit and len codes.
 tree_d: the tree for distance codes.
 */
-static void writeLZ77data(size_t* bp, ucvector* out, const uivector* lz77_encoded,
+static void writeLZ77data(BitWriter* writer, const uivector* lz77_encoded,
                           const HuffmanTree* tree_ll, const HuffmanTree* tree_d)
 {
+  /*the codes are reversed once per block rather than once per symbol*/
+  unsigned codes_ll[NUM_DEFLATE_CODE_SYMBOLS];
+  unsigned codes_d[NUM_DISTANCE_SYMBOLS];
   size_t i = 0;
+  for(i = 0; i != tree_ll->numcodes; ++i)
+  {
+    codes_ll[i] = reverseBits(HuffmanTree_getCode(tree_ll, (unsigned)i), HuffmanTree_getLength(tree_ll, (unsigned)i));
+  }
+  for(i = 0; i != tree_d->numcodes; ++i)
+  {
+    codes_d[i] = reverseBits(HuffmanTree_getCode(tree_d, (unsigned)i), HuffmanTree_getLength(tree_d, (unsigned)i));
+  }
+
   for(i = 0; i != lz77_encoded->size; ++i)
   {
     unsigned val = lz77_encoded->data[i];
-    addHuffmanSymbol(bp, out, HuffmanTree_getCode(tree_ll, val), HuffmanTree_getLength(tree_ll, val));
+    addBits(writer, codes_ll[val], HuffmanTree_getLength(tree_ll, val));
     if(val > 256) /*for a length code, 3 more things have to be added*/
     {
       unsigned length_index = val - FIRST_LENGTH_CODE_INDEX;
@@ -1712,10 +2353,9 @@ static void writeLZ77data(size_t* bp, ucvector* out, const uivector* lz77_encode
       unsigned n_distance_extra_bits = DISTANCEEXTRA[distance_index];
       unsigned distance_extra_bits = lz77_encoded->data[++i];
 
-      addBitsToStream(bp, out, length_extra_bits, n_length_extra_bits);
-      addHuffmanSymbol(bp, out, HuffmanTree_getCode(tree_d, distance_code),
-                       HuffmanTree_getLength(tree_d, distance_code));
-      addBitsToStream(bp, out, distance_extra_bits, n_distance_extra_bits);
+      addBits(writer, length_extra_bits, n_length_extra_bits);
+      addBits(writer, codes_d[distance_code], HuffmanTree_getLength(tree_d, distance_code));
+      addBits(writer, distance_extra_bits, n_distance_extra_bits);
     }
   }
 }
@@ -1739,7 +2379,7 @@ static unsigned deflateDynamic(ucvector* out, size_t* bp, Hash* hash,
   */
 
   /*The lz77 encoded data, represented with integers since there will also be length and distance codes in it*/
-  uivector lz77_encoded;
+  uivector* lz77_encoded = &hash->lz77;
   HuffmanTree tree_ll; /*tree for lit,len values*/
   HuffmanTree tree_d; /*tree for distance codes*/
   HuffmanTree tree_cl; /*tree for encoding the code lengths representing tree_ll and tree_d*/
@@ -1762,10 +2402,11 @@ static unsigned deflateDynamic(ucvector* out, size_t* bp, Hash* hash,
   */
 
   unsigned BFINAL = final;
-  size_t numcodes_ll, numcodes_d, i;
+  size_t numcodes_ll, numcodes_d, i, databits;
   unsigned HLIT, HDIST, HCLEN;
+  BitWriter writer;
 
-  uivector_init(&lz77_encoded);
+  lz77_encoded->size = 0;
   HuffmanTree_init(&tree_ll);
   HuffmanTree_init(&tree_d);
   HuffmanTree_init(&tree_cl);
@@ -1780,29 +2421,28 @@ static unsigned deflateDynamic(ucvector* out, size_t* bp, Hash* hash,
   allow breaking out of it to the cleanup phase on error conditions.*/
   while(!error)
   {
-    if(settings->use_lz77)
+    if(useLZ77(settings))
     {
-      error = encodeLZ77(&lz77_encoded, hash, data, datapos, dataend, settings->windowsize,
-                         settings->minmatch, settings->nicematch, settings->lazymatching);
+      error = encodeLZ77Strategy(lz77_encoded, hash, data, datapos, dataend, settings);
       if(error) break;
     }
     else
     {
-      if(!uivector_resize(&lz77_encoded, datasize)) ERROR_BREAK(83 /*alloc fail*/);
-      for(i = datapos; i < dataend; ++i) lz77_encoded.data[i - datapos] = data[i]; /*no LZ77, but still will be Huffman compressed*/
+      if(!uivector_resize(lz77_encoded, datasize)) ERROR_BREAK(83 /*alloc fail*/);
+      for(i = datapos; i < dataend; ++i) lz77_encoded->data[i - datapos] = data[i]; /*no LZ77, but still will be Huffman compressed*/
     }
 
     if(!uivector_resizev(&frequencies_ll, 286, 0)) ERROR_BREAK(83 /*alloc fail*/);
     if(!uivector_resizev(&frequencies_d, 30, 0)) ERROR_BREAK(83 /*alloc fail*/);
 
     /*Count the frequencies of lit, len and dist codes*/
-    for(i = 0; i != lz77_encoded.size; ++i)
+    for(i = 0; i != lz77_encoded->size; ++i)
     {
-      unsigned symbol = lz77_encoded.data[i];
+      unsigned symbol = lz77_encoded->data[i];
       ++frequencies_ll.data[symbol];
       if(symbol > 256)
       {
-        unsigned dist = lz77_encoded.data[i + 2];
+        unsigned dist = lz77_encoded->data[i + 2];
         ++frequencies_d.data[dist];
         i += 3;
       }
@@ -1911,10 +2551,24 @@ static unsigned deflateDynamic(ucvector* out, size_t* bp, Hash* hash,
     - 256 (end code)
     */
 
+    /*the size of the compressed data is known from the trees, so the output is allocated once. The header
+    is at most 17 bits, 19 code length code lengths and 14 bits per repeat coded code length.*/
+    databits = 0;
+    for(i = 0; i != numcodes_ll; ++i)
+    {
+      databits += frequencies_ll.data[i] * (size_t)HuffmanTree_getLength(&tree_ll, (unsigned)i);
+      if(i > 256) databits += frequencies_ll.data[i] * (size_t)LENGTHEXTRA[i - FIRST_LENGTH_CODE_INDEX];
+    }
+    for(i = 0; i != numcodes_d; ++i)
+    {
+      databits += frequencies_d.data[i] * (size_t)(HuffmanTree_getLength(&tree_d, (unsigned)i) + DISTANCEEXTRA[i]);
+    }
+    BitWriter_init(&writer, out, bp);
+    BitWriter_reserve(&writer, (databits + 17 + 19 * 3 + bitlen_lld_e.size * 14) / 8 + 8);
+
     /*Write block type*/
-    addBitToStream(bp, out, BFINAL);
-    addBitToStream(bp, out, 0); /*first bit of BTYPE "dynamic"*/
-    addBitToStream(bp, out, 1); /*second bit of BTYPE "dynamic"*/
+    addBits(&writer, BFINAL, 1);
+    addBits(&writer, 2, 2); /*BTYPE "dynamic", its first bit is 0 and second bit 1*/
 
     /*write the HLIT, HDIST and HCLEN values*/
     HLIT = (unsigned)(numcodes_ll - 257);
@@ -1922,37 +2576,37 @@ static unsigned deflateDynamic(ucvector* out, size_t* bp, Hash* hash,
     HCLEN = (unsigned)bitlen_cl.size - 4;
     /*trim zeroes for HCLEN. HLIT and HDIST were already trimmed at tree creation*/
     while(!bitlen_cl.data[HCLEN + 4 - 1] && HCLEN > 0) --HCLEN;
-    addBitsToStream(bp, out, HLIT, 5);
-    addBitsToStream(bp, out, HDIST, 5);
-    addBitsToStream(bp, out, HCLEN, 4);
+    addBits(&writer, HLIT, 5);
+    addBits(&writer, HDIST, 5);
+    addBits(&writer, HCLEN, 4);
 
     /*write the code lenghts of the code length alphabet*/
-    for(i = 0; i != HCLEN + 4; ++i) addBitsToStream(bp, out, bitlen_cl.data[i], 3);
+    for(i = 0; i != HCLEN + 4; ++i) addBits(&writer, bitlen_cl.data[i], 3);
 
     /*write the lenghts of the lit/len AND the dist alphabet*/
     for(i = 0; i != bitlen_lld_e.size; ++i)
     {
-      addHuffmanSymbol(bp, out, HuffmanTree_getCode(&tree_cl, bitlen_lld_e.data[i]),
+      addHuffmanSymbol(&writer, HuffmanTree_getCode(&tree_cl, bitlen_lld_e.data[i]),
                        HuffmanTree_getLength(&tree_cl, bitlen_lld_e.data[i]));
       /*extra bits of repeat codes*/
-      if(bitlen_lld_e.data[i] == 16) addBitsToStream(bp, out, bitlen_lld_e.data[++i], 2);
-      else if(bitlen_lld_e.data[i] == 17) addBitsToStream(bp, out, bitlen_lld_e.data[++i], 3);
-      else if(bitlen_lld_e.data[i] == 18) addBitsToStream(bp, out, bitlen_lld_e.data[++i], 7);
+      if(bitlen_lld_e.data[i] == 16) addBits(&writer, bitlen_lld_e.data[++i], 2);
+      else if(bitlen_lld_e.data[i] == 17) addBits(&writer, bitlen_lld_e.data[++i], 3);
+      else if(bitlen_lld_e.data[i] == 18) addBits(&writer, bitlen_lld_e.data[++i], 7);
     }
 
     /*write the compressed data symbols*/
-    writeLZ77data(bp, out, &lz77_encoded, &tree_ll, &tree_d);
+    writeLZ77data(&writer, lz77_encoded, &tree_ll, &tree_d);
     /*error: the length of the end code 256 must be larger than 0*/
     if(HuffmanTree_getLength(&tree_ll, 256) == 0) ERROR_BREAK(64);
 
     /*write the end code*/
-    addHuffmanSymbol(bp, out, HuffmanTree_getCode(&tree_ll, 256), HuffmanTree_getLength(&tree_ll, 256));
+    addHuffmanSymbol(&writer, HuffmanTree_getCode(&tree_ll, 256), HuffmanTree_getLength(&tree_ll, 256));
+    error = BitWriter_finish(&writer);
 
     break; /*end of error-while*/
   }
 
   /*cleanup*/
-  uivector_cleanup(&lz77_encoded);
   HuffmanTree_cleanup(&tree_ll);
   HuffmanTree_cleanup(&tree_d);
   HuffmanTree_cleanup(&tree_cl);
@@ -1977,6 +2631,7 @@ static unsigned deflateFixed(ucvector* out, size_t* bp, Hash* hash,
   unsigned BFINAL = final;
   unsigned error = 0;
   size_t i;
+  BitWriter writer;
 
   HuffmanTree_init(&tree_ll);
   HuffmanTree_init(&tree_d);
@@ -1984,28 +2639,30 @@ static unsigned deflateFixed(ucvector* out, size_t* bp, Hash* hash,
   generateFixedLitLenTree(&tree_ll);
   generateFixedDistanceTree(&tree_d);
 
-  addBitToStream(bp, out, BFINAL);
-  addBitToStream(bp, out, 1); /*first bit of BTYPE*/
-  addBitToStream(bp, out, 0); /*second bit of BTYPE*/
+  BitWriter_init(&writer, out, bp);
+  addBits(&writer, BFINAL, 1);
+  addBits(&writer, 1, 2); /*BTYPE "fixed", its first bit is 1 and second bit 0*/
 
-  if(settings->use_lz77) /*LZ77 encoded*/
+  if(useLZ77(settings)) /*LZ77 encoded*/
   {
-    uivector lz77_encoded;
-    uivector_init(&lz77_encoded);
-    error = encodeLZ77(&lz77_encoded, hash, data, datapos, dataend, settings->windowsize,
-                       settings->minmatch, settings->nicematch, settings->lazymatching);
-    if(!error) writeLZ77data(bp, out, &lz77_encoded, &tree_ll, &tree_d);
-    uivector_cleanup(&lz77_encoded);
+    uivector* lz77_encoded = &hash->lz77;
+    lz77_encoded->size = 0;
+    error = encodeLZ77Strategy(lz77_encoded, hash, data, datapos, dataend, settings);
+    /*fixed codes take at most 9 bits per literal and 31 bits per length-distance pair of 4 values*/
+    if(!error) BitWriter_reserve(&writer, lz77_encoded->size * 9 / 8 + 8);
+    if(!error) writeLZ77data(&writer, lz77_encoded, &tree_ll, &tree_d);
   }
   else /*no LZ77, but still will be Huffman compressed*/
   {
+    BitWriter_reserve(&writer, (dataend - datapos) * 9 / 8 + 8);
     for(i = datapos; i < dataend; ++i)
     {
-      addHuffmanSymbol(bp, out, HuffmanTree_getCode(&tree_ll, data[i]), HuffmanTree_getLength(&tree_ll, data[i]));
+      addHuffmanSymbol(&writer, HuffmanTree_getCode(&tree_ll, data[i]), HuffmanTree_getLength(&tree_ll, data[i]));
     }
   }
   /*add END code*/
-  if(!error) addHuffmanSymbol(bp, out, HuffmanTree_getCode(&tree_ll, 256), HuffmanTree_getLength(&tree_ll, 256));
+  if(!error) addHuffmanSymbol(&writer, HuffmanTree_getCode(&tree_ll, 256), HuffmanTree_getLength(&tree_ll, 256));
+  if(!error) error = BitWriter_finish(&writer);
 
   /*cleanup*/
   HuffmanTree_cleanup(&tree_ll);
@@ -2014,30 +2671,189 @@ static unsigned deflateFixed(ucvector* out, size_t* bp, Hash* hash,
   return error;
 }
 
+/*size of the dynamic deflate blocks that insize bytes of data are split into*/
+static size_t getDeflateBlockSize(size_t insize)
+{
+  /*on PNGs, deflate blocks of 65-262k seem to give most dense encoding*/
+  size_t blocksize = insize / 8 + 8;
+  if(blocksize < 65536) blocksize = 65536;
+  if(blocksize > 262144) blocksize = 262144;
+  return blocksize;
+}
+
+#ifdef LODEPNG_COMPILE_THREADS
+
+/*puts the positions [start, end) in the hash chains without encoding them, so LZ77 can refer back to them*/
+static void hashPrime(Hash* hash, const unsigned char* in, size_t start, size_t end, unsigned windowsize)
+{
+  size_t pos;
+  for(pos = start; pos < end; ++pos) updateHashChain(hash, in, pos, end, windowsize);
+}
+
+/*one chunk of a parallel deflate, compressed by one thread*/
+typedef struct DeflateChunk
+{
+  ucvector out; /*the chunk as deflate blocks, ending on a byte boundary unless it is the final one*/
+  unsigned adler; /*adler32 of the uncompressed chunk*/
+  unsigned error;
+} DeflateChunk;
+
+typedef struct DeflateChunks
+{
+  const unsigned char* in;
+  size_t start, end, chunksize;
+  unsigned final;
+  const LodePNGCompressSettings* settings;
+  Hash* hashes; /*a hash table per thread, or NULL to allocate one per chunk*/
+  DeflateChunk* chunks;
+} DeflateChunks;
+
+static void deflateChunk(void* context, size_t index, unsigned thread)
+{
+  DeflateChunks* c = (DeflateChunks*)context;
+  DeflateChunk* chunk = &c->chunks[index];
+  const LodePNGCompressSettings* settings = c->settings;
+  size_t start = c->start + index * c->chunksize;
+  size_t end = start + c->chunksize;
+  unsigned final;
+  size_t bp = 0;
+  Hash localhash;
+  Hash* hash = c->hashes ? &c->hashes[thread] : &localhash;
+
+  if(end > c->end) end = c->end;
+  final = c->final && end == c->end;
+  chunk->adler = adler32(&c->in[start], (unsigned)(end - start));
+
+  if(c->hashes)
+  {
+    hash_reset(hash);
+    chunk->error = 0;
+  }
+  else chunk->error = hash_init(hash, settings->windowsize, 0);
+  if(!chunk->error)
+  {
+    /*the windowsize bytes before the chunk are its dictionary, same as when deflating on a single thread*/
+    if(useLZ77(settings) && settings->strategy == LDS_DEFAULT)
+    {
+      hashPrime(hash, c->in, start > settings->windowsize ? start - settings->windowsize : 0, start,
+                settings->windowsize);
+    }
+    if(settings->btype == 1) chunk->error = deflateFixed(&chunk->out, &bp, hash, c->in, start, end, settings, final);
+    else chunk->error = deflateDynamic(&chunk->out, &bp, hash, c->in, start, end, settings, final);
+  }
+  if(!chunk->error && !final)
+  {
+    /*sync flush: an empty non-final stored block moves to the next byte boundary, so the next chunk can
+    simply be appended. 3 header bits, padding to the byte boundary, then LEN 0 and NLEN 65535.*/
+    BitWriter writer;
+    BitWriter_init(&writer, &chunk->out, &bp);
+    addBits(&writer, 0, 3);
+    addBits(&writer, 0, (8 - writer.numbits % 8) % 8);
+    addBits(&writer, 0xffff0000u, 32);
+    chunk->error = BitWriter_finish(&writer);
+  }
+  if(hash == &localhash) hash_cleanup(hash);
+}
+
+/*
+Deflates in[start, end) as chunks of chunksize bytes, on as many threads as the settings allow, and
+appends them to out, which must end on a byte boundary. So does the result, unless final is set.
+The bytes of in before start may be used as dictionary. If adler is not NULL, it gets the adler32
+of in[start, end). hashes is NULL, or lodepng_get_num_threads(settings->numthreads) hash tables
+initialized with settings->windowsize that the threads use instead of allocating their own.
+*/
+static unsigned deflateParallel(ucvector* out, unsigned* adler, const unsigned char* in, size_t start, size_t end,
+                                size_t chunksize, unsigned final, const LodePNGCompressSettings* settings,
+                                Hash* hashes)
+{
+  DeflateChunks c;
+  size_t i, numchunks = (end - start + chunksize - 1) / chunksize;
+  unsigned error = 0;
+
+  /*checked here already since the dictionary goes in the hash chains before encodeLZ77 checks it*/
+  if(useLZ77(settings))
+  {
+    if(settings->windowsize == 0 || settings->windowsize > 32768) return 60;
+    if((settings->windowsize & (settings->windowsize - 1)) != 0) return 90;
+  }
+  if(numchunks == 0) numchunks = 1;
+
+  c.in = in;
+  c.start = start;
+  c.end = end;
+  c.chunksize = chunksize;
+  c.final = final;
+  c.settings = settings;
+  c.hashes = hashes;
+  c.chunks = (DeflateChunk*)lodepng_malloc(sizeof(DeflateChunk) * numchunks);
+  if(!c.chunks) return 83; /*alloc fail*/
+  for(i = 0; i != numchunks; ++i) ucvector_init_buffer(&c.chunks[i].out, 0, 0);
+
+  lodepng_run_parallel(deflateChunk, &c, numchunks, lodepng_get_num_threads(settings->numthreads));
+
+  if(adler) *adler = 1;
+  for(i = 0; i != numchunks; ++i)
+  {
+    DeflateChunk* chunk = &c.chunks[i];
+    size_t size = out->size;
+    if(!error) error = chunk->error;
+    if(!error && !ucvector_resize(out, size + chunk->out.size)) error = 83; /*alloc fail*/
+    if(!error) memcpy(&out->data[size], chunk->out.data, chunk->out.size);
+    if(adler)
+    {
+      size_t chunkstart = start + i * chunksize;
+      size_t chunkend = chunkstart + chunksize < end ? chunkstart + chunksize : end;
+      *adler = lodepng_adler32_combine(*adler, chunk->adler, chunkend - chunkstart);
+    }
+    lodepng_free(chunk->out.data);
+  }
+  lodepng_free(c.chunks);
+
+  return error;
+}
+
+/*whether deflating insize bytes is done by deflateParallel*/
+static unsigned useParallelDeflate(size_t insize, const LodePNGCompressSettings* settings)
+{
+  return (settings->btype == 1 || settings->btype == 2) && lodepng_get_num_threads(settings->numthreads) > 1
+      && insize > getDeflateBlockSize(insize);
+}
+
+#endif /*LODEPNG_COMPILE_THREADS*/
+
+/*
+Appends the deflated in to out. If hash is not NULL, it is used for the LZ77 instead of allocating a hash
+table, and must have been initialized with settings->windowsize. When deflating on several threads it must
+be an array of a hash table per thread, see deflateParallel.
+*/
 static unsigned lodepng_deflatev(ucvector* out, const unsigned char* in, size_t insize,
-                                 const LodePNGCompressSettings* settings)
+                                 const LodePNGCompressSettings* settings, Hash* hash)
 {
   unsigned error = 0;
   size_t i, blocksize, numdeflateblocks;
   size_t bp = 0; /*the bit pointer*/
-  Hash hash;
+  Hash localhash;
 
   if(settings->btype > 2) return 61;
-  else if(settings->btype == 0) return deflateNoCompression(out, in, insize);
-  else if(settings->btype == 1) blocksize = insize;
-  else /*if(settings->btype == 2)*/
+  else if(settings->btype == 0) return deflateNoCompression(out, in, insize, 1);
+#ifdef LODEPNG_COMPILE_THREADS
+  else if(useParallelDeflate(insize, settings))
   {
-    /*on PNGs, deflate blocks of 65-262k seem to give most dense encoding*/
-    blocksize = insize / 8 + 8;
-    if(blocksize < 65536) blocksize = 65536;
-    if(blocksize > 262144) blocksize = 262144;
+    return deflateParallel(out, 0, in, 0, insize, getDeflateBlockSize(insize), 1, settings, hash);
   }
+#endif /*LODEPNG_COMPILE_THREADS*/
+  else if(settings->btype == 1) blocksize = insize > 0 ? insize : 1; /*one block, also for empty input*/
+  else /*if(settings->btype == 2)*/ blocksize = getDeflateBlockSize(insize);
 
   numdeflateblocks = (insize + blocksize - 1) / blocksize;
   if(numdeflateblocks == 0) numdeflateblocks = 1;
 
-  error = hash_init(&hash, settings->windowsize);
-  if(error) return error;
+  if(hash) hash_reset(hash);
+  else
+  {
+    hash = &localhash;
+    error = hash_init(hash, settings->windowsize, 0);
+  }
 
   for(i = 0; i != numdeflateblocks && !error; ++i)
   {
@@ -2046,11 +2862,11 @@ static unsigned lodepng_deflatev(ucvector* out, const unsigned char* in, size_t
     size_t end = start + blocksize;
     if(end > insize) end = insize;
 
-    if(settings->btype == 1) error = deflateFixed(out, &bp, &hash, in, start, end, settings, final);
-    else if(settings->btype == 2) error = deflateDynamic(out, &bp, &hash, in, start, end, settings, final);
+    if(settings->btype == 1) error = deflateFixed(out, &bp, hash, in, start, end, settings, final);
+    else if(settings->btype == 2) error = deflateDynamic(out, &bp, hash, in, start, end, settings, final);
   }
 
-  hash_cleanup(&hash);
+  if(hash == &localhash) hash_cleanup(hash);
 
   return error;
 }
@@ -2062,69 +2878,22 @@ unsigned lodepng_deflate(unsigned char** out, size_t* outsize,
   unsigned error;
   ucvector v;
   ucvector_init_buffer(&v, *out, *outsize);
-  error = lodepng_deflatev(&v, in, insize, settings);
+  error = lodepng_deflatev(&v, in, insize, settings, 0);
   *out = v.data;
   *outsize = v.size;
   return error;
 }
 
-static unsigned deflate(unsigned char** out, size_t* outsize,
-                        const unsigned char* in, size_t insize,
-                        const LodePNGCompressSettings* settings)
-{
-  if(settings->custom_deflate)
-  {
-    return settings->custom_deflate(out, outsize, in, insize, settings);
-  }
-  else
-  {
-    return lodepng_deflate(out, outsize, in, insize, settings);
-  }
-}
-
 #endif /*LODEPNG_COMPILE_DECODER*/
 
-/* ////////////////////////////////////////////////////////////////////////// */
-/* / Adler32                                                                  */
-/* ////////////////////////////////////////////////////////////////////////// */
-
-static unsigned update_adler32(unsigned adler, const unsigned char* data, unsigned len)
-{
-   unsigned s1 = adler & 0xffff;
-   unsigned s2 = (adler >> 16) & 0xffff;
-
-  while(len > 0)
-  {
-    /*at least 5550 sums can be done before the sums overflow, saving a lot of module divisions*/
-    unsigned amount = len > 5550 ? 5550 : len;
-    len -= amount;
-    while(amount > 0)
-    {
-      s1 += (*data++);
-      s2 += s1;
-      --amount;
-    }
-    s1 %= 65521;
-    s2 %= 65521;
-  }
-
-  return (s2 << 16) | s1;
-}
-
-/*Return the adler32 of the bytes data[0..len-1]*/
-static unsigned adler32(const unsigned char* data, unsigned len)
-{
-  return update_adler32(1L, data, len);
-}
-
 /* ////////////////////////////////////////////////////////////////////////// */
 /* / Zlib                                                                   / */
 /* ////////////////////////////////////////////////////////////////////////// */
 
 #ifdef LODEPNG_COMPILE_DECODER
 
-unsigned lodepng_zlib_decompress(unsigned char** out, size_t* outsize, const unsigned char* in,
-                                 size_t insize, const LodePNGDecompressSettings* settings)
+static unsigned lodepng_zlib_decompressv(ucvector* out, const unsigned char* in, size_t insize,
+                                         const LodePNGDecompressSettings* settings)
 {
   unsigned error = 0;
   unsigned CM, CINFO, FDICT;
@@ -2155,19 +2924,31 @@ unsigned lodepng_zlib_decompress(unsigned char** out, size_t* outsize, const uns
     return 26;
   }
 
-  error = inflate(out, outsize, in + 2, insize - 2, settings);
+  error = inflatev(out, in + 2, insize - 2, settings);
   if(error) return error;
 
   if(!settings->ignore_adler32)
   {
     unsigned ADLER32 = lodepng_read32bitInt(&in[insize - 4]);
-    unsigned checksum = adler32(*out, (unsigned)(*outsize));
+    unsigned checksum = adler32(out->data, (unsigned)(out->size));
     if(checksum != ADLER32) return 58; /*error, adler checksum not correct, data must be corrupted*/
   }
 
   return 0; /*no error*/
 }
 
+unsigned lodepng_zlib_decompress(unsigned char** out, size_t* outsize, const unsigned char* in,
+                                 size_t insize, const LodePNGDecompressSettings* settings)
+{
+  unsigned error;
+  ucvector v;
+  ucvector_init_buffer(&v, *out, *outsize);
+  error = lodepng_zlib_decompressv(&v, in, insize, settings);
+  *out = v.data;
+  *outsize = v.size;
+  return error;
+}
+
 static unsigned zlib_decompress(unsigned char** out, size_t* outsize, const unsigned char* in,
                                 size_t insize, const LodePNGDecompressSettings* settings)
 {
@@ -2181,20 +2962,39 @@ static unsigned zlib_decompress(unsigned char** out, size_t* outsize, const unsi
   }
 }
 
+#ifdef LODEPNG_COMPILE_PNG
+/*
+Decompresses into out, which the caller has initialized. If expected_size is the size of the decompressed
+data, out gets that much room up front and the default inflate never has to reallocate it.
+*/
+static unsigned zlib_decompressv(ucvector* out, size_t expected_size, const unsigned char* in,
+                                 size_t insize, const LodePNGDecompressSettings* settings)
+{
+  if(!ucvector_reserve(out, expected_size + INFLATE_OUTPUT_SLACK)) return 83; /*alloc fail*/
+  if(settings->custom_zlib)
+  {
+    unsigned error = settings->custom_zlib(&out->data, &out->size, in, insize, settings);
+    out->allocsize = out->size;
+    return error;
+  }
+  else
+  {
+    return lodepng_zlib_decompressv(out, in, insize, settings);
+  }
+}
+#endif /*LODEPNG_COMPILE_PNG*/
+
 #endif /*LODEPNG_COMPILE_DECODER*/
 
 #ifdef LODEPNG_COMPILE_ENCODER
 
-unsigned lodepng_zlib_compress(unsigned char** out, size_t* outsize, const unsigned char* in,
-                               size_t insize, const LodePNGCompressSettings* settings)
+/*appends the zlib data of in to out, hash is used like by lodepng_deflatev*/
+static unsigned lodepng_zlib_compressv(ucvector* out, const unsigned char* in, size_t insize,
+                                       const LodePNGCompressSettings* settings, Hash* hash)
 {
-  /*initially, *out must be NULL and outsize 0, if you just give some random *out
-  that's pointing to a non allocated buffer, this'll crash*/
-  ucvector outv;
-  size_t i;
   unsigned error;
-  unsigned char* deflatedata = 0;
-  size_t deflatesize = 0;
+  unsigned ADLER32 = 0;
+  size_t size;
 
   /*zlib data: 1 byte CMF (CM+CINFO), 1 byte FLG, deflate data, 4 byte ADLER32 checksum of the Decompressed data*/
   unsigned CMF = 120; /*0b01111000: CM 8, CINFO 7. With CINFO 7, any window size up to 32768 can be used.*/
@@ -2204,34 +3004,67 @@ unsigned lodepng_zlib_compress(unsigned char** out, size_t* outsize, const unsig
   unsigned FCHECK = 31 - CMFFLG % 31;
   CMFFLG += FCHECK;
 
-  /*ucvector-controlled version of the output buffer, for dynamic array*/
-  ucvector_init_buffer(&outv, *out, *outsize);
+  size = out->size;
+  if(!ucvector_resize(out, size + 2)) return 83; /*alloc fail*/
+  out->data[size + 0] = (unsigned char)(CMFFLG >> 8);
+  out->data[size + 1] = (unsigned char)(CMFFLG & 255);
 
-  ucvector_push_back(&outv, (unsigned char)(CMFFLG >> 8));
-  ucvector_push_back(&outv, (unsigned char)(CMFFLG & 255));
-
-  error = deflate(&deflatedata, &deflatesize, in, insize, settings);
-
-  if(!error)
+#ifdef LODEPNG_COMPILE_THREADS
+  if(!settings->custom_deflate && useParallelDeflate(insize, settings))
+  {
+    /*the threads compute the adler32 of their chunks along with deflating them*/
+    error = deflateParallel(out, &ADLER32, in, 0, insize, getDeflateBlockSize(insize), 1, settings, hash);
+  }
+  else
+#endif /*LODEPNG_COMPILE_THREADS*/
+  if(settings->custom_deflate)
   {
-    unsigned ADLER32 = adler32(in, (unsigned)insize);
-    for(i = 0; i != deflatesize; ++i) ucvector_push_back(&outv, deflatedata[i]);
+    unsigned char* deflatedata = 0;
+    size_t deflatesize = 0;
+    error = settings->custom_deflate(&deflatedata, &deflatesize, in, insize, settings);
+    size = out->size;
+    if(!error && !ucvector_resize(out, size + deflatesize)) error = 83; /*alloc fail*/
+    if(!error && deflatesize) memcpy(&out->data[size], deflatedata, deflatesize);
     lodepng_free(deflatedata);
-    lodepng_add32bitInt(&outv, ADLER32);
+    if(!error) ADLER32 = adler32(in, (unsigned)insize);
+  }
+  else
+  {
+    /*the deflate blocks go straight behind the header, without a copy*/
+    error = lodepng_deflatev(out, in, insize, settings, hash);
+    if(!error) ADLER32 = adler32(in, (unsigned)insize);
   }
 
-  *out = outv.data;
-  *outsize = outv.size;
+  if(!error)
+  {
+    size = out->size;
+    if(!ucvector_resize(out, size + 4)) return 83; /*alloc fail*/
+    lodepng_set32bitInt(&out->data[size], ADLER32);
+  }
 
   return error;
 }
 
-/* compress using the default or custom zlib function */
-static unsigned zlib_compress(unsigned char** out, size_t* outsize, const unsigned char* in,
-                              size_t insize, const LodePNGCompressSettings* settings)
+unsigned lodepng_zlib_compress(unsigned char** out, size_t* outsize, const unsigned char* in,
+                               size_t insize, const LodePNGCompressSettings* settings)
 {
-  if(settings->custom_zlib)
-  {
+  /*initially, *out must be NULL and outsize 0, if you just give some random *out
+  that's pointing to a non allocated buffer, this'll crash*/
+  unsigned error;
+  ucvector v;
+  ucvector_init_buffer(&v, *out, *outsize);
+  error = lodepng_zlib_compressv(&v, in, insize, settings, 0);
+  *out = v.data;
+  *outsize = v.size;
+  return error;
+}
+
+/* compress using the default or custom zlib function */
+static unsigned zlib_compress(unsigned char** out, size_t* outsize, const unsigned char* in,
+                              size_t insize, const LodePNGCompressSettings* settings)
+{
+  if(settings->custom_zlib)
+  {
     return settings->custom_zlib(out, outsize, in, insize, settings);
   }
   else
@@ -2251,6 +3084,17 @@ static unsigned zlib_decompress(unsigned char** out, size_t* outsize, const unsi
   if(!settings->custom_zlib) return 87; /*no custom zlib function provided */
   return settings->custom_zlib(out, outsize, in, insize, settings);
 }
+
+static unsigned zlib_decompressv(ucvector* out, size_t expected_size, const unsigned char* in,
+                                 size_t insize, const LodePNGDecompressSettings* settings)
+{
+  unsigned error;
+  if(!settings->custom_zlib) return 87; /*no custom zlib function provided */
+  if(!ucvector_reserve(out, expected_size)) return 83; /*alloc fail*/
+  error = settings->custom_zlib(&out->data, &out->size, in, insize, settings);
+  out->allocsize = out->size;
+  return error;
+}
 #endif /*LODEPNG_COMPILE_DECODER*/
 #ifdef LODEPNG_COMPILE_ENCODER
 static unsigned zlib_compress(unsigned char** out, size_t* outsize, const unsigned char* in,
@@ -2279,13 +3123,36 @@ void lodepng_compress_settings_init(LodePNGCompressSettings* settings)
   settings->minmatch = 3;
   settings->nicematch = 128;
   settings->lazymatching = 1;
+  settings->maxchainlength = 0;
+  settings->strategy = LDS_DEFAULT;
+  settings->numthreads = 1;
 
   settings->custom_zlib = 0;
   settings->custom_deflate = 0;
   settings->custom_context = 0;
 }
 
-const LodePNGCompressSettings lodepng_default_compress_settings = {2, 1, DEFAULT_WINDOWSIZE, 3, 128, 1, 0, 0, 0};
+const LodePNGCompressSettings lodepng_default_compress_settings = {2, 1, DEFAULT_WINDOWSIZE, 3, 128, 1, 0, LDS_DEFAULT,
+                                                                   1, 0, 0, 0};
+
+void lodepng_compress_settings_level(LodePNGCompressSettings* settings, unsigned level)
+{
+  /*maxchainlength, nicematch and lazymatching per level, level 0 only stores*/
+  static const unsigned LEVELS[10][3] = {
+    {    0,   0, 0},
+    {    4,  16, 0}, {    8,  32, 0}, {   16,  64, 0},
+    {   16,  32, 1}, {   32,  64, 1}, {   64, 128, 1},
+    {  256, 128, 1}, { 1024, 258, 1}, {32768, 258, 1}
+  };
+  if(level > 9) level = 9;
+  settings->btype = level == 0 ? 0 : 2;
+  settings->use_lz77 = 1;
+  settings->windowsize = 32768;
+  settings->minmatch = 3;
+  settings->maxchainlength = LEVELS[level][0];
+  settings->nicematch = LEVELS[level][1];
+  settings->lazymatching = LEVELS[level][2];
+}
 
 
 #endif /*LODEPNG_COMPILE_ENCODER*/
@@ -2319,8 +3186,12 @@ const LodePNGDecompressSettings lodepng_default_decompress_settings = {0, 0, 0,
 
 
 #ifndef LODEPNG_NO_COMPILE_CRC
-/* CRC polynomial: 0xedb88320 */
-static unsigned lodepng_crc32_table[256] = {
+/*
+CRC polynomial: 0xedb88320. lodepng_crc32_table[0] is the usual table to process one byte at a time,
+lodepng_crc32_table[k][n] is the CRC of byte n followed by k zero bytes, so that eight table lookups
+process eight bytes at once (slice-by-8).
+*/
+static const unsigned lodepng_crc32_table[8][256] = {{
            0u, 1996959894u, 3993919788u, 2567524794u,  124634137u, 1886057615u, 3915621685u, 2657392035u,
    249268274u, 2044508324u, 3772115230u, 2547177864u,  162941995u, 2125561021u, 3887607047u, 2428444049u,
    498536548u, 1789927666u, 4089016648u, 2227061214u,  450548861u, 1843258603u, 4107580753u, 2211677639u,
@@ -2353,16 +3224,328 @@ static unsigned lodepng_crc32_table[256] = {
   2932959818u, 3654703836u, 1088359270u,  936918000u, 2847714899u, 3736837829u, 1202900863u,  817233897u,
   3183342108u, 3401237130u, 1404277552u,  615818150u, 3134207493u, 3453421203u, 1423857449u,  601450431u,
   3009837614u, 3294710456u, 1567103746u,  711928724u, 3020668471u, 3272380065u, 1510334235u,  755167117u
-};
+}, {
+           0u,  421212481u,  842424962u,  724390851u, 1684849924u, 2105013317u, 1448781702u, 1329698503u,
+  3369699848u, 3519200073u, 4210026634u, 3824474571u, 2897563404u, 3048111693u, 2659397006u, 2274893007u,
+  1254232657u, 1406739216u, 2029285587u, 1643069842u,  783210325u,  934667796u,  479770071u,   92505238u,
+  2182846553u, 2600511768u, 2955803355u, 2838940570u, 3866582365u, 4285295644u, 3561045983u, 3445231262u,
+  2508465314u, 2359236067u, 2813478432u, 3198777185u, 4058571174u, 3908292839u, 3286139684u, 3670389349u,
+  1566420650u, 1145479147u, 1869335592u, 1987116393u,  959540142u,  539646703u,  185010476u,  303839341u,
+  3745920755u, 3327985586u, 3983561841u, 4100678960u, 3140154359u, 2721170102u, 2300350837u, 2416418868u,
+   396344571u,  243568058u,  631889529u, 1018359608u, 1945336319u, 1793607870u, 1103436669u, 1490954812u,
+  4034481925u, 3915546180u, 3259968903u, 3679722694u, 2484439553u, 2366552896u, 2787371139u, 3208174018u,
+   950060301u,  565965900u,  177645455u,  328046286u, 1556873225u, 1171730760u, 1861902987u, 2011255754u,
+  3132841300u, 2745199637u, 2290958294u, 2442530455u, 3738671184u, 3352078609u, 3974232786u, 4126854035u,
+  1919080284u, 1803150877u, 1079293406u, 1498383519u,  370020952u,  253043481u,  607678682u, 1025720731u,
+  1711106983u, 2095471334u, 1472923941u, 1322268772u,   26324643u,  411738082u,  866634785u,  717028704u,
+  2904875439u, 3024081134u, 2668790573u, 2248782444u, 3376948395u, 3495106026u, 4219356713u, 3798300520u,
+   792689142u,  908347575u,  487136116u,   68299317u, 1263779058u, 1380486579u, 2036719216u, 1618931505u,
+  3890672638u, 4278043327u, 3587215740u, 3435896893u, 2206873338u, 2593195963u, 2981909624u, 2829542713u,
+   998479947u,  580430090u,  162921161u,  279890824u, 1609522511u, 1190423566u, 1842954189u, 1958874764u,
+  4082766403u, 3930137346u, 3245109441u, 3631694208u, 2536953671u, 2385372678u, 2768287173u, 3155920004u,
+  1900120602u, 1750776667u, 1131931800u, 1517083097u,  355290910u,  204897887u,  656092572u, 1040194781u,
+  3113746450u, 2692952403u, 2343461520u, 2461357009u, 3723805974u, 3304059991u, 4022511508u, 4141455061u,
+  2919742697u, 3072101800u, 2620513899u, 2234183466u, 3396041197u, 3547351212u, 4166851439u, 3779471918u,
+  1725839073u, 2143618976u, 1424512099u, 1307796770u,   45282277u,  464110244u,  813994343u,  698327078u,
+  3838160568u, 4259225593u, 3606301754u, 3488152955u, 2158586812u, 2578602749u, 2996767038u, 2877569151u,
+   740041904u,  889656817u,  506086962u,  120682355u, 1215357364u, 1366020341u, 2051441462u, 1667084919u,
+  3422213966u, 3538019855u, 4190942668u, 3772220557u, 2945847882u, 3062702859u, 2644537544u, 2226864521u,
+    52649286u,  439905287u,  823476164u,  672009861u, 1733269570u, 2119477507u, 1434057408u, 1281543041u,
+  2167981343u, 2552493150u, 3004082077u, 2853541596u, 3847487515u, 4233048410u, 3613549209u, 3464057816u,
+  1239502615u, 1358593622u, 2077699477u, 1657543892u,  764250643u,  882293586u,  532408465u,  111204816u,
+  1585378284u, 1197851309u, 1816695150u, 1968414767u,  974272232u,  587794345u,  136598634u,  289367339u,
+  2527558116u, 2411481253u, 2760973158u, 3179948583u, 4073438432u, 3956313505u, 3237863010u, 3655790371u,
+   347922877u,  229101820u,  646611775u, 1066513022u, 1892689081u, 1774917112u, 1122387515u, 1543337850u,
+  3697634229u, 3313392372u, 3998419255u, 4148705398u, 3087642289u, 2702352368u, 2319436851u, 2468674930u
+}, {
+           0u,   29518391u,   59036782u,   38190681u,  118073564u,  114017003u,   76381362u,   89069189u,
+   236147128u,  265370511u,  228034006u,  206958561u,  152762724u,  148411219u,  178138378u,  190596925u,
+   472294256u,  501532999u,  530741022u,  509615401u,  456068012u,  451764635u,  413917122u,  426358261u,
+   305525448u,  334993663u,  296822438u,  275991697u,  356276756u,  352202787u,  381193850u,  393929805u,
+   944588512u,  965684439u, 1003065998u,  973863097u, 1061482044u, 1049003019u, 1019230802u, 1023561829u,
+   912136024u,  933002607u,  903529270u,  874031361u,  827834244u,  815125939u,  852716522u,  856752605u,
+   611050896u,  631869351u,  669987326u,  640506825u,  593644876u,  580921211u,  551983394u,  556069653u,
+   712553512u,  733666847u,  704405574u,  675154545u,  762387700u,  749958851u,  787859610u,  792175277u,
+  1889177024u, 1901651959u, 1931368878u, 1927033753u, 2006131996u, 1985040171u, 1947726194u, 1976933189u,
+  2122964088u, 2135668303u, 2098006038u, 2093965857u, 2038461604u, 2017599123u, 2047123658u, 2076625661u,
+  1824272048u, 1836991623u, 1866005214u, 1861914857u, 1807058540u, 1786244187u, 1748062722u, 1777547317u,
+  1655668488u, 1668093247u, 1630251878u, 1625932113u, 1705433044u, 1684323811u, 1713505210u, 1742760333u,
+  1222101792u, 1226154263u, 1263738702u, 1251046777u, 1339974652u, 1310460363u, 1281013650u, 1301863845u,
+  1187289752u, 1191637167u, 1161842422u, 1149379777u, 1103966788u, 1074747507u, 1112139306u, 1133218845u,
+  1425107024u, 1429406311u, 1467333694u, 1454888457u, 1408811148u, 1379576507u, 1350309090u, 1371438805u,
+  1524775400u, 1528845279u, 1499917702u, 1487177649u, 1575719220u, 1546255107u, 1584350554u, 1605185389u,
+  3778354048u, 3774312887u, 3803303918u, 3816007129u, 3862737756u, 3892238699u, 3854067506u, 3833203973u,
+  4012263992u, 4007927823u, 3970080342u, 3982554209u, 3895452388u, 3924658387u, 3953866378u, 3932773565u,
+  4245928176u, 4241609415u, 4271336606u, 4283762345u, 4196012076u, 4225268251u, 4187931714u, 4166823541u,
+  4076923208u, 4072833919u, 4035198246u, 4047918865u, 4094247316u, 4123732899u, 4153251322u, 4132437965u,
+  3648544096u, 3636082519u, 3673983246u, 3678331705u, 3732010428u, 3753090955u, 3723829714u, 3694611429u,
+  3614117080u, 3601426159u, 3572488374u, 3576541825u, 3496125444u, 3516976691u, 3555094634u, 3525581405u,
+  3311336976u, 3298595879u, 3336186494u, 3340255305u, 3260503756u, 3281337595u, 3251864226u, 3222399125u,
+  3410866088u, 3398419871u, 3368647622u, 3372945905u, 3427010420u, 3448139075u, 3485520666u, 3456284973u,
+  2444203584u, 2423127159u, 2452308526u, 2481530905u, 2527477404u, 2539934891u, 2502093554u, 2497740997u,
+  2679949304u, 2659102159u, 2620920726u, 2650438049u, 2562027300u, 2574714131u, 2603727690u, 2599670141u,
+  2374579504u, 2353749767u, 2383274334u, 2412743529u, 2323684844u, 2336421851u, 2298759554u, 2294686645u,
+  2207933576u, 2186809023u, 2149495014u, 2178734801u, 2224278612u, 2236720739u, 2266437690u, 2262135309u,
+  2850214048u, 2820717207u, 2858812622u, 2879680249u, 2934667388u, 2938704459u, 2909776914u, 2897069605u,
+  2817622296u, 2788420399u, 2759153014u, 2780249921u, 2700618180u, 2704950259u, 2742877610u, 2730399645u,
+  3049550800u, 3020298727u, 3057690558u, 3078802825u, 2999835404u, 3004150075u, 2974355298u, 2961925461u,
+  3151438440u, 3121956959u, 3092510214u, 3113327665u, 3168701108u, 3172786307u, 3210370778u, 3197646061u
+}, {
+           0u, 3099354981u, 2852767883u,  313896942u, 2405603159u,  937357362u,  627793884u, 2648127673u,
+  3316918511u, 2097696650u, 1874714724u, 3607201537u, 1255587768u, 4067088605u, 3772741427u, 1482887254u,
+  1343838111u, 3903140090u, 4195393300u, 1118632049u, 3749429448u, 1741137837u, 1970407491u, 3452858150u,
+  2511175536u,  756094997u, 1067759611u, 2266550430u,  449832999u, 2725482306u, 2965774508u,  142231497u,
+  2687676222u,  412010587u,  171665333u, 2995192016u,  793786473u, 2548850444u, 2237264098u, 1038456711u,
+  1703315409u, 3711623348u, 3482275674u, 1999841343u, 3940814982u, 1381529571u, 1089329165u, 4166106984u,
+  4029413537u, 1217896388u, 1512189994u, 3802027855u, 2135519222u, 3354724499u, 3577784189u, 1845280792u,
+   899665998u, 2367928107u, 2677414085u,  657096608u, 3137160985u,   37822588u,  284462994u, 2823350519u,
+  2601801789u,  598228824u,  824021174u, 2309093331u,  343330666u, 2898962447u, 3195996129u,  113467524u,
+  1587572946u, 3860600759u, 4104763481u, 1276501820u, 3519211397u, 1769898208u, 2076913422u, 3279374443u,
+  3406630818u, 1941006535u, 1627703081u, 3652755532u, 1148164341u, 4241751952u, 3999682686u, 1457141531u,
+   247015245u, 3053797416u, 2763059142u,  470583459u, 2178658330u,  963106687u,  735213713u, 2473467892u,
+   992409347u, 2207944806u, 2435792776u,  697522413u, 3024379988u,  217581361u,  508405983u, 2800865210u,
+  4271038444u, 1177467017u, 1419450215u, 3962007554u, 1911572667u, 3377213406u, 3690561584u, 1665525589u,
+  1799331996u, 3548628985u, 3241568279u, 2039091058u, 3831314379u, 1558270126u, 1314193216u, 4142438437u,
+  2928380019u,  372764438u,   75645176u, 3158189981u,  568925988u, 2572515393u, 2346768303u,  861712586u,
+  3982079547u, 1441124702u, 1196457648u, 4293663189u, 1648042348u, 3666298377u, 3358779879u, 1888390786u,
+   686661332u, 2421291441u, 2196002399u,  978858298u, 2811169155u,  523464422u,  226935048u, 3040519789u,
+  3175145892u,  100435649u,  390670639u, 2952089162u,  841119475u, 2325614998u, 2553003640u,  546822429u,
+  2029308235u, 3225988654u, 3539796416u, 1782671013u, 4153826844u, 1328167289u, 1570739863u, 3844338162u,
+  1298864389u, 4124540512u, 3882013070u, 1608431339u, 3255406162u, 2058742071u, 1744848601u, 3501990332u,
+  2296328682u,  811816591u,  584513889u, 2590678532u,  129869501u, 3204563416u, 2914283062u,  352848211u,
+   494030490u, 2781751807u, 3078325777u,  264757620u, 2450577869u,  715964072u,  941166918u, 2158327331u,
+  3636881013u, 1618608400u, 1926213374u, 3396585883u, 1470427426u, 4011365959u, 4255988137u, 1158766284u,
+  1984818694u, 3471935843u, 3695453837u, 1693991400u, 4180638033u, 1100160564u, 1395044826u, 3952793279u,
+  3019491049u,  189112716u,  435162722u, 2706139399u, 1016811966u, 2217162459u, 2526189877u,  774831696u,
+   643086745u, 2666061564u, 2354934034u,  887166583u, 2838900430u,  294275499u,   54519365u, 3145957664u,
+  3823145334u, 1532818963u, 1240029693u, 4048895640u, 1820460577u, 3560857924u, 3331051178u, 2117577167u,
+  3598663992u, 1858283101u, 2088143283u, 3301633750u, 1495127663u, 3785470218u, 4078182116u, 1269332353u,
+   332098007u, 2876706482u, 3116540252u,   25085497u, 2628386432u,  605395429u,  916469259u, 2384220526u,
+  2254837415u, 1054503362u,  745528876u, 2496903497u,  151290352u, 2981684885u, 2735556987u,  464596510u,
+  1137851976u, 4218313005u, 3923506883u, 1365741990u, 3434129695u, 1946996346u, 1723425172u, 3724871409u
+}, {
+           0u, 1029712304u, 2059424608u, 1201699536u, 4118849216u, 3370159984u, 2403399072u, 2988497936u,
+   812665793u,  219177585u, 1253054625u, 2010132753u, 3320900865u, 4170237105u, 3207642721u, 2186319825u,
+  1625331586u, 1568718386u,  438355170u,  658566482u, 2506109250u, 2818578674u, 4020265506u, 3535817618u,
+  1351670851u, 1844508147u,  709922595u,  389064339u, 2769320579u, 2557498163u, 3754961379u, 3803185235u,
+  3250663172u, 4238411444u, 3137436772u, 2254525908u,  876710340u,  153198708u, 1317132964u, 1944187668u,
+  4054934725u, 3436268917u, 2339452837u, 3054575125u,   70369797u,  961670069u, 2129760613u, 1133623509u,
+  2703341702u, 2621542710u, 3689016294u, 3867263574u, 1419845190u, 1774270454u,  778128678u,  318858390u,
+  2438067015u, 2888948471u, 3952189479u, 3606153623u, 1691440519u, 1504803895u,  504432359u,  594620247u,
+  1492342857u, 1704161785u,  573770537u,  525542041u, 2910060169u, 2417219385u, 3618876905u, 3939730521u,
+  1753420680u, 1440954936u,  306397416u,  790849880u, 2634265928u, 2690882808u, 3888375336u, 3668168600u,
+   940822475u,   91481723u, 1121164459u, 2142483739u, 3448989963u, 4042473659u, 3075684971u, 2318603227u,
+   140739594u,  889433530u, 1923340138u, 1338244826u, 4259521226u, 3229813626u, 2267247018u, 3124975642u,
+  2570221389u, 2756861693u, 3824297005u, 3734113693u, 1823658381u, 1372780605u,  376603373u,  722643805u,
+  2839690380u, 2485261628u, 3548540908u, 4007806556u, 1556257356u, 1638052860u,  637716780u,  459464860u,
+  4191346895u, 3300051327u, 2199040943u, 3195181599u,  206718479u,  825388991u, 1989285231u, 1274166495u,
+  3382881038u, 4106388158u, 3009607790u, 2382549470u, 1008864718u,   21111934u, 1189240494u, 2072147742u,
+  2984685714u, 2357631266u, 3408323570u, 4131834434u, 1147541074u, 2030452706u, 1051084082u,   63335554u,
+  2174155603u, 3170292451u, 4216760371u, 3325460867u, 1947622803u, 1232499747u,  248909555u,  867575619u,
+  3506841360u, 3966111392u, 2881909872u, 2527485376u,  612794832u,  434546784u, 1581699760u, 1663499008u,
+  3782634705u, 3692447073u, 2612412337u, 2799048193u,  351717905u,  697754529u, 1849071985u, 1398190273u,
+  1881644950u, 1296545318u,  182963446u,  931652934u, 2242328918u, 3100053734u, 4284967478u, 3255255942u,
+  1079497815u, 2100821479u,  983009079u,  133672583u, 3050795671u, 2293717799u, 3474399735u, 4067887175u,
+   281479188u,  765927844u, 1778867060u, 1466397380u, 3846680276u, 3626469220u, 2676489652u, 2733102084u,
+   548881365u,  500656741u, 1517752501u, 1729575173u, 3577210133u, 3898068133u, 2952246901u, 2459410373u,
+  3910527195u, 3564487019u, 2480257979u, 2931134987u,  479546907u,  569730987u, 1716854139u, 1530213579u,
+  3647316762u, 3825568426u, 2745561210u, 2663766474u,  753206746u,  293940330u, 1445287610u, 1799716618u,
+  2314567513u, 3029685993u, 4080348217u, 3461678473u, 2088098201u, 1091956777u,  112560889u, 1003856713u,
+  3112514712u, 2229607720u, 3276105720u, 4263857736u, 1275433560u, 1902492648u,  918929720u,  195422344u,
+   685033439u,  364179055u, 1377080511u, 1869921551u, 3713294623u, 3761522863u, 2811507327u, 2599689167u,
+   413436958u,  633644462u, 1650777982u, 1594160846u, 3978570462u, 3494118254u, 2548332990u, 2860797966u,
+  1211387997u, 1968470509u,  854852413u,  261368461u, 3182753437u, 2161434413u, 3346310653u, 4195650637u,
+  2017729436u, 1160000044u,   42223868u, 1071931724u, 2378480988u, 2963576044u, 4144295484u, 3395602316u
+}, {
+           0u, 3411858341u, 1304994059u, 2257875630u, 2609988118u, 1355649459u, 3596215069u,  486879416u,
+  3964895853u,  655315400u, 2711298918u, 1791488195u, 2009251963u, 3164476382u,  973758832u, 4048990933u,
+    64357019u, 3364540734u, 1310630800u, 2235723829u, 2554806413u, 1394316072u, 3582976390u,  517157411u,
+  4018503926u,  618222419u, 2722963965u, 1762783832u, 1947517664u, 3209171269u,  970744811u, 4068520014u,
+   128714038u, 3438335635u, 1248109629u, 2167961496u, 2621261600u, 1466012805u, 3522553387u,  447296910u,
+  3959392091u,  547575038u, 2788632144u, 1835791861u, 1886307661u, 3140622056u, 1034314822u, 4143626211u,
+    75106221u, 3475428360u, 1236444838u, 2196665603u, 2682996155u, 1421317662u, 3525567664u,  427767573u,
+  3895035328u,  594892389u, 2782995659u, 1857943406u, 1941489622u, 3101955187u, 1047553757u, 4113347960u,
+   257428076u, 3288652233u, 1116777319u, 2311878850u, 2496219258u, 1603640287u, 3640781169u,  308099796u,
+  3809183745u,  676813732u, 2932025610u, 1704983215u, 2023410199u, 3016104370u,  894593820u, 4262377657u,
+   210634999u, 3352484690u, 1095150076u, 2316991065u, 2535410401u, 1547934020u, 3671583722u,  294336591u,
+  3772615322u,  729897279u, 2903845777u, 1716123700u, 2068629644u, 2953845545u,  914647431u, 4258839074u,
+   150212442u, 3282623743u, 1161604689u, 2388688372u, 2472889676u, 1480171241u, 3735940167u,  368132066u,
+  3836185911u,  805002898u, 2842635324u, 1647574937u, 2134298401u, 3026852996u,  855535146u, 4188192143u,
+   186781121u, 3229539940u, 1189784778u, 2377547631u, 2427670487u, 1542429810u, 3715886812u,  371670393u,
+  3882979244u,  741170185u, 2864262823u, 1642462466u, 2095107514u, 3082559007u,  824732849u, 4201955092u,
+   514856152u, 3589064573u, 1400419795u, 2552522358u, 2233554638u, 1316849003u, 3370776517u,   62202976u,
+  4075001525u,  968836368u, 3207280574u, 1954014235u, 1769133219u, 2720925446u,  616199592u, 4024870413u,
+   493229635u, 3594175974u, 1353627464u, 2616354029u, 2264355925u, 1303087088u, 3409966430u,    6498043u,
+  4046820398u,  979978123u, 3170710821u, 2007099008u, 1789187640u, 2717386141u,  661419827u, 3962610838u,
+   421269998u, 3527459403u, 1423225061u, 2676515648u, 2190300152u, 1238466653u, 3477467891u,   68755798u,
+  4115633027u, 1041448998u, 3095868040u, 1943789869u, 1860096405u, 2776760880u,  588673182u, 3897205563u,
+   449450869u, 3516317904u, 1459794558u, 2623431131u, 2170245475u, 1242006214u, 3432247400u,  131015629u,
+  4137259288u, 1036337853u, 3142660115u, 1879958454u, 1829294862u, 2790523051u,  549483013u, 3952910752u,
+   300424884u, 3669282065u, 1545650111u, 2541513754u, 2323209378u, 1092980487u, 3350330793u,  216870412u,
+  4256931033u,  921128828u, 2960342482u, 2066738807u, 1714085583u, 2910195050u,  736264132u, 3770592353u,
+   306060335u, 3647131530u, 1610005796u, 2494197377u, 2309971513u, 1123257756u, 3295149874u,  255536279u,
+  4268596802u,  892423655u, 3013951305u, 2029645036u, 1711070292u, 2929725425u,  674528607u, 3815288570u,
+   373562242u, 3709388839u, 1535949449u, 2429577516u, 2379569556u, 1183418929u, 3223189663u,  188820282u,
+  4195850735u,  827017802u, 3084859620u, 2089020225u, 1636228089u, 2866415708u,  743340786u, 3876759895u,
+   361896217u, 3738094268u, 1482340370u, 2466671543u, 2382584591u, 1163888810u, 3284924932u,  144124321u,
+  4190215028u,  849168593u, 3020503679u, 2136336858u, 1649465698u, 2836138695u,  798521449u, 3838094284u
+}, {
+           0u, 2792819636u, 2543784233u,  837294749u, 4098827283u, 1379413927u, 1674589498u, 3316072078u,
+   871321191u, 2509784531u, 2758827854u,   34034938u, 3349178996u, 1641505216u, 1346337629u, 4131942633u,
+  1742642382u, 3249117050u, 4030828007u, 1446413907u, 2475800797u,  904311657u,   68069876u, 2725880384u,
+  1412551337u, 4064729373u, 3283010432u, 1708771380u, 2692675258u,  101317902u,  937551763u, 2442587175u,
+  3485284764u, 1774858792u, 1478633653u, 4266992385u, 1005723023u, 2642744891u, 2892827814u,  169477906u,
+  4233263099u, 1512406095u, 1808623314u, 3451546982u,  136139752u, 2926205020u, 2676114113u,  972376437u,
+  2825102674u,  236236518u, 1073525883u, 2576072655u, 1546420545u, 4200303349u, 3417542760u, 1841601500u,
+  2609703733u, 1039917185u,  202635804u, 2858742184u, 1875103526u, 3384067218u, 4166835727u, 1579931067u,
+  1141601657u, 3799809741u, 3549717584u, 1977839588u, 2957267306u,  372464350u,  668680259u, 2175552503u,
+  2011446046u, 3516084394u, 3766168119u, 1175200131u, 2209029901u,  635180217u,  338955812u, 2990736784u,
+   601221559u, 2242044419u, 3024812190u,  306049834u, 3617246628u, 1911408144u, 1074125965u, 3866285881u,
+   272279504u, 3058543716u, 2275784441u,  567459149u, 3832906691u, 1107462263u, 1944752874u, 3583875422u,
+  2343980261u,  767641425u,  472473036u, 3126744696u, 2147051766u, 3649987394u, 3899029983u, 1309766251u,
+  3092841090u,  506333494u,  801510315u, 2310084639u, 1276520081u, 3932237093u, 3683203000u, 2113813516u,
+  3966292011u, 1243601823u, 2079834370u, 3716205238u,  405271608u, 3192979340u, 2411259153u,  701492901u,
+  3750207052u, 2045810168u, 1209569125u, 4000285905u,  734575199u, 2378150379u, 3159862134u,  438345922u,
+  2283203314u,  778166598u,  529136603u, 3120492655u, 2086260449u, 3660498261u, 3955679176u, 1303499900u,
+  3153699989u,  495890209u,  744928700u, 2316418568u, 1337360518u, 3921775410u, 3626602927u, 2120129051u,
+  4022892092u, 1237286280u, 2018993941u, 3726666913u,  461853231u, 3186645403u, 2350400262u,  711936178u,
+  3693557851u, 2052076527u, 1270360434u, 3989775046u,  677911624u, 2384402428u, 3220639073u,  427820757u,
+  1202443118u, 3789347034u, 3493118535u, 1984154099u, 3018127229u,  362020041u,  612099668u, 2181885408u,
+  1950653705u, 3526596285u, 3822816288u, 1168934804u, 2148251930u,  645706414u,  395618355u, 2984485767u,
+   544559008u, 2248295444u, 3085590153u,  295523645u, 3560598451u, 1917673479u, 1134918298u, 3855773998u,
+   328860103u, 3052210803u, 2214924526u,  577903450u, 3889505748u, 1101147744u, 1883911421u, 3594338121u,
+  3424493451u, 1785369663u, 1535282850u, 4260726038u,  944946072u, 2653270060u, 2949491377u,  163225861u,
+  4294103532u, 1501944408u, 1752023237u, 3457862513u,  196998655u, 2915761739u, 2619532502u,  978710370u,
+  2881684293u,  229902577u, 1012666988u, 2586515928u, 1603020630u, 4193987810u, 3356702335u, 1852063179u,
+  2553040162u, 1046169238u,  263412747u, 2848217023u, 1818454321u, 3390333573u, 4227627032u, 1569420204u,
+    60859927u, 2782375331u, 2487203646u,  843627658u, 4159668740u, 1368951216u, 1617990445u, 3322386585u,
+   810543216u, 2520310724u, 2815490393u,   27783917u, 3288386659u, 1652017111u, 1402985802u, 4125677310u,
+  1685994201u, 3255382381u, 4091620336u, 1435902020u, 2419138250u,  910562686u,  128847843u, 2715354199u,
+  1469150398u, 4058414858u, 3222168983u, 1719234083u, 2749255853u,   94984985u,  876691844u, 2453031472u
+}, {
+           0u, 3433693342u, 1109723005u, 2391738339u, 2219446010u, 1222643300u, 3329165703u,  180685081u,
+  3555007413u,  525277995u, 2445286600u, 1567235158u, 1471092047u, 2600801745u,  361370162u, 3642757804u,
+  2092642603u, 2953916853u, 1050555990u, 4063508168u, 4176560081u,  878395215u, 3134470316u, 1987983410u,
+  2942184094u, 1676945920u, 3984272867u,  567356797u,  722740324u, 3887998202u, 1764827929u, 2778407815u,
+  4185285206u,  903635656u, 3142804779u, 2012833205u, 2101111980u, 2979425330u, 1058630609u, 4088621903u,
+   714308067u, 3862526333u, 1756790430u, 2753330688u, 2933487385u, 1651734407u, 3975966820u,  542535930u,
+  2244825981u, 1231508451u, 3353891840u,  188896414u,   25648519u, 3442302233u, 1134713594u, 2399689316u,
+  1445480648u, 2592229462u,  336416693u, 3634843435u, 3529655858u,  516441772u, 2420588879u, 1559052753u,
+   698204909u, 3845636723u, 1807271312u, 2803025166u, 2916600855u, 1635634313u, 4025666410u,  593021940u,
+  4202223960u,  919787974u, 3093159461u, 1962401467u, 2117261218u, 2996361020u, 1008193759u, 4038971457u,
+  1428616134u, 2576151384u,  386135227u, 3685348389u, 3513580860u,  499580322u, 2471098945u, 1608776415u,
+  2260985971u, 1248454893u, 3303468814u,  139259792u,   42591881u, 3458459159u, 1085071860u, 2349261162u,
+  3505103035u,  474062885u, 2463016902u, 1583654744u, 1419882049u, 2550902495u,  377792828u, 3660491170u,
+    51297038u, 3483679632u, 1093385331u, 2374089965u, 2269427188u, 1273935210u, 3311514249u,  164344343u,
+  2890961296u, 1627033870u, 4000683757u,  585078387u,  672833386u, 3836780532u, 1782552599u, 2794821769u,
+  2142603813u, 3005188795u, 1032883544u, 4047146438u, 4227826911u,  928351297u, 3118105506u, 1970307900u,
+  1396409818u, 2677114180u,  287212199u, 3719594553u, 3614542624u,  467372990u, 2505346141u, 1509854403u,
+  2162073199u, 1282711281u, 3271268626u,  240228748u,   76845205u, 3359543307u, 1186043880u, 2317064054u,
+   796964081u, 3811226735u, 1839575948u, 2702160658u, 2882189835u, 1734392469u, 3924802934u,  625327592u,
+  4234522436u,  818917338u, 3191908409u, 1927981223u, 2016387518u, 3028656416u,  973776579u, 4137723485u,
+  2857232268u, 1726474002u, 3899187441u,  616751215u,  772270454u, 3803048424u, 1814228491u, 2693328533u,
+  2041117753u, 3036871847u,  999160644u, 4146592730u, 4259508931u,  826864221u, 3217552830u, 1936586016u,
+  3606501031u,  442291769u, 2496909786u, 1484378436u, 1388107869u, 2652297411u,  278519584u, 3694387134u,
+    85183762u, 3384397196u, 1194773103u, 2342308593u, 2170143720u, 1307820918u, 3279733909u,  265733131u,
+  2057717559u, 3054258089u,  948125770u, 4096344276u, 4276898253u,  843467091u, 3167309488u, 1885556270u,
+  2839764098u, 1709792284u, 3949353983u,  667704161u,  755585656u, 3785577190u, 1865176325u, 2743489947u,
+   102594076u, 3401021058u, 1144549729u, 2291298815u, 2186770662u, 1325234296u, 3228729243u,  215514885u,
+  3589828009u,  424832311u, 2547870420u, 1534552650u, 1370645331u, 2635621325u,  328688686u, 3745342640u,
+  2211456353u, 1333405183u, 3254067740u,  224338562u,  127544219u, 3408931589u, 1170156774u, 2299866232u,
+  1345666772u, 2627681866u,  303053225u, 3736746295u, 3565105198u,  416624816u, 2522494803u, 1525692365u,
+  4285207626u,  868291796u, 3176010551u, 1910772649u, 2065767088u, 3079346734u,  956571085u, 4121828691u,
+   747507711u, 3760459617u, 1856702594u, 2717976604u, 2831417605u, 1684930971u, 3940615800u,  642451174u
+}};
+
+#ifdef LODEPNG_COMPILE_SIMD
+/*
+Folds the CRC over blocks of 16 bytes with carry-less multiplication, as described in Intel's "Fast CRC
+Computation for Generic Polynomials Using PCLMULQDQ Instruction". The constants are powers of x modulo the
+bit reflected polynomial: x^(4*128+32), x^(4*128-32), x^(128+32), x^(128-32) and x^64 to fold, and the
+polynomial with its Barrett constant to reduce the last 64 bits to 32. length must be a multiple of 16 and
+at least 64. crc is not inverted at the start or end.
+*/
+static LODEPNG_TARGET_PCLMUL unsigned crc32PCLMUL(unsigned crc, const unsigned char* data, size_t length)
+{
+  const __m128i k1k2 = _mm_set_epi32(0x00000001, 0xc6e41596, 0x00000001, 0x54442bd4);
+  const __m128i k3k4 = _mm_set_epi32(0x00000000, 0xccaa009e, 0x00000001, 0x751997d0);
+  const __m128i k5 = _mm_set_epi32(0x00000000, 0x00000000, 0x00000001, 0x63cd6124);
+  const __m128i poly = _mm_set_epi32(0x00000001, 0xf7011641, 0x00000001, 0xdb710641);
+  const __m128i mask32 = _mm_setr_epi32(-1, 0, -1, 0);
+  __m128i x0 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)&data[0]), _mm_cvtsi32_si128((int)crc));
+  __m128i x1 = _mm_loadu_si128((const __m128i*)&data[16]);
+  __m128i x2 = _mm_loadu_si128((const __m128i*)&data[32]);
+  __m128i x3 = _mm_loadu_si128((const __m128i*)&data[48]);
+  __m128i t;
+  data += 64;
+  length -= 64;
+
+  /*fold four blocks at a time*/
+  while(length >= 64)
+  {
+    x0 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x0, k1k2, 0x00), _mm_clmulepi64_si128(x0, k1k2, 0x11)),
+                       _mm_loadu_si128((const __m128i*)&data[0]));
+    x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k1k2, 0x00), _mm_clmulepi64_si128(x1, k1k2, 0x11)),
+                       _mm_loadu_si128((const __m128i*)&data[16]));
+    x2 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x2, k1k2, 0x00), _mm_clmulepi64_si128(x2, k1k2, 0x11)),
+                       _mm_loadu_si128((const __m128i*)&data[32]));
+    x3 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x3, k1k2, 0x00), _mm_clmulepi64_si128(x3, k1k2, 0x11)),
+                       _mm_loadu_si128((const __m128i*)&data[48]));
+    data += 64;
+    length -= 64;
+  }
+
+  /*fold the four into one, then the remaining blocks one at a time*/
+  x0 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x0, k3k4, 0x00), _mm_clmulepi64_si128(x0, k3k4, 0x11)), x1);
+  x0 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x0, k3k4, 0x00), _mm_clmulepi64_si128(x0, k3k4, 0x11)), x2);
+  x0 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x0, k3k4, 0x00), _mm_clmulepi64_si128(x0, k3k4, 0x11)), x3);
+  while(length >= 16)
+  {
+    x0 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x0, k3k4, 0x00), _mm_clmulepi64_si128(x0, k3k4, 0x11)),
+                       _mm_loadu_si128((const __m128i*)data));
+    data += 16;
+    length -= 16;
+  }
+
+  /*fold 128 bits to 64*/
+  x0 = _mm_xor_si128(_mm_srli_si128(x0, 8), _mm_clmulepi64_si128(x0, k3k4, 0x10));
+  t = _mm_srli_si128(x0, 4);
+  x0 = _mm_xor_si128(_mm_clmulepi64_si128(_mm_and_si128(x0, mask32), k5, 0x00), t);
+
+  /*Barrett reduction to 32 bits*/
+  t = _mm_clmulepi64_si128(_mm_and_si128(x0, mask32), poly, 0x10);
+  t = _mm_clmulepi64_si128(_mm_and_si128(t, mask32), poly, 0x00);
+  x0 = _mm_xor_si128(x0, t);
+  return (unsigned)_mm_cvtsi128_si32(_mm_srli_si128(x0, 4));
+}
+#endif /*LODEPNG_COMPILE_SIMD*/
 
 /*Return the CRC of the bytes buf[0..len-1].*/
 unsigned lodepng_crc32(const unsigned char* data, size_t length)
 {
   unsigned r = 0xffffffffu;
-  size_t i;
-  for(i = 0; i < length; ++i)
+#ifdef LODEPNG_COMPILE_SIMD
+  if(length >= 64 && LODEPNG_CPU_SUPPORTS("pclmul"))
+  {
+    size_t blocks = length & ~(size_t)15;
+    r = crc32PCLMUL(r, data, blocks);
+    data += blocks;
+    length -= blocks;
+  }
+#endif /*LODEPNG_COMPILE_SIMD*/
+  while(length >= 8)
   {
-    r = lodepng_crc32_table[(r ^ data[i]) & 0xff] ^ (r >> 8);
+    unsigned word = r ^ (data[0] | ((unsigned)data[1] << 8) | ((unsigned)data[2] << 16) | ((unsigned)data[3] << 24));
+    r = lodepng_crc32_table[7][word & 0xff] ^ lodepng_crc32_table[6][(word >> 8) & 0xff]
+      ^ lodepng_crc32_table[5][(word >> 16) & 0xff] ^ lodepng_crc32_table[4][word >> 24]
+      ^ lodepng_crc32_table[3][data[4]] ^ lodepng_crc32_table[2][data[5]]
+      ^ lodepng_crc32_table[1][data[6]] ^ lodepng_crc32_table[0][data[7]];
+    data += 8;
+    length -= 8;
+  }
+  while(length--)
+  {
+    r = lodepng_crc32_table[0][(r ^ *data++) & 0xff] ^ (r >> 8);
   }
   return r ^ 0xffffffffu;
 }
@@ -2370,6 +3553,37 @@ unsigned lodepng_crc32(const unsigned char* data, size_t length)
 unsigned lodepng_crc32(const unsigned char* data, size_t length);
 #endif /* !LODEPNG_NO_COMPILE_CRC */
 
+/*a * b modulo the CRC polynomial, both bit reflected like the CRC itself*/
+static unsigned crc32_multmodp(unsigned a, unsigned b)
+{
+  unsigned m = 1u << 31;
+  unsigned p = 0;
+  for(;;)
+  {
+    if(a & m)
+    {
+      p ^= b;
+      if((a & (m - 1)) == 0) break;
+    }
+    m >>= 1;
+    b = (b & 1) ? (b >> 1) ^ 0xedb88320u : b >> 1;
+  }
+  return p;
+}
+
+unsigned lodepng_crc32_combine(unsigned crc1, unsigned crc2, size_t len2)
+{
+  /*appending len2 bytes multiplies crc1 by x^(8 * len2), computed by squaring x^8 (bit 31 is x^0)*/
+  unsigned xpow = 1u << 23;
+  unsigned p = 1u << 31;
+  for(; len2; len2 >>= 1)
+  {
+    if(len2 & 1) p = crc32_multmodp(xpow, p);
+    xpow = crc32_multmodp(xpow, xpow);
+  }
+  return crc32_multmodp(p, crc1) ^ crc2;
+}
+
 /* ////////////////////////////////////////////////////////////////////////// */
 /* / Reading and writing single bits and bytes from/to stream for LodePNG   / */
 /* ////////////////////////////////////////////////////////////////////////// */
@@ -2989,82 +4203,74 @@ static void addColorBits(unsigned char* out, size_t index, unsigned bits, unsign
   else out[index * bits / 8] |= in;
 }
 
-typedef struct ColorTree ColorTree;
-
 /*
-One node of a color tree
-This is the data structure used to count the number of unique colors and to get a palette
-index for a color. It's like an octree, but because the alpha channel is used too, each
-node has 16 instead of 8 children.
+Open addressing hash table of RGBA colors with their index, the colors packed in an unsigned as
+r | g << 8 | b << 16 | a << 24. This is the data structure used to count the number of unique
+colors and to get a palette index for a color. It has room for more than the 257 colors a profile
+ever counts or a palette has, so it has a fixed size, never allocates and a lookup is one or a few
+probes. The last color looked up is cached, for the runs of equal pixels common in images.
 */
-struct ColorTree
-{
-  ColorTree* children[16]; /*up to 16 pointers to ColorTree of next level*/
-  int index; /*the payload. Only has a meaningful value if this is in the last level*/
-};
+#define COLOR_HASH_BITS 9
+#define COLOR_HASH_SIZE (1u << COLOR_HASH_BITS)
 
-static void color_tree_init(ColorTree* tree)
+typedef struct ColorHash
 {
-  int i;
-  for(i = 0; i != 16; ++i) tree->children[i] = 0;
-  tree->index = -1;
-}
+  unsigned colors[COLOR_HASH_SIZE];
+  short index[COLOR_HASH_SIZE]; /*-1 for an empty slot*/
+  unsigned last_color; /*the last color found by color_hash_get*/
+  int last_index; /*index of last_color, -1 if there is none*/
+} ColorHash;
 
-static void color_tree_cleanup(ColorTree* tree)
+static void color_hash_init(ColorHash* hash)
 {
-  int i;
-  for(i = 0; i != 16; ++i)
-  {
-    if(tree->children[i])
-    {
-      color_tree_cleanup(tree->children[i]);
-      lodepng_free(tree->children[i]);
-    }
-  }
+  unsigned i;
+  for(i = 0; i != COLOR_HASH_SIZE; ++i) hash->index[i] = -1;
+  hash->last_color = 0;
+  hash->last_index = -1;
 }
 
-/*returns -1 if color not present, its index otherwise*/
-static int color_tree_get(ColorTree* tree, unsigned char r, unsigned char g, unsigned char b, unsigned char a)
+static unsigned packColorRGBA8(unsigned char r, unsigned char g, unsigned char b, unsigned char a)
 {
-  int bit = 0;
-  for(bit = 0; bit < 8; ++bit)
-  {
-    int i = 8 * ((r >> bit) & 1) + 4 * ((g >> bit) & 1) + 2 * ((b >> bit) & 1) + 1 * ((a >> bit) & 1);
-    if(!tree->children[i]) return -1;
-    else tree = tree->children[i];
-  }
-  return tree ? tree->index : -1;
+  return (unsigned)r | ((unsigned)g << 8u) | ((unsigned)b << 16u) | ((unsigned)a << 24u);
 }
 
-#ifdef LODEPNG_COMPILE_ENCODER
-static int color_tree_has(ColorTree* tree, unsigned char r, unsigned char g, unsigned char b, unsigned char a)
+/*the slot the color is in, or the empty slot where it would go*/
+static unsigned color_hash_slot(const ColorHash* hash, unsigned color)
 {
-  return color_tree_get(tree, r, g, b, a) >= 0;
+  /*Fibonacci hashing: the top bits of the product depend on all bytes of the color*/
+  unsigned slot = ((color * 2654435761u) & 0xffffffffu) >> (32u - COLOR_HASH_BITS);
+  while(hash->index[slot] >= 0 && hash->colors[slot] != color) slot = (slot + 1u) & (COLOR_HASH_SIZE - 1u);
+  return slot;
 }
-#endif /*LODEPNG_COMPILE_ENCODER*/
 
-/*color is not allowed to already exist.
-Index should be >= 0 (it's signed to be compatible with using -1 for "doesn't exist")*/
-static void color_tree_add(ColorTree* tree,
-                           unsigned char r, unsigned char g, unsigned char b, unsigned char a, unsigned index)
+/*returns -1 if color not present, its index otherwise*/
+static int color_hash_get(ColorHash* hash, unsigned color)
 {
-  int bit;
-  for(bit = 0; bit < 8; ++bit)
+  int index;
+  if(hash->last_index >= 0 && hash->last_color == color) return hash->last_index;
+  index = hash->index[color_hash_slot(hash, color)];
+  if(index >= 0)
   {
-    int i = 8 * ((r >> bit) & 1) + 4 * ((g >> bit) & 1) + 2 * ((b >> bit) & 1) + 1 * ((a >> bit) & 1);
-    if(!tree->children[i])
-    {
-      tree->children[i] = (ColorTree*)lodepng_malloc(sizeof(ColorTree));
-      color_tree_init(tree->children[i]);
-    }
-    tree = tree->children[i];
+    hash->last_color = color;
+    hash->last_index = index;
   }
-  tree->index = (int)index;
+  return index;
+}
+
+/*Adds the color, or changes its index if it is already present, like a later palette entry with
+the same color overrides an earlier one. At most COLOR_HASH_SIZE - 1 colors. Index should be >= 0
+(it's signed to be compatible with using -1 for "doesn't exist")*/
+static void color_hash_add(ColorHash* hash, unsigned color, unsigned index)
+{
+  unsigned slot = color_hash_slot(hash, color);
+  hash->colors[slot] = color;
+  hash->index[slot] = (short)index;
+  hash->last_index = -1;
 }
 
 /*put a pixel, given its RGBA color, into image of any color type*/
 static unsigned rgba8ToPixel(unsigned char* out, size_t i,
-                             const LodePNGColorMode* mode, ColorTree* tree /*for palette*/,
+                             const LodePNGColorMode* mode, ColorHash* hash /*for palette*/,
                              unsigned char r, unsigned char g, unsigned char b, unsigned char a)
 {
   if(mode->colortype == LCT_GREY)
@@ -3096,7 +4302,7 @@ static unsigned rgba8ToPixel(unsigned char* out, size_t i,
   }
   else if(mode->colortype == LCT_PALETTE)
   {
-    int index = color_tree_get(tree, r, g, b, a);
+    int index = color_hash_get(hash, packColorRGBA8(r, g, b, a));
     if(index < 0) return 82; /*color not in palette*/
     if(mode->bitdepth == 8) out[i] = index;
     else addColorBits(out, i, mode->bitdepth, (unsigned)index);
@@ -3456,13 +4662,258 @@ static void getPixelColorRGBA16(unsigned short* r, unsigned short* g, unsigned s
   }
 }
 
+/*
+Conversions between common 8-bit and 16-bit color modes, done a whole vector of pixels at a time instead
+of per pixel through getPixelColorRGBA8 and rgba8ToPixel. Each converts numpixels pixels and gives the
+same result as the generic path: grey output takes the red channel, 16-bit input its most significant
+byte. These loops are bound by memory bandwidth, so SSE2 or SSSE3 is enough.
+*/
+typedef void (*ConvertPixelsFunc)(unsigned char* out, const unsigned char* in, size_t numpixels);
+
+#ifdef LODEPNG_COMPILE_SIMD
+/*each of these converts whole blocks of pixels from index i on and returns the first pixel not done*/
+
+static LODEPNG_TARGET_SSSE3 size_t convertRGBA8ToRGB8SSSE3(unsigned char* out, const unsigned char* in,
+                                                           size_t i, size_t numpixels)
+{
+  const __m128i dropalpha = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+  for(; i + 4 <= numpixels; i += 4)
+  {
+    __m128i bytes = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)&in[i * 4]), dropalpha);
+    int last = _mm_cvtsi128_si32(_mm_srli_si128(bytes, 8));
+    _mm_storel_epi64((__m128i*)&out[i * 3], bytes);
+    memcpy(&out[i * 3 + 8], &last, 4);
+  }
+  return i;
+}
+
+static LODEPNG_TARGET_SSSE3 size_t convertRGB8ToRGBA8SSSE3(unsigned char* out, const unsigned char* in,
+                                                           size_t i, size_t numpixels)
+{
+  const __m128i addalpha = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+  const __m128i opaque = _mm_set1_epi32((int)0xff000000u);
+  /*the load of 16 bytes for 4 pixels of 12 needs 4 more bytes of input*/
+  for(; i * 3 + 16 <= numpixels * 3; i += 4)
+  {
+    __m128i bytes = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)&in[i * 3]), addalpha);
+    _mm_storeu_si128((__m128i*)&out[i * 4], _mm_or_si128(bytes, opaque));
+  }
+  return i;
+}
+
+static LODEPNG_TARGET_SSE2 size_t convertRGBA16ToRGBA8SSE2(unsigned char* out, const unsigned char* in,
+                                                           size_t i, size_t numpixels)
+{
+  /*the most significant byte of a big endian value is the low byte of the little endian 16-bit lane*/
+  const __m128i lowbytes = _mm_set1_epi16(0x00ff);
+  for(; i + 4 <= numpixels; i += 4)
+  {
+    __m128i a = _mm_and_si128(_mm_loadu_si128((const __m128i*)&in[i * 8 + 0]), lowbytes);
+    __m128i b = _mm_and_si128(_mm_loadu_si128((const __m128i*)&in[i * 8 + 16]), lowbytes);
+    _mm_storeu_si128((__m128i*)&out[i * 4], _mm_packus_epi16(a, b));
+  }
+  return i;
+}
+
+static LODEPNG_TARGET_SSE2 size_t convertGrey8ToRGBA8SSE2(unsigned char* out, const unsigned char* in,
+                                                          size_t i, size_t numpixels)
+{
+  const __m128i opaque = _mm_set1_epi8((char)255);
+  for(; i + 16 <= numpixels; i += 16)
+  {
+    __m128i grey = _mm_loadu_si128((const __m128i*)&in[i]);
+    __m128i gg0 = _mm_unpacklo_epi8(grey, grey), gg1 = _mm_unpackhi_epi8(grey, grey);
+    __m128i ga0 = _mm_unpacklo_epi8(grey, opaque), ga1 = _mm_unpackhi_epi8(grey, opaque);
+    _mm_storeu_si128((__m128i*)&out[i * 4 + 0], _mm_unpacklo_epi16(gg0, ga0));
+    _mm_storeu_si128((__m128i*)&out[i * 4 + 16], _mm_unpackhi_epi16(gg0, ga0));
+    _mm_storeu_si128((__m128i*)&out[i * 4 + 32], _mm_unpacklo_epi16(gg1, ga1));
+    _mm_storeu_si128((__m128i*)&out[i * 4 + 48], _mm_unpackhi_epi16(gg1, ga1));
+  }
+  return i;
+}
+
+static LODEPNG_TARGET_SSE2 size_t convertRGBA8ToGrey8SSE2(unsigned char* out, const unsigned char* in,
+                                                          size_t i, size_t numpixels)
+{
+  const __m128i red = _mm_set1_epi32(0xff);
+  for(; i + 16 <= numpixels; i += 16)
+  {
+    __m128i r0 = _mm_and_si128(_mm_loadu_si128((const __m128i*)&in[i * 4 + 0]), red);
+    __m128i r1 = _mm_and_si128(_mm_loadu_si128((const __m128i*)&in[i * 4 + 16]), red);
+    __m128i r2 = _mm_and_si128(_mm_loadu_si128((const __m128i*)&in[i * 4 + 32]), red);
+    __m128i r3 = _mm_and_si128(_mm_loadu_si128((const __m128i*)&in[i * 4 + 48]), red);
+    _mm_storeu_si128((__m128i*)&out[i], _mm_packus_epi16(_mm_packs_epi32(r0, r1), _mm_packs_epi32(r2, r3)));
+  }
+  return i;
+}
+
+static LODEPNG_TARGET_SSSE3 size_t convertGreyAlpha8ToRGBA8SSSE3(unsigned char* out, const unsigned char* in,
+                                                                 size_t i, size_t numpixels)
+{
+  const __m128i lo = _mm_setr_epi8(0, 0, 0, 1, 2, 2, 2, 3, 4, 4, 4, 5, 6, 6, 6, 7);
+  const __m128i hi = _mm_setr_epi8(8, 8, 8, 9, 10, 10, 10, 11, 12, 12, 12, 13, 14, 14, 14, 15);
+  for(; i + 8 <= numpixels; i += 8)
+  {
+    __m128i bytes = _mm_loadu_si128((const __m128i*)&in[i * 2]);
+    _mm_storeu_si128((__m128i*)&out[i * 4 + 0], _mm_shuffle_epi8(bytes, lo));
+    _mm_storeu_si128((__m128i*)&out[i * 4 + 16], _mm_shuffle_epi8(bytes, hi));
+  }
+  return i;
+}
+
+static LODEPNG_TARGET_SSSE3 size_t convertRGBA8ToGreyAlpha8SSSE3(unsigned char* out, const unsigned char* in,
+                                                                 size_t i, size_t numpixels)
+{
+  const __m128i redalpha = _mm_setr_epi8(0, 3, 4, 7, 8, 11, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1);
+  for(; i + 8 <= numpixels; i += 8)
+  {
+    __m128i a = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)&in[i * 4 + 0]), redalpha);
+    __m128i b = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)&in[i * 4 + 16]), redalpha);
+    _mm_storeu_si128((__m128i*)&out[i * 2], _mm_unpacklo_epi64(a, b));
+  }
+  return i;
+}
+#endif /*LODEPNG_COMPILE_SIMD*/
+
+static void convertRGBA8ToRGB8(unsigned char* out, const unsigned char* in, size_t numpixels)
+{
+  size_t i = 0;
+#ifdef LODEPNG_COMPILE_SIMD
+  if(LODEPNG_CPU_SUPPORTS("ssse3")) i = convertRGBA8ToRGB8SSSE3(out, in, i, numpixels);
+#endif /*LODEPNG_COMPILE_SIMD*/
+  for(; i != numpixels; ++i)
+  {
+    out[i * 3 + 0] = in[i * 4 + 0];
+    out[i * 3 + 1] = in[i * 4 + 1];
+    out[i * 3 + 2] = in[i * 4 + 2];
+  }
+}
+
+static void convertRGB8ToRGBA8(unsigned char* out, const unsigned char* in, size_t numpixels)
+{
+  size_t i = 0;
+#ifdef LODEPNG_COMPILE_SIMD
+  if(LODEPNG_CPU_SUPPORTS("ssse3")) i = convertRGB8ToRGBA8SSSE3(out, in, i, numpixels);
+#endif /*LODEPNG_COMPILE_SIMD*/
+  for(; i != numpixels; ++i)
+  {
+    out[i * 4 + 0] = in[i * 3 + 0];
+    out[i * 4 + 1] = in[i * 3 + 1];
+    out[i * 4 + 2] = in[i * 3 + 2];
+    out[i * 4 + 3] = 255;
+  }
+}
+
+static void convertRGBA16ToRGBA8(unsigned char* out, const unsigned char* in, size_t numpixels)
+{
+  size_t i = 0;
+#ifdef LODEPNG_COMPILE_SIMD
+  if(LODEPNG_CPU_SUPPORTS("sse2")) i = convertRGBA16ToRGBA8SSE2(out, in, i, numpixels);
+#endif /*LODEPNG_COMPILE_SIMD*/
+  for(; i != numpixels; ++i)
+  {
+    out[i * 4 + 0] = in[i * 8 + 0];
+    out[i * 4 + 1] = in[i * 8 + 2];
+    out[i * 4 + 2] = in[i * 8 + 4];
+    out[i * 4 + 3] = in[i * 8 + 6];
+  }
+}
+
+static void convertGrey8ToRGBA8(unsigned char* out, const unsigned char* in, size_t numpixels)
+{
+  size_t i = 0;
+#ifdef LODEPNG_COMPILE_SIMD
+  if(LODEPNG_CPU_SUPPORTS("sse2")) i = convertGrey8ToRGBA8SSE2(out, in, i, numpixels);
+#endif /*LODEPNG_COMPILE_SIMD*/
+  for(; i != numpixels; ++i)
+  {
+    out[i * 4 + 0] = out[i * 4 + 1] = out[i * 4 + 2] = in[i];
+    out[i * 4 + 3] = 255;
+  }
+}
+
+static void convertRGBA8ToGrey8(unsigned char* out, const unsigned char* in, size_t numpixels)
+{
+  size_t i = 0;
+#ifdef LODEPNG_COMPILE_SIMD
+  if(LODEPNG_CPU_SUPPORTS("sse2")) i = convertRGBA8ToGrey8SSE2(out, in, i, numpixels);
+#endif /*LODEPNG_COMPILE_SIMD*/
+  for(; i != numpixels; ++i) out[i] = in[i * 4];
+}
+
+static void convertGreyAlpha8ToRGBA8(unsigned char* out, const unsigned char* in, size_t numpixels)
+{
+  size_t i = 0;
+#ifdef LODEPNG_COMPILE_SIMD
+  if(LODEPNG_CPU_SUPPORTS("ssse3")) i = convertGreyAlpha8ToRGBA8SSSE3(out, in, i, numpixels);
+#endif /*LODEPNG_COMPILE_SIMD*/
+  for(; i != numpixels; ++i)
+  {
+    out[i * 4 + 0] = out[i * 4 + 1] = out[i * 4 + 2] = in[i * 2 + 0];
+    out[i * 4 + 3] = in[i * 2 + 1];
+  }
+}
+
+static void convertRGBA8ToGreyAlpha8(unsigned char* out, const unsigned char* in, size_t numpixels)
+{
+  size_t i = 0;
+#ifdef LODEPNG_COMPILE_SIMD
+  if(LODEPNG_CPU_SUPPORTS("ssse3")) i = convertRGBA8ToGreyAlpha8SSSE3(out, in, i, numpixels);
+#endif /*LODEPNG_COMPILE_SIMD*/
+  for(; i != numpixels; ++i)
+  {
+    out[i * 2 + 0] = in[i * 4 + 0];
+    out[i * 2 + 1] = in[i * 4 + 3];
+  }
+}
+
+typedef struct ConvertKernel
+{
+  LodePNGColorType colortype_in;
+  unsigned bitdepth_in;
+  LodePNGColorType colortype_out;
+  unsigned bitdepth_out;
+  ConvertPixelsFunc convert;
+} ConvertKernel;
+
+/*the conversions lodepng_convert does without the generic per pixel path*/
+static const ConvertKernel convertKernels[] =
+{
+  {LCT_RGBA, 8, LCT_RGB, 8, convertRGBA8ToRGB8},
+  {LCT_RGB, 8, LCT_RGBA, 8, convertRGB8ToRGBA8},
+  {LCT_RGBA, 16, LCT_RGBA, 8, convertRGBA16ToRGBA8},
+  {LCT_GREY, 8, LCT_RGBA, 8, convertGrey8ToRGBA8},
+  {LCT_RGBA, 8, LCT_GREY, 8, convertRGBA8ToGrey8},
+  {LCT_GREY_ALPHA, 8, LCT_RGBA, 8, convertGreyAlpha8ToRGBA8},
+  {LCT_RGBA, 8, LCT_GREY_ALPHA, 8, convertRGBA8ToGreyAlpha8}
+};
+
+/*returns the kernel for converting mode_in to mode_out, or NULL if the generic path must do it*/
+static ConvertPixelsFunc getConvertKernel(const LodePNGColorMode* mode_out, const LodePNGColorMode* mode_in)
+{
+  size_t i;
+  /*the color key makes pixels of the modes without alpha channel transparent, the kernels don't do that*/
+  if(mode_in->key_defined && (mode_in->colortype == LCT_GREY || mode_in->colortype == LCT_RGB)) return 0;
+  for(i = 0; i != sizeof(convertKernels) / sizeof(*convertKernels); ++i)
+  {
+    const ConvertKernel* k = &convertKernels[i];
+    if(k->colortype_in == mode_in->colortype && k->bitdepth_in == mode_in->bitdepth
+        && k->colortype_out == mode_out->colortype && k->bitdepth_out == mode_out->bitdepth)
+    {
+      return k->convert;
+    }
+  }
+  return 0;
+}
+
 unsigned lodepng_convert(unsigned char* out, const unsigned char* in,
                          const LodePNGColorMode* mode_out, const LodePNGColorMode* mode_in,
                          unsigned w, unsigned h)
 {
   size_t i;
-  ColorTree tree;
+  ColorHash hash;
   size_t numpixels = w * h;
+  ConvertPixelsFunc convert;
 
   if(lodepng_color_mode_equal(mode_out, mode_in))
   {
@@ -3471,6 +4922,13 @@ unsigned lodepng_convert(unsigned char* out, const unsigned char* in,
     return 0;
   }
 
+  convert = getConvertKernel(mode_out, mode_in);
+  if(convert)
+  {
+    convert(out, in, numpixels);
+    return 0;
+  }
+
   if(mode_out->colortype == LCT_PALETTE)
   {
     size_t palettesize = mode_out->palettesize;
@@ -3485,11 +4943,11 @@ unsigned lodepng_convert(unsigned char* out, const unsigned char* in,
       palette = mode_in->palette;
     }
     if(palettesize < palsize) palsize = palettesize;
-    color_tree_init(&tree);
+    color_hash_init(&hash);
     for(i = 0; i != palsize; ++i)
     {
       const unsigned char* p = &palette[i * 4];
-      color_tree_add(&tree, p[0], p[1], p[2], p[3], i);
+      color_hash_add(&hash, packColorRGBA8(p[0], p[1], p[2], p[3]), i);
     }
   }
 
@@ -3516,19 +4974,179 @@ unsigned lodepng_convert(unsigned char* out, const unsigned char* in,
     for(i = 0; i != numpixels; ++i)
     {
       getPixelColorRGBA8(&r, &g, &b, &a, in, i, mode_in);
-      CERROR_TRY_RETURN(rgba8ToPixel(out, i, mode_out, &tree, r, g, b, a));
+      CERROR_TRY_RETURN(rgba8ToPixel(out, i, mode_out, &hash, r, g, b, a));
     }
   }
 
-  if(mode_out->colortype == LCT_PALETTE)
+  return 0; /*no error*/
+}
+
+#ifdef LODEPNG_COMPILE_ENCODER
+
+/*clamps to [0, 1] and rounds to the nearest of 256 steps, NaN gives 0*/
+static unsigned char floatToByte(float f)
+{
+  if(!(f > 0.0f)) return 0;
+  if(f >= 1.0f) return 255;
+  return (unsigned char)(f * 255.0f + 0.5f);
+}
+
+#ifdef LODEPNG_COMPILE_SIMD
+/*gives 4 channels as 32-bit values in 0-255, rounded like floatToByte. max returns its second operand
+for NaN, so NaN becomes 0*/
+static LODEPNG_TARGET_SSSE3 __m128i floatsToBytesSSSE3(__m128 f)
+{
+  f = _mm_min_ps(_mm_max_ps(f, _mm_setzero_ps()), _mm_set1_ps(1.0f));
+  return _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(f, _mm_set1_ps(255.0f)), _mm_set1_ps(0.5f)));
+}
+
+/*converts pixels 4 at a time, returns how many pixels were done*/
+static LODEPNG_TARGET_SSSE3 unsigned convertFloatRowSSSE3(unsigned char* out, const float* in, unsigned w,
+                                                          unsigned alpha)
+{
+  const __m128i dropalpha = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+  unsigned x;
+  for(x = 0; x + 4 <= w; x += 4)
   {
-    color_tree_cleanup(&tree);
+    __m128i c0 = floatsToBytesSSSE3(_mm_loadu_ps(&in[x * 4 + 0]));
+    __m128i c1 = floatsToBytesSSSE3(_mm_loadu_ps(&in[x * 4 + 4]));
+    __m128i c2 = floatsToBytesSSSE3(_mm_loadu_ps(&in[x * 4 + 8]));
+    __m128i c3 = floatsToBytesSSSE3(_mm_loadu_ps(&in[x * 4 + 12]));
+    __m128i bytes = _mm_packus_epi16(_mm_packs_epi32(c0, c1), _mm_packs_epi32(c2, c3));
+    if(alpha) _mm_storeu_si128((__m128i*)&out[x * 4], bytes);
+    else
+    {
+      int last;
+      bytes = _mm_shuffle_epi8(bytes, dropalpha);
+      last = _mm_cvtsi128_si32(_mm_srli_si128(bytes, 8));
+      _mm_storel_epi64((__m128i*)&out[x * 3], bytes);
+      memcpy(&out[x * 3 + 8], &last, 4);
+    }
   }
+  return x;
+}
 
-  return 0; /*no error*/
+static LODEPNG_TARGET_AVX2 __m256i floatsToBytesAVX2(__m256 f)
+{
+  f = _mm256_min_ps(_mm256_max_ps(f, _mm256_setzero_ps()), _mm256_set1_ps(1.0f));
+  return _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(f, _mm256_set1_ps(255.0f)), _mm256_set1_ps(0.5f)));
 }
 
-#ifdef LODEPNG_COMPILE_ENCODER
+/*converts pixels 8 at a time, returns how many pixels were done*/
+static LODEPNG_TARGET_AVX2 unsigned convertFloatRowAVX2(unsigned char* out, const float* in, unsigned w,
+                                                        unsigned alpha)
+{
+  const __m256i dropalpha = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+                                             0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+  /*the packs work within 128-bit lanes, which leaves the pixels in the order 0 2 4 6 1 3 5 7*/
+  const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+  unsigned x;
+  for(x = 0; x + 8 <= w; x += 8)
+  {
+    __m256i c0 = floatsToBytesAVX2(_mm256_loadu_ps(&in[x * 4 + 0]));
+    __m256i c1 = floatsToBytesAVX2(_mm256_loadu_ps(&in[x * 4 + 8]));
+    __m256i c2 = floatsToBytesAVX2(_mm256_loadu_ps(&in[x * 4 + 16]));
+    __m256i c3 = floatsToBytesAVX2(_mm256_loadu_ps(&in[x * 4 + 24]));
+    __m256i bytes = _mm256_packus_epi16(_mm256_packs_epi32(c0, c1), _mm256_packs_epi32(c2, c3));
+    bytes = _mm256_permutevar8x32_epi32(bytes, order);
+    if(alpha) _mm256_storeu_si256((__m256i*)&out[x * 4], bytes);
+    else
+    {
+      __m128i lo, hi;
+      int last;
+      bytes = _mm256_shuffle_epi8(bytes, dropalpha);
+      lo = _mm256_castsi256_si128(bytes);
+      hi = _mm256_extracti128_si256(bytes, 1);
+      _mm_storel_epi64((__m128i*)&out[x * 3], lo);
+      last = _mm_cvtsi128_si32(_mm_srli_si128(lo, 8));
+      memcpy(&out[x * 3 + 8], &last, 4);
+      _mm_storel_epi64((__m128i*)&out[x * 3 + 12], hi);
+      last = _mm_cvtsi128_si32(_mm_srli_si128(hi, 8));
+      memcpy(&out[x * 3 + 20], &last, 4);
+    }
+  }
+  return x;
+}
+#endif /*LODEPNG_COMPILE_SIMD*/
+
+/*converts one row of w float RGBA pixels to RGBA8, or RGB8 if alpha is 0*/
+static void convertFloatRow(unsigned char* out, const float* in, unsigned w, unsigned alpha)
+{
+  unsigned x = 0, numchannels = alpha ? 4 : 3;
+#ifdef LODEPNG_COMPILE_SIMD
+  if(LODEPNG_CPU_SUPPORTS("avx2")) x = convertFloatRowAVX2(out, in, w, alpha);
+  else if(LODEPNG_CPU_SUPPORTS("ssse3")) x = convertFloatRowSSSE3(out, in, w, alpha);
+#endif /*LODEPNG_COMPILE_SIMD*/
+  for(; x < w; ++x)
+  {
+    out[x * numchannels + 0] = floatToByte(in[x * 4 + 0]);
+    out[x * numchannels + 1] = floatToByte(in[x * 4 + 1]);
+    out[x * numchannels + 2] = floatToByte(in[x * 4 + 2]);
+    if(alpha) out[x * 4 + 3] = floatToByte(in[x * 4 + 3]);
+  }
+}
+
+typedef struct FloatConversion
+{
+  unsigned char* out;
+  size_t out_stride;
+  const unsigned char* in;
+  size_t in_stride;
+  unsigned w, h;
+  unsigned bandheight; /*rows per band, the last band may have less*/
+  unsigned alpha;
+} FloatConversion;
+
+static void convertFloatBand(void* context, size_t index, unsigned thread)
+{
+  const FloatConversion* c = (const FloatConversion*)context;
+  unsigned y = (unsigned)index * c->bandheight;
+  unsigned end = c->h - y < c->bandheight ? c->h : y + c->bandheight;
+  (void)thread;
+  for(; y < end; ++y)
+  {
+    convertFloatRow(&c->out[y * c->out_stride], (const float*)&c->in[y * c->in_stride], c->w, c->alpha);
+  }
+}
+
+/*minimum amount of pixels per band of rows converted by one task*/
+#define CONVERT_BAND_MIN_PIXELS 65536
+
+unsigned lodepng_convert_from_float(unsigned char* out, size_t out_stride, const float* in, size_t in_stride,
+                                    unsigned w, unsigned h, const LodePNGColorMode* mode_out, unsigned numthreads)
+{
+  FloatConversion c;
+  if(mode_out->bitdepth != 8 || (mode_out->colortype != LCT_RGB && mode_out->colortype != LCT_RGBA)) return 56;
+
+  c.out = out;
+  c.out_stride = out_stride;
+  c.in = (const unsigned char*)in;
+  c.in_stride = in_stride;
+  c.w = w;
+  c.h = h;
+  c.alpha = mode_out->colortype == LCT_RGBA;
+  c.bandheight = h;
+#ifdef LODEPNG_COMPILE_THREADS
+  numthreads = lodepng_get_num_threads(numthreads);
+  if(numthreads > 1 && w != 0 && h > 1)
+  {
+    size_t minheight = (CONVERT_BAND_MIN_PIXELS + w - 1) / w;
+    size_t numbands;
+    c.bandheight = (h + numthreads - 1) / numthreads;
+    if(c.bandheight < minheight) c.bandheight = minheight < h ? (unsigned)minheight : h;
+    numbands = (h + c.bandheight - 1) / c.bandheight;
+    if(numbands > 1)
+    {
+      lodepng_run_parallel(convertFloatBand, &c, numbands, numthreads);
+      return 0;
+    }
+  }
+#else /*LODEPNG_COMPILE_THREADS*/
+  (void)numthreads;
+#endif /*LODEPNG_COMPILE_THREADS*/
+  if(h != 0) convertFloatBand(&c, 0, 0);
+  return 0;
+}
 
 void lodepng_color_profile_init(LodePNGColorProfile* profile)
 {
@@ -3554,6 +5172,61 @@ void lodepng_color_profile_init(LodePNGColorProfile* profile)
 }*/
 
 /*Returns how many bits needed to represent given value (max 8 bit)*/
+/*
+A pixel with the same color as the one before it can't change the color profile, and runs of equal
+pixels are common in real images, so they are skipped 4 or 8 pixels per compare. Each load of the
+pixels from i on is compared with the same load one pixel earlier, for RGB the last 4 or 8 bytes of
+the loads are ignored. Returns the first pixel from i on not skipped, all pixels before it equal
+pixel i - 1. i must be at least 1.
+*/
+#ifdef LODEPNG_COMPILE_SIMD
+static LODEPNG_TARGET_SSE2 size_t skipRepeatedPixelsSSE2(const unsigned char* in, size_t i, size_t numpixels,
+                                                         unsigned channels)
+{
+  int all = channels == 4 ? 0xffff : 0x0fff;
+  for(; i * channels + 16 <= numpixels * channels; i += 4)
+  {
+    __m128i prev = _mm_loadu_si128((const __m128i*)&in[(i - 1) * channels]);
+    __m128i cur = _mm_loadu_si128((const __m128i*)&in[i * channels]);
+    if((_mm_movemask_epi8(_mm_cmpeq_epi8(prev, cur)) & all) != all) break;
+  }
+  return i;
+}
+
+static LODEPNG_TARGET_AVX2 size_t skipRepeatedPixelsAVX2(const unsigned char* in, size_t i, size_t numpixels,
+                                                         unsigned channels)
+{
+  unsigned all = channels == 4 ? 0xffffffffu : 0x00ffffffu;
+  for(; i * channels + 32 <= numpixels * channels; i += 8)
+  {
+    __m256i prev = _mm256_loadu_si256((const __m256i*)&in[(i - 1) * channels]);
+    __m256i cur = _mm256_loadu_si256((const __m256i*)&in[i * channels]);
+    if(((unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(prev, cur)) & all) != all) break;
+  }
+  return i;
+}
+#endif /*LODEPNG_COMPILE_SIMD*/
+
+/*whether 8-bit RGB or RGBA pixel i, of 3 or 4 channels, has the color of pixel i - 1*/
+static unsigned repeatsPixel(const unsigned char* in, size_t i, unsigned channels)
+{
+  const unsigned char* prev = &in[(i - 1) * channels];
+  return prev[0] == prev[channels] && prev[1] == prev[channels + 1] && prev[2] == prev[channels + 2]
+      && (channels == 3 || prev[3] == prev[7]);
+}
+
+static size_t skipRepeatedPixels(const unsigned char* in, size_t i, size_t numpixels, unsigned channels)
+{
+  /*in noisy images most pixels differ from the one before, only look further on a repeat*/
+  if(!repeatsPixel(in, i, channels)) return i;
+#ifdef LODEPNG_COMPILE_SIMD
+  if(LODEPNG_CPU_SUPPORTS("avx2")) i = skipRepeatedPixelsAVX2(in, i, numpixels, channels);
+  else if(LODEPNG_CPU_SUPPORTS("sse2")) i = skipRepeatedPixelsSSE2(in, i, numpixels, channels);
+#endif /*LODEPNG_COMPILE_SIMD*/
+  while(i != numpixels && repeatsPixel(in, i, channels)) ++i;
+  return i;
+}
+
 static unsigned getValueRequiredBits(unsigned char value)
 {
   if(value == 0 || value == 255) return 1;
@@ -3570,7 +5243,7 @@ unsigned lodepng_get_color_profile(LodePNGColorProfile* profile,
 {
   unsigned error = 0;
   size_t i;
-  ColorTree tree;
+  ColorHash hash;
   size_t numpixels = w * h;
 
   unsigned colored_done = lodepng_is_greyscale_type(mode) ? 1 : 0;
@@ -3582,7 +5255,7 @@ unsigned lodepng_get_color_profile(LodePNGColorProfile* profile,
   unsigned sixteen = 0;
   if(bpp <= 8) maxnumcolors = bpp == 1 ? 2 : (bpp == 2 ? 4 : (bpp == 4 ? 16 : 256));
 
-  color_tree_init(&tree);
+  color_hash_init(&hash);
 
   /*Check if the 16-bit input is truly 16-bit*/
   if(mode->bitdepth == 16)
@@ -3661,9 +5334,24 @@ unsigned lodepng_get_color_profile(LodePNGColorProfile* profile,
   else /* < 16-bit */
   {
     unsigned char r = 0, g = 0, b = 0, a = 0;
+    /*8-bit RGBA, and RGB without color key, are read directly instead of per pixel through the mode*/
+    unsigned channels = mode->bitdepth != 8 ? 0 : mode->colortype == LCT_RGBA ? 4
+                      : (mode->colortype == LCT_RGB && !mode->key_defined) ? 3 : 0;
     for(i = 0; i != numpixels; ++i)
     {
-      getPixelColorRGBA8(&r, &g, &b, &a, in, i, mode);
+      if(channels)
+      {
+        if(i != 0)
+        {
+          i = skipRepeatedPixels(in, i, numpixels, channels);
+          if(i == numpixels) break;
+        }
+        r = in[i * channels + 0];
+        g = in[i * channels + 1];
+        b = in[i * channels + 2];
+        a = channels == 4 ? in[i * 4 + 3] : 255;
+      }
+      else getPixelColorRGBA8(&r, &g, &b, &a, in, i, mode);
 
       if(!bits_done && profile->bits < 8)
       {
@@ -3709,9 +5397,10 @@ unsigned lodepng_get_color_profile(LodePNGColorProfile* profile,
 
       if(!numcolors_done)
       {
-        if(!color_tree_has(&tree, r, g, b, a))
+        unsigned color = packColorRGBA8(r, g, b, a);
+        if(color_hash_get(&hash, color) < 0)
         {
-          color_tree_add(&tree, r, g, b, a, profile->numcolors);
+          color_hash_add(&hash, color, profile->numcolors);
           if(profile->numcolors < 256)
           {
             unsigned char* p = profile->palette;
@@ -3726,7 +5415,8 @@ unsigned lodepng_get_color_profile(LodePNGColorProfile* profile,
         }
       }
 
-      if(alpha_done && numcolors_done && colored_done && bits_done) break;
+      /*once at 8 bits, the rest of the pixels can't raise the bits either*/
+      if(alpha_done && numcolors_done && colored_done && (bits_done || profile->bits >= 8)) break;
     }
 
     if(profile->key && !profile->alpha)
@@ -3751,7 +5441,6 @@ unsigned lodepng_get_color_profile(LodePNGColorProfile* profile,
     profile->key_b += (profile->key_b << 8);
   }
 
-  color_tree_cleanup(&tree);
   return error;
 }
 
@@ -3766,30 +5455,40 @@ unsigned lodepng_auto_choose_color(LodePNGColorMode* mode_out,
 {
   LodePNGColorProfile prof;
   unsigned error = 0;
-  unsigned i, n, palettebits, palette_ok;
 
   lodepng_color_profile_init(&prof);
   error = lodepng_get_color_profile(&prof, image, w, h, mode_in);
   if(error) return error;
+  return lodepng_auto_choose_color_from_profile(mode_out, &prof, w, h, mode_in);
+}
+
+unsigned lodepng_auto_choose_color_from_profile(LodePNGColorMode* mode_out,
+                                                const LodePNGColorProfile* profile, unsigned w, unsigned h,
+                                                const LodePNGColorMode* mode_in)
+{
+  unsigned error = 0;
+  unsigned i, n, palettebits, palette_ok;
+  unsigned alpha = profile->alpha, key = profile->key, bits = profile->bits;
+
   mode_out->key_defined = 0;
 
-  if(prof.key && w * h <= 16)
+  if(key && w * h <= 16)
   {
-    prof.alpha = 1; /*too few pixels to justify tRNS chunk overhead*/
-    prof.key = 0;
-    if(prof.bits < 8) prof.bits = 8; /*PNG has no alphachannel modes with less than 8-bit per channel*/
+    alpha = 1; /*too few pixels to justify tRNS chunk overhead*/
+    key = 0;
+    if(bits < 8) bits = 8; /*PNG has no alphachannel modes with less than 8-bit per channel*/
   }
-  n = prof.numcolors;
+  n = profile->numcolors;
   palettebits = n <= 2 ? 1 : (n <= 4 ? 2 : (n <= 16 ? 4 : 8));
-  palette_ok = n <= 256 && prof.bits <= 8;
+  palette_ok = n <= 256 && bits <= 8;
   if(w * h < n * 2) palette_ok = 0; /*don't add palette overhead if image has only a few pixels*/
-  if(!prof.colored && prof.bits <= palettebits) palette_ok = 0; /*grey is less overhead*/
+  if(!profile->colored && bits <= palettebits) palette_ok = 0; /*grey is less overhead*/
 
   if(palette_ok)
   {
-    unsigned char* p = prof.palette;
+    const unsigned char* p = profile->palette;
     lodepng_palette_clear(mode_out); /*remove potential earlier palette*/
-    for(i = 0; i != prof.numcolors; ++i)
+    for(i = 0; i != profile->numcolors; ++i)
     {
       error = lodepng_palette_add(mode_out, p[i * 4 + 0], p[i * 4 + 1], p[i * 4 + 2], p[i * 4 + 3]);
       if(error) break;
@@ -3808,16 +5507,16 @@ unsigned lodepng_auto_choose_color(LodePNGColorMode* mode_out,
   }
   else /*8-bit or 16-bit per channel*/
   {
-    mode_out->bitdepth = prof.bits;
-    mode_out->colortype = prof.alpha ? (prof.colored ? LCT_RGBA : LCT_GREY_ALPHA)
-                                     : (prof.colored ? LCT_RGB : LCT_GREY);
+    mode_out->bitdepth = bits;
+    mode_out->colortype = alpha ? (profile->colored ? LCT_RGBA : LCT_GREY_ALPHA)
+                                : (profile->colored ? LCT_RGB : LCT_GREY);
 
-    if(prof.key)
+    if(key)
     {
       unsigned mask = (1u << mode_out->bitdepth) - 1u; /*profile always uses 16-bit, mask converts it*/
-      mode_out->key_r = prof.key_r & mask;
-      mode_out->key_g = prof.key_g & mask;
-      mode_out->key_b = prof.key_b & mask;
+      mode_out->key_r = profile->key_r & mask;
+      mode_out->key_g = profile->key_g & mask;
+      mode_out->key_b = profile->key_b & mask;
       mode_out->key_defined = 1;
     }
   }
@@ -3843,6 +5542,32 @@ static unsigned char paethPredictor(short a, short b, short c)
   else return (unsigned char)a;
 }
 
+#ifdef LODEPNG_COMPILE_SIMD
+/*floor((a + b) / 2) per byte, _mm_avg_epu8 rounds up*/
+static LODEPNG_TARGET_SSE2 __m128i averageSSE2(__m128i a, __m128i b)
+{
+  __m128i odd = _mm_and_si128(_mm_xor_si128(a, b), _mm_set1_epi8(1));
+  return _mm_sub_epi8(_mm_avg_epu8(a, b), odd);
+}
+
+/*paethPredictor on 8 values widened to 16 bits, with the same tie breaking*/
+static LODEPNG_TARGET_SSE2 __m128i paethPredictorSSE2(__m128i a, __m128i b, __m128i c)
+{
+  __m128i zero = _mm_setzero_si128();
+  __m128i pa = _mm_sub_epi16(b, c);
+  __m128i pb = _mm_sub_epi16(a, c);
+  __m128i pc = _mm_add_epi16(pa, pb);
+  __m128i usec, useb;
+  pa = _mm_max_epi16(pa, _mm_sub_epi16(zero, pa));
+  pb = _mm_max_epi16(pb, _mm_sub_epi16(zero, pb));
+  pc = _mm_max_epi16(pc, _mm_sub_epi16(zero, pc));
+  usec = _mm_and_si128(_mm_cmplt_epi16(pc, pa), _mm_cmplt_epi16(pc, pb));
+  useb = _mm_cmplt_epi16(pb, pa);
+  a = _mm_or_si128(_mm_and_si128(useb, b), _mm_andnot_si128(useb, a));
+  return _mm_or_si128(_mm_and_si128(usec, c), _mm_andnot_si128(usec, a));
+}
+#endif /*LODEPNG_COMPILE_SIMD*/
+
 /*shared values used by multiple Adam7 related functions*/
 
 static const unsigned ADAM7_IX[7] = { 0, 4, 0, 2, 0, 1, 0 }; /*x start values*/
@@ -3966,9 +5691,135 @@ unsigned lodepng_inspect(unsigned* w, unsigned* h, LodePNGState* state,
   return state->error;
 }
 
-static unsigned unfilterScanline(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
-                                 size_t bytewidth, unsigned char filterType, size_t length)
-{
+#ifdef LODEPNG_COMPILE_SIMD
+/*
+SSE2 and AVX2 versions of unfilterScanline for the filter types 1 to 4, with precon not NULL. A
+reconstructed byte depends on the one bytewidth to its left, so Sub, Average and Paeth go one pixel at a
+time with the bytes of the pixel in parallel, for 3 and 4 byte pixels. Up has no such dependency and goes
+per block of 16 or 32 bytes, whatever the bytewidth. They return 0 or the index of the first byte they did
+not reconstruct, which is then at least bytewidth.
+*/
+
+/*3 byte pixels are assembled in a register, a 3 byte memcpy would go through memory and stall reading it back*/
+static LODEPNG_TARGET_SSE2 __m128i loadPixelSSE2(const unsigned char* p, size_t bytewidth)
+{
+  int value;
+  if(bytewidth == 4) memcpy(&value, p, 4);
+  else value = p[0] | (p[1] << 8) | (p[2] << 16);
+  return _mm_cvtsi32_si128(value);
+}
+
+static LODEPNG_TARGET_SSE2 void storePixelSSE2(unsigned char* p, __m128i pixel, size_t bytewidth)
+{
+  int value = _mm_cvtsi128_si32(pixel);
+  if(bytewidth == 4) memcpy(p, &value, 4);
+  else
+  {
+    p[0] = (unsigned char)value;
+    p[1] = (unsigned char)(value >> 8);
+    p[2] = (unsigned char)(value >> 16);
+  }
+}
+
+static LODEPNG_TARGET_SSE2 size_t unfilterScanlineSSE2(unsigned char* recon, const unsigned char* scanline,
+                                                       const unsigned char* precon, size_t i, size_t length,
+                                                       size_t bytewidth, unsigned char filterType)
+{
+  __m128i zero = _mm_setzero_si128();
+  __m128i a = zero; /*the reconstructed pixel to the left, 0 left of the first one*/
+  __m128i b, c = zero; /*the pixels above and above left*/
+
+  if(filterType == 2)
+  {
+    for(; i + 16 <= length; i += 16)
+    {
+      __m128i x = _mm_loadu_si128((const __m128i*)&scanline[i]);
+      b = _mm_loadu_si128((const __m128i*)&precon[i]);
+      _mm_storeu_si128((__m128i*)&recon[i], _mm_add_epi8(x, b));
+    }
+    return i;
+  }
+
+  if(i != 0 || (bytewidth != 3 && bytewidth != 4)) return i;
+  switch(filterType)
+  {
+    case 1:
+      for(; i + bytewidth <= length; i += bytewidth)
+      {
+        a = _mm_add_epi8(loadPixelSSE2(&scanline[i], bytewidth), a);
+        storePixelSSE2(&recon[i], a, bytewidth);
+      }
+      break;
+    case 3:
+      for(; i + bytewidth <= length; i += bytewidth)
+      {
+        b = loadPixelSSE2(&precon[i], bytewidth);
+        a = _mm_add_epi8(loadPixelSSE2(&scanline[i], bytewidth), averageSSE2(a, b));
+        storePixelSSE2(&recon[i], a, bytewidth);
+      }
+      break;
+    case 4:
+      for(; i + bytewidth <= length; i += bytewidth)
+      {
+        __m128i predictor;
+        b = _mm_unpacklo_epi8(loadPixelSSE2(&precon[i], bytewidth), zero);
+        predictor = paethPredictorSSE2(_mm_unpacklo_epi8(a, zero), b, c);
+        a = _mm_add_epi8(loadPixelSSE2(&scanline[i], bytewidth), _mm_packus_epi16(predictor, predictor));
+        storePixelSSE2(&recon[i], a, bytewidth);
+        c = b;
+      }
+      break;
+    default: break;
+  }
+  return i;
+}
+
+static LODEPNG_TARGET_AVX2 size_t unfilterScanlineAVX2(unsigned char* recon, const unsigned char* scanline,
+                                                       const unsigned char* precon, size_t i, size_t length,
+                                                       unsigned char filterType)
+{
+  if(filterType == 2)
+  {
+    for(; i + 32 <= length; i += 32)
+    {
+      __m256i x = _mm256_loadu_si256((const __m256i*)&scanline[i]);
+      __m256i b = _mm256_loadu_si256((const __m256i*)&precon[i]);
+      _mm256_storeu_si256((__m256i*)&recon[i], _mm256_add_epi8(x, b));
+    }
+  }
+  return i;
+}
+#endif /*LODEPNG_COMPILE_SIMD*/
+
+/*reconstructs as much of the scanline as the CPU can do with SIMD, returns where the portable code has to
+continue, see unfilterScanlineSSE2*/
+static size_t unfilterScanlineSIMD(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                                   size_t length, size_t bytewidth, unsigned char filterType)
+{
+  size_t i = 0;
+#ifdef LODEPNG_COMPILE_SIMD
+  if(LODEPNG_CPU_SUPPORTS("avx2"))
+  {
+    i = unfilterScanlineAVX2(recon, scanline, precon, i, length, filterType);
+  }
+  if(LODEPNG_CPU_SUPPORTS("sse2"))
+  {
+    i = unfilterScanlineSSE2(recon, scanline, precon, i, length, bytewidth, filterType);
+  }
+#else /*LODEPNG_COMPILE_SIMD*/
+  (void)recon;
+  (void)scanline;
+  (void)precon;
+  (void)length;
+  (void)bytewidth;
+  (void)filterType;
+#endif /*LODEPNG_COMPILE_SIMD*/
+  return i;
+}
+
+static unsigned unfilterScanline(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                                 size_t bytewidth, unsigned char filterType, size_t length)
+{
   /*
   For PNG filter method 0
   unfilter a PNG image scanline by scanline. when the pixels are smaller than 1 byte,
@@ -3985,13 +5836,15 @@ static unsigned unfilterScanline(unsigned char* recon, const unsigned char* scan
       for(i = 0; i != length; ++i) recon[i] = scanline[i];
       break;
     case 1:
-      for(i = 0; i != bytewidth; ++i) recon[i] = scanline[i];
-      for(i = bytewidth; i < length; ++i) recon[i] = scanline[i] + recon[i - bytewidth];
+      i = unfilterScanlineSIMD(recon, scanline, precon, length, bytewidth, 1);
+      if(i == 0) for(; i != bytewidth; ++i) recon[i] = scanline[i];
+      for(; i < length; ++i) recon[i] = scanline[i] + recon[i - bytewidth];
       break;
     case 2:
       if(precon)
       {
-        for(i = 0; i != length; ++i) recon[i] = scanline[i] + precon[i];
+        i = unfilterScanlineSIMD(recon, scanline, precon, length, bytewidth, 2);
+        for(; i != length; ++i) recon[i] = scanline[i] + precon[i];
       }
       else
       {
@@ -4001,8 +5854,9 @@ static unsigned unfilterScanline(unsigned char* recon, const unsigned char* scan
     case 3:
       if(precon)
       {
-        for(i = 0; i != bytewidth; ++i) recon[i] = scanline[i] + (precon[i] >> 1);
-        for(i = bytewidth; i < length; ++i) recon[i] = scanline[i] + ((recon[i - bytewidth] + precon[i]) >> 1);
+        i = unfilterScanlineSIMD(recon, scanline, precon, length, bytewidth, 3);
+        if(i == 0) for(; i != bytewidth; ++i) recon[i] = scanline[i] + (precon[i] >> 1);
+        for(; i < length; ++i) recon[i] = scanline[i] + ((recon[i - bytewidth] + precon[i]) >> 1);
       }
       else
       {
@@ -4013,11 +5867,12 @@ static unsigned unfilterScanline(unsigned char* recon, const unsigned char* scan
     case 4:
       if(precon)
       {
-        for(i = 0; i != bytewidth; ++i)
+        i = unfilterScanlineSIMD(recon, scanline, precon, length, bytewidth, 4);
+        if(i == 0) for(; i != bytewidth; ++i)
         {
           recon[i] = (scanline[i] + precon[i]); /*paethPredictor(0, precon[i], 0) is always precon[i]*/
         }
-        for(i = bytewidth; i < length; ++i)
+        for(; i < length; ++i)
         {
           recon[i] = (scanline[i] + paethPredictor(recon[i - bytewidth], precon[i], precon[i - bytewidth]));
         }
@@ -4518,19 +6373,63 @@ static unsigned readChunk_pHYs(LodePNGInfo* info, const unsigned char* data, siz
 }
 #endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
 
-/*read a PNG, the result will be in the same color type as the PNG (hence "generic")*/
-static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
-                          LodePNGState* state,
-                          const unsigned char* in, size_t insize)
+/*returns error 92 if the image has too many pixels to decode*/
+static unsigned checkNumPixels(unsigned w, unsigned h)
+{
+  size_t numpixels = (size_t)w * h;
+  /*multiplication overflow*/
+  if(h != 0 && numpixels / h != w) return 92;
+  /*multiplication overflow possible further below. Allows up to 2^31-1 pixel
+  bytes with 16-bit RGBA, the rest is room for filter bytes.*/
+  if(numpixels > 268435455) return 92;
+  return 0;
+}
+
+/*
+Unfilters the non-interlaced scanlines in place one at a time, and converts each to mode_out straight
+into out while it is still in the cache. The rows of mode_out must be a whole number of bytes.
+*/
+static unsigned unfilterConvertScanlines(unsigned char* out, unsigned char* in, unsigned w, unsigned h,
+                                         const LodePNGColorMode* mode_out, const LodePNGColorMode* mode_in)
+{
+  unsigned y;
+  unsigned char* prevline = 0;
+  unsigned bpp = lodepng_get_bpp(mode_in);
+  size_t bytewidth = (bpp + 7) / 8;
+  size_t linebytes = (w * bpp + 7) / 8;
+  size_t outlinebytes = lodepng_get_raw_size(w, 1, mode_out);
+
+  for(y = 0; y < h; ++y)
+  {
+    unsigned char* line = &in[(1 + linebytes) * y + 1]; /*after the filter byte*/
+    CERROR_TRY_RETURN(unfilterScanline(line, line, prevline, bytewidth, line[-1], linebytes));
+    CERROR_TRY_RETURN(lodepng_convert(&out[outlinebytes * y], line, mode_out, mode_in, w, 1));
+    prevline = line;
+  }
+
+  return 0;
+}
+
+/*
+Read a PNG into out, in the color type of info_raw, or in that of the PNG if color_convert is off. The
+IDAT data is decompressed into a buffer of exactly the size the header predicts, and then unfiltered and
+converted into out. Only interlaced images that need converting use a full size temporary image.
+*/
+static void decodeInto(unsigned char* out, size_t outsize, unsigned* w, unsigned* h,
+                       LodePNGState* state,
+                       const unsigned char* in, size_t insize)
 {
   unsigned char IEND = 0;
   const unsigned char* chunk;
   size_t i;
-  ucvector idat; /*the data from idat chunks*/
+  const unsigned char* idat = 0; /*the data from the idat chunks*/
+  unsigned char* idatbuffer = 0; /*only used if the idat data is split over several chunks*/
+  size_t idatsize = 0;
+  unsigned numidat = 0;
   ucvector scanlines;
   size_t predict;
-  size_t numpixels;
-  size_t outsize = 0;
+  size_t rawsize = 0;
+  unsigned convert = 0;
 
   /*for unknown chunk order*/
   unsigned unknown = 0;
@@ -4538,25 +6437,16 @@ static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
   unsigned critical_pos = 1; /*1 = after IHDR, 2 = after PLTE, 3 = after IDAT*/
 #endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
 
-  /*provide some proper output values if error will happen*/
-  *out = 0;
-
   state->error = lodepng_inspect(w, h, state, in, insize); /*reads header and resets other parameters in state->info_png*/
   if(state->error) return;
 
-  numpixels = *w * *h;
-
-  /*multiplication overflow*/
-  if(*h != 0 && numpixels / *h != *w) CERROR_RETURN(state->error, 92);
-  /*multiplication overflow possible further below. Allows up to 2^31-1 pixel
-  bytes with 16-bit RGBA, the rest is room for filter bytes.*/
-  if(numpixels > 268435455) CERROR_RETURN(state->error, 92);
+  state->error = checkNumPixels(*w, *h);
+  if(state->error) return;
 
-  ucvector_init(&idat);
   chunk = &in[33]; /*first byte of the first chunk after the header*/
 
   /*loop through the chunks, ignoring unknown chunks and stopping at IEND chunk.
-  IDAT data is put at the start of the in buffer*/
+  Only the location and total size of the IDAT data is noted here*/
   while(!IEND && !state->error)
   {
     unsigned chunkLength;
@@ -4580,9 +6470,8 @@ static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
     /*IDAT chunk, containing compressed image data*/
     if(lodepng_chunk_type_equals(chunk, "IDAT"))
     {
-      size_t oldsize = idat.size;
-      if(!ucvector_resize(&idat, oldsize + chunkLength)) CERROR_BREAK(state->error, 83 /*alloc fail*/);
-      for(i = 0; i != chunkLength; ++i) idat.data[oldsize + i] = data[i];
+      if(numidat++ == 0) idat = data;
+      idatsize += chunkLength;
 #ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
       critical_pos = 3;
 #endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
@@ -4676,7 +6565,48 @@ static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
     if(!IEND) chunk = lodepng_chunk_next_const(chunk);
   }
 
-  ucvector_init(&scanlines);
+  if(state->error) return;
+
+  if(!state->decoder.color_convert)
+  {
+    /*store the info_png color settings on the info_raw so that the info_raw still reflects what colortype
+    the raw image has to the end user*/
+    state->error = lodepng_color_mode_copy(&state->info_raw, &state->info_png.color);
+    if(state->error) return;
+  }
+  else if(!lodepng_color_mode_equal(&state->info_raw, &state->info_png.color))
+  {
+    /*TODO: check if this works according to the statement in the documentation: "The converter can convert
+    from greyscale input color type, to 8-bit greyscale or greyscale with alpha"*/
+    if(!(state->info_raw.colortype == LCT_RGB || state->info_raw.colortype == LCT_RGBA)
+       && !(state->info_raw.bitdepth == 8))
+    {
+      CERROR_RETURN(state->error, 56); /*unsupported color mode conversion*/
+    }
+    convert = 1;
+  }
+
+  rawsize = lodepng_get_raw_size(*w, *h, &state->info_raw);
+  if(outsize < rawsize) CERROR_RETURN(state->error, 100);
+
+  /*a single IDAT chunk is decompressed where it is, the data of several is concatenated first*/
+  if(numidat > 1 && idatsize != 0)
+  {
+    size_t pos = 0;
+    idatbuffer = (unsigned char*)lodepng_malloc(idatsize);
+    if(!idatbuffer) CERROR_RETURN(state->error, 83); /*alloc fail*/
+    for(chunk = &in[33]; pos != idatsize; chunk = lodepng_chunk_next_const(chunk))
+    {
+      if(lodepng_chunk_type_equals(chunk, "IDAT"))
+      {
+        unsigned chunkLength = lodepng_chunk_length(chunk);
+        memcpy(idatbuffer + pos, lodepng_chunk_data_const(chunk), chunkLength);
+        pos += chunkLength;
+      }
+    }
+    idat = idatbuffer;
+  }
+
   /*predict output size, to allocate exact size for output buffer to avoid more dynamic allocation.
   If the decompressed size does not match the prediction, the image must be corrupt.*/
   if(state->info_png.interlace_method == 0)
@@ -4697,25 +6627,39 @@ static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
     if(*w > 1) predict += lodepng_get_raw_size_idat((*w + 0) >> 1, (*h + 1) >> 1, color) + ((*h + 1) >> 1);
     predict += lodepng_get_raw_size_idat((*w + 0), (*h + 0) >> 1, color) + ((*h + 0) >> 1);
   }
-  if(!state->error && !ucvector_reserve(&scanlines, predict)) state->error = 83; /*alloc fail*/
-  if(!state->error)
-  {
-    state->error = zlib_decompress(&scanlines.data, &scanlines.size, idat.data,
-                                   idat.size, &state->decoder.zlibsettings);
-    if(!state->error && scanlines.size != predict) state->error = 91; /*decompressed size doesn't match prediction*/
-  }
-  ucvector_cleanup(&idat);
+  ucvector_init(&scanlines);
+  state->error = zlib_decompressv(&scanlines, predict, idat, idatsize, &state->decoder.zlibsettings);
+  if(!state->error && scanlines.size != predict) state->error = 91; /*decompressed size doesn't match prediction*/
+  lodepng_free(idatbuffer);
 
   if(!state->error)
   {
-    outsize = lodepng_get_raw_size(*w, *h, &state->info_png.color);
-    *out = (unsigned char*)lodepng_malloc(outsize);
-    if(!*out) state->error = 83; /*alloc fail*/
-  }
-  if(!state->error)
-  {
-    for(i = 0; i < outsize; i++) (*out)[i] = 0;
-    state->error = postProcessScanlines(*out, scanlines.data, *w, *h, &state->info_png);
+    /*pixels smaller than a byte are written with bit operations that expect zeroed output*/
+    if(lodepng_get_bpp(&state->info_raw) < 8) for(i = 0; i != rawsize; ++i) out[i] = 0;
+
+    if(!convert) state->error = postProcessScanlines(out, scanlines.data, *w, *h, &state->info_png);
+    else if(state->info_png.interlace_method == 0 && lodepng_get_bpp(&state->info_raw) % 8 == 0)
+    {
+      state->error = unfilterConvertScanlines(out, scanlines.data, *w, *h,
+                                              &state->info_raw, &state->info_png.color);
+    }
+    else
+    {
+      /*Adam7 must be deinterlaced into a full image before it can be converted*/
+      size_t size = lodepng_get_raw_size(*w, *h, &state->info_png.color);
+      unsigned char* data = (unsigned char*)lodepng_malloc(size);
+      if(!data) state->error = 83; /*alloc fail*/
+      else
+      {
+        for(i = 0; i != size; ++i) data[i] = 0;
+        state->error = postProcessScanlines(data, scanlines.data, *w, *h, &state->info_png);
+        if(!state->error)
+        {
+          state->error = lodepng_convert(out, data, &state->info_raw, &state->info_png.color, *w, *h);
+        }
+      }
+      lodepng_free(data);
+    }
   }
   ucvector_cleanup(&scanlines);
 }
@@ -4724,47 +6668,34 @@ unsigned lodepng_decode(unsigned char** out, unsigned* w, unsigned* h,
                         LodePNGState* state,
                         const unsigned char* in, size_t insize)
 {
+  size_t outsize;
   *out = 0;
-  decodeGeneric(out, w, h, state, in, insize);
+  state->error = lodepng_inspect(w, h, state, in, insize);
+  if(!state->error) state->error = checkNumPixels(*w, *h);
   if(state->error) return state->error;
-  if(!state->decoder.color_convert || lodepng_color_mode_equal(&state->info_raw, &state->info_png.color))
-  {
-    /*same color type, no copying or converting of data needed*/
-    /*store the info_png color settings on the info_raw so that the info_raw still reflects what colortype
-    the raw image has to the end user*/
-    if(!state->decoder.color_convert)
-    {
-      state->error = lodepng_color_mode_copy(&state->info_raw, &state->info_png.color);
-      if(state->error) return state->error;
-    }
-  }
-  else
-  {
-    /*color conversion needed; sort of copy of the data*/
-    unsigned char* data = *out;
-    size_t outsize;
 
-    /*TODO: check if this works according to the statement in the documentation: "The converter can convert
-    from greyscale input color type, to 8-bit greyscale or greyscale with alpha"*/
-    if(!(state->info_raw.colortype == LCT_RGB || state->info_raw.colortype == LCT_RGBA)
-       && !(state->info_raw.bitdepth == 8))
-    {
-      return 56; /*unsupported color mode conversion*/
-    }
+  /*the header is enough to know the size of the output, so it is allocated once, at its final size*/
+  outsize = lodepng_get_raw_size(*w, *h, state->decoder.color_convert ? &state->info_raw : &state->info_png.color);
+  *out = (unsigned char*)lodepng_malloc(outsize);
+  if(!*out) CERROR_RETURN_ERROR(state->error, 83); /*alloc fail*/
 
-    outsize = lodepng_get_raw_size(*w, *h, &state->info_raw);
-    *out = (unsigned char*)lodepng_malloc(outsize);
-    if(!(*out))
-    {
-      state->error = 83; /*alloc fail*/
-    }
-    else state->error = lodepng_convert(*out, data, &state->info_raw,
-                                        &state->info_png.color, *w, *h);
-    lodepng_free(data);
+  decodeInto(*out, outsize, w, h, state, in, insize);
+  if(state->error)
+  {
+    lodepng_free(*out);
+    *out = 0;
   }
   return state->error;
 }
 
+unsigned lodepng_decode_into(unsigned char* out, size_t outsize, unsigned* w, unsigned* h,
+                             LodePNGState* state,
+                             const unsigned char* in, size_t insize)
+{
+  decodeInto(out, outsize, w, h, state, in, insize);
+  return state->error;
+}
+
 unsigned lodepng_decode_memory(unsigned char** out, unsigned* w, unsigned* h, const unsigned char* in,
                                size_t insize, LodePNGColorType colortype, unsigned bitdepth)
 {
@@ -4792,12 +6723,12 @@ unsigned lodepng_decode24(unsigned char** out, unsigned* w, unsigned* h, const u
 unsigned lodepng_decode_file(unsigned char** out, unsigned* w, unsigned* h, const char* filename,
                              LodePNGColorType colortype, unsigned bitdepth)
 {
-  unsigned char* buffer = 0;
-  size_t buffersize;
+  const unsigned char* buffer = 0;
+  size_t buffersize = 0;
   unsigned error;
-  error = lodepng_load_file(&buffer, &buffersize, filename);
+  error = lodepng_map_file(&buffer, &buffersize, filename);
   if(!error) error = lodepng_decode_memory(out, w, h, buffer, buffersize, colortype, bitdepth);
-  lodepng_free(buffer);
+  lodepng_unmap_file(buffer, buffersize);
   return error;
 }
 
@@ -4864,11 +6795,37 @@ void lodepng_state_copy(LodePNGState* dest, const LodePNGState* source)
 /* / PNG Encoder                                                            / */
 /* ////////////////////////////////////////////////////////////////////////// */
 
+/*
+The buffers an encoder context keeps between images. The vectors only ever grow, so once they are big
+enough for the images encoded with it, encoding does not allocate them anymore.
+*/
+typedef struct LodePNGEncoderContextInternal
+{
+  LodePNGAllocator custom; /*copy of the allocator given to lodepng_encoder_context_init*/
+  const LodePNGAllocator* allocator; /*&custom, or NULL for lodepng_realloc and lodepng_free*/
+  ucvector png; /*the result of the last lodepng_encode_context*/
+  ucvector converted; /*the image in the color type of the PNG, if it was given in another one*/
+  ucvector filtered; /*the filtered scanlines, the data of the IDAT chunk before compression*/
+  ucvector adam7; /*the 7 Adam7 reduced images*/
+  ucvector padded; /*scanlines with padding bits to a whole byte, for less than 8 bits per pixel*/
+  ucvector attempts; /*the rows with each of the 5 filter types of each thread, for the adaptive filter strategies*/
+#ifdef LODEPNG_COMPILE_ZLIB
+  Hash* hashes; /*LZ77 hash table and symbol buffer of each thread deflating, see hashes_reserve*/
+  unsigned numhashes;
+#endif /*LODEPNG_COMPILE_ZLIB*/
+} LodePNGEncoderContextInternal;
+
 /*chunkName must be string of 4 characters*/
 static unsigned addChunk(ucvector* out, const char* chunkName, const unsigned char* data, size_t length)
 {
-  CERROR_TRY_RETURN(lodepng_chunk_create(&out->data, &out->size, (unsigned)length, chunkName, data));
-  out->allocsize = out->size; /*fix the allocsize again*/
+  size_t pos = out->size;
+  if(pos + length + 12 < length + 12) return 77; /*integer overflow happened*/
+  /*grows out like the other vectors, also when it uses the allocator of an encoder context*/
+  if(!ucvector_resize(out, pos + length + 12)) return 83; /*alloc fail*/
+  lodepng_set32bitInt(&out->data[pos], (unsigned)length);
+  memcpy(&out->data[pos + 4], chunkName, 4);
+  if(length) memcpy(&out->data[pos + 8], data, length);
+  lodepng_chunk_generate_crc(&out->data[pos]);
   return 0;
 }
 
@@ -4969,12 +6926,40 @@ static unsigned addChunk_tRNS(ucvector* out, const LodePNGColorMode* info)
 }
 
 static unsigned addChunk_IDAT(ucvector* out, const unsigned char* data, size_t datasize,
-                              LodePNGCompressSettings* zlibsettings)
+                              LodePNGCompressSettings* zlibsettings, LodePNGEncoderContextInternal* context)
 {
   ucvector zlibdata;
   unsigned error = 0;
 
-  /*compress with the Zlib compressor*/
+#ifdef LODEPNG_COMPILE_ZLIB
+  if(!zlibsettings->custom_zlib)
+  {
+    /*compressed in place, behind the length and type of the chunk, which are filled in afterwards*/
+    size_t pos = out->size;
+    Hash* hash = 0;
+    if(zlibsettings->btype == 1 || zlibsettings->btype == 2)
+    {
+      unsigned numhashes = 1;
+#ifdef LODEPNG_COMPILE_THREADS
+      if(useParallelDeflate(datasize, zlibsettings)) numhashes = lodepng_get_num_threads(zlibsettings->numthreads);
+#endif /*LODEPNG_COMPILE_THREADS*/
+      CERROR_TRY_RETURN(hashes_reserve(&context->hashes, &context->numhashes, numhashes, zlibsettings->windowsize,
+                                       context->allocator));
+      hash = context->hashes;
+    }
+    if(!ucvector_resize(out, pos + 8)) return 83; /*alloc fail*/
+    CERROR_TRY_RETURN(lodepng_zlib_compressv(out, data, datasize, zlibsettings, hash));
+    lodepng_set32bitInt(&out->data[pos], (unsigned)(out->size - pos - 8));
+    memcpy(&out->data[pos + 4], "IDAT", 4);
+    if(!ucvector_resize(out, out->size + 4)) return 83; /*alloc fail*/
+    lodepng_chunk_generate_crc(&out->data[pos]);
+    return 0;
+  }
+#else /*LODEPNG_COMPILE_ZLIB*/
+  (void)context;
+#endif /*LODEPNG_COMPILE_ZLIB*/
+
+  /*compress with the custom Zlib compressor, which allocates its own output*/
   ucvector_init(&zlibdata);
   error = zlib_compress(&zlibdata.data, &zlibdata.size, data, datasize, zlibsettings);
   if(!error) error = addChunk(out, "IDAT", zlibdata.data, zlibdata.size);
@@ -5141,6 +7126,204 @@ static unsigned addChunk_pHYs(ucvector* out, const LodePNGInfo* info)
 
 #endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
 
+#ifdef LODEPNG_COMPILE_SIMD
+/*
+SSE2 and AVX2 versions of filterScanline for the filter types 1 to 4. They filter the bytes from
+index i on in blocks of 16 or 32 and return the index of the first byte they did not filter.
+i must be at least bytewidth for the types that look left, and prevline must not be NULL for
+the types that look up. Filtering only reads unfiltered bytes, so unlike unfiltering the bytes of
+a block never depend on each other, whatever the bytewidth.
+*/
+
+static LODEPNG_TARGET_SSE2 size_t filterScanlineSSE2(unsigned char* out, const unsigned char* scanline,
+                                                     const unsigned char* prevline, size_t i, size_t length,
+                                                     size_t bytewidth, unsigned char filterType)
+{
+  __m128i zero = _mm_setzero_si128();
+  switch(filterType)
+  {
+    case 1: /*Sub*/
+      for(; i + 16 <= length; i += 16)
+      {
+        __m128i s = _mm_loadu_si128((const __m128i*)&scanline[i]);
+        __m128i a = _mm_loadu_si128((const __m128i*)&scanline[i - bytewidth]);
+        _mm_storeu_si128((__m128i*)&out[i], _mm_sub_epi8(s, a));
+      }
+      break;
+    case 2: /*Up*/
+      for(; i + 16 <= length; i += 16)
+      {
+        __m128i s = _mm_loadu_si128((const __m128i*)&scanline[i]);
+        __m128i b = _mm_loadu_si128((const __m128i*)&prevline[i]);
+        _mm_storeu_si128((__m128i*)&out[i], _mm_sub_epi8(s, b));
+      }
+      break;
+    case 3: /*Average*/
+      for(; i + 16 <= length; i += 16)
+      {
+        __m128i s = _mm_loadu_si128((const __m128i*)&scanline[i]);
+        __m128i a = _mm_loadu_si128((const __m128i*)&scanline[i - bytewidth]);
+        __m128i b = _mm_loadu_si128((const __m128i*)&prevline[i]);
+        _mm_storeu_si128((__m128i*)&out[i], _mm_sub_epi8(s, averageSSE2(a, b)));
+      }
+      break;
+    case 4: /*Paeth*/
+      for(; i + 16 <= length; i += 16)
+      {
+        __m128i s = _mm_loadu_si128((const __m128i*)&scanline[i]);
+        __m128i a = _mm_loadu_si128((const __m128i*)&scanline[i - bytewidth]);
+        __m128i b = _mm_loadu_si128((const __m128i*)&prevline[i]);
+        __m128i c = _mm_loadu_si128((const __m128i*)&prevline[i - bytewidth]);
+        __m128i lo = paethPredictorSSE2(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero),
+                                        _mm_unpacklo_epi8(c, zero));
+        __m128i hi = paethPredictorSSE2(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero),
+                                        _mm_unpackhi_epi8(c, zero));
+        _mm_storeu_si128((__m128i*)&out[i], _mm_sub_epi8(s, _mm_packus_epi16(lo, hi)));
+      }
+      break;
+    default: break;
+  }
+  return i;
+}
+
+static LODEPNG_TARGET_AVX2 __m256i averageAVX2(__m256i a, __m256i b)
+{
+  __m256i odd = _mm256_and_si256(_mm256_xor_si256(a, b), _mm256_set1_epi8(1));
+  return _mm256_sub_epi8(_mm256_avg_epu8(a, b), odd);
+}
+
+static LODEPNG_TARGET_AVX2 __m256i paethPredictorAVX2(__m256i a, __m256i b, __m256i c)
+{
+  __m256i pa = _mm256_sub_epi16(b, c);
+  __m256i pb = _mm256_sub_epi16(a, c);
+  __m256i pc = _mm256_abs_epi16(_mm256_add_epi16(pa, pb));
+  __m256i usec, useb;
+  pa = _mm256_abs_epi16(pa);
+  pb = _mm256_abs_epi16(pb);
+  usec = _mm256_and_si256(_mm256_cmpgt_epi16(pa, pc), _mm256_cmpgt_epi16(pb, pc));
+  useb = _mm256_cmpgt_epi16(pa, pb);
+  return _mm256_blendv_epi8(_mm256_blendv_epi8(a, b, useb), c, usec);
+}
+
+static LODEPNG_TARGET_AVX2 size_t filterScanlineAVX2(unsigned char* out, const unsigned char* scanline,
+                                                     const unsigned char* prevline, size_t i, size_t length,
+                                                     size_t bytewidth, unsigned char filterType)
+{
+  __m256i zero = _mm256_setzero_si256();
+  switch(filterType)
+  {
+    case 1: /*Sub*/
+      for(; i + 32 <= length; i += 32)
+      {
+        __m256i s = _mm256_loadu_si256((const __m256i*)&scanline[i]);
+        __m256i a = _mm256_loadu_si256((const __m256i*)&scanline[i - bytewidth]);
+        _mm256_storeu_si256((__m256i*)&out[i], _mm256_sub_epi8(s, a));
+      }
+      break;
+    case 2: /*Up*/
+      for(; i + 32 <= length; i += 32)
+      {
+        __m256i s = _mm256_loadu_si256((const __m256i*)&scanline[i]);
+        __m256i b = _mm256_loadu_si256((const __m256i*)&prevline[i]);
+        _mm256_storeu_si256((__m256i*)&out[i], _mm256_sub_epi8(s, b));
+      }
+      break;
+    case 3: /*Average*/
+      for(; i + 32 <= length; i += 32)
+      {
+        __m256i s = _mm256_loadu_si256((const __m256i*)&scanline[i]);
+        __m256i a = _mm256_loadu_si256((const __m256i*)&scanline[i - bytewidth]);
+        __m256i b = _mm256_loadu_si256((const __m256i*)&prevline[i]);
+        _mm256_storeu_si256((__m256i*)&out[i], _mm256_sub_epi8(s, averageAVX2(a, b)));
+      }
+      break;
+    case 4: /*Paeth*/
+      for(; i + 32 <= length; i += 32)
+      {
+        /*unpack and pack both work per 128-bit lane, so together they keep the byte order*/
+        __m256i s = _mm256_loadu_si256((const __m256i*)&scanline[i]);
+        __m256i a = _mm256_loadu_si256((const __m256i*)&scanline[i - bytewidth]);
+        __m256i b = _mm256_loadu_si256((const __m256i*)&prevline[i]);
+        __m256i c = _mm256_loadu_si256((const __m256i*)&prevline[i - bytewidth]);
+        __m256i lo = paethPredictorAVX2(_mm256_unpacklo_epi8(a, zero), _mm256_unpacklo_epi8(b, zero),
+                                        _mm256_unpacklo_epi8(c, zero));
+        __m256i hi = paethPredictorAVX2(_mm256_unpackhi_epi8(a, zero), _mm256_unpackhi_epi8(b, zero),
+                                        _mm256_unpackhi_epi8(c, zero));
+        _mm256_storeu_si256((__m256i*)&out[i], _mm256_sub_epi8(s, _mm256_packus_epi16(lo, hi)));
+      }
+      break;
+    default: break;
+  }
+  return i;
+}
+
+/*
+The sum of filterScanlineSum on blocks of 16 or 32 bytes: psadbw adds up the bytes, after
+the negative ones of the filter types other than 0 are turned into 255 - s with an xor.
+Returns the sum of the bytes from *i on and moves *i to the first byte not summed.
+*/
+static LODEPNG_TARGET_SSE2 size_t filterScanlineSumSSE2(const unsigned char* data, size_t* i, size_t length,
+                                                        unsigned char filterType)
+{
+  __m128i zero = _mm_setzero_si128();
+  __m128i sum = zero;
+  unsigned long long lanes[2];
+  size_t pos = *i;
+  for(; pos + 16 <= length; pos += 16)
+  {
+    __m128i s = _mm_loadu_si128((const __m128i*)&data[pos]);
+    if(filterType != 0) s = _mm_xor_si128(s, _mm_cmplt_epi8(s, zero));
+    sum = _mm_add_epi64(sum, _mm_sad_epu8(s, zero));
+  }
+  *i = pos;
+  _mm_storeu_si128((__m128i*)lanes, sum);
+  return (size_t)(lanes[0] + lanes[1]);
+}
+
+static LODEPNG_TARGET_AVX2 size_t filterScanlineSumAVX2(const unsigned char* data, size_t* i, size_t length,
+                                                        unsigned char filterType)
+{
+  __m256i zero = _mm256_setzero_si256();
+  __m256i sum = zero;
+  unsigned long long lanes[4];
+  size_t pos = *i;
+  for(; pos + 32 <= length; pos += 32)
+  {
+    __m256i s = _mm256_loadu_si256((const __m256i*)&data[pos]);
+    if(filterType != 0) s = _mm256_xor_si256(s, _mm256_cmpgt_epi8(zero, s));
+    sum = _mm256_add_epi64(sum, _mm256_sad_epu8(s, zero));
+  }
+  *i = pos;
+  _mm256_storeu_si256((__m256i*)lanes, sum);
+  return (size_t)(lanes[0] + lanes[1] + lanes[2] + lanes[3]);
+}
+#endif /*LODEPNG_COMPILE_SIMD*/
+
+/*filters as much of the scanline from index i on as the CPU can do with SIMD, returns where the
+portable code has to continue. See filterScanlineSSE2 for the requirements.*/
+static size_t filterScanlineSIMD(unsigned char* out, const unsigned char* scanline, const unsigned char* prevline,
+                                 size_t i, size_t length, size_t bytewidth, unsigned char filterType)
+{
+#ifdef LODEPNG_COMPILE_SIMD
+  if(LODEPNG_CPU_SUPPORTS("avx2"))
+  {
+    i = filterScanlineAVX2(out, scanline, prevline, i, length, bytewidth, filterType);
+  }
+  if(LODEPNG_CPU_SUPPORTS("sse2"))
+  {
+    i = filterScanlineSSE2(out, scanline, prevline, i, length, bytewidth, filterType);
+  }
+#else /*LODEPNG_COMPILE_SIMD*/
+  (void)out;
+  (void)scanline;
+  (void)prevline;
+  (void)length;
+  (void)bytewidth;
+  (void)filterType;
+#endif /*LODEPNG_COMPILE_SIMD*/
+  return i;
+}
+
 static void filterScanline(unsigned char* out, const unsigned char* scanline, const unsigned char* prevline,
                            size_t length, size_t bytewidth, unsigned char filterType)
 {
@@ -5152,12 +7335,14 @@ static void filterScanline(unsigned char* out, const unsigned char* scanline, co
       break;
     case 1: /*Sub*/
       for(i = 0; i != bytewidth; ++i) out[i] = scanline[i];
-      for(i = bytewidth; i < length; ++i) out[i] = scanline[i] - scanline[i - bytewidth];
+      i = filterScanlineSIMD(out, scanline, prevline, i, length, bytewidth, 1);
+      for(; i < length; ++i) out[i] = scanline[i] - scanline[i - bytewidth];
       break;
     case 2: /*Up*/
       if(prevline)
       {
-        for(i = 0; i != length; ++i) out[i] = scanline[i] - prevline[i];
+        i = filterScanlineSIMD(out, scanline, prevline, 0, length, bytewidth, 2);
+        for(; i != length; ++i) out[i] = scanline[i] - prevline[i];
       }
       else
       {
@@ -5168,7 +7353,8 @@ static void filterScanline(unsigned char* out, const unsigned char* scanline, co
       if(prevline)
       {
         for(i = 0; i != bytewidth; ++i) out[i] = scanline[i] - (prevline[i] >> 1);
-        for(i = bytewidth; i < length; ++i) out[i] = scanline[i] - ((scanline[i - bytewidth] + prevline[i]) >> 1);
+        i = filterScanlineSIMD(out, scanline, prevline, i, length, bytewidth, 3);
+        for(; i < length; ++i) out[i] = scanline[i] - ((scanline[i - bytewidth] + prevline[i]) >> 1);
       }
       else
       {
@@ -5181,7 +7367,8 @@ static void filterScanline(unsigned char* out, const unsigned char* scanline, co
       {
         /*paethPredictor(0, prevline[i], 0) is always prevline[i]*/
         for(i = 0; i != bytewidth; ++i) out[i] = (scanline[i] - prevline[i]);
-        for(i = bytewidth; i < length; ++i)
+        i = filterScanlineSIMD(out, scanline, prevline, i, length, bytewidth, 4);
+        for(; i < length; ++i)
         {
           out[i] = (scanline[i] - paethPredictor(scanline[i - bytewidth], prevline[i], prevline[i - bytewidth]));
         }
@@ -5190,13 +7377,41 @@ static void filterScanline(unsigned char* out, const unsigned char* scanline, co
       {
         for(i = 0; i != bytewidth; ++i) out[i] = scanline[i];
         /*paethPredictor(scanline[i - bytewidth], 0, 0) is always scanline[i - bytewidth]*/
-        for(i = bytewidth; i < length; ++i) out[i] = (scanline[i] - scanline[i - bytewidth]);
+        i = filterScanlineSIMD(out, scanline, prevline, i, length, bytewidth, 1);
+        for(; i < length; ++i) out[i] = (scanline[i] - scanline[i - bytewidth]);
       }
       break;
     default: return; /*unexisting filter type given*/
   }
 }
 
+/*the score of a filtered scanline for LFS_MINSUM, the smaller the better*/
+static size_t filterScanlineSum(const unsigned char* data, size_t length, unsigned char filterType)
+{
+  size_t sum = 0;
+  size_t i = 0;
+#ifdef LODEPNG_COMPILE_SIMD
+  if(LODEPNG_CPU_SUPPORTS("avx2")) sum += filterScanlineSumAVX2(data, &i, length, filterType);
+  if(LODEPNG_CPU_SUPPORTS("sse2")) sum += filterScanlineSumSSE2(data, &i, length, filterType);
+#endif /*LODEPNG_COMPILE_SIMD*/
+  if(filterType == 0)
+  {
+    for(; i != length; ++i) sum += data[i];
+  }
+  else
+  {
+    for(; i != length; ++i)
+    {
+      /*For differences, each byte should be treated as signed, values above 127 are negative
+      (converted to signed char). Filtertype 0 isn't a difference though, so use unsigned there.
+      This means filtertype 0 is almost never chosen, but that is justified.*/
+      unsigned char s = data[i];
+      sum += s < 128 ? s : (255U - s);
+    }
+  }
+  return sum;
+}
+
 /* log2 approximation. A slight bit faster than std::log. */
 static float flog2(float f)
 {
@@ -5206,13 +7421,16 @@ static float flog2(float f)
   return result + 1.442695f * (f * f * f / 3 - 3 * f * f / 2 + 3 * f - 1.83333f);
 }
 
-static unsigned filter(unsigned char* out, const unsigned char* in, unsigned w, unsigned h,
-                       const LodePNGColorMode* info, const LodePNGEncoderSettings* settings)
+static unsigned filterRows(unsigned char* out, const unsigned char* in, const unsigned char* prevline,
+                           unsigned w, unsigned h, const LodePNGColorMode* info,
+                           const LodePNGEncoderSettings* settings, unsigned char* attempts)
 {
   /*
   For PNG filter method 0
   out must be a buffer with as size: h + (w * h * bpp + 7) / 8, because there are
   the scanlines with 1 extra byte per scanline
+  prevline is the scanline above the first one of in, or NULL if in starts at the top of the image
+  attempts is room for 5 scanlines for the adaptive strategies to try the filter types in, or NULL to allocate it
   */
 
   unsigned bpp = lodepng_get_bpp(info);
@@ -5220,10 +7438,11 @@ static unsigned filter(unsigned char* out, const unsigned char* in, unsigned w,
   size_t linebytes = (w * bpp + 7) / 8;
   /*bytewidth is used for filtering, is 1 when bpp < 8, number of bytes per pixel otherwise*/
   size_t bytewidth = (bpp + 7) / 8;
-  const unsigned char* prevline = 0;
   unsigned x, y;
   unsigned error = 0;
   LodePNGFilterStrategy strategy = settings->filter_strategy;
+  unsigned char* attempt[5]; /*five filtering attempts, one for each filter type*/
+  unsigned char* allocated = 0;
 
   /*
   There is a heuristic called the minimum sum of absolute differences heuristic, suggested by the PNG standard:
@@ -5243,6 +7462,17 @@ static unsigned filter(unsigned char* out, const unsigned char* in, unsigned w,
 
   if(bpp == 0) return 31; /*error: invalid color type*/
 
+  if(strategy == LFS_MINSUM || strategy == LFS_ENTROPY || strategy == LFS_BRUTE_FORCE)
+  {
+    unsigned type;
+    if(!attempts)
+    {
+      attempts = allocated = (unsigned char*)lodepng_malloc(linebytes * 5);
+      if(!attempts) return 83; /*alloc fail*/
+    }
+    for(type = 0; type != 5; ++type) attempt[type] = &attempts[type * linebytes];
+  }
+
   if(strategy == LFS_ZERO)
   {
     for(y = 0; y != h; ++y)
@@ -5258,75 +7488,41 @@ static unsigned filter(unsigned char* out, const unsigned char* in, unsigned w,
   {
     /*adaptive filtering*/
     size_t sum[5];
-    unsigned char* attempt[5]; /*five filtering attempts, one for each filter type*/
     size_t smallest = 0;
     unsigned char type, bestType = 0;
 
-    for(type = 0; type != 5; ++type)
+    for(y = 0; y != h; ++y)
     {
-      attempt[type] = (unsigned char*)lodepng_malloc(linebytes);
-      if(!attempt[type]) return 83; /*alloc fail*/
-    }
-
-    if(!error)
-    {
-      for(y = 0; y != h; ++y)
+      /*try the 5 filter types*/
+      for(type = 0; type != 5; ++type)
       {
-        /*try the 5 filter types*/
-        for(type = 0; type != 5; ++type)
-        {
-          filterScanline(attempt[type], &in[y * linebytes], prevline, linebytes, bytewidth, type);
+        filterScanline(attempt[type], &in[y * linebytes], prevline, linebytes, bytewidth, type);
 
-          /*calculate the sum of the result*/
-          sum[type] = 0;
-          if(type == 0)
-          {
-            for(x = 0; x != linebytes; ++x) sum[type] += (unsigned char)(attempt[type][x]);
-          }
-          else
-          {
-            for(x = 0; x != linebytes; ++x)
-            {
-              /*For differences, each byte should be treated as signed, values above 127 are negative
-              (converted to signed char). Filtertype 0 isn't a difference though, so use unsigned there.
-              This means filtertype 0 is almost never chosen, but that is justified.*/
-              unsigned char s = attempt[type][x];
-              sum[type] += s < 128 ? s : (255U - s);
-            }
-          }
+        /*calculate the sum of the result*/
+        sum[type] = filterScanlineSum(attempt[type], linebytes, type);
 
-          /*check if this is smallest sum (or if type == 0 it's the first case so always store the values)*/
-          if(type == 0 || sum[type] < smallest)
-          {
-            bestType = type;
-            smallest = sum[type];
-          }
+        /*check if this is smallest sum (or if type == 0 it's the first case so always store the values)*/
+        if(type == 0 || sum[type] < smallest)
+        {
+          bestType = type;
+          smallest = sum[type];
         }
+      }
 
-        prevline = &in[y * linebytes];
+      prevline = &in[y * linebytes];
 
-        /*now fill the out values*/
-        out[y * (linebytes + 1)] = bestType; /*the first byte of a scanline will be the filter type*/
-        for(x = 0; x != linebytes; ++x) out[y * (linebytes + 1) + 1 + x] = attempt[bestType][x];
-      }
+      /*now fill the out values*/
+      out[y * (linebytes + 1)] = bestType; /*the first byte of a scanline will be the filter type*/
+      for(x = 0; x != linebytes; ++x) out[y * (linebytes + 1) + 1 + x] = attempt[bestType][x];
     }
-
-    for(type = 0; type != 5; ++type) lodepng_free(attempt[type]);
   }
   else if(strategy == LFS_ENTROPY)
   {
     float sum[5];
-    unsigned char* attempt[5]; /*five filtering attempts, one for each filter type*/
     float smallest = 0;
     unsigned type, bestType = 0;
     unsigned count[256];
 
-    for(type = 0; type != 5; ++type)
-    {
-      attempt[type] = (unsigned char*)lodepng_malloc(linebytes);
-      if(!attempt[type]) return 83; /*alloc fail*/
-    }
-
     for(y = 0; y != h; ++y)
     {
       /*try the 5 filter types*/
@@ -5356,8 +7552,6 @@ static unsigned filter(unsigned char* out, const unsigned char* in, unsigned w,
       out[y * (linebytes + 1)] = bestType; /*the first byte of a scanline will be the filter type*/
       for(x = 0; x != linebytes; ++x) out[y * (linebytes + 1) + 1 + x] = attempt[bestType][x];
     }
-
-    for(type = 0; type != 5; ++type) lodepng_free(attempt[type]);
   }
   else if(strategy == LFS_PREDEFINED)
   {
@@ -5377,7 +7571,6 @@ static unsigned filter(unsigned char* out, const unsigned char* in, unsigned w,
     deflate the scanline after every filter attempt to see which one deflates best.
     This is very slow and gives only slightly smaller, sometimes even larger, result*/
     size_t size[5];
-    unsigned char* attempt[5]; /*five filtering attempts, one for each filter type*/
     size_t smallest = 0;
     unsigned type = 0, bestType = 0;
     unsigned char* dummy;
@@ -5391,11 +7584,6 @@ static unsigned filter(unsigned char* out, const unsigned char* in, unsigned w,
     images only, so disable it*/
     zlibsettings.custom_zlib = 0;
     zlibsettings.custom_deflate = 0;
-    for(type = 0; type != 5; ++type)
-    {
-      attempt[type] = (unsigned char*)lodepng_malloc(linebytes);
-      if(!attempt[type]) return 83; /*alloc fail*/
-    }
     for(y = 0; y != h; ++y) /*try the 5 filter types*/
     {
       for(type = 0; type != 5; ++type)
@@ -5419,13 +7607,111 @@ static unsigned filter(unsigned char* out, const unsigned char* in, unsigned w,
       out[y * (linebytes + 1)] = bestType; /*the first byte of a scanline will be the filter type*/
       for(x = 0; x != linebytes; ++x) out[y * (linebytes + 1) + 1 + x] = attempt[bestType][x];
     }
-    for(type = 0; type != 5; ++type) lodepng_free(attempt[type]);
   }
   else return 88; /* unknown filter strategy */
 
+  lodepng_free(allocated);
   return error;
 }
 
+#ifdef LODEPNG_COMPILE_THREADS
+/*minimum amount of input bytes per band of rows filtered by one task*/
+#define FILTER_BAND_MIN_BYTES 32768
+
+typedef struct FilterBands
+{
+  unsigned char* out;
+  const unsigned char* in;
+  const unsigned char* prevline; /*the scanline above in, or NULL*/
+  unsigned w, h;
+  unsigned bandheight; /*rows per band, the last band may have less*/
+  size_t linebytes;
+  const LodePNGColorMode* info;
+  const LodePNGEncoderSettings* settings;
+  unsigned char* attempts; /*room for the 5 filter attempts of each thread, or NULL to allocate them per band*/
+  unsigned* errors; /*error code of each band*/
+} FilterBands;
+
+/*filters one band of rows. The filter of a row only depends on the unfiltered row above it, which
+is also available for the first row of a band, so this gives the same bytes as filtering serially*/
+static void filterBand(void* context, size_t index, unsigned thread)
+{
+  FilterBands* bands = (FilterBands*)context;
+  unsigned y = (unsigned)index * bands->bandheight;
+  unsigned h = bands->h - y < bands->bandheight ? bands->h - y : bands->bandheight;
+  const unsigned char* prevline = y ? &bands->in[(y - 1) * bands->linebytes] : bands->prevline;
+  unsigned char* attempts = bands->attempts ? &bands->attempts[thread * bands->linebytes * 5] : 0;
+  bands->errors[index] = filterRows(&bands->out[y * (bands->linebytes + 1)], &bands->in[y * bands->linebytes],
+                                    prevline, bands->w, h, bands->info, bands->settings, attempts);
+}
+#endif /*LODEPNG_COMPILE_THREADS*/
+
+/*
+Same as filterRows, but with more than one thread in the zlib settings, the adaptive strategies
+filter bands of rows in parallel. The output is identical to that of filterRows. If attempts is
+not NULL, it is resized to hold the filter attempts of each thread, so that it can be reused.
+*/
+static unsigned filter(unsigned char* out, const unsigned char* in, const unsigned char* prevline,
+                       unsigned w, unsigned h, const LodePNGColorMode* info,
+                       const LodePNGEncoderSettings* settings, ucvector* attempts)
+{
+#ifdef LODEPNG_COMPILE_THREADS
+  unsigned numthreads = lodepng_get_num_threads(settings->zlibsettings.numthreads);
+  LodePNGFilterStrategy strategy = settings->filter_strategy;
+  size_t linebytes = ((size_t)w * lodepng_get_bpp(info) + 7) / 8;
+  if(settings->filter_palette_zero &&
+     (info->colortype == LCT_PALETTE || info->bitdepth < 8)) strategy = LFS_ZERO;
+
+  /*LFS_ZERO and LFS_PREDEFINED are a single pass over memory, not worth the threads*/
+  if(numthreads > 1 && linebytes != 0 && h > 1 &&
+     (strategy == LFS_MINSUM || strategy == LFS_ENTROPY || strategy == LFS_BRUTE_FORCE))
+  {
+    FilterBands bands;
+    size_t minheight = (FILTER_BAND_MIN_BYTES + linebytes - 1) / linebytes;
+    size_t numbands, i;
+    unsigned error = 0;
+
+    /*a few bands per thread so that threads finishing early can take over work*/
+    bands.bandheight = (h + numthreads * 4 - 1) / (numthreads * 4);
+    if(bands.bandheight < minheight) bands.bandheight = minheight < h ? (unsigned)minheight : h;
+    numbands = (h + bands.bandheight - 1) / bands.bandheight;
+
+    if(numbands > 1)
+    {
+      bands.out = out;
+      bands.in = in;
+      bands.prevline = prevline;
+      bands.w = w;
+      bands.h = h;
+      bands.linebytes = linebytes;
+      bands.info = info;
+      bands.settings = settings;
+      bands.attempts = 0;
+      if(attempts)
+      {
+        if(!ucvector_resize(attempts, linebytes * 5 * numthreads)) return 83; /*alloc fail*/
+        bands.attempts = attempts->data;
+      }
+      bands.errors = (unsigned*)lodepng_malloc(numbands * sizeof(unsigned));
+      if(!bands.errors) return 83; /*alloc fail*/
+
+      lodepng_run_parallel(filterBand, &bands, numbands, numthreads);
+
+      for(i = 0; i != numbands && !error; ++i) error = bands.errors[i];
+      lodepng_free(bands.errors);
+      return error;
+    }
+  }
+#endif /*LODEPNG_COMPILE_THREADS*/
+
+  if(attempts)
+  {
+    if(!ucvector_resize(attempts, ((size_t)w * lodepng_get_bpp(info) + 7) / 8 * 5)) return 83; /*alloc fail*/
+    return filterRows(out, in, prevline, w, h, info, settings, attempts->data);
+  }
+  return filterRows(out, in, prevline, w, h, info, settings, 0);
+}
+
 static void addPaddingBits(unsigned char* out, const unsigned char* in,
                            size_t olinebits, size_t ilinebits, unsigned h)
 {
@@ -5508,11 +7794,11 @@ static void Adam7_interlace(unsigned char* out, const unsigned char* in, unsigne
   }
 }
 
-/*out must be buffer big enough to contain uncompressed IDAT chunk data, and in must contain the full image.
-return value is error**/
-static unsigned preProcessScanlines(unsigned char** out, size_t* outsize, const unsigned char* in,
-                                    unsigned w, unsigned h,
-                                    const LodePNGInfo* info_png, const LodePNGEncoderSettings* settings)
+/*out is resized to the uncompressed IDAT chunk data, and in must contain the full image. The scratch
+buffers come from the encoder context. return value is error*/
+static unsigned preProcessScanlines(ucvector* out, const unsigned char* in,
+                                    unsigned w, unsigned h, const LodePNGInfo* info_png,
+                                    const LodePNGEncoderSettings* settings, LodePNGEncoderContextInternal* context)
 {
   /*
   This function converts the pure 2D image with the PNG's colortype, into filtered-padded-interlaced data. Steps:
@@ -5524,74 +7810,53 @@ static unsigned preProcessScanlines(unsigned char** out, size_t* outsize, const
 
   if(info_png->interlace_method == 0)
   {
-    *outsize = h + (h * ((w * bpp + 7) / 8)); /*image size plus an extra byte per scanline + possible padding bits*/
-    *out = (unsigned char*)lodepng_malloc(*outsize);
-    if(!(*out) && (*outsize)) error = 83; /*alloc fail*/
+    /*image size plus an extra byte per scanline + possible padding bits*/
+    if(!ucvector_resize(out, h + (h * ((w * bpp + 7) / 8)))) return 83; /*alloc fail*/
 
-    if(!error)
+    /*non multiple of 8 bits per scanline, padding bits needed per scanline*/
+    if(bpp < 8 && w * bpp != ((w * bpp + 7) / 8) * 8)
     {
-      /*non multiple of 8 bits per scanline, padding bits needed per scanline*/
-      if(bpp < 8 && w * bpp != ((w * bpp + 7) / 8) * 8)
-      {
-        unsigned char* padded = (unsigned char*)lodepng_malloc(h * ((w * bpp + 7) / 8));
-        if(!padded) error = 83; /*alloc fail*/
-        if(!error)
-        {
-          addPaddingBits(padded, in, ((w * bpp + 7) / 8) * 8, w * bpp, h);
-          error = filter(*out, padded, w, h, &info_png->color, settings);
-        }
-        lodepng_free(padded);
-      }
-      else
-      {
-        /*we can immediately filter into the out buffer, no other steps needed*/
-        error = filter(*out, in, w, h, &info_png->color, settings);
-      }
+      if(!ucvector_resize(&context->padded, h * ((w * bpp + 7) / 8))) return 83; /*alloc fail*/
+      addPaddingBits(context->padded.data, in, ((w * bpp + 7) / 8) * 8, w * bpp, h);
+      error = filter(out->data, context->padded.data, 0, w, h, &info_png->color, settings, &context->attempts);
+    }
+    else
+    {
+      /*we can immediately filter into the out buffer, no other steps needed*/
+      error = filter(out->data, in, 0, w, h, &info_png->color, settings, &context->attempts);
     }
   }
   else /*interlace_method is 1 (Adam7)*/
   {
     unsigned passw[7], passh[7];
     size_t filter_passstart[8], padded_passstart[8], passstart[8];
-    unsigned char* adam7;
+    unsigned i;
 
     Adam7_getpassvalues(passw, passh, filter_passstart, padded_passstart, passstart, w, h, bpp);
 
-    *outsize = filter_passstart[7]; /*image size plus an extra byte per scanline + possible padding bits*/
-    *out = (unsigned char*)lodepng_malloc(*outsize);
-    if(!(*out)) error = 83; /*alloc fail*/
-
-    adam7 = (unsigned char*)lodepng_malloc(passstart[7]);
-    if(!adam7 && passstart[7]) error = 83; /*alloc fail*/
+    /*image size plus an extra byte per scanline + possible padding bits*/
+    if(!ucvector_resize(out, filter_passstart[7])) return 83; /*alloc fail*/
+    if(!ucvector_resize(&context->adam7, passstart[7])) return 83; /*alloc fail*/
 
-    if(!error)
+    Adam7_interlace(context->adam7.data, in, w, h, bpp);
+    for(i = 0; i != 7; ++i)
     {
-      unsigned i;
-
-      Adam7_interlace(adam7, in, w, h, bpp);
-      for(i = 0; i != 7; ++i)
+      if(bpp < 8)
       {
-        if(bpp < 8)
-        {
-          unsigned char* padded = (unsigned char*)lodepng_malloc(padded_passstart[i + 1] - padded_passstart[i]);
-          if(!padded) ERROR_BREAK(83); /*alloc fail*/
-          addPaddingBits(padded, &adam7[passstart[i]],
-                         ((passw[i] * bpp + 7) / 8) * 8, passw[i] * bpp, passh[i]);
-          error = filter(&(*out)[filter_passstart[i]], padded,
-                         passw[i], passh[i], &info_png->color, settings);
-          lodepng_free(padded);
-        }
-        else
-        {
-          error = filter(&(*out)[filter_passstart[i]], &adam7[padded_passstart[i]],
-                         passw[i], passh[i], &info_png->color, settings);
-        }
-
-        if(error) break;
+        if(!ucvector_resize(&context->padded, padded_passstart[i + 1] - padded_passstart[i])) ERROR_BREAK(83);
+        addPaddingBits(context->padded.data, &context->adam7.data[passstart[i]],
+                       ((passw[i] * bpp + 7) / 8) * 8, passw[i] * bpp, passh[i]);
+        error = filter(&out->data[filter_passstart[i]], context->padded.data, 0,
+                       passw[i], passh[i], &info_png->color, settings, &context->attempts);
+      }
+      else
+      {
+        error = filter(&out->data[filter_passstart[i]], &context->adam7.data[padded_passstart[i]], 0,
+                       passw[i], passh[i], &info_png->color, settings, &context->attempts);
       }
-    }
 
-    lodepng_free(adam7);
+      if(error) break;
+    }
   }
 
   return error;
@@ -5629,203 +7894,287 @@ static unsigned addUnknownChunks(ucvector* out, unsigned char* data, size_t data
   unsigned char* inchunk = data;
   while((size_t)(inchunk - data) < datasize)
   {
-    CERROR_TRY_RETURN(lodepng_chunk_append(&out->data, &out->size, inchunk));
-    out->allocsize = out->size; /*fix the allocsize again*/
+    size_t pos = out->size;
+    size_t chunksize = (size_t)lodepng_chunk_length(inchunk) + 12;
+    if(pos + chunksize < chunksize) return 77; /*integer overflow happened*/
+    if(!ucvector_resize(out, pos + chunksize)) return 83; /*alloc fail*/
+    memcpy(&out->data[pos], inchunk, chunksize);
     inchunk = lodepng_chunk_next(inchunk);
   }
   return 0;
 }
 #endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
 
-unsigned lodepng_encode(unsigned char** out, size_t* outsize,
-                        const unsigned char* image, unsigned w, unsigned h,
-                        LodePNGState* state)
+/*writes the signature and all chunks that go before the IDAT chunks*/
+static unsigned addChunksBeforeIDAT(ucvector* out, unsigned w, unsigned h,
+                                    const LodePNGInfo* info, const LodePNGEncoderSettings* settings)
 {
-  LodePNGInfo info;
-  ucvector outv;
-  unsigned char* data = 0; /*uncompressed version of the IDAT chunk data*/
-  size_t datasize = 0;
-
-  /*provide some proper output values if error will happen*/
-  *out = 0;
-  *outsize = 0;
-  state->error = 0;
-
-  lodepng_info_init(&info);
-  lodepng_info_copy(&info, &state->info_png);
-
-  if((info.color.colortype == LCT_PALETTE || state->encoder.force_palette)
-      && (info.color.palettesize == 0 || info.color.palettesize > 256))
+  unsigned error = 0;
+  /*write signature and chunks*/
+  writeSignature(out);
+  /*IHDR*/
+  addChunk_IHDR(out, w, h, info->color.colortype, info->color.bitdepth, info->interlace_method);
+#ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
+  /*unknown chunks between IHDR and PLTE*/
+  if(info->unknown_chunks_data[0])
   {
-    state->error = 68; /*invalid palette size, it is only allowed to be 1-256*/
-    return state->error;
+    error = addUnknownChunks(out, info->unknown_chunks_data[0], info->unknown_chunks_size[0]);
+    if(error) return error;
   }
-
-  if(state->encoder.auto_convert)
+#endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
+  /*PLTE*/
+  if(info->color.colortype == LCT_PALETTE)
   {
-    state->error = lodepng_auto_choose_color(&info.color, image, w, h, &state->info_raw);
+    addChunk_PLTE(out, &info->color);
   }
-  if(state->error) return state->error;
-
-  if(state->encoder.zlibsettings.btype > 2)
+  if(settings->force_palette && (info->color.colortype == LCT_RGB || info->color.colortype == LCT_RGBA))
   {
-    CERROR_RETURN_ERROR(state->error, 61); /*error: unexisting btype*/
+    addChunk_PLTE(out, &info->color);
   }
-  if(state->info_png.interlace_method > 1)
+  /*tRNS*/
+  if(info->color.colortype == LCT_PALETTE && getPaletteTranslucency(info->color.palette, info->color.palettesize) != 0)
   {
-    CERROR_RETURN_ERROR(state->error, 71); /*error: unexisting interlace mode*/
+    addChunk_tRNS(out, &info->color);
   }
-
-  state->error = checkColorValidity(info.color.colortype, info.color.bitdepth);
-  if(state->error) return state->error; /*error: unexisting color type given*/
-  state->error = checkColorValidity(state->info_raw.colortype, state->info_raw.bitdepth);
-  if(state->error) return state->error; /*error: unexisting color type given*/
-
-  if(!lodepng_color_mode_equal(&state->info_raw, &info.color))
+  if((info->color.colortype == LCT_GREY || info->color.colortype == LCT_RGB) && info->color.key_defined)
   {
-    unsigned char* converted;
-    size_t size = (w * h * (size_t)lodepng_get_bpp(&info.color) + 7) / 8;
-
-    converted = (unsigned char*)lodepng_malloc(size);
-    if(!converted && size) state->error = 83; /*alloc fail*/
-    if(!state->error)
-    {
-      state->error = lodepng_convert(converted, image, &info.color, &state->info_raw, w, h);
-    }
-    if(!state->error) preProcessScanlines(&data, &datasize, converted, w, h, &info, &state->encoder);
-    lodepng_free(converted);
+    addChunk_tRNS(out, &info->color);
   }
-  else preProcessScanlines(&data, &datasize, image, w, h, &info, &state->encoder);
+#ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
+  /*bKGD (must come between PLTE and the IDAt chunks*/
+  if(info->background_defined) addChunk_bKGD(out, info);
+  /*pHYs (must come before the IDAT chunks)*/
+  if(info->phys_defined) addChunk_pHYs(out, info);
 
-  ucvector_init(&outv);
-  while(!state->error) /*while only executed once, to break on error*/
+  /*unknown chunks between PLTE and IDAT*/
+  if(info->unknown_chunks_data[1])
   {
-#ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
-    size_t i;
+    error = addUnknownChunks(out, info->unknown_chunks_data[1], info->unknown_chunks_size[1]);
+    if(error) return error;
+  }
 #endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
-    /*write signature and chunks*/
-    writeSignature(&outv);
-    /*IHDR*/
-    addChunk_IHDR(&outv, w, h, info.color.colortype, info.color.bitdepth, info.interlace_method);
+  return error;
+}
+
+/*writes all chunks that go after the IDAT chunks, ending with IEND*/
+static unsigned addChunksAfterIDAT(ucvector* out, const LodePNGInfo* info, LodePNGEncoderSettings* settings)
+{
+  unsigned error = 0;
 #ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
-    /*unknown chunks between IHDR and PLTE*/
-    if(info.unknown_chunks_data[0])
+  size_t i;
+  /*tIME*/
+  if(info->time_defined) addChunk_tIME(out, &info->time);
+  /*tEXt and/or zTXt*/
+  for(i = 0; i != info->text_num; ++i)
+  {
+    if(strlen(info->text_keys[i]) > 79)
     {
-      state->error = addUnknownChunks(&outv, info.unknown_chunks_data[0], info.unknown_chunks_size[0]);
-      if(state->error) break;
+      return 66; /*text chunk too large*/
     }
-#endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
-    /*PLTE*/
-    if(info.color.colortype == LCT_PALETTE)
+    if(strlen(info->text_keys[i]) < 1)
     {
-      addChunk_PLTE(&outv, &info.color);
+      return 67; /*text chunk too small*/
     }
-    if(state->encoder.force_palette && (info.color.colortype == LCT_RGB || info.color.colortype == LCT_RGBA))
+    if(settings->text_compression)
     {
-      addChunk_PLTE(&outv, &info.color);
+      addChunk_zTXt(out, info->text_keys[i], info->text_strings[i], &settings->zlibsettings);
     }
-    /*tRNS*/
-    if(info.color.colortype == LCT_PALETTE && getPaletteTranslucency(info.color.palette, info.color.palettesize) != 0)
+    else
     {
-      addChunk_tRNS(&outv, &info.color);
+      addChunk_tEXt(out, info->text_keys[i], info->text_strings[i]);
     }
-    if((info.color.colortype == LCT_GREY || info.color.colortype == LCT_RGB) && info.color.key_defined)
+  }
+  /*LodePNG version id in text chunk*/
+  if(settings->add_id)
+  {
+    unsigned alread_added_id_text = 0;
+    for(i = 0; i != info->text_num; ++i)
     {
-      addChunk_tRNS(&outv, &info.color);
+      if(!strcmp(info->text_keys[i], "LodePNG"))
+      {
+        alread_added_id_text = 1;
+        break;
+      }
     }
-#ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
-    /*bKGD (must come between PLTE and the IDAt chunks*/
-    if(info.background_defined) addChunk_bKGD(&outv, &info);
-    /*pHYs (must come before the IDAT chunks)*/
-    if(info.phys_defined) addChunk_pHYs(&outv, &info);
-
-    /*unknown chunks between PLTE and IDAT*/
-    if(info.unknown_chunks_data[1])
+    if(alread_added_id_text == 0)
     {
-      state->error = addUnknownChunks(&outv, info.unknown_chunks_data[1], info.unknown_chunks_size[1]);
-      if(state->error) break;
+      addChunk_tEXt(out, "LodePNG", LODEPNG_VERSION_STRING); /*it's shorter as tEXt than as zTXt chunk*/
     }
-#endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
-    /*IDAT (multiple IDAT chunks must be consecutive)*/
-    state->error = addChunk_IDAT(&outv, data, datasize, &state->encoder.zlibsettings);
-    if(state->error) break;
-#ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
-    /*tIME*/
-    if(info.time_defined) addChunk_tIME(&outv, &info.time);
-    /*tEXt and/or zTXt*/
-    for(i = 0; i != info.text_num; ++i)
+  }
+  /*iTXt*/
+  for(i = 0; i != info->itext_num; ++i)
+  {
+    if(strlen(info->itext_keys[i]) > 79)
     {
-      if(strlen(info.text_keys[i]) > 79)
-      {
-        state->error = 66; /*text chunk too large*/
-        break;
-      }
-      if(strlen(info.text_keys[i]) < 1)
-      {
-        state->error = 67; /*text chunk too small*/
-        break;
-      }
-      if(state->encoder.text_compression)
-      {
-        addChunk_zTXt(&outv, info.text_keys[i], info.text_strings[i], &state->encoder.zlibsettings);
-      }
-      else
-      {
-        addChunk_tEXt(&outv, info.text_keys[i], info.text_strings[i]);
-      }
+      return 66; /*text chunk too large*/
     }
-    /*LodePNG version id in text chunk*/
-    if(state->encoder.add_id)
+    if(strlen(info->itext_keys[i]) < 1)
     {
-      unsigned alread_added_id_text = 0;
-      for(i = 0; i != info.text_num; ++i)
-      {
-        if(!strcmp(info.text_keys[i], "LodePNG"))
-        {
-          alread_added_id_text = 1;
-          break;
-        }
-      }
-      if(alread_added_id_text == 0)
-      {
-        addChunk_tEXt(&outv, "LodePNG", LODEPNG_VERSION_STRING); /*it's shorter as tEXt than as zTXt chunk*/
-      }
+      return 67; /*text chunk too small*/
     }
-    /*iTXt*/
-    for(i = 0; i != info.itext_num; ++i)
+    addChunk_iTXt(out, settings->text_compression,
+                  info->itext_keys[i], info->itext_langtags[i], info->itext_transkeys[i], info->itext_strings[i],
+                  &settings->zlibsettings);
+  }
+
+  /*unknown chunks between IDAT and IEND*/
+  if(info->unknown_chunks_data[2])
+  {
+    error = addUnknownChunks(out, info->unknown_chunks_data[2], info->unknown_chunks_size[2]);
+    if(error) return error;
+  }
+#else /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
+  (void)info;
+  (void)settings;
+#endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
+  addChunk_IEND(out);
+  return error;
+}
+
+/*encodes the PNG into context->png, using the other buffers of the context for the intermediate steps*/
+static unsigned encodeWithContext(LodePNGEncoderContextInternal* context,
+                                  const unsigned char* image, unsigned w, unsigned h, LodePNGState* state)
+{
+  LodePNGInfo info;
+  const unsigned char* pixels = image; /*the image in the color type of the PNG*/
+
+  context->png.size = 0;
+  state->error = 0;
+
+  if((state->info_png.color.colortype == LCT_PALETTE || state->encoder.force_palette)
+      && (state->info_png.color.palettesize == 0 || state->info_png.color.palettesize > 256))
+  {
+    state->error = 68; /*invalid palette size, it is only allowed to be 1-256*/
+    return state->error;
+  }
+
+  lodepng_info_init(&info);
+  state->error = lodepng_info_copy(&info, &state->info_png);
+
+  if(!state->error && state->encoder.auto_convert)
+  {
+    if(state->encoder.profile)
     {
-      if(strlen(info.itext_keys[i]) > 79)
-      {
-        state->error = 66; /*text chunk too large*/
-        break;
-      }
-      if(strlen(info.itext_keys[i]) < 1)
-      {
-        state->error = 67; /*text chunk too small*/
-        break;
-      }
-      addChunk_iTXt(&outv, state->encoder.text_compression,
-                    info.itext_keys[i], info.itext_langtags[i], info.itext_transkeys[i], info.itext_strings[i],
-                    &state->encoder.zlibsettings);
+      state->error = lodepng_auto_choose_color_from_profile(&info.color, state->encoder.profile, w, h,
+                                                            &state->info_raw);
     }
+    else state->error = lodepng_auto_choose_color(&info.color, image, w, h, &state->info_raw);
+  }
+  if(!state->error && state->encoder.zlibsettings.btype > 2) state->error = 61; /*error: unexisting btype*/
+  if(!state->error && state->info_png.interlace_method > 1) state->error = 71; /*error: unexisting interlace mode*/
+
+  /*error: unexisting color type given*/
+  if(!state->error) state->error = checkColorValidity(info.color.colortype, info.color.bitdepth);
+  if(!state->error) state->error = checkColorValidity(state->info_raw.colortype, state->info_raw.bitdepth);
 
-    /*unknown chunks between IDAT and IEND*/
-    if(info.unknown_chunks_data[2])
+  if(!state->error && !lodepng_color_mode_equal(&state->info_raw, &info.color))
+  {
+    size_t size = (w * h * (size_t)lodepng_get_bpp(&info.color) + 7) / 8;
+    if(!ucvector_resize(&context->converted, size)) state->error = 83; /*alloc fail*/
+    if(!state->error)
     {
-      state->error = addUnknownChunks(&outv, info.unknown_chunks_data[2], info.unknown_chunks_size[2]);
-      if(state->error) break;
+      state->error = lodepng_convert(context->converted.data, image, &info.color, &state->info_raw, w, h);
     }
-#endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
-    addChunk_IEND(&outv);
+    pixels = context->converted.data;
+  }
 
-    break; /*this isn't really a while loop; no error happened so break out now!*/
+  if(!state->error)
+  {
+    state->error = preProcessScanlines(&context->filtered, pixels, w, h, &info, &state->encoder, context);
+  }
+  if(!state->error) state->error = addChunksBeforeIDAT(&context->png, w, h, &info, &state->encoder);
+  /*IDAT (multiple IDAT chunks must be consecutive)*/
+  if(!state->error)
+  {
+    state->error = addChunk_IDAT(&context->png, context->filtered.data, context->filtered.size,
+                                 &state->encoder.zlibsettings, context);
   }
+  if(!state->error) state->error = addChunksAfterIDAT(&context->png, &info, &state->encoder);
 
   lodepng_info_cleanup(&info);
-  lodepng_free(data);
-  /*instead of cleaning the vector up, give it to the output*/
-  *out = outv.data;
-  *outsize = outv.size;
+  return state->error;
+}
+
+unsigned lodepng_encoder_context_init(LodePNGEncoderContext* context, const LodePNGAllocator* allocator)
+{
+  LodePNGEncoderContextInternal* c;
+  size_t size = sizeof(LodePNGEncoderContextInternal);
+  c = (LodePNGEncoderContextInternal*)(allocator ? allocator->realloc_func(0, 0, size, allocator->user)
+                                                 : lodepng_malloc(size));
+  context->internal = c;
+  if(!c) return 83; /*alloc fail*/
+
+  if(allocator) c->custom = *allocator;
+  c->allocator = allocator ? &c->custom : 0;
+  ucvector_init(&c->png);
+  ucvector_init(&c->converted);
+  ucvector_init(&c->filtered);
+  ucvector_init(&c->adam7);
+  ucvector_init(&c->padded);
+  ucvector_init(&c->attempts);
+  c->png.allocator = c->converted.allocator = c->filtered.allocator = c->allocator;
+  c->adam7.allocator = c->padded.allocator = c->attempts.allocator = c->allocator;
+#ifdef LODEPNG_COMPILE_ZLIB
+  c->hashes = 0;
+  c->numhashes = 0;
+#endif /*LODEPNG_COMPILE_ZLIB*/
+  return 0;
+}
+
+void lodepng_encoder_context_cleanup(LodePNGEncoderContext* context)
+{
+  LodePNGEncoderContextInternal* c = context->internal;
+  if(!c) return;
+  ucvector_cleanup(&c->png);
+  ucvector_cleanup(&c->converted);
+  ucvector_cleanup(&c->filtered);
+  ucvector_cleanup(&c->adam7);
+  ucvector_cleanup(&c->padded);
+  ucvector_cleanup(&c->attempts);
+#ifdef LODEPNG_COMPILE_ZLIB
+  hashes_cleanup(c->hashes, c->numhashes, c->allocator);
+#endif /*LODEPNG_COMPILE_ZLIB*/
+  lodepng_allocator_free(c->allocator, c, sizeof(LodePNGEncoderContextInternal));
+  context->internal = 0;
+}
+
+unsigned lodepng_encode_context(const unsigned char** out, size_t* outsize,
+                                const unsigned char* image, unsigned w, unsigned h,
+                                LodePNGState* state, LodePNGEncoderContext* context)
+{
+  *out = 0;
+  *outsize = 0;
+  if(!context->internal) CERROR_RETURN_ERROR(state->error, 83); /*the context failed to allocate*/
+
+  encodeWithContext(context->internal, image, w, h, state);
+  if(!state->error)
+  {
+    *out = context->internal->png.data;
+    *outsize = context->internal->png.size;
+  }
+  return state->error;
+}
+
+unsigned lodepng_encode(unsigned char** out, size_t* outsize,
+                        const unsigned char* image, unsigned w, unsigned h,
+                        LodePNGState* state)
+{
+  LodePNGEncoderContext context;
+
+  /*provide some proper output values if error will happen*/
+  *out = 0;
+  *outsize = 0;
+
+  state->error = lodepng_encoder_context_init(&context, 0);
+  if(!state->error)
+  {
+    encodeWithContext(context.internal, image, w, h, state);
+    /*instead of cleaning the vector up, give it to the output*/
+    *out = context.internal->png.data;
+    *outsize = context.internal->png.size;
+    ucvector_init(&context.internal->png);
+  }
+  lodepng_encoder_context_cleanup(&context);
 
   return state->error;
 }
@@ -5879,6 +8228,431 @@ unsigned lodepng_encode24_file(const char* filename, const unsigned char* image,
 }
 #endif /*LODEPNG_COMPILE_DISK*/
 
+#ifdef LODEPNG_COMPILE_ZLIB
+
+/*state of a LodePNGStreamEncoder that only this file needs to know about*/
+typedef struct LodePNGStreamInternal
+{
+  LodePNGInfo info; /*the PNG to write, copied from the state given to init*/
+  LodePNGColorMode info_raw; /*color mode of the rows given to add_rows*/
+  LodePNGEncoderSettings settings;
+  unsigned char* prevline; /*last scanline of the previous band, in the PNG color mode and padded*/
+  /*LZ77 history followed by the filtered scanlines that are not deflated yet. The history starts
+  at a multiple of the LZ77 windowsize, so positions in the hash chains stay valid after dropping data.*/
+  ucvector window;
+  size_t windowstart; /*position of window.data[0] in the uncompressed zlib data*/
+  size_t windowpos; /*first byte in window that is not deflated yet*/
+  size_t datasize; /*size of all filtered scanlines together, known up front from w and h*/
+  size_t blocksize; /*deflate block size, the same lodepng_deflate would use for datasize bytes*/
+  /*zlib data not written yet, after 8 bytes of room for the IDAT chunk length and type. Its last byte can
+  still be partially filled*/
+  ucvector deflated;
+  size_t bp; /*bit pointer in deflated*/
+  unsigned adler; /*adler32 of the filtered scanlines so far*/
+  unsigned prefiltered; /*rows were given by add_filtered_rows, so prevline is not known*/
+  ucvector attempts; /*filter attempts of each thread, kept from band to band*/
+  /*LZ77 hash tables. The first one keeps the hash chains from block to block on a single thread, with
+  more threads each thread resets its own for every chunk*/
+  Hash* hashes;
+  unsigned numhashes;
+} LodePNGStreamInternal;
+
+static unsigned streamWrite(LodePNGStreamEncoder* stream, const unsigned char* data, size_t size)
+{
+  if(stream->write(data, size, stream->write_context)) return 99; /*error: write function failed*/
+  return 0;
+}
+
+/*
+writes the complete bytes of the deflate stream as one IDAT chunk, with the adler32 checksum if final. The chunk
+is built around the data where it is: the length and type go in the room before it, and the crc temporarily
+over the bytes after it.
+*/
+static unsigned streamWriteIDAT(LodePNGStreamEncoder* stream, unsigned final)
+{
+  LodePNGStreamInternal* s = stream->internal;
+  unsigned char saved[4];
+  size_t i, end, numbytes, numsaved;
+  unsigned error;
+
+  if(final)
+  {
+    lodepng_add32bitInt(&s->deflated, s->adler);
+    end = s->deflated.size;
+  }
+  else end = s->bp >> 3;
+  numbytes = end - 8;
+  if(numbytes > 2147483647) return 77; /*error: chunk too large*/
+  if(!ucvector_reserve(&s->deflated, end + 4)) return 83; /*alloc fail*/
+
+  numsaved = s->deflated.size - end < 4 ? s->deflated.size - end : 4;
+  for(i = 0; i != numsaved; ++i) saved[i] = s->deflated.data[end + i];
+  lodepng_set32bitInt(s->deflated.data, (unsigned)numbytes);
+  memcpy(s->deflated.data + 4, "IDAT", 4);
+  lodepng_chunk_generate_crc(s->deflated.data);
+  error = streamWrite(stream, s->deflated.data, end + 4);
+  for(i = 0; i != numsaved; ++i) s->deflated.data[end + i] = saved[i];
+
+  /*the partially filled last byte is continued by the next block*/
+  for(i = end; i != s->deflated.size; ++i) s->deflated.data[8 + i - end] = s->deflated.data[i];
+  s->deflated.size -= numbytes;
+  s->bp -= numbytes * 8;
+  return error;
+}
+
+/*deflates and writes all complete blocks in the window, the last block once all scanlines are given*/
+static unsigned streamDeflate(LodePNGStreamEncoder* stream)
+{
+  LodePNGStreamInternal* s = stream->internal;
+  const LodePNGCompressSettings* settings = &s->settings.zlibsettings;
+  unsigned error = 0;
+
+  while(!error)
+  {
+    size_t start = s->windowpos;
+    size_t remaining = s->datasize - (s->windowstart + start); /*not deflated, including scanlines still to come*/
+    size_t blocksize = remaining < s->blocksize ? remaining : s->blocksize;
+    size_t end = start + blocksize, discard = 0;
+    unsigned final = (blocksize == remaining);
+
+    if(remaining == 0 || s->window.size - start < blocksize) break; /*done, or wait for more scanlines*/
+
+#ifdef LODEPNG_COMPILE_THREADS
+    if(settings->btype != 0 && lodepng_get_num_threads(settings->numthreads) > 1)
+    {
+      /*all complete blocks in the window at once, one per thread*/
+      if(s->window.size - start < remaining) end = start + (s->window.size - start) / s->blocksize * s->blocksize;
+      else end = start + remaining;
+      final = (end - start == remaining);
+      error = deflateParallel(&s->deflated, 0, s->window.data, start, end, s->blocksize, final, settings, s->hashes);
+      s->bp = s->deflated.size * 8; /*every chunk but the final one ends with a sync flush*/
+    }
+    else
+#endif /*LODEPNG_COMPILE_THREADS*/
+    if(settings->btype == 0)
+    {
+      error = deflateNoCompression(&s->deflated, &s->window.data[start], blocksize, final);
+      s->bp = s->deflated.size * 8; /*stored blocks always end on a byte boundary*/
+    }
+    else if(settings->btype == 1)
+    {
+      error = deflateFixed(&s->deflated, &s->bp, s->hashes, s->window.data, start, end, settings, final);
+    }
+    else error = deflateDynamic(&s->deflated, &s->bp, s->hashes, s->window.data, start, end, settings, final);
+    if(error) break;
+    s->windowpos = end;
+
+    error = streamWriteIDAT(stream, final);
+    if(error) break;
+
+    /*drop what LZ77 can no longer refer to, keeping the start of the window at a multiple of windowsize*/
+    if(settings->btype == 0 || !useLZ77(settings)) discard = end;
+    else if(end > settings->windowsize) discard = (end - settings->windowsize) & ~(size_t)(settings->windowsize - 1);
+    if(discard)
+    {
+      memmove(s->window.data, &s->window.data[discard], s->window.size - discard);
+      s->window.size -= discard;
+      s->windowstart += discard;
+      s->windowpos -= discard;
+    }
+  }
+
+  return error;
+}
+
+unsigned lodepng_stream_encoder_init(LodePNGStreamEncoder* stream, unsigned w, unsigned h,
+                                     const LodePNGState* state, LodePNGStreamWriteFunc write, void* write_context)
+{
+  LodePNGStreamInternal* s;
+  const LodePNGEncoderSettings* settings = &state->encoder;
+  const LodePNGColorMode* color = &state->info_png.color;
+  ucvector header;
+  size_t linebytes;
+  unsigned numhashes = 1;
+
+  stream->w = w;
+  stream->h = h;
+  stream->y = 0;
+  stream->error = 0;
+  stream->write = write;
+  stream->write_context = write_context;
+  stream->close_file = 0;
+  stream->internal = 0;
+
+  if((color->colortype == LCT_PALETTE || settings->force_palette)
+      && (color->palettesize == 0 || color->palettesize > 256))
+  {
+    CERROR_RETURN_ERROR(stream->error, 68); /*invalid palette size, it is only allowed to be 1-256*/
+  }
+  if(settings->zlibsettings.btype > 2) CERROR_RETURN_ERROR(stream->error, 61); /*error: unexisting btype*/
+  if(state->info_png.interlace_method > 1) CERROR_RETURN_ERROR(stream->error, 71); /*error: unexisting interlace mode*/
+  if(state->info_png.interlace_method == 1) CERROR_RETURN_ERROR(stream->error, 95); /*Adam7 needs the whole image*/
+  if(settings->zlibsettings.custom_zlib || settings->zlibsettings.custom_deflate)
+  {
+    CERROR_RETURN_ERROR(stream->error, 96); /*custom compressors take the whole image at once*/
+  }
+  if(w == 0 || h == 0) CERROR_RETURN_ERROR(stream->error, 93);
+  stream->error = checkColorValidity(color->colortype, color->bitdepth);
+  if(stream->error) return stream->error; /*error: unexisting color type given*/
+  stream->error = checkColorValidity(state->info_raw.colortype, state->info_raw.bitdepth);
+  if(stream->error) return stream->error; /*error: unexisting color type given*/
+
+  s = (LodePNGStreamInternal*)lodepng_malloc(sizeof(LodePNGStreamInternal));
+  if(!s) CERROR_RETURN_ERROR(stream->error, 83); /*alloc fail*/
+  stream->internal = s;
+
+  linebytes = ((size_t)w * lodepng_get_bpp(color) + 7) / 8;
+  lodepng_info_init(&s->info);
+  lodepng_color_mode_init(&s->info_raw);
+  s->settings = *settings;
+  s->prevline = (unsigned char*)lodepng_malloc(linebytes);
+  ucvector_init(&s->window);
+  s->windowstart = s->windowpos = 0;
+  s->datasize = (size_t)h * (linebytes + 1);
+  /*with btype 0 this gives the same 65535 byte stored blocks as deflateNoCompression does on the whole data*/
+  s->blocksize = settings->zlibsettings.btype == 0 ? 65535 : getDeflateBlockSize(s->datasize);
+  ucvector_init(&s->deflated);
+  s->adler = 1;
+  s->prefiltered = 0;
+  ucvector_init(&s->attempts);
+  s->hashes = 0;
+  s->numhashes = 0;
+  /*zlib header: CMF 120 (deflate, 32K window) and FLG 1 (no dictionary, FCHECK makes CMF * 256 + FLG a multiple of 31).
+  The deflate blocks follow in the same bit stream.*/
+  if(ucvector_resize(&s->deflated, 8))
+  {
+    ucvector_push_back(&s->deflated, 120);
+    ucvector_push_back(&s->deflated, 1);
+  }
+  s->bp = 80;
+
+#ifdef LODEPNG_COMPILE_THREADS
+  if(settings->zlibsettings.btype != 0) numhashes = lodepng_get_num_threads(settings->zlibsettings.numthreads);
+#endif /*LODEPNG_COMPILE_THREADS*/
+  stream->error = hashes_reserve(&s->hashes, &s->numhashes, numhashes, settings->zlibsettings.windowsize, 0);
+  if(!stream->error && (!s->prevline || s->deflated.size != 10)) stream->error = 83; /*alloc fail*/
+  if(!stream->error) stream->error = lodepng_info_copy(&s->info, &state->info_png);
+  if(!stream->error) stream->error = lodepng_color_mode_copy(&s->info_raw, &state->info_raw);
+  if(stream->error) return stream->error;
+
+  ucvector_init(&header);
+  stream->error = addChunksBeforeIDAT(&header, w, h, &s->info, &s->settings);
+  if(!stream->error) stream->error = streamWrite(stream, header.data, header.size);
+  ucvector_cleanup(&header);
+
+  return stream->error;
+}
+
+unsigned lodepng_stream_encoder_add_rows(LodePNGStreamEncoder* stream, const unsigned char* rows, unsigned numrows)
+{
+  LodePNGStreamInternal* s = stream->internal;
+  const LodePNGColorMode* color;
+  LodePNGEncoderSettings settings;
+  unsigned char* converted = 0;
+  unsigned char* padded = 0;
+  const unsigned char* band = rows; /*the rows in the PNG color mode, with padding bits*/
+  unsigned bpp, error = 0;
+  size_t linebytes, filterpos;
+
+  if(stream->error) return stream->error;
+  if(numrows > stream->h - stream->y) CERROR_RETURN_ERROR(stream->error, 97);
+  if(s->prefiltered) CERROR_RETURN_ERROR(stream->error, 101);
+  if(numrows == 0) return 0;
+
+  color = &s->info.color;
+  bpp = lodepng_get_bpp(color);
+  linebytes = ((size_t)stream->w * bpp + 7) / 8;
+
+  while(!error) /*while only executed once, to break on error*/
+  {
+    if(!lodepng_color_mode_equal(&s->info_raw, color))
+    {
+      converted = (unsigned char*)lodepng_malloc(((size_t)stream->w * numrows * bpp + 7) / 8);
+      if(!converted) ERROR_BREAK(83); /*alloc fail*/
+      error = lodepng_convert(converted, rows, color, &s->info_raw, stream->w, numrows);
+      if(error) break;
+      band = converted;
+    }
+    /*non multiple of 8 bits per scanline, padding bits needed per scanline*/
+    if(bpp < 8 && stream->w * bpp != linebytes * 8)
+    {
+      padded = (unsigned char*)lodepng_malloc(numrows * linebytes);
+      if(!padded) ERROR_BREAK(83); /*alloc fail*/
+      addPaddingBits(padded, band, linebytes * 8, stream->w * bpp, numrows);
+      band = padded;
+    }
+
+    /*filter straight into the end of the deflate window*/
+    filterpos = s->window.size;
+    if(!ucvector_resize(&s->window, filterpos + numrows * (linebytes + 1))) ERROR_BREAK(83); /*alloc fail*/
+    settings = s->settings;
+    if(settings.predefined_filters) settings.predefined_filters += stream->y;
+    error = filter(&s->window.data[filterpos], band, stream->y ? s->prevline : 0, stream->w, numrows, color, &settings,
+                   &s->attempts);
+    if(error) break;
+    memcpy(s->prevline, &band[(numrows - 1) * linebytes], linebytes);
+    s->adler = update_adler32(s->adler, &s->window.data[filterpos], (unsigned)(numrows * (linebytes + 1)));
+    stream->y += numrows;
+
+    error = streamDeflate(stream);
+    break;
+  }
+
+  lodepng_free(converted);
+  lodepng_free(padded);
+  stream->error = error;
+  return error;
+}
+
+unsigned lodepng_stream_encoder_add_filtered_rows(LodePNGStreamEncoder* stream, const unsigned char* rows,
+                                                  size_t stride, unsigned numrows)
+{
+  LodePNGStreamInternal* s = stream->internal;
+  size_t linebytes, filterpos, y;
+
+  if(stream->error) return stream->error;
+  if(numrows > stream->h - stream->y) CERROR_RETURN_ERROR(stream->error, 97);
+  if(numrows == 0) return 0;
+
+  linebytes = ((size_t)stream->w * lodepng_get_bpp(&s->info.color) + 7) / 8;
+  if(stride < linebytes + 1) CERROR_RETURN_ERROR(stream->error, 102);
+
+  /*the rows already are zlib data, copy them to the end of the deflate window as they are*/
+  filterpos = s->window.size;
+  if(!ucvector_resize(&s->window, filterpos + numrows * (linebytes + 1))) CERROR_RETURN_ERROR(stream->error, 83);
+  for(y = 0; y != numrows; ++y)
+  {
+    const unsigned char* row = &rows[y * stride];
+    if(row[0] > 4)
+    {
+      s->window.size = filterpos;
+      CERROR_RETURN_ERROR(stream->error, 36); /*error: illegal filter type*/
+    }
+    memcpy(&s->window.data[filterpos + y * (linebytes + 1)], row, linebytes + 1);
+  }
+  s->adler = update_adler32(s->adler, &s->window.data[filterpos], (unsigned)(numrows * (linebytes + 1)));
+  s->prefiltered = 1;
+  stream->y += numrows;
+
+  stream->error = streamDeflate(stream);
+  return stream->error;
+}
+
+#ifdef LODEPNG_COMPILE_DISK
+/*closes the file opened by lodepng_stream_encoder_init_file, if any. Returns nonzero if closing failed.*/
+static int streamCloseFile(LodePNGStreamEncoder* stream)
+{
+  int result = 0;
+  if(stream->close_file)
+  {
+#ifdef LODEPNG_COMPILE_MMAP
+    result = close(stream->fd);
+    stream->fd = -1;
+#else /*LODEPNG_COMPILE_MMAP*/
+    /*closing flushes the last buffered bytes, so this can still fail*/
+    result = fclose((FILE*)stream->write_context);
+#endif /*LODEPNG_COMPILE_MMAP*/
+    stream->close_file = 0;
+    stream->write_context = 0;
+  }
+  return result;
+}
+#endif /*LODEPNG_COMPILE_DISK*/
+
+unsigned lodepng_stream_encoder_finish(LodePNGStreamEncoder* stream)
+{
+  LodePNGStreamInternal* s = stream->internal;
+  ucvector trailer;
+
+  if(stream->error) return stream->error;
+  if(stream->y != stream->h) CERROR_RETURN_ERROR(stream->error, 98);
+
+  ucvector_init(&trailer);
+  stream->error = addChunksAfterIDAT(&trailer, &s->info, &s->settings);
+  if(!stream->error) stream->error = streamWrite(stream, trailer.data, trailer.size);
+  ucvector_cleanup(&trailer);
+
+#ifdef LODEPNG_COMPILE_DISK
+  if(streamCloseFile(stream) && !stream->error) stream->error = 99;
+#endif /*LODEPNG_COMPILE_DISK*/
+
+  return stream->error;
+}
+
+void lodepng_stream_encoder_cleanup(LodePNGStreamEncoder* stream)
+{
+  LodePNGStreamInternal* s = stream->internal;
+  if(s)
+  {
+    lodepng_info_cleanup(&s->info);
+    lodepng_color_mode_cleanup(&s->info_raw);
+    lodepng_free(s->prevline);
+    ucvector_cleanup(&s->window);
+    ucvector_cleanup(&s->deflated);
+    ucvector_cleanup(&s->attempts);
+    hashes_cleanup(s->hashes, s->numhashes, 0);
+    lodepng_free(s);
+    stream->internal = 0;
+  }
+#ifdef LODEPNG_COMPILE_DISK
+  streamCloseFile(stream);
+#endif /*LODEPNG_COMPILE_DISK*/
+}
+
+#ifdef LODEPNG_COMPILE_MMAP
+static unsigned streamWriteFd(const unsigned char* data, size_t size, void* context)
+{
+  LodePNGStreamEncoder* stream = (LodePNGStreamEncoder*)context;
+  return lodepng_write_fd(stream->fd, &stream->fd_offset, data, size);
+}
+
+unsigned lodepng_stream_encoder_init_fd(LodePNGStreamEncoder* stream, int fd,
+                                        unsigned w, unsigned h, const LodePNGState* state)
+{
+  off_t offset = lseek(fd, 0, SEEK_CUR);
+  stream->fd = fd;
+  stream->fd_offset = offset < 0 ? -1 : (long long)offset;
+  return lodepng_stream_encoder_init(stream, w, h, state, streamWriteFd, stream);
+}
+
+unsigned lodepng_stream_encoder_init_file(LodePNGStreamEncoder* stream, const char* filename,
+                                          unsigned w, unsigned h, const LodePNGState* state)
+{
+  int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  if(fd < 0)
+  {
+    stream->internal = 0;
+    stream->close_file = 0;
+    CERROR_RETURN_ERROR(stream->error, 79);
+  }
+  lodepng_stream_encoder_init_fd(stream, fd, w, h, state);
+  stream->close_file = 1;
+  return stream->error;
+}
+#elif defined(LODEPNG_COMPILE_DISK)
+static unsigned streamWriteFile(const unsigned char* data, size_t size, void* context)
+{
+  return fwrite((char*)data, 1, size, (FILE*)context) != size;
+}
+
+unsigned lodepng_stream_encoder_init_file(LodePNGStreamEncoder* stream, const char* filename,
+                                          unsigned w, unsigned h, const LodePNGState* state)
+{
+  FILE* file = fopen(filename, "wb");
+  if(!file)
+  {
+    stream->internal = 0;
+    stream->close_file = 0;
+    CERROR_RETURN_ERROR(stream->error, 79);
+  }
+  lodepng_stream_encoder_init(stream, w, h, state, streamWriteFile, file);
+  stream->close_file = 1;
+  return stream->error;
+}
+#endif /*LODEPNG_COMPILE_MMAP*/
+
+#endif /*LODEPNG_COMPILE_ZLIB*/
+
 void lodepng_encoder_settings_init(LodePNGEncoderSettings* settings)
 {
   lodepng_compress_settings_init(&settings->zlibsettings);
@@ -5887,6 +8661,7 @@ void lodepng_encoder_settings_init(LodePNGEncoderSettings* settings)
   settings->auto_convert = 1;
   settings->force_palette = 0;
   settings->predefined_filters = 0;
+  settings->profile = 0;
 #ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
   settings->add_id = 0;
   settings->text_compression = 1;
@@ -5998,6 +8773,15 @@ const char* lodepng_error_text(unsigned code)
     case 92: return "too many pixels, not supported";
     case 93: return "zero width or height is invalid";
     case 94: return "header chunk must have a size of 13 bytes";
+    /*the stream encoder writes the scanlines top to bottom as they come in*/
+    case 95: return "the stream encoder does not support Adam7 interlacing";
+    case 96: return "the stream encoder cannot use custom zlib or deflate functions";
+    case 97: return "more scanlines given to the stream encoder than the image height";
+    case 98: return "stream encoder finished before all scanlines were given";
+    case 99: return "the stream encoder failed to write its output";
+    case 100: return "output buffer given to lodepng_decode_into is too small for the image";
+    case 101: return "the stream encoder can't filter scanlines after already filtered ones";
+    case 102: return "stride of the filtered scanlines given to the stream encoder is smaller than a scanline";
   }
   return "unknown error code";
 }
@@ -6105,18 +8889,10 @@ State& State::operator=(const State& other)
 unsigned decode(std::vector<unsigned char>& out, unsigned& w, unsigned& h, const unsigned char* in,
                 size_t insize, LodePNGColorType colortype, unsigned bitdepth)
 {
-  unsigned char* buffer;
-  unsigned error = lodepng_decode_memory(&buffer, &w, &h, in, insize, colortype, bitdepth);
-  if(buffer && !error)
-  {
-    State state;
-    state.info_raw.colortype = colortype;
-    state.info_raw.bitdepth = bitdepth;
-    size_t buffersize = lodepng_get_raw_size(w, h, &state.info_raw);
-    out.insert(out.end(), &buffer[0], &buffer[buffersize]);
-    lodepng_free(buffer);
-  }
-  return error;
+  State state;
+  state.info_raw.colortype = colortype;
+  state.info_raw.bitdepth = bitdepth;
+  return decode(out, w, h, state, in, insize);
 }
 
 unsigned decode(std::vector<unsigned char>& out, unsigned& w, unsigned& h,
@@ -6129,14 +8905,15 @@ unsigned decode(std::vector<unsigned char>& out, unsigned& w, unsigned& h,
                 State& state,
                 const unsigned char* in, size_t insize)
 {
-  unsigned char* buffer = NULL;
-  unsigned error = lodepng_decode(&buffer, &w, &h, &state, in, insize);
-  if(buffer && !error)
-  {
-    size_t buffersize = lodepng_get_raw_size(w, h, &state.info_raw);
-    out.insert(out.end(), &buffer[0], &buffer[buffersize]);
-  }
-  lodepng_free(buffer);
+  /*the pixels are decoded straight into the end of out, which is grown to its final size up front*/
+  size_t oldsize = out.size(), buffersize;
+  unsigned error = lodepng_inspect(&w, &h, &state, in, insize);
+  if(!error) error = checkNumPixels(w, h);
+  if(error) return error;
+  buffersize = lodepng_get_raw_size(w, h, state.decoder.color_convert ? &state.info_raw : &state.info_png.color);
+  out.resize(oldsize + buffersize);
+  error = lodepng_decode_into(buffersize ? &out[oldsize] : 0, buffersize, &w, &h, &state, in, insize);
+  if(error) out.resize(oldsize);
   return error;
 }
 
@@ -6151,10 +8928,12 @@ unsigned decode(std::vector<unsigned char>& out, unsigned& w, unsigned& h,
 unsigned decode(std::vector<unsigned char>& out, unsigned& w, unsigned& h, const std::string& filename,
                 LodePNGColorType colortype, unsigned bitdepth)
 {
-  std::vector<unsigned char> buffer;
-  unsigned error = load_file(buffer, filename);
-  if(error) return error;
-  return decode(out, w, h, buffer, colortype, bitdepth);
+  const unsigned char* buffer = 0;
+  size_t buffersize = 0;
+  unsigned error = lodepng_map_file(&buffer, &buffersize, filename.c_str());
+  if(!error) error = decode(out, w, h, buffer, buffersize, colortype, bitdepth);
+  lodepng_unmap_file(buffer, buffersize);
+  return error;
 }
 #endif /* LODEPNG_COMPILE_DECODER */
 #endif /* LODEPNG_COMPILE_DISK */
@@ -6205,6 +8984,27 @@ unsigned encode(std::vector<unsigned char>& out,
   return encode(out, in.empty() ? 0 : &in[0], w, h, state);
 }
 
+EncoderContext::EncoderContext(const LodePNGAllocator* allocator)
+{
+  lodepng_encoder_context_init(this, allocator);
+}
+
+EncoderContext::~EncoderContext()
+{
+  lodepng_encoder_context_cleanup(this);
+}
+
+unsigned encode(std::vector<unsigned char>& out,
+                const unsigned char* in, unsigned w, unsigned h,
+                State& state, EncoderContext& context)
+{
+  const unsigned char* buffer;
+  size_t buffersize;
+  unsigned error = lodepng_encode_context(&buffer, &buffersize, in, w, h, &state, &context);
+  if(!error) out.insert(out.end(), &buffer[0], &buffer[buffersize]);
+  return error;
+}
+
 #ifdef LODEPNG_COMPILE_DISK
 unsigned encode(const std::string& filename,
                 const unsigned char* in, unsigned w, unsigned h,
@@ -80,12 +80,47 @@ source files with custom allocators.*/
 #define LODEPNG_COMPILE_CPP
 #endif
 #endif
+/*compile multithreaded compression, this needs C++11 std::thread (link with -pthread on POSIX).
+The amount of threads is chosen with the numthreads setting, which defaults to a single thread.*/
+#if defined(__cplusplus) && (__cplusplus >= 201103L || (defined(_MSC_VER) && _MSC_VER >= 1900))
+#ifndef LODEPNG_NO_COMPILE_THREADS
+#define LODEPNG_COMPILE_THREADS
+#endif
+#endif
+/*compile SSE2 and AVX2 versions of the hot loops, chosen at runtime depending on what the CPU supports.
+This needs gcc 6 or newer or clang on x86, other compilers and CPUs always use the portable code.*/
+#if (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__clang__) || __GNUC__ >= 6)
+#ifndef LODEPNG_NO_COMPILE_SIMD
+#define LODEPNG_COMPILE_SIMD
+#endif
+#endif
+/*read files with mmap and write them with pwrite on a file descriptor, instead of copying them through C's
+stdio buffers. This needs POSIX, on other systems the disk functions always use stdio.*/
+#if defined(LODEPNG_COMPILE_DISK) && (defined(__unix__) || defined(__APPLE__))
+#ifndef LODEPNG_NO_COMPILE_MMAP
+#define LODEPNG_COMPILE_MMAP
+#endif
+#endif
 
 #ifdef LODEPNG_COMPILE_CPP
 #include <vector>
 #include <string>
 #endif /*LODEPNG_COMPILE_CPP*/
 
+/*
+Allocator for the buffers of an encoder context (see lodepng_encoder_context_init), e.g. to take
+them from an arena. realloc_func gets NULL as ptr to allocate, and must keep the first oldsize
+bytes like realloc. free_func gets the size the buffer was last allocated with. user is passed
+to both unchanged.
+*/
+typedef struct LodePNGAllocator
+{
+  void* (*realloc_func)(void* ptr, size_t oldsize, size_t newsize, void* user);
+  void (*free_func)(void* ptr, size_t size, void* user);
+  void* user;
+} LodePNGAllocator;
+
 #ifdef LODEPNG_COMPILE_PNG
 /*The PNG color types (also used for raw).*/
 typedef enum LodePNGColorType
@@ -276,6 +311,27 @@ void lodepng_decompress_settings_init(LodePNGDecompressSettings* settings);
 #endif /*LODEPNG_COMPILE_DECODER*/
 
 #ifdef LODEPNG_COMPILE_ENCODER
+/*How the built in deflate looks for repeated data to encode as LZ77 length/distance pairs*/
+typedef enum LodePNGDeflateStrategy
+{
+  /*hash chain search, tuned with windowsize, minmatch, nicematch, lazymatching and maxchainlength*/
+  LDS_DEFAULT,
+  /*only repeats of the previous byte, as distance 1 matches. Filtered images with large flat areas
+  are made of such runs, so this gets close to the default size many times faster*/
+  LDS_RLE,
+  /*no LZ77 at all, the bytes are only Huffman coded. The same as use_lz77 set to 0*/
+  LDS_HUFFMAN_ONLY
+} LodePNGDeflateStrategy;
+
+/*Named levels for lodepng_compress_settings_level. The levels in between can be used as well.*/
+typedef enum LodePNGCompressLevel
+{
+  LCL_NONE = 0, /*no compression, stored blocks*/
+  LCL_FASTEST = 1, /*greedy matching on very short hash chains*/
+  LCL_DEFAULT = 6, /*lazy matching on short hash chains, a good balance of speed and size*/
+  LCL_BEST = 9 /*searches the whole window for every match, the smallest and slowest*/
+} LodePNGCompressLevel;
+
 /*
 Settings for zlib compression. Tweaking these settings tweaks the balance
 between speed and compression ratio.
@@ -290,6 +346,17 @@ struct LodePNGCompressSettings /*deflate = compress*/
   unsigned minmatch; /*mininum lz77 length. 3 is normally best, 6 can be better for some PNGs. Default: 0*/
   unsigned nicematch; /*stop searching if >= this length found. Set to 258 for best compression. Default: 128*/
   unsigned lazymatching; /*use lazy matching: better compression but a bit slower. Default: true*/
+  /*maximum amount of earlier positions tried per LZ77 match search, 0 means windowsize if windowsize is at
+  least 8192, windowsize / 8 otherwise. Lower is faster. Default: 0*/
+  unsigned maxchainlength;
+  LodePNGDeflateStrategy strategy; /*how to find LZ77 matches, see LodePNGDeflateStrategy. Default: LDS_DEFAULT*/
+  /*amount of threads the built in deflate may use, 0 means one per CPU core. Default: 1.
+  With more than one, the data is deflated as independent chunks of one block each, using the windowsize
+  bytes before a chunk as its dictionary. The result is slightly larger than with a single thread, but
+  identical for any numthreads above 1. The PNG encoder also uses this many threads to choose the filters
+  of the adaptive filter strategies, which does not change the result.
+  Only has effect if LODEPNG_COMPILE_THREADS is defined.*/
+  unsigned numthreads;
 
   /*use custom zlib encoder instead of built in one (default: null)*/
   unsigned (*custom_zlib)(unsigned char**, size_t*,
@@ -307,6 +374,13 @@ struct LodePNGCompressSettings /*deflate = compress*/
 
 extern const LodePNGCompressSettings lodepng_default_compress_settings;
 void lodepng_compress_settings_init(LodePNGCompressSettings* settings);
+/*
+Sets btype, use_lz77, windowsize, minmatch, nicematch, lazymatching and maxchainlength for a compression
+level from 0 to 9, like those of zlib: 0 only stores, 1 is the fastest and 9 the smallest. All levels use
+the full 32768 byte window. Higher levels are treated as 9. The other settings, including strategy, are
+left as they are. See LodePNGCompressLevel.
+*/
+void lodepng_compress_settings_level(LodePNGCompressSettings* settings, unsigned level);
 #endif /*LODEPNG_COMPILE_ENCODER*/
 
 #ifdef LODEPNG_COMPILE_PNG
@@ -511,6 +585,19 @@ unsigned lodepng_convert(unsigned char* out, const unsigned char* in,
                          const LodePNGColorMode* mode_out, const LodePNGColorMode* mode_in,
                          unsigned w, unsigned h);
 
+#ifdef LODEPNG_COMPILE_ENCODER
+/*
+Converts w * h pixels of 4 floats RGBA, like a GPU renders them, to 8-bit RGBA or to 8-bit RGB
+without the alpha, as given by mode_out, in a single pass. Channels are clamped to [0, 1] and
+rounded to the nearest byte value, NaN gives 0. in_stride and out_stride are the distances
+between the rows in bytes, so in can be a mapped buffer with a row pitch and out can be a part
+of a larger image. Bands of rows are converted on numthreads threads, 0 means one per core.
+Returns error 56 if mode_out is not 8-bit RGB or RGBA.
+*/
+unsigned lodepng_convert_from_float(unsigned char* out, size_t out_stride, const float* in, size_t in_stride,
+                                    unsigned w, unsigned h, const LodePNGColorMode* mode_out, unsigned numthreads);
+#endif /*LODEPNG_COMPILE_ENCODER*/
+
 #ifdef LODEPNG_COMPILE_DECODER
 /*
 Settings for the decoder. This contains settings for the PNG and the Zlib
@@ -580,6 +667,11 @@ Chooses an optimal color model, e.g. grey if only grey pixels, palette if < 256
 unsigned lodepng_auto_choose_color(LodePNGColorMode* mode_out,
                                    const unsigned char* image, unsigned w, unsigned h,
                                    const LodePNGColorMode* mode_in);
+/*Like lodepng_auto_choose_color, but from an already known profile of the image instead of scanning
+its pixels, e.g. one kept from an earlier frame with the same colors. w and h are the image size.*/
+unsigned lodepng_auto_choose_color_from_profile(LodePNGColorMode* mode_out,
+                                                const LodePNGColorProfile* profile, unsigned w, unsigned h,
+                                                const LodePNGColorMode* mode_in);
 
 /*Settings for the encoder.*/
 typedef struct LodePNGEncoderSettings
@@ -602,6 +694,12 @@ typedef struct LodePNGEncoderSettings
   must be set to 0 to ensure this is also used on palette or low bitdepth images.*/
   const unsigned char* predefined_filters;
 
+  /*used if auto_convert is true. If not NULL, the color type is chosen from this profile of the image
+  instead of from a scan of its pixels, which saves a pass over the image when the caller already
+  knows its colors. The profile must be correct for the image, or encoding fails or loses colors.
+  LodePNG never frees it. Default: NULL*/
+  const LodePNGColorProfile* profile;
+
   /*force creating a PLTE chunk if colortype is 2 or 6 (= a suggested palette).
   If colortype is 3, PLTE is _always_ created.*/
   unsigned force_palette;
@@ -651,6 +749,17 @@ unsigned lodepng_decode(unsigned char** out, unsigned* w, unsigned* h,
                         LodePNGState* state,
                         const unsigned char* in, size_t insize);
 
+/*
+Same as lodepng_decode, but decodes into out, a buffer of outsize bytes owned by the caller, instead of
+allocating one. It needs lodepng_get_raw_size(w, h, &state->info_raw) bytes, with w and h from
+lodepng_inspect, or the size for state->info_png.color if decoder.color_convert is off. Non-interlaced
+images are unfiltered and color converted straight into out, without a temporary image. Returns error
+100 if outsize is too small.
+*/
+unsigned lodepng_decode_into(unsigned char* out, size_t outsize, unsigned* w, unsigned* h,
+                             LodePNGState* state,
+                             const unsigned char* in, size_t insize);
+
 /*
 Read the PNG header, but not the actual data. This returns only the information
 that is in the header chunk of the PNG, such as width, height and color type. The
@@ -667,6 +776,123 @@ unsigned lodepng_inspect(unsigned* w, unsigned* h,
 unsigned lodepng_encode(unsigned char** out, size_t* outsize,
                         const unsigned char* image, unsigned w, unsigned h,
                         LodePNGState* state);
+
+/*
+Keeps the buffers of the encoder between images: the converted and filtered image, the filter
+attempts and LZ77 hash tables of each thread, and the PNG itself. After the first image, encoding
+more images of the same or a smaller size does not allocate these anymore. They are allocated with the allocator
+given to init, or with lodepng_malloc and co if it is NULL. The Huffman trees, the chunks of the
+multithreaded deflate and auto_convert still use lodepng_malloc.
+A context can be used for one image at a time, cleanup frees everything.
+*/
+typedef struct LodePNGEncoderContext
+{
+  struct LodePNGEncoderContextInternal* internal;
+} LodePNGEncoderContext;
+
+/*allocator is copied, and may be NULL. Returns error 83 if the context could not be allocated,
+cleanup must still be called then.*/
+unsigned lodepng_encoder_context_init(LodePNGEncoderContext* context, const LodePNGAllocator* allocator);
+void lodepng_encoder_context_cleanup(LodePNGEncoderContext* context);
+
+/*
+Same as lodepng_encode, but with the buffers of the context. out points into the context, it is
+only valid until the next image is encoded with it or it is cleaned up, and must not be freed.
+*/
+unsigned lodepng_encode_context(const unsigned char** out, size_t* outsize,
+                                const unsigned char* image, unsigned w, unsigned h,
+                                LodePNGState* state, LodePNGEncoderContext* context);
+
+#ifdef LODEPNG_COMPILE_ZLIB
+/*
+Receives the bytes of the PNG from the stream encoder, in file order. Must return 0
+on success, anything else stops the stream with error 99.
+*/
+typedef unsigned (*LodePNGStreamWriteFunc)(const unsigned char* data, size_t size, void* context);
+
+/*
+Encoder that writes the PNG while the image is still being produced, instead of needing
+the whole image in memory like lodepng_encode. Scanlines are given in bands of any
+amount of rows, from top to bottom. They are filtered and deflated right away, and each
+finished deflate block is written out as an IDAT chunk, so memory use stays bounded by
+the LZ77 window, one deflate block and the band being added.
+
+Since the whole image is never available, it differs from lodepng_encode in a few ways:
+*) auto_convert is ignored: the PNG gets the color mode of state->info_png, the rows
+   are given in state->info_raw and converted band by band. For a palette PNG, the
+   palette must already be in info_png.
+*) Adam7 interlacing (error 95) and custom_zlib or custom_deflate (error 96) are not supported.
+*) with btype 1, several fixed Huffman blocks are written instead of a single one.
+With btype 0 or 2, the zlib data is identical to that of lodepng_encode, only split over more IDAT chunks.
+
+Usage: init, add_rows (or add_filtered_rows) until all h rows are given, finish, and then always
+cleanup, also on errors.
+*/
+typedef struct LodePNGStreamEncoder
+{
+  unsigned w, h; /*size of the image*/
+  unsigned y; /*amount of scanlines given so far*/
+  unsigned error; /*the first error that happened, all following calls return it again*/
+
+  LodePNGStreamWriteFunc write;
+  void* write_context;
+  unsigned close_file; /*the file was opened by lodepng_stream_encoder_init_file, and is closed by finish*/
+#ifdef LODEPNG_COMPILE_MMAP
+  int fd; /*the file descriptor written by lodepng_stream_encoder_init_fd or _init_file*/
+  long long fd_offset; /*where the next pwrite goes, or -1 if fd can't seek and is written with write*/
+#endif /*LODEPNG_COMPILE_MMAP*/
+  struct LodePNGStreamInternal* internal; /*filter and deflate state, owned by the stream*/
+} LodePNGStreamEncoder;
+
+/*
+Writes the PNG signature and header chunks, the image will be w * h pixels. The
+settings and color modes are copied from state, except encoder.predefined_filters
+which must stay valid until the last row is given.
+*/
+unsigned lodepng_stream_encoder_init(LodePNGStreamEncoder* stream, unsigned w, unsigned h,
+                                     const LodePNGState* state, LodePNGStreamWriteFunc write, void* write_context);
+
+#ifdef LODEPNG_COMPILE_DISK
+/*
+Same as lodepng_stream_encoder_init, but writes to a file, which is overwritten without warning.
+With LODEPNG_COMPILE_MMAP the chunks go straight to the file with pwrite, without stdio buffering.
+*/
+unsigned lodepng_stream_encoder_init_file(LodePNGStreamEncoder* stream, const char* filename,
+                                          unsigned w, unsigned h, const LodePNGState* state);
+#endif /*LODEPNG_COMPILE_DISK*/
+
+#ifdef LODEPNG_COMPILE_MMAP
+/*
+Same as lodepng_stream_encoder_init, but writes to an open file descriptor, starting at its
+current offset. It is written with pwrite, so its own offset is left alone, or with write if
+it can't seek, like a pipe. The descriptor is not closed.
+*/
+unsigned lodepng_stream_encoder_init_fd(LodePNGStreamEncoder* stream, int fd,
+                                        unsigned w, unsigned h, const LodePNGState* state);
+#endif /*LODEPNG_COMPILE_MMAP*/
+
+/*
+Adds the next numrows scanlines. rows is laid out like a raw image of w * numrows
+pixels in the color mode of state->info_raw.
+*/
+unsigned lodepng_stream_encoder_add_rows(LodePNGStreamEncoder* stream, const unsigned char* rows, unsigned numrows);
+
+/*
+Adds the next numrows scanlines already filtered elsewhere, e.g. on the GPU, they go straight to deflate.
+Each row is a filter type byte followed by the filtered scanline in the color mode of state->info_png,
+with padding bits: exactly a row of the PNG's uncompressed zlib data. Rows are stride bytes apart, so
+padded rows can be given as they are. The filter strategy settings are not used.
+Can follow add_rows, but add_rows can't come after it (error 101): the unfiltered scanline the next
+rows would be filtered against is not known.
+*/
+unsigned lodepng_stream_encoder_add_filtered_rows(LodePNGStreamEncoder* stream, const unsigned char* rows,
+                                                  size_t stride, unsigned numrows);
+
+/*Writes the chunks after the image data and IEND, and closes the file if it opened one.*/
+unsigned lodepng_stream_encoder_finish(LodePNGStreamEncoder* stream);
+
+void lodepng_stream_encoder_cleanup(LodePNGStreamEncoder* stream);
+#endif /*LODEPNG_COMPILE_ZLIB*/
 #endif /*LODEPNG_COMPILE_ENCODER*/
 
 /*
@@ -736,6 +962,12 @@ unsigned lodepng_chunk_create(unsigned char** out, size_t* outlength, unsigned l
 
 /*Calculate CRC32 of buffer*/
 unsigned lodepng_crc32(const unsigned char* buf, size_t len);
+
+/*
+Given crc1, the CRC32 of buffer A, and crc2, the CRC32 of buffer B of len2 bytes, returns the CRC32 of
+A followed by B. Allows computing the CRC of separate parts, e.g. on different threads, and joining them.
+*/
+unsigned lodepng_crc32_combine(unsigned crc1, unsigned crc2, size_t len2);
 #endif /*LODEPNG_COMPILE_PNG*/
 
 
@@ -788,6 +1020,13 @@ unsigned lodepng_deflate(unsigned char** out, size_t* outsize,
                          const LodePNGCompressSettings* settings);
 
 #endif /*LODEPNG_COMPILE_ENCODER*/
+
+/*
+Given adler1, the Adler-32 of buffer A, and adler2, the Adler-32 of buffer B of len2 bytes, returns the
+Adler-32 of A followed by B, as stored at the end of zlib data. Allows checksumming the parts of a
+buffer separately, e.g. on different threads, and joining them.
+*/
+unsigned lodepng_adler32_combine(unsigned adler1, unsigned adler2, size_t len2);
 #endif /*LODEPNG_COMPILE_ZLIB*/
 
 #ifdef LODEPNG_COMPILE_DISK
@@ -810,6 +1049,15 @@ filename: the path to the file to save to
 return value: error code (0 means ok)
 */
 unsigned lodepng_save_file(const unsigned char* buffer, size_t buffersize, const char* filename);
+
+/*
+Same as lodepng_load_file, but with LODEPNG_COMPILE_MMAP the file is mapped read-only
+instead of copied into an allocated buffer, so its pages are only read in as they are
+used. The file must not be truncated while it is mapped. Release the buffer with
+lodepng_unmap_file, not with free. Without LODEPNG_COMPILE_MMAP this loads the file.
+*/
+unsigned lodepng_map_file(const unsigned char** out, size_t* outsize, const char* filename);
+void lodepng_unmap_file(const unsigned char* buffer, size_t buffersize);
 #endif /*LODEPNG_COMPILE_DISK*/
 
 #ifdef LODEPNG_COMPILE_CPP
@@ -844,6 +1092,23 @@ unsigned encode(std::vector<unsigned char>& out,
 unsigned encode(std::vector<unsigned char>& out,
                 const std::vector<unsigned char>& in, unsigned w, unsigned h,
                 State& state);
+
+/*Owns the buffers of a LodePNGEncoderContext, to encode many images without allocating them each time.*/
+class EncoderContext : public LodePNGEncoderContext
+{
+  public:
+    explicit EncoderContext(const LodePNGAllocator* allocator = 0);
+    virtual ~EncoderContext();
+
+  private:
+    EncoderContext(const EncoderContext& other); /*not copyable, it owns its buffers*/
+    EncoderContext& operator=(const EncoderContext& other);
+};
+
+/*Same as the encode with a State, but reuses the buffers of the context. The PNG is appended to out.*/
+unsigned encode(std::vector<unsigned char>& out,
+                const unsigned char* in, unsigned w, unsigned h,
+                State& state, EncoderContext& context);
 #endif /*LODEPNG_COMPILE_ENCODER*/
 
 #ifdef LODEPNG_COMPILE_DISK
@@ -1172,6 +1437,12 @@ can encode the colors of all pixels without information loss.
    true for proper compression.
 *) windowsize: the window size used by the LZ77 encoder (1 - 32768). Has value
    2048 by default, but can be set to 32768 for better, but slow, compression.
+*) maxchainlength: how many earlier positions the LZ77 encoder tries per match,
+   0 by default, which chooses it from the windowsize.
+*) strategy: LDS_DEFAULT for the normal LZ77 search, LDS_RLE to only encode runs
+   of a repeated byte, which is very fast, or LDS_HUFFMAN_ONLY for no LZ77.
+*) lodepng_compress_settings_level sets the above to a level from 0 (store) over
+   1 (fastest) to 9 (smallest), similar to the levels of zlib.
 *) force_palette: if colortype is 2 or 6, you can make the encoder write a PLTE
    chunk if force_palette is true. This can used as suggested palette to convert
    to by viewers that don't support more than 256 colors (if those still exist)
@@ -1583,6 +1854,8 @@ state.encoder.zlibsettings.windowsize: tweak LZ77 windowsize
 state.encoder.zlibsettings.minmatch: tweak min LZ77 length to match
 state.encoder.zlibsettings.nicematch: tweak LZ77 match where to stop searching
 state.encoder.zlibsettings.lazymatching: try one more LZ77 matching
+state.encoder.zlibsettings.maxchainlength: tweak how many LZ77 matches to try
+state.encoder.zlibsettings.strategy: normal LZ77, run length only or Huffman only
 state.encoder.zlibsettings.custom_...: use custom deflate function
 state.encoder.auto_convert: choose optimal PNG color type, if 0 uses info_png
 state.encoder.filter_palette_zero: PNG filter strategy for palette
@@ -0,0 +1,232 @@
+/*
+Timings of lodepng's deflate on the filtered scanlines of a PNG, mandelbrot.png by default, with a few
+match finder settings, every compression level and the deflate strategies. Then timings of inflate, on
+streams of the image pixels, and of decoding the image as a PNG.
+
+The image is filtered the way lodepng_encode filters it, once as RGB and once as the palette image that
+auto_convert picks for the render. Those scanlines are then deflated with a few window sizes. Times are CPU
+time, the best of a few runs, so they don't count time the sandbox or the OS spends elsewhere.
+
+Build and run (the "benchmark" task):
+g++ lodepng_benchmark.cpp -O2 -std=c++11 -pthread -olodepng_benchmark && ./lodepng_benchmark [image.png]
+
+To compare with another version of lodepng, copy this file next to that version's lodepng.h and lodepng.cpp
+and build and run it there on the same image. Add -DLODEPNG_BENCHMARK_NO_LEVELS for a lodepng from before
+lodepng_compress_settings_level and the deflate strategies, which only runs the match finder settings.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <vector>
+
+#include "lodepng.h"
+
+static const int RUNS = 3;
+
+static double cpuMilliseconds()
+{
+  return clock() * 1000.0 / CLOCKS_PER_SEC;
+}
+
+/*the filtered scanlines of a PNG, which is what lodepng deflates: its IDAT chunks decompressed*/
+static std::vector<unsigned char> filteredScanlines(const std::vector<unsigned char>& png)
+{
+  std::vector<unsigned char> zlib, scanlines;
+  const unsigned char* chunk = &png[8];
+  while(chunk < &png[0] + png.size())
+  {
+    if(lodepng_chunk_type_equals(chunk, "IDAT"))
+    {
+      const unsigned char* data = lodepng_chunk_data_const(chunk);
+      zlib.insert(zlib.end(), data, data + lodepng_chunk_length(chunk));
+    }
+    chunk = lodepng_chunk_next_const(chunk);
+  }
+  lodepng::decompress(scanlines, zlib);
+  return scanlines;
+}
+
+/*encodes the image with stored deflate blocks, which are quick to take the scanlines back out of*/
+static std::vector<unsigned char> encodeScanlines(const std::vector<unsigned char>& image, unsigned w, unsigned h,
+                                                  bool auto_convert)
+{
+  std::vector<unsigned char> png;
+  lodepng::State state;
+  state.info_raw.colortype = LCT_RGB;
+  state.info_png.color.colortype = LCT_RGB;
+  state.encoder.auto_convert = auto_convert;
+  state.encoder.zlibsettings.btype = 0;
+  lodepng::encode(png, image, w, h, state);
+  return filteredScanlines(png);
+}
+
+/*deflates the data RUNS times, prints the size and the fastest time*/
+static void benchmarkDeflate(const char* name, const std::vector<unsigned char>& data, const LodePNGCompressSettings& settings)
+{
+  double best = 0;
+  size_t size = 0;
+  for(int run = 0; run < RUNS; ++run)
+  {
+    unsigned char* out = 0;
+    size_t outsize = 0;
+    double start = cpuMilliseconds();
+    unsigned error = lodepng_deflate(&out, &outsize, &data[0], data.size(), &settings);
+    double time = cpuMilliseconds() - start;
+    free(out);
+    if(error)
+    {
+      printf("  %-18s error %u: %s\n", name, error, lodepng_error_text(error));
+      return;
+    }
+    if(run == 0 || time < best) best = time;
+    size = outsize;
+  }
+  printf("  %-18s %9u bytes %7.0f ms\n", name, (unsigned)size, best);
+}
+
+/*the default settings, larger windows up to the largest with nicematch 258 for best compression, and a fast setting*/
+static void benchmarkMatchFinder(const std::vector<unsigned char>& data)
+{
+  static const struct { unsigned windowsize, nicematch, lazymatching; const char* name; } configs[] = {
+    {2048, 128, 1, "ws2048 (default)"},
+    {8192, 128, 1, "ws8192"},
+    {32768, 258, 1, "ws32768 nice258"},
+    {1024, 32, 0, "ws1024 no lazy"}
+  };
+  for(size_t i = 0; i < sizeof(configs) / sizeof(*configs); ++i)
+  {
+    LodePNGCompressSettings settings;
+    lodepng_compress_settings_init(&settings);
+    settings.windowsize = configs[i].windowsize;
+    settings.nicematch = configs[i].nicematch;
+    settings.lazymatching = configs[i].lazymatching;
+    benchmarkDeflate(configs[i].name, data, settings);
+  }
+}
+
+#ifndef LODEPNG_BENCHMARK_NO_LEVELS
+/*every compression level, and the strategies with otherwise default settings*/
+static void benchmarkLevels(const std::vector<unsigned char>& data)
+{
+  char name[32];
+  for(unsigned level = 0; level <= 9; ++level)
+  {
+    LodePNGCompressSettings settings;
+    lodepng_compress_settings_init(&settings);
+    lodepng_compress_settings_level(&settings, level);
+    snprintf(name, sizeof(name), "level %u", level);
+    benchmarkDeflate(name, data, settings);
+  }
+
+  LodePNGCompressSettings settings;
+  lodepng_compress_settings_init(&settings);
+  settings.strategy = LDS_RLE;
+  benchmarkDeflate("LDS_RLE", data, settings);
+  settings.strategy = LDS_HUFFMAN_ONLY;
+  benchmarkDeflate("LDS_HUFFMAN_ONLY", data, settings);
+}
+
+/*inflates a zlib stream of the data made with the settings RUNS times, prints the fastest time*/
+static void benchmarkInflate(const char* name, const std::vector<unsigned char>& data, const LodePNGCompressSettings& settings)
+{
+  std::vector<unsigned char> zlib;
+  lodepng::compress(zlib, data, settings);
+  double best = 0;
+  for(int run = 0; run < RUNS; ++run)
+  {
+    std::vector<unsigned char> out;
+    double start = cpuMilliseconds();
+    unsigned error = lodepng::decompress(out, zlib);
+    double time = cpuMilliseconds() - start;
+    if(error || out != data)
+    {
+      printf("  %-24s error %u: %s\n", name, error, error ? lodepng_error_text(error) : "wrong output");
+      return;
+    }
+    if(run == 0 || time < best) best = time;
+  }
+  printf("  %-24s %9u bytes %7.0f ms %6.0f MB/s\n", name, (unsigned)zlib.size(), best, data.size() / best / 1000.0);
+}
+
+/*decodes a PNG of the image encoded with the settings RUNS times, prints the fastest time*/
+static void benchmarkDecode(const char* name, const std::vector<unsigned char>& image, unsigned w, unsigned h,
+                            const LodePNGCompressSettings& settings)
+{
+  std::vector<unsigned char> png;
+  lodepng::State state;
+  state.info_raw.colortype = LCT_RGB;
+  state.encoder.zlibsettings = settings;
+  lodepng::encode(png, image, w, h, state);
+  double best = 0;
+  for(int run = 0; run < RUNS; ++run)
+  {
+    std::vector<unsigned char> out;
+    unsigned outw, outh;
+    double start = cpuMilliseconds();
+    unsigned error = lodepng::decode(out, outw, outh, png, LCT_RGB, 8);
+    double time = cpuMilliseconds() - start;
+    if(error || out != image)
+    {
+      printf("  %-24s error %u: %s\n", name, error, error ? lodepng_error_text(error) : "wrong output");
+      return;
+    }
+    if(run == 0 || time < best) best = time;
+  }
+  printf("  %-24s %9u bytes %7.0f ms\n", name, (unsigned)png.size(), best);
+}
+
+/*inflate of streams with mostly long matches, and of noisy ones with mostly literals*/
+static void benchmarkInflates(const std::vector<unsigned char>& image, unsigned w, unsigned h)
+{
+  /*the render with a little noise added, so that most of it is literals*/
+  std::vector<unsigned char> noisy = image;
+  srand(1);
+  for(size_t i = 0; i < noisy.size(); ++i) noisy[i] = (unsigned char)(noisy[i] + rand() % 5);
+
+  LodePNGCompressSettings rle, level6, huffman;
+  lodepng_compress_settings_init(&rle);
+  rle.strategy = LDS_RLE;
+  lodepng_compress_settings_init(&level6);
+  lodepng_compress_settings_level(&level6, 6);
+  lodepng_compress_settings_init(&huffman);
+  huffman.strategy = LDS_HUFFMAN_ONLY;
+
+  benchmarkInflate("render, LDS_RLE", image, rle);
+  benchmarkInflate("render, level 6", image, level6);
+  benchmarkInflate("noisy, level 6", noisy, level6);
+  benchmarkInflate("noisy, LDS_HUFFMAN_ONLY", noisy, huffman);
+  benchmarkDecode("decode, LDS_RLE PNG", image, w, h, rle);
+  benchmarkDecode("decode, default PNG", image, w, h, lodepng_default_compress_settings);
+}
+#endif /*LODEPNG_BENCHMARK_NO_LEVELS*/
+
+int main(int argc, char** argv)
+{
+  const char* filename = argc > 1 ? argv[1] : "mandelbrot.png";
+  std::vector<unsigned char> image;
+  unsigned w, h;
+  unsigned error = lodepng::decode(image, w, h, filename, LCT_RGB, 8);
+  if(error)
+  {
+    printf("%s: error %u: %s\n", filename, error, lodepng_error_text(error));
+    return 1;
+  }
+
+  std::vector<unsigned char> rgb = encodeScanlines(image, w, h, false);
+  std::vector<unsigned char> palette = encodeScanlines(image, w, h, true);
+
+  printf("deflate, RGB, %u bytes of scanlines\n", (unsigned)rgb.size());
+  benchmarkMatchFinder(rgb);
+#ifndef LODEPNG_BENCHMARK_NO_LEVELS
+  benchmarkLevels(rgb);
+#endif /*LODEPNG_BENCHMARK_NO_LEVELS*/
+  printf("deflate, palette (auto_convert), %u bytes of scanlines\n", (unsigned)palette.size());
+  benchmarkMatchFinder(palette);
+#ifndef LODEPNG_BENCHMARK_NO_LEVELS
+  benchmarkLevels(palette);
+  printf("inflate (lodepng::decompress) and decode (lodepng::decode), RGB pixels, %u bytes\n", (unsigned)image.size());
+  benchmarkInflates(image, w, h);
+#endif /*LODEPNG_BENCHMARK_NO_LEVELS*/
+  return 0;
+}
@@ -0,0 +1,1333 @@
+/*
+Tests of the SIMD code in lodepng against portable reference code, of deflate and inflate against a
+reference decoder that reads one bit at a time, and of the encoders by decoding what they write.
+
+lodepng picks its SSE2, SSSE3, PCLMUL and AVX2 functions at runtime. LODEPNG_CPU_SUPPORTS is
+defined below to hide the newer instruction sets, so every dispatch tier the CPU can run is
+tested on the same machine, including the SSE2 only one. lodepng is compiled into this file like
+into main.cpp, so its static functions can be tested directly.
+
+Build and run (the "unittest" task):
+g++ lodepng_unittest.cpp -O2 -std=c++11 -pthread -olodepng_unittest && ./lodepng_unittest
+*/
+
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include <vector>
+
+/*the dispatch tier being tested: 0 = portable code only, 1 = SSE2, 2 = also SSSE3 and PCLMUL, 3 = also AVX2*/
+static int simd_tier = 3;
+static int tierOf(const char* feature)
+{
+  if(strcmp(feature, "sse2") == 0) return 1;
+  if(strcmp(feature, "avx2") == 0) return 3;
+  return 2;
+}
+#define LODEPNG_CPU_SUPPORTS(feature) (tierOf(feature) <= simd_tier && __builtin_cpu_supports(feature))
+
+#include "lodepng.h"
+
+static const char* tier_names[] = {"portable", "SSE2", "SSSE3 and PCLMUL", "AVX2"};
+static unsigned failures = 0;
+static unsigned checks = 0;
+
+#define ASSERT_EQUALS(expected, actual, what) do {\
+  ++checks;\
+  if((expected) != (actual))\
+  {\
+    if(++failures <= 20) printf("FAIL (%s tier, line %d): %s\n", tier_names[simd_tier], __LINE__, what);\
+  }\
+} while(0)
+
+/*xorshift, the same data on every run*/
+static unsigned random_state = 2463534242u;
+static unsigned randomNumber()
+{
+  random_state ^= random_state << 13;
+  random_state ^= random_state >> 17;
+  random_state ^= random_state << 5;
+  return random_state;
+}
+
+/*random bytes, bytes from a few values around the signed and unsigned limits that make Paeth
+and the scores tie often, or a smooth gradient like a render has*/
+static void fillBytes(std::vector<unsigned char>& data, int pattern)
+{
+  static const unsigned char edges[] = {0, 1, 2, 127, 128, 129, 254, 255};
+  for(size_t i = 0; i < data.size(); ++i)
+  {
+    if(pattern == 0) data[i] = (unsigned char)randomNumber();
+    else if(pattern == 1) data[i] = edges[randomNumber() % 8];
+    else data[i] = (unsigned char)(i / 3 + (randomNumber() % 3));
+  }
+}
+
+/* ////////////////////////////////////////////////////////////////////////// */
+
+/*the PNG specification's predictors, one byte at a time*/
+static unsigned char referencePredictor(unsigned char a, unsigned char b, unsigned char c, unsigned char type)
+{
+  int p, pa, pb, pc;
+  switch(type)
+  {
+    case 1: return a;
+    case 2: return b;
+    case 3: return (unsigned char)((a + b) / 2);
+    case 4:
+      p = a + b - c;
+      pa = p > a ? p - a : a - p;
+      pb = p > b ? p - b : b - p;
+      pc = p > c ? p - c : c - p;
+      if(pa <= pb && pa <= pc) return a;
+      return pb <= pc ? b : c;
+    default: return 0;
+  }
+}
+
+static void referenceFilter(unsigned char* out, const unsigned char* scanline, const unsigned char* prevline,
+                            size_t length, size_t bytewidth, unsigned char type)
+{
+  for(size_t i = 0; i < length; ++i)
+  {
+    unsigned char a = i >= bytewidth ? scanline[i - bytewidth] : 0;
+    unsigned char b = prevline ? prevline[i] : 0;
+    unsigned char c = prevline && i >= bytewidth ? prevline[i - bytewidth] : 0;
+    out[i] = (unsigned char)(scanline[i] - referencePredictor(a, b, c, type));
+  }
+}
+
+static void referenceUnfilter(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                              size_t length, size_t bytewidth, unsigned char type)
+{
+  for(size_t i = 0; i < length; ++i)
+  {
+    unsigned char a = i >= bytewidth ? recon[i - bytewidth] : 0;
+    unsigned char b = precon ? precon[i] : 0;
+    unsigned char c = precon && i >= bytewidth ? precon[i - bytewidth] : 0;
+    recon[i] = (unsigned char)(scanline[i] + referencePredictor(a, b, c, type));
+  }
+}
+
+static size_t referenceSum(const unsigned char* data, size_t length, unsigned char type)
+{
+  size_t sum = 0;
+  for(size_t i = 0; i < length; ++i) sum += type == 0 || data[i] < 128 ? data[i] : 256 - data[i] - 1;
+  return sum;
+}
+
+static unsigned referenceCrc32(const unsigned char* data, size_t length)
+{
+  unsigned r = 0xffffffffu;
+  for(size_t i = 0; i < length; ++i)
+  {
+    r ^= data[i];
+    for(int bit = 0; bit < 8; ++bit) r = (r & 1) ? (r >> 1) ^ 0xedb88320u : r >> 1;
+  }
+  return r ^ 0xffffffffu;
+}
+
+static unsigned referenceAdler32(unsigned adler, const unsigned char* data, size_t length)
+{
+  unsigned s1 = adler & 0xffff, s2 = adler >> 16;
+  for(size_t i = 0; i < length; ++i)
+  {
+    s1 = (s1 + data[i]) % 65521;
+    s2 = (s2 + s1) % 65521;
+  }
+  return (s2 << 16) | s1;
+}
+
+/* ////////////////////////////////////////////////////////////////////////// */
+
+static const size_t bytewidths[] = {1, 2, 3, 4, 6, 8};
+
+/*widths around the 16 and 32 byte SIMD blocks, so every tail length is hit for every bytewidth*/
+static std::vector<size_t> testWidths()
+{
+  std::vector<size_t> widths;
+  for(size_t w = 1; w <= 40; ++w) widths.push_back(w);
+  widths.push_back(63);
+  widths.push_back(64);
+  widths.push_back(65);
+  widths.push_back(257);
+  widths.push_back(1001);
+  return widths;
+}
+
+void testFilterScanline()
+{
+  std::vector<size_t> widths = testWidths();
+  for(size_t b = 0; b < sizeof(bytewidths) / sizeof(*bytewidths); ++b)
+  for(size_t w = 0; w < widths.size(); ++w)
+  for(int pattern = 0; pattern < 3; ++pattern)
+  {
+    size_t bytewidth = bytewidths[b], length = widths[w] * bytewidth;
+    std::vector<unsigned char> scanline(length), prevline(length), out(length), expected(length);
+    fillBytes(scanline, pattern);
+    fillBytes(prevline, pattern);
+    for(unsigned char type = 0; type < 5; ++type)
+    for(int has_prev = 0; has_prev < 2; ++has_prev)
+    {
+      const unsigned char* prev = has_prev ? &prevline[0] : 0;
+      filterScanline(&out[0], &scanline[0], prev, length, bytewidth, type);
+      referenceFilter(&expected[0], &scanline[0], prev, length, bytewidth, type);
+      ASSERT_EQUALS(true, out == expected, "filterScanline");
+      ASSERT_EQUALS(referenceSum(&out[0], length, type), filterScanlineSum(&out[0], length, type), "filterScanlineSum");
+    }
+  }
+}
+
+void testUnfilterScanline()
+{
+  std::vector<size_t> widths = testWidths();
+  for(size_t b = 0; b < sizeof(bytewidths) / sizeof(*bytewidths); ++b)
+  for(size_t w = 0; w < widths.size(); ++w)
+  for(int pattern = 0; pattern < 3; ++pattern)
+  {
+    size_t bytewidth = bytewidths[b], length = widths[w] * bytewidth;
+    std::vector<unsigned char> scanline(length), precon(length), recon(length), expected(length);
+    fillBytes(scanline, pattern);
+    fillBytes(precon, pattern);
+    for(unsigned char type = 0; type < 5; ++type)
+    for(int has_prev = 0; has_prev < 2; ++has_prev)
+    {
+      const unsigned char* prev = has_prev ? &precon[0] : 0;
+      referenceUnfilter(&expected[0], &scanline[0], prev, length, bytewidth, type);
+      ASSERT_EQUALS(0u, unfilterScanline(&recon[0], &scanline[0], prev, bytewidth, type, length), "unfilterScanline error");
+      ASSERT_EQUALS(true, recon == expected, "unfilterScanline");
+
+      /*the decoder reconstructs in place*/
+      recon = scanline;
+      ASSERT_EQUALS(0u, unfilterScanline(&recon[0], &recon[0], prev, bytewidth, type, length), "unfilterScanline error");
+      ASSERT_EQUALS(true, recon == expected, "unfilterScanline in place");
+
+      /*the filter undoes the unfilter*/
+      std::vector<unsigned char> refiltered(length);
+      filterScanline(&refiltered[0], &recon[0], prev, length, bytewidth, type);
+      ASSERT_EQUALS(true, refiltered == scanline, "filterScanline of unfilterScanline");
+    }
+  }
+}
+
+void testCrc32()
+{
+  std::vector<unsigned char> data(70000);
+  fillBytes(data, 0);
+  /*all tail lengths of the 8 and 16 byte blocks, unaligned starts, and the 64 byte minimum of PCLMUL*/
+  for(size_t length = 0; length < 300; ++length)
+  for(size_t offset = 0; offset < 16; offset += 5)
+  {
+    ASSERT_EQUALS(referenceCrc32(&data[offset], length), lodepng_crc32(&data[offset], length), "lodepng_crc32");
+  }
+  ASSERT_EQUALS(referenceCrc32(&data[3], 65536 + 13), lodepng_crc32(&data[3], 65536 + 13), "lodepng_crc32 long");
+  ASSERT_EQUALS(0xcbf43926u, lodepng_crc32((const unsigned char*)"123456789", 9), "lodepng_crc32 check value");
+
+  for(size_t split = 0; split <= 1000; split += 37)
+  {
+    unsigned crc1 = lodepng_crc32(&data[0], split), crc2 = lodepng_crc32(&data[split], 1000 - split);
+    ASSERT_EQUALS(lodepng_crc32(&data[0], 1000), lodepng_crc32_combine(crc1, crc2, 1000 - split), "lodepng_crc32_combine");
+  }
+}
+
+void testAdler32()
+{
+  std::vector<unsigned char> data(100000), ones(100000, 255);
+  fillBytes(data, 0);
+  for(size_t length = 0; length < 200; ++length)
+  for(size_t offset = 0; offset < 32; offset += 7)
+  {
+    ASSERT_EQUALS(referenceAdler32(1, &data[offset], length), adler32(&data[offset], (unsigned)length), "adler32");
+  }
+  /*around the points where the sums are reduced modulo 65521, with bytes that make them grow fastest*/
+  static const size_t lengths[] = {5549, 5550, 5551, 5552, 5553, 5583, 5584, 11100, 65536, 99999};
+  for(size_t i = 0; i < sizeof(lengths) / sizeof(*lengths); ++i)
+  {
+    ASSERT_EQUALS(referenceAdler32(1, &ones[0], lengths[i]), adler32(&ones[0], (unsigned)lengths[i]), "adler32 of 255s");
+    ASSERT_EQUALS(referenceAdler32(1, &data[1], lengths[i]), adler32(&data[1], (unsigned)lengths[i]), "adler32 long");
+    ASSERT_EQUALS(referenceAdler32(0xfff0fff0u, &ones[0], lengths[i]), update_adler32(0xfff0fff0u, &ones[0], (unsigned)lengths[i]),
+                  "update_adler32 from large sums");
+  }
+
+  for(size_t split = 0; split <= 20000; split += 1999)
+  {
+    unsigned adler1 = adler32(&data[0], (unsigned)split), adler2 = adler32(&data[split], (unsigned)(20000 - split));
+    ASSERT_EQUALS(adler32(&data[0], 20000), lodepng_adler32_combine(adler1, adler2, 20000 - split), "lodepng_adler32_combine");
+  }
+}
+
+/* ////////////////////////////////////////////////////////////////////////// */
+
+/*the documented conversion of lodepng_convert_from_float, one channel at a time*/
+static unsigned char referenceFloatToByte(float f)
+{
+  if(f != f || f <= 0.0f) return 0;
+  if(f >= 1.0f) return 255;
+  float scaled = f * 255.0f + 0.5f;
+  return (unsigned char)scaled;
+}
+
+/*NaN, infinities, values out of [0, 1], the edges of the rounding around every (k + 0.5) / 255, and random values*/
+static float floatTestValue(unsigned i)
+{
+  static const float specials[] = {NAN, -NAN, INFINITY, -INFINITY, -1.0f, -0.0f, 0.0f, 1e-30f, 0.5f / 255.0f,
+                                   1.0f, 1.0000001f, 2.0f, 1e30f, 0.99999994f};
+  unsigned numspecials = sizeof(specials) / sizeof(*specials);
+  unsigned r = randomNumber();
+  if(i % 4 == 0) return specials[r % numspecials];
+  if(i % 4 == 1)
+  {
+    float edge = ((r >> 8) % 256 + 0.5f) / 255.0f;
+    int steps = (int)(r % 5) - 2;
+    for(; steps < 0; ++steps) edge = nextafterf(edge, 0.0f);
+    for(; steps > 0; --steps) edge = nextafterf(edge, 1.0f);
+    return edge;
+  }
+  return (float)(r % 1400000) / 1000000.0f - 0.2f;
+}
+
+void testConvertFromFloat()
+{
+  LodePNGColorMode modes[2];
+  lodepng_color_mode_init(&modes[0]);
+  lodepng_color_mode_init(&modes[1]);
+  modes[1].colortype = LCT_RGB;
+
+  std::vector<size_t> widths = testWidths();
+  for(size_t m = 0; m < 2; ++m)
+  for(size_t wi = 0; wi < widths.size(); ++wi)
+  {
+    /*rows further apart than their size on both sides, the bytes in between must stay untouched*/
+    unsigned w = (unsigned)widths[wi], h = 3, numchannels = m == 0 ? 4 : 3;
+    size_t in_stride = w * 16 + 12, out_stride = w * numchannels + 7;
+    std::vector<float> in(in_stride / 4 * h);
+    for(size_t i = 0; i < in.size(); ++i) in[i] = floatTestValue((unsigned)i);
+    std::vector<unsigned char> out(out_stride * h, 0xaa), expected(out_stride * h, 0xaa);
+    for(unsigned y = 0; y < h; ++y)
+    for(unsigned x = 0; x < w; ++x)
+    for(unsigned c = 0; c < numchannels; ++c)
+    {
+      expected[y * out_stride + x * numchannels + c] = referenceFloatToByte(in[y * in_stride / 4 + x * 4 + c]);
+    }
+    ASSERT_EQUALS(0u, lodepng_convert_from_float(&out[0], out_stride, &in[0], in_stride, w, h, &modes[m], 1), "lodepng_convert_from_float");
+    ASSERT_EQUALS(true, out == expected, "lodepng_convert_from_float output");
+  }
+
+  /*big enough for several bands on threads, which must give the same*/
+  for(size_t m = 0; m < 2; ++m)
+  {
+    unsigned w = 257, h = 700, numchannels = m == 0 ? 4 : 3;
+    size_t in_stride = w * 16 + 4, out_stride = w * numchannels + 1;
+    std::vector<float> in(in_stride / 4 * h);
+    for(size_t i = 0; i < in.size(); ++i) in[i] = floatTestValue((unsigned)i);
+    std::vector<unsigned char> out(out_stride * h, 0xaa), threaded(out_stride * h, 0xaa);
+    ASSERT_EQUALS(0u, lodepng_convert_from_float(&out[0], out_stride, &in[0], in_stride, w, h, &modes[m], 1), "lodepng_convert_from_float");
+    ASSERT_EQUALS(0u, lodepng_convert_from_float(&threaded[0], out_stride, &in[0], in_stride, w, h, &modes[m], 3), "lodepng_convert_from_float on threads");
+    ASSERT_EQUALS(true, out == threaded, "lodepng_convert_from_float on threads output");
+    ASSERT_EQUALS(referenceFloatToByte(in[(h - 1) * in_stride / 4 + 2]), threaded[(h - 1) * out_stride + 2], "lodepng_convert_from_float on threads last row");
+    ASSERT_EQUALS(0xaa, threaded[(h - 1) * out_stride + w * numchannels], "lodepng_convert_from_float on threads padding");
+  }
+
+  LodePNGColorMode grey;
+  lodepng_color_mode_init(&grey);
+  grey.colortype = LCT_GREY;
+  std::vector<float> pixel(4);
+  std::vector<unsigned char> out(4);
+  ASSERT_EQUALS(56u, lodepng_convert_from_float(&out[0], 4, &pixel[0], 16, 1, 1, &grey, 1), "lodepng_convert_from_float to grey");
+  modes[0].bitdepth = 16;
+  ASSERT_EQUALS(56u, lodepng_convert_from_float(&out[0], 4, &pixel[0], 16, 1, 1, &modes[0], 1), "lodepng_convert_from_float to 16-bit");
+}
+
+/*required bits of a grey value, 0 and 255 fit in 1 bit and multiples of 85 and 17 in 2 and 4*/
+static unsigned referenceRequiredBits(unsigned char value)
+{
+  if(value == 0 || value == 255) return 1;
+  if(value % 85 == 0) return 2;
+  return value % 17 == 0 ? 4 : 8;
+}
+
+/*the color profile of 8-bit RGB or RGBA pixels, looking at every pixel with a list of the colors*/
+static void referenceColorProfile(LodePNGColorProfile* profile, const unsigned char* in, size_t numpixels,
+                                  unsigned channels)
+{
+  std::vector<unsigned> colors;
+  unsigned alpha_done = channels == 3;
+  lodepng_color_profile_init(profile);
+  for(size_t i = 0; i < numpixels; ++i)
+  {
+    unsigned char r = in[i * channels], g = in[i * channels + 1], b = in[i * channels + 2];
+    unsigned char a = channels == 4 ? in[i * 4 + 3] : 255;
+    if(profile->bits < 8 && referenceRequiredBits(r) > profile->bits) profile->bits = referenceRequiredBits(r);
+    if(r != g || r != b)
+    {
+      profile->colored = 1;
+      profile->bits = 8;
+    }
+    if(!alpha_done)
+    {
+      bool matchkey = r == profile->key_r && g == profile->key_g && b == profile->key_b;
+      if((a != 255 && (a != 0 || (profile->key && !matchkey))) || (a == 255 && profile->key && matchkey))
+      {
+        profile->alpha = 1;
+        profile->key = 0;
+        alpha_done = 1;
+        profile->bits = 8;
+      }
+      else if(a == 0 && !profile->alpha && !profile->key)
+      {
+        profile->key = 1;
+        profile->key_r = r;
+        profile->key_g = g;
+        profile->key_b = b;
+      }
+    }
+    unsigned color = r | g << 8 | b << 16 | (unsigned)a << 24;
+    bool known = false;
+    for(size_t c = 0; c < colors.size() && !known; ++c) known = colors[c] == color;
+    if(!known && colors.size() < 257)
+    {
+      if(colors.size() < 256)
+      {
+        profile->palette[colors.size() * 4 + 0] = r;
+        profile->palette[colors.size() * 4 + 1] = g;
+        profile->palette[colors.size() * 4 + 2] = b;
+        profile->palette[colors.size() * 4 + 3] = a;
+      }
+      colors.push_back(color);
+    }
+  }
+  profile->numcolors = (unsigned)colors.size();
+  for(size_t i = 0; i < numpixels && profile->key && !profile->alpha; ++i)
+  {
+    const unsigned char* p = &in[i * channels];
+    if(channels == 4 && p[3] != 0 && p[0] == profile->key_r && p[1] == profile->key_g && p[2] == profile->key_b)
+    {
+      profile->alpha = 1;
+      profile->key = 0;
+      profile->bits = 8;
+    }
+  }
+  profile->key_r = (unsigned short)(profile->key_r * 257);
+  profile->key_g = (unsigned short)(profile->key_g * 257);
+  profile->key_b = (unsigned short)(profile->key_b * 257);
+}
+
+/*lodepng_get_color_profile and the color types chosen from it agree with the reference*/
+static void checkColorProfile(const std::vector<unsigned char>& image, unsigned w, unsigned h, unsigned channels)
+{
+  LodePNGColorMode mode;
+  lodepng_color_mode_init(&mode);
+  mode.colortype = channels == 4 ? LCT_RGBA : LCT_RGB;
+  LodePNGColorProfile profile, expected;
+  lodepng_color_profile_init(&profile);
+  referenceColorProfile(&expected, &image[0], (size_t)w * h, channels);
+  ASSERT_EQUALS(0u, lodepng_get_color_profile(&profile, &image[0], w, h, &mode), "lodepng_get_color_profile");
+  bool equal = profile.colored == expected.colored && profile.key == expected.key && profile.alpha == expected.alpha
+            && profile.numcolors == expected.numcolors && profile.bits == expected.bits
+            && (!expected.key || (profile.key_r == expected.key_r && profile.key_g == expected.key_g && profile.key_b == expected.key_b))
+            && memcmp(profile.palette, expected.palette, (expected.numcolors < 256 ? expected.numcolors : 256) * 4) == 0;
+  ASSERT_EQUALS(true, equal, "lodepng_get_color_profile equal to the reference");
+
+  LodePNGColorMode chosen, chosen_expected;
+  lodepng_color_mode_init(&chosen);
+  lodepng_color_mode_init(&chosen_expected);
+  ASSERT_EQUALS(0u, lodepng_auto_choose_color(&chosen, &image[0], w, h, &mode), "lodepng_auto_choose_color");
+  ASSERT_EQUALS(0u, lodepng_auto_choose_color_from_profile(&chosen_expected, &expected, w, h, &mode), "lodepng_auto_choose_color_from_profile");
+  ASSERT_EQUALS(true, lodepng_color_mode_equal(&chosen, &chosen_expected) != 0, "lodepng_auto_choose_color equal to the reference");
+  lodepng_color_mode_cleanup(&chosen);
+  lodepng_color_mode_cleanup(&chosen_expected);
+}
+
+void testColorProfile()
+{
+  /*runs of one color, broken by a pixel differing in one byte at every position, so every run length and
+  the last pixel end a run. The byte makes the image colored, not opaque, or adds a color.*/
+  std::vector<size_t> widths = testWidths();
+  for(unsigned channels = 3; channels <= 4; ++channels)
+  for(size_t wi = 0; wi < widths.size() && widths[wi] <= 64; ++wi)
+  for(unsigned h = 1; h <= 2; ++h)
+  {
+    unsigned w = (unsigned)widths[wi];
+    size_t numpixels = (size_t)w * h;
+    for(size_t pos = 0; pos <= numpixels; ++pos)
+    for(unsigned channel = 0; channel < channels; channel += channels - 1)
+    {
+      std::vector<unsigned char> image(numpixels * channels);
+      for(size_t i = 0; i < image.size(); ++i) image[i] = i % channels == 3 ? 255 : 17;
+      if(pos < numpixels) image[pos * channels + channel] ^= 0x80;
+      checkColorProfile(image, w, h, channels);
+    }
+  }
+
+  /*images with few and with many colors, grey ones, and transparent pixels that can be a color key or not*/
+  for(int kind = 0; kind < 6; ++kind)
+  for(unsigned channels = 3; channels <= 4; ++channels)
+  {
+    unsigned w = 61 + kind * 30, h = 13 + kind;
+    std::vector<unsigned char> image((size_t)w * h * channels);
+    for(size_t i = 0; i < image.size(); i += channels)
+    {
+      if(i != 0 && randomNumber() % 3 == 0)
+      {
+        memcpy(&image[i], &image[i - channels], channels);
+        continue;
+      }
+      unsigned r = randomNumber(), mod = kind == 2 ? 3 : 256;
+      unsigned char v = kind == 0 ? (unsigned char)(r % 4 * 85) : kind == 1 ? (unsigned char)(r % 16 * 17)
+                      : kind == 2 ? (unsigned char)(r % 7 * 40) : (unsigned char)r;
+      image[i + 0] = v;
+      image[i + 1] = kind < 2 ? v : (unsigned char)((r >> 8) % mod);
+      image[i + 2] = kind < 2 ? v : (unsigned char)((r >> 16) % mod);
+      if(channels == 4) image[i + 3] = kind == 5 ? (unsigned char)(r >> 24) : kind == 4 && (r >> 24) % 8 == 0 ? 0 : 255;
+      /*kind 4 has one color key, except where an opaque pixel gets its color*/
+      if(kind == 4 && channels == 4 && image[i + 3] == 0) image[i] = image[i + 1] = image[i + 2] = 7;
+    }
+    checkColorProfile(image, w, h, channels);
+
+    /*the encoder gives the same PNG from the profile as from its own scan*/
+    LodePNGColorMode mode;
+    lodepng_color_mode_init(&mode);
+    mode.colortype = channels == 4 ? LCT_RGBA : LCT_RGB;
+    LodePNGColorProfile profile;
+    referenceColorProfile(&profile, &image[0], (size_t)w * h, channels);
+    LodePNGState state;
+    lodepng_state_init(&state);
+    state.info_raw.colortype = mode.colortype;
+    unsigned char* scanned = 0;
+    unsigned char* given = 0;
+    size_t scannedsize = 0, givensize = 0;
+    ASSERT_EQUALS(0u, lodepng_encode(&scanned, &scannedsize, &image[0], w, h, &state), "lodepng_encode");
+    state.encoder.profile = &profile;
+    ASSERT_EQUALS(0u, lodepng_encode(&given, &givensize, &image[0], w, h, &state), "lodepng_encode with a profile");
+    ASSERT_EQUALS(true, scannedsize == givensize && memcmp(scanned, given, givensize) == 0, "lodepng_encode with a profile equal to without");
+    free(scanned);
+    free(given);
+    lodepng_state_cleanup(&state);
+  }
+}
+
+/*the generic path of lodepng_convert, one pixel at a time through RGBA8*/
+static void genericConvert(unsigned char* out, const unsigned char* in, const LodePNGColorMode* mode_out,
+                           const LodePNGColorMode* mode_in, size_t numpixels)
+{
+  ColorHash hash; /*only for palette output*/
+  color_hash_init(&hash);
+  for(size_t i = 0; i < numpixels; ++i)
+  {
+    unsigned char r, g, b, a;
+    getPixelColorRGBA8(&r, &g, &b, &a, in, i, mode_in);
+    rgba8ToPixel(out, i, mode_out, &hash, r, g, b, a);
+  }
+}
+
+void testConvert()
+{
+  /*every pair in the table of kernels, at widths around the 4, 8 and 16 pixel blocks. The input ends
+  exactly at the end of its allocation, so an over-read like RGB8 to RGBA8 loading 16 bytes for 12 is
+  caught by the address sanitizer, and a byte after the output must stay untouched*/
+  std::vector<size_t> widths = testWidths();
+  for(size_t k = 0; k < sizeof(convertKernels) / sizeof(*convertKernels); ++k)
+  for(size_t wi = 0; wi < widths.size(); ++wi)
+  for(unsigned h = 1; h <= 2; ++h)
+  for(int pattern = 0; pattern < 3; ++pattern)
+  {
+    const ConvertKernel* kernel = &convertKernels[k];
+    LodePNGColorMode mode_in, mode_out;
+    lodepng_color_mode_init(&mode_in);
+    lodepng_color_mode_init(&mode_out);
+    mode_in.colortype = kernel->colortype_in;
+    mode_in.bitdepth = kernel->bitdepth_in;
+    mode_out.colortype = kernel->colortype_out;
+    mode_out.bitdepth = kernel->bitdepth_out;
+    ASSERT_EQUALS(true, getConvertKernel(&mode_out, &mode_in) == kernel->convert, "getConvertKernel");
+
+    unsigned w = (unsigned)widths[wi];
+    size_t insize = lodepng_get_raw_size(w, h, &mode_in), outsize = lodepng_get_raw_size(w, h, &mode_out);
+    std::vector<unsigned char> in(insize);
+    fillBytes(in, pattern);
+    unsigned char* exact = (unsigned char*)malloc(insize);
+    memcpy(exact, &in[0], insize);
+    std::vector<unsigned char> out(outsize + 1, 0xaa), expected(outsize + 1, 0xaa);
+    ASSERT_EQUALS(0u, lodepng_convert(&out[0], exact, &mode_out, &mode_in, w, h), "lodepng_convert");
+    genericConvert(&expected[0], exact, &mode_out, &mode_in, (size_t)w * h);
+    ASSERT_EQUALS(true, out == expected, "lodepng_convert kernel equal to the generic path");
+    free(exact);
+  }
+
+  /*a color key on RGB or grey input makes some pixels transparent, only the generic path does that*/
+  for(int grey = 0; grey < 2; ++grey)
+  {
+    unsigned w = 37, h = 3;
+    LodePNGColorMode mode_in, mode_out;
+    lodepng_color_mode_init(&mode_in);
+    lodepng_color_mode_init(&mode_out);
+    mode_in.colortype = grey ? LCT_GREY : LCT_RGB;
+    mode_in.key_defined = 1;
+    mode_in.key_r = mode_in.key_g = mode_in.key_b = 128;
+    ASSERT_EQUALS(true, getConvertKernel(&mode_out, &mode_in) == 0, "getConvertKernel with a color key");
+
+    std::vector<unsigned char> in(lodepng_get_raw_size(w, h, &mode_in));
+    fillBytes(in, 1);
+    in[0] = in[1] = in[2] = 128;
+    std::vector<unsigned char> out((size_t)w * h * 4), expected((size_t)w * h * 4);
+    ASSERT_EQUALS(0u, lodepng_convert(&out[0], &in[0], &mode_out, &mode_in, w, h), "lodepng_convert with a color key");
+    genericConvert(&expected[0], &in[0], &mode_out, &mode_in, (size_t)w * h);
+    ASSERT_EQUALS(true, out == expected, "lodepng_convert with a color key equal to the generic path");
+    ASSERT_EQUALS(0, out[3], "lodepng_convert with a color key transparent pixel");
+  }
+}
+
+/* ////////////////////////////////////////////////////////////////////////// */
+
+/*
+A deflate decoder that reads one bit at a time and decodes Huffman codes bit by bit from their canonical
+code, written from the deflate specification, for comparing lodepng_inflate with. Like lodepng it allows
+incomplete trees but no oversubscribed ones, accepts up to 288 literal/length and 32 distance code lengths,
+and fails on a code that isn't used, such as a bit combination an incomplete tree has no code for.
+*/
+struct ReferenceInflate
+{
+  const unsigned char* in;
+  size_t insize, bp;
+  std::vector<unsigned char> out;
+  unsigned blocktypes; /*bit 1 << BTYPE is set for every block that was decoded*/
+
+  /*returns -1 past the end of the input*/
+  int readBits(unsigned count)
+  {
+    int result = 0;
+    for(unsigned i = 0; i < count; ++i)
+    {
+      if(bp >= insize * 8) return -1;
+      result |= ((in[bp >> 3] >> (bp & 7)) & 1) << i;
+      ++bp;
+    }
+    return result;
+  }
+
+  /*codes of the same length are consecutive numbers, in the order of their symbols*/
+  struct Code
+  {
+    unsigned counts[16];
+    std::vector<unsigned> symbols;
+  };
+
+  /*returns false if the lengths oversubscribe the code*/
+  static bool makeCode(Code& code, const unsigned* lengths, unsigned numcodes)
+  {
+    for(unsigned i = 0; i < 16; ++i) code.counts[i] = 0;
+    for(unsigned i = 0; i < numcodes; ++i) ++code.counts[lengths[i]];
+    int left = 1;
+    for(unsigned len = 1; len < 16; ++len)
+    {
+      left = left * 2 - (int)code.counts[len];
+      if(left < 0) return false;
+    }
+    code.symbols.clear();
+    for(unsigned len = 1; len < 16; ++len)
+    {
+      for(unsigned i = 0; i < numcodes; ++i) if(lengths[i] == len) code.symbols.push_back(i);
+    }
+    return true;
+  }
+
+  /*returns -1 at the end of the input or for a bit combination that is not a code*/
+  int decodeSymbol(const Code& code)
+  {
+    int value = 0, first = 0, index = 0;
+    for(unsigned len = 1; len < 16; ++len)
+    {
+      int bit = readBits(1);
+      if(bit < 0) return -1;
+      value |= bit;
+      int count = (int)code.counts[len];
+      if(value - first < count) return (int)code.symbols[index + value - first];
+      index += count;
+      first = (first + count) << 1;
+      value <<= 1;
+    }
+    return -1;
+  }
+
+  bool stored()
+  {
+    bp = (bp + 7) & ~(size_t)7;
+    int len = readBits(16), nlen = readBits(16);
+    if(len < 0 || nlen < 0 || len + nlen != 65535) return false;
+    for(int i = 0; i < len; ++i)
+    {
+      int byte = readBits(8);
+      if(byte < 0) return false;
+      out.push_back((unsigned char)byte);
+    }
+    return true;
+  }
+
+  bool codes(const Code& ll, const Code& d)
+  {
+    static const unsigned lengthbase[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59,
+                                            67, 83, 99, 115, 131, 163, 195, 227, 258};
+    static const unsigned lengthextra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3,
+                                             4, 4, 4, 4, 5, 5, 5, 5, 0};
+    static const unsigned distancebase[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385,
+                                              513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+    static const unsigned distanceextra[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8,
+                                               9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+    for(;;)
+    {
+      int symbol = decodeSymbol(ll);
+      if(symbol < 0 || symbol > 285) return false;
+      if(symbol < 256) out.push_back((unsigned char)symbol);
+      else if(symbol == 256) return true;
+      else
+      {
+        int extra = readBits(lengthextra[symbol - 257]);
+        int dsymbol = extra < 0 ? -1 : decodeSymbol(d);
+        if(dsymbol < 0 || dsymbol > 29) return false;
+        int dextra = readBits(distanceextra[dsymbol]);
+        if(dextra < 0) return false;
+        size_t length = lengthbase[symbol - 257] + extra, distance = distancebase[dsymbol] + dextra;
+        if(distance > out.size()) return false;
+        for(size_t i = 0; i < length; ++i) out.push_back(out[out.size() - distance]);
+      }
+    }
+  }
+
+  bool fixed()
+  {
+    unsigned lengths[288];
+    for(unsigned i = 0; i < 288; ++i) lengths[i] = i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8;
+    Code ll, d;
+    makeCode(ll, lengths, 288);
+    for(unsigned i = 0; i < 30; ++i) lengths[i] = 5;
+    makeCode(d, lengths, 30);
+    return codes(ll, d);
+  }
+
+  bool dynamic()
+  {
+    static const unsigned order[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+    int hlit = readBits(5), hdist = readBits(5), hclen = readBits(4);
+    if(hlit < 0 || hdist < 0 || hclen < 0) return false;
+    unsigned nlen = hlit + 257, ndist = hdist + 1, lengths[320] = {0};
+    for(int i = 0; i < hclen + 4; ++i)
+    {
+      int length = readBits(3);
+      if(length < 0) return false;
+      lengths[order[i]] = length;
+    }
+    Code cl, ll, d;
+    if(!makeCode(cl, lengths, 19)) return false;
+
+    unsigned index = 0;
+    while(index < nlen + ndist)
+    {
+      int symbol = decodeSymbol(cl);
+      if(symbol < 0) return false;
+      if(symbol < 16)
+      {
+        lengths[index++] = symbol;
+        continue;
+      }
+      unsigned value = 0;
+      int repeat;
+      if(symbol == 16)
+      {
+        if(index == 0) return false;
+        value = lengths[index - 1];
+        repeat = readBits(2) + 3;
+      }
+      else if(symbol == 17) repeat = readBits(3) + 3;
+      else repeat = readBits(7) + 11;
+      if(repeat < 3 || index + repeat > nlen + ndist) return false;
+      while(repeat--) lengths[index++] = value;
+    }
+    if(lengths[256] == 0) return false;
+    return makeCode(ll, lengths, nlen) && makeCode(d, lengths + nlen, ndist) && codes(ll, d);
+  }
+
+  /*returns false for an invalid or truncated stream*/
+  bool inflate(const unsigned char* data, size_t size)
+  {
+    in = data;
+    insize = size;
+    bp = 0;
+    out.clear();
+    blocktypes = 0;
+    for(;;)
+    {
+      int final = readBits(1), type = readBits(2);
+      if(final < 0 || type < 0 || type == 3) return false;
+      blocktypes |= 1u << type;
+      if(!(type == 0 ? stored() : type == 1 ? fixed() : dynamic())) return false;
+      if(final) return true;
+    }
+  }
+};
+
+/*data that deflates to literals, to long matches, and to a mix of both*/
+static std::vector<unsigned char> deflateTestData(size_t size, int kind)
+{
+  std::vector<unsigned char> data(size);
+  for(size_t i = 0; i < size; ++i)
+  {
+    if(kind == 0) data[i] = (unsigned char)randomNumber();
+    else if(kind == 1) data[i] = (unsigned char)(i / 100 % 3);
+    else data[i] = "the quick brown fox jumps over the lazy dog "[(i * 7 + i / 37) % 44];
+  }
+  return data;
+}
+
+/*lodepng_inflate of a stream, and whether it agrees with the reference about whether the stream is valid*/
+static bool inflateAgrees(const std::vector<unsigned char>& stream, ReferenceInflate& reference, bool* valid)
+{
+  unsigned char* out = 0;
+  size_t outsize = 0;
+  const unsigned char* data = stream.empty() ? 0 : &stream[0];
+  unsigned error = lodepng_inflate(&out, &outsize, data, stream.size(), &lodepng_default_decompress_settings);
+  *valid = reference.inflate(data, stream.size());
+  bool agrees = *valid ? !error && outsize == reference.out.size() &&
+                         (outsize == 0 || memcmp(out, &reference.out[0], outsize) == 0)
+                       : error != 0;
+  free(out);
+  return agrees;
+}
+
+void testDeflateRoundTrip()
+{
+  static const size_t sizes[] = {0, 1, 2, 3, 4, 100, 1000, 65535, 65536, 70000};
+  static const LodePNGDeflateStrategy strategies[] = {LDS_DEFAULT, LDS_RLE, LDS_HUFFMAN_ONLY};
+  ReferenceInflate reference;
+  for(size_t s = 0; s < sizeof(sizes) / sizeof(*sizes); ++s)
+  for(int kind = 0; kind < 3; ++kind)
+  for(unsigned variant = 0; variant < 22; ++variant)
+  {
+    std::vector<unsigned char> data = deflateTestData(sizes[s], kind);
+    LodePNGCompressSettings settings;
+    lodepng_compress_settings_init(&settings);
+    /*each btype without LZ77 and with each strategy, then levels 0 to 9, so also level 0 of empty input*/
+    if(variant < 12)
+    {
+      settings.btype = variant / 4;
+      settings.use_lz77 = variant % 4 != 0;
+      if(variant % 4 != 0) settings.strategy = strategies[variant % 4 - 1];
+    }
+    else lodepng_compress_settings_level(&settings, variant - 12);
+    unsigned char* out = 0;
+    size_t outsize = 0;
+    ASSERT_EQUALS(0u, lodepng_deflate(&out, &outsize, data.empty() ? 0 : &data[0], data.size(), &settings), "lodepng_deflate");
+    std::vector<unsigned char> stream(out, out + outsize);
+    free(out);
+
+    /*the reference decodes the BitWriter output, with the blocks of the requested type*/
+    ASSERT_EQUALS(true, reference.inflate(stream.empty() ? 0 : &stream[0], stream.size()), "reference inflate of lodepng_deflate");
+    ASSERT_EQUALS(true, reference.out == data, "reference inflate of lodepng_deflate output");
+    ASSERT_EQUALS(1u << settings.btype, reference.blocktypes, "lodepng_deflate block type");
+
+    bool valid;
+    ASSERT_EQUALS(true, inflateAgrees(stream, reference, &valid), "lodepng_inflate of lodepng_deflate");
+
+    /*every shorter stream misses at least the end code of the final block*/
+    for(size_t size = 0; size < stream.size(); size += size < 300 ? 1 : stream.size() / 97 + 1)
+    {
+      std::vector<unsigned char> truncated(stream.begin(), stream.begin() + size);
+      ASSERT_EQUALS(true, inflateAgrees(truncated, reference, &valid), "lodepng_inflate of a truncated stream");
+      ASSERT_EQUALS(false, valid, "truncated stream");
+    }
+  }
+
+  /*more than one block size on several threads: chunks deflated in parallel and joined by empty stored
+  blocks, the same stream for any numthreads above 1*/
+  for(int kind = 0; kind < 3; ++kind)
+  for(unsigned btype = 1; btype < 3; ++btype)
+  {
+    std::vector<unsigned char> data = deflateTestData(600000, kind), threaded;
+    for(unsigned numthreads = 2; numthreads <= 3; ++numthreads)
+    {
+      LodePNGCompressSettings settings;
+      lodepng_compress_settings_init(&settings);
+      settings.btype = btype;
+      settings.numthreads = numthreads;
+      unsigned char* out = 0;
+      size_t outsize = 0;
+      ASSERT_EQUALS(0u, lodepng_deflate(&out, &outsize, &data[0], data.size(), &settings), "lodepng_deflate on threads");
+      std::vector<unsigned char> stream(out, out + outsize);
+      free(out);
+      ASSERT_EQUALS(true, reference.inflate(&stream[0], stream.size()), "reference inflate of lodepng_deflate on threads");
+      ASSERT_EQUALS(true, reference.out == data, "reference inflate of lodepng_deflate on threads output");
+#ifdef LODEPNG_COMPILE_THREADS
+      ASSERT_EQUALS((1u << btype) | 1u, reference.blocktypes, "lodepng_deflate on threads block types");
+#else /*LODEPNG_COMPILE_THREADS*/
+      ASSERT_EQUALS(1u << btype, reference.blocktypes, "lodepng_deflate without threads block types");
+#endif /*LODEPNG_COMPILE_THREADS*/
+      if(numthreads == 2) threaded = stream;
+      else ASSERT_EQUALS(true, threaded == stream, "lodepng_deflate the same on 2 and 3 threads");
+
+      std::vector<unsigned char> compressed, decompressed;
+      ASSERT_EQUALS(0u, lodepng::compress(compressed, data, settings), "lodepng::compress on threads");
+      ASSERT_EQUALS(0u, lodepng::decompress(decompressed, compressed), "lodepng::decompress of lodepng::compress on threads");
+      ASSERT_EQUALS(true, decompressed == data, "lodepng::decompress of lodepng::compress on threads output");
+    }
+  }
+
+  /*the zlib container around it, with its Adler-32*/
+  std::vector<unsigned char> data = deflateTestData(5000, 2), compressed, decompressed;
+  ASSERT_EQUALS(0u, lodepng::compress(compressed, data), "lodepng::compress");
+  ASSERT_EQUALS(0u, lodepng::decompress(decompressed, compressed), "lodepng::decompress");
+  ASSERT_EQUALS(true, decompressed == data, "lodepng::decompress output");
+  compressed[compressed.size() - 1] ^= 1;
+  ASSERT_EQUALS(58u, lodepng::decompress(decompressed, compressed), "lodepng::decompress with a wrong Adler-32");
+}
+
+void testInflateCorrupt()
+{
+  ReferenceInflate reference;
+  unsigned valid_count = 0;
+  for(int kind = 0; kind < 3; ++kind)
+  for(unsigned btype = 0; btype < 3; ++btype)
+  {
+    std::vector<unsigned char> data = deflateTestData(kind == 0 ? 300 : 3000, kind);
+    LodePNGCompressSettings settings;
+    lodepng_compress_settings_init(&settings);
+    settings.btype = btype;
+    unsigned char* out = 0;
+    size_t outsize = 0;
+    lodepng_deflate(&out, &outsize, &data[0], data.size(), &settings);
+    std::vector<unsigned char> stream(out, out + outsize);
+    free(out);
+
+    /*a few flipped bits, mostly in the block headers and trees at the start where they change the most*/
+    for(int i = 0; i < 3000; ++i)
+    {
+      std::vector<unsigned char> corrupt = stream;
+      unsigned flips = 1 + randomNumber() % 3;
+      for(unsigned f = 0; f < flips; ++f)
+      {
+        size_t range = i % 2 ? corrupt.size() * 8 : (corrupt.size() < 40 ? corrupt.size() : 40) * 8;
+        size_t bit = randomNumber() % range;
+        corrupt[bit / 8] ^= (unsigned char)(1u << (bit % 8));
+      }
+      bool valid;
+      ASSERT_EQUALS(true, inflateAgrees(corrupt, reference, &valid), "lodepng_inflate of a corrupt stream");
+      valid_count += valid;
+    }
+  }
+
+  /*random bytes, starting with a final fixed or dynamic block header*/
+  for(int i = 0; i < 20000; ++i)
+  {
+    std::vector<unsigned char> corrupt(1 + randomNumber() % 64);
+    fillBytes(corrupt, i % 2);
+    corrupt[0] = (unsigned char)((corrupt[0] & ~7u) | (i % 4 < 2 ? 3 : 5));
+    bool valid;
+    ASSERT_EQUALS(true, inflateAgrees(corrupt, reference, &valid), "lodepng_inflate of random bytes");
+    valid_count += valid;
+  }
+
+  /*a few of them should have been valid, so both paths of the comparison ran*/
+  ASSERT_EQUALS(true, valid_count > 0, "some corrupt streams valid");
+
+  /*empty input, and the shortest final blocks of each type*/
+  static const unsigned char empty_stored[] = {1, 0, 0, 255, 255};
+  static const unsigned char wrong_nlen[] = {1, 0, 0, 0, 0};
+  static const unsigned char empty_fixed[] = {3, 0};
+  static const unsigned char invalid_type[] = {7};
+  std::vector<unsigned char> stream;
+  bool valid;
+  ASSERT_EQUALS(true, inflateAgrees(stream, reference, &valid) && !valid, "lodepng_inflate of empty input");
+  stream.assign(empty_stored, empty_stored + 5);
+  ASSERT_EQUALS(true, inflateAgrees(stream, reference, &valid) && valid, "lodepng_inflate of an empty stored block");
+  stream.assign(wrong_nlen, wrong_nlen + 5);
+  ASSERT_EQUALS(true, inflateAgrees(stream, reference, &valid) && !valid, "lodepng_inflate of a stored block with a wrong NLEN");
+  stream.assign(empty_fixed, empty_fixed + 2);
+  ASSERT_EQUALS(true, inflateAgrees(stream, reference, &valid) && valid, "lodepng_inflate of an empty fixed block");
+  stream.assign(invalid_type, invalid_type + 1);
+  ASSERT_EQUALS(true, inflateAgrees(stream, reference, &valid) && !valid, "lodepng_inflate of block type 3");
+}
+
+/* ////////////////////////////////////////////////////////////////////////// */
+
+/*the IDAT chunks of a PNG put together, the zlib data*/
+static std::vector<unsigned char> idatData(const std::vector<unsigned char>& png)
+{
+  std::vector<unsigned char> zlib;
+  const unsigned char* end = png.empty() ? 0 : &png[0] + png.size();
+  for(const unsigned char* chunk = png.size() > 8 ? &png[8] : end; chunk + 12 <= end; chunk = lodepng_chunk_next_const(chunk))
+  {
+    if(!lodepng_chunk_type_equals(chunk, "IDAT")) continue;
+    const unsigned char* data = lodepng_chunk_data_const(chunk);
+    zlib.insert(zlib.end(), data, data + lodepng_chunk_length(chunk));
+  }
+  return zlib;
+}
+
+static unsigned appendToVector(const unsigned char* data, size_t size, void* context)
+{
+  std::vector<unsigned char>* out = (std::vector<unsigned char>*)context;
+  out->insert(out->end(), data, data + size);
+  return 0;
+}
+
+/*an RGBA image with runs, so the LZ77 matches reach back through several bands, and opaque if alpha is not kept*/
+static std::vector<unsigned char> streamTestImage(unsigned w, unsigned h, bool opaque)
+{
+  std::vector<unsigned char> image((size_t)w * h * 4);
+  for(size_t i = 0; i < image.size(); ++i)
+  {
+    image[i] = (unsigned char)(randomNumber() % 4 == 0 ? randomNumber() : i / 4 % 61 * 3);
+    if(opaque && i % 4 == 3) image[i] = 255;
+  }
+  return image;
+}
+
+/*lodepng_decode to RGBA8 of the PNG, and whether it gives the image*/
+static bool decodesTo(const std::vector<unsigned char>& png, const std::vector<unsigned char>& image, unsigned w, unsigned h)
+{
+  unsigned char* decoded = 0;
+  unsigned dw, dh;
+  unsigned error = lodepng_decode_memory(&decoded, &dw, &dh, png.empty() ? 0 : &png[0], png.size(), LCT_RGBA, 8);
+  bool equal = !error && dw == w && dh == h && memcmp(decoded, &image[0], image.size()) == 0;
+  free(decoded);
+  return equal;
+}
+
+static unsigned customZlibNotCalled(unsigned char**, size_t*, const unsigned char*, size_t, const LodePNGCompressSettings*)
+{
+  return 1;
+}
+
+void testStreamEncoder()
+{
+  static const unsigned sizes[][2] = {{1, 1}, {7, 3}, {33, 100}, {200, 150}, {1000, 90}};
+  static const unsigned windowsizes[] = {256, 2048, 32768};
+  for(size_t s = 0; s < sizeof(sizes) / sizeof(*sizes); ++s)
+  for(unsigned btype = 0; btype < 3; ++btype)
+  for(size_t ws = 0; ws < 3; ++ws)
+  for(unsigned numthreads = 1; numthreads <= 3; ++numthreads)
+  {
+    unsigned w = sizes[s][0], h = sizes[s][1];
+    bool rgb = (ws + numthreads) % 2 == 0; /*RGB PNGs convert every band from the RGBA rows*/
+    std::vector<unsigned char> image = streamTestImage(w, h, rgb);
+    LodePNGState state;
+    lodepng_state_init(&state);
+    state.info_png.color.colortype = rgb ? LCT_RGB : LCT_RGBA;
+    state.encoder.zlibsettings.btype = btype;
+    state.encoder.zlibsettings.windowsize = windowsizes[ws];
+    state.encoder.zlibsettings.numthreads = numthreads;
+    state.encoder.auto_convert = 0;
+
+    std::vector<unsigned char> png;
+    LodePNGStreamEncoder stream;
+    ASSERT_EQUALS(0u, lodepng_stream_encoder_init(&stream, w, h, &state, appendToVector, &png), "lodepng_stream_encoder_init");
+    /*bands of random sizes, some of them empty*/
+    for(unsigned y = 0; y < h && !stream.error;)
+    {
+      unsigned numrows = randomNumber() % 5 == 0 ? 0 : 1 + randomNumber() % (h - y < 40 ? h - y : 40);
+      ASSERT_EQUALS(0u, lodepng_stream_encoder_add_rows(&stream, &image[(size_t)y * w * 4], numrows), "lodepng_stream_encoder_add_rows");
+      y += numrows;
+    }
+    ASSERT_EQUALS(0u, lodepng_stream_encoder_finish(&stream), "lodepng_stream_encoder_finish");
+    lodepng_stream_encoder_cleanup(&stream);
+    ASSERT_EQUALS(true, decodesTo(png, image, w, h), "decode of the stream encoder output");
+
+    /*with btype 0 or 2 the zlib data is that of lodepng_encode, in more IDAT chunks*/
+    if(btype != 1 && numthreads == 1)
+    {
+      unsigned char* encoded = 0;
+      size_t encodedsize = 0;
+      ASSERT_EQUALS(0u, lodepng_encode(&encoded, &encodedsize, &image[0], w, h, &state), "lodepng_encode");
+      std::vector<unsigned char> expected(encoded, encoded + encodedsize);
+      free(encoded);
+      ASSERT_EQUALS(true, idatData(expected) == idatData(png), "stream encoder zlib data equal to lodepng_encode");
+    }
+    lodepng_state_cleanup(&state);
+  }
+
+  /*rows filtered elsewhere, with padding bytes between them, after a band of normal rows*/
+  {
+    unsigned w = 61, h = 40;
+    size_t linebytes = w * 4, stride = linebytes + 1 + 13;
+    std::vector<unsigned char> image = streamTestImage(w, h, false);
+    std::vector<unsigned char> filtered(h * stride);
+    fillBytes(filtered, 0);
+    for(unsigned y = 0; y < h; ++y)
+    {
+      unsigned char type = (unsigned char)(randomNumber() % 5);
+      filtered[y * stride] = type;
+      referenceFilter(&filtered[y * stride + 1], &image[y * linebytes], y ? &image[(y - 1) * linebytes] : 0, linebytes, 4, type);
+    }
+    LodePNGState state;
+    lodepng_state_init(&state);
+    state.encoder.auto_convert = 0;
+    state.encoder.zlibsettings.windowsize = 1024;
+    std::vector<unsigned char> png;
+    LodePNGStreamEncoder stream;
+    ASSERT_EQUALS(0u, lodepng_stream_encoder_init(&stream, w, h, &state, appendToVector, &png), "lodepng_stream_encoder_init");
+    ASSERT_EQUALS(0u, lodepng_stream_encoder_add_rows(&stream, &image[0], 5), "add_rows before add_filtered_rows");
+    for(unsigned y = 5; y < h; y += 7)
+    {
+      unsigned numrows = h - y < 7 ? h - y : 7;
+      ASSERT_EQUALS(0u, lodepng_stream_encoder_add_filtered_rows(&stream, &filtered[y * stride], stride, numrows), "lodepng_stream_encoder_add_filtered_rows");
+    }
+    ASSERT_EQUALS(0u, lodepng_stream_encoder_finish(&stream), "lodepng_stream_encoder_finish after add_filtered_rows");
+    lodepng_stream_encoder_cleanup(&stream);
+    ASSERT_EQUALS(true, decodesTo(png, image, w, h), "decode of add_filtered_rows output");
+
+    /*add_rows after add_filtered_rows, a stride shorter than a row, and then the error sticks*/
+    png.clear();
+    lodepng_stream_encoder_init(&stream, w, h, &state, appendToVector, &png);
+    lodepng_stream_encoder_add_filtered_rows(&stream, &filtered[0], stride, 1);
+    ASSERT_EQUALS(101u, lodepng_stream_encoder_add_rows(&stream, &image[linebytes], 1), "add_rows after add_filtered_rows");
+    ASSERT_EQUALS(101u, lodepng_stream_encoder_finish(&stream), "finish after an error");
+    lodepng_stream_encoder_cleanup(&stream);
+    lodepng_stream_encoder_init(&stream, w, h, &state, appendToVector, &png);
+    ASSERT_EQUALS(102u, lodepng_stream_encoder_add_filtered_rows(&stream, &filtered[0], linebytes, 1), "add_filtered_rows stride too small");
+    ASSERT_EQUALS(102u, lodepng_stream_encoder_add_rows(&stream, &image[0], 1), "add_rows after an error");
+    lodepng_stream_encoder_cleanup(&stream);
+
+    /*more rows than the image has, and finishing before all rows are given*/
+    lodepng_stream_encoder_init(&stream, w, h, &state, appendToVector, &png);
+    ASSERT_EQUALS(0u, lodepng_stream_encoder_add_rows(&stream, &image[0], h - 1), "add_rows");
+    ASSERT_EQUALS(97u, lodepng_stream_encoder_add_rows(&stream, &image[0], 2), "add_rows past the last row");
+    lodepng_stream_encoder_cleanup(&stream);
+    lodepng_stream_encoder_init(&stream, w, h, &state, appendToVector, &png);
+    ASSERT_EQUALS(97u, lodepng_stream_encoder_add_filtered_rows(&stream, &filtered[0], stride, h + 1), "add_filtered_rows past the last row");
+    lodepng_stream_encoder_cleanup(&stream);
+    lodepng_stream_encoder_init(&stream, w, h, &state, appendToVector, &png);
+    lodepng_stream_encoder_add_rows(&stream, &image[0], h - 1);
+    ASSERT_EQUALS(98u, lodepng_stream_encoder_finish(&stream), "finish before the last row");
+    lodepng_stream_encoder_cleanup(&stream);
+
+    /*what init refuses*/
+    ASSERT_EQUALS(93u, lodepng_stream_encoder_init(&stream, 0, h, &state, appendToVector, &png), "stream encoder width 0");
+    lodepng_stream_encoder_cleanup(&stream);
+    ASSERT_EQUALS(93u, lodepng_stream_encoder_init(&stream, w, 0, &state, appendToVector, &png), "stream encoder height 0");
+    lodepng_stream_encoder_cleanup(&stream);
+    state.info_png.interlace_method = 1;
+    ASSERT_EQUALS(95u, lodepng_stream_encoder_init(&stream, w, h, &state, appendToVector, &png), "stream encoder with Adam7");
+    lodepng_stream_encoder_cleanup(&stream);
+    state.info_png.interlace_method = 0;
+    state.encoder.zlibsettings.custom_zlib = customZlibNotCalled;
+    ASSERT_EQUALS(96u, lodepng_stream_encoder_init(&stream, w, h, &state, appendToVector, &png), "stream encoder with custom_zlib");
+    lodepng_stream_encoder_cleanup(&stream);
+    lodepng_state_cleanup(&state);
+  }
+}
+
+/*lodepng_decode_into agrees with lodepng_decode on the PNG, decoding to colortype and bitdepth, or
+without color conversion if colortype is -1*/
+static void checkDecodeInto(const std::vector<unsigned char>& png, int colortype, unsigned bitdepth)
+{
+  LodePNGState state;
+  lodepng_state_init(&state);
+  if(colortype < 0) state.decoder.color_convert = 0;
+  else
+  {
+    state.info_raw.colortype = (LodePNGColorType)colortype;
+    state.info_raw.bitdepth = bitdepth;
+  }
+  unsigned char* expected = 0;
+  unsigned w = 0, h = 0;
+  unsigned error = lodepng_decode(&expected, &w, &h, &state, &png[0], png.size());
+  ASSERT_EQUALS(0u, error, "lodepng_decode");
+  if(error)
+  {
+    lodepng_state_cleanup(&state);
+    return;
+  }
+  size_t size = lodepng_get_raw_size(w, h, colortype < 0 ? &state.info_png.color : &state.info_raw);
+
+  /*a byte after the buffer that must stay untouched, and a buffer one byte short*/
+  std::vector<unsigned char> out(size + 1, 0xaa);
+  unsigned w2 = 0, h2 = 0;
+  ASSERT_EQUALS(0u, lodepng_decode_into(&out[0], size, &w2, &h2, &state, &png[0], png.size()), "lodepng_decode_into");
+  ASSERT_EQUALS(true, w2 == w && h2 == h, "lodepng_decode_into size");
+  ASSERT_EQUALS(0, memcmp(expected, &out[0], size), "lodepng_decode_into output equal to lodepng_decode");
+  ASSERT_EQUALS(0xaa, out[size], "lodepng_decode_into writes past outsize");
+  ASSERT_EQUALS(100u, lodepng_decode_into(&out[0], size - 1, &w2, &h2, &state, &png[0], png.size()), "lodepng_decode_into one byte short");
+  free(expected);
+  lodepng_state_cleanup(&state);
+}
+
+void testDecodeInto()
+{
+  static const unsigned sizes[][2] = {{1, 1}, {3, 5}, {37, 20}, {300, 64}};
+  for(size_t s = 0; s < sizeof(sizes) / sizeof(*sizes); ++s)
+  for(int kind = 0; kind < 3; ++kind)
+  for(unsigned interlace = 0; interlace < 2; ++interlace)
+  {
+    unsigned w = sizes[s][0], h = sizes[s][1];
+    /*RGBA, opaque so it becomes RGB, and few colors so it becomes a palette*/
+    std::vector<unsigned char> image = streamTestImage(w, h, kind != 0);
+    if(kind == 2) for(size_t i = 0; i < image.size(); ++i) image[i] = i % 4 == 3 ? 255 : (unsigned char)(image[i] / 64 * 85);
+    LodePNGState state;
+    lodepng_state_init(&state);
+    state.info_png.interlace_method = interlace;
+    unsigned char* encoded = 0;
+    size_t encodedsize = 0;
+    ASSERT_EQUALS(0u, lodepng_encode(&encoded, &encodedsize, &image[0], w, h, &state), "lodepng_encode");
+    std::vector<unsigned char> png(encoded, encoded + encodedsize);
+    free(encoded);
+    lodepng_state_cleanup(&state);
+
+    checkDecodeInto(png, LCT_RGBA, 8);
+    checkDecodeInto(png, LCT_RGB, 8);
+    checkDecodeInto(png, LCT_RGBA, 16);
+    checkDecodeInto(png, -1, 0);
+  }
+
+  /*the image data split over many IDAT chunks, as the stream encoder writes it*/
+  {
+    unsigned w = 500, h = 300;
+    std::vector<unsigned char> image = streamTestImage(w, h, false), png;
+    LodePNGState state;
+    lodepng_state_init(&state);
+    state.encoder.auto_convert = 0;
+    state.encoder.zlibsettings.btype = 1;
+    LodePNGStreamEncoder stream;
+    lodepng_stream_encoder_init(&stream, w, h, &state, appendToVector, &png);
+    for(unsigned y = 0; y < h; y += 10) lodepng_stream_encoder_add_rows(&stream, &image[(size_t)y * w * 4], 10);
+    ASSERT_EQUALS(0u, lodepng_stream_encoder_finish(&stream), "lodepng_stream_encoder_finish");
+    lodepng_stream_encoder_cleanup(&stream);
+    lodepng_state_cleanup(&state);
+
+    unsigned numidat = 0;
+    for(const unsigned char* chunk = &png[8]; chunk + 12 <= &png[0] + png.size(); chunk = lodepng_chunk_next_const(chunk))
+    {
+      numidat += lodepng_chunk_type_equals(chunk, "IDAT");
+    }
+    ASSERT_EQUALS(true, numidat > 1, "stream encoder writes several IDAT chunks");
+    checkDecodeInto(png, LCT_RGBA, 8);
+    checkDecodeInto(png, LCT_RGB, 8);
+    checkDecodeInto(png, -1, 0);
+  }
+}
+
+/*an allocator that keeps the size in front of each buffer, to check the sizes lodepng passes back*/
+struct CheckingAllocator
+{
+  size_t live; /*bytes allocated and not freed*/
+  unsigned allocations;
+  bool sizes_right;
+};
+
+static void* checkingRealloc(void* ptr, size_t oldsize, size_t newsize, void* user)
+{
+  CheckingAllocator* a = (CheckingAllocator*)user;
+  size_t* header = ptr ? (size_t*)ptr - 2 : 0;
+  if(header && header[0] != oldsize) a->sizes_right = false;
+  if(!header && oldsize != 0) a->sizes_right = false;
+  header = (size_t*)realloc(header, newsize + 2 * sizeof(size_t));
+  if(!header) return 0;
+  header[0] = newsize;
+  a->live += newsize - oldsize;
+  ++a->allocations;
+  return header + 2;
+}
+
+static void checkingFree(void* ptr, size_t size, void* user)
+{
+  CheckingAllocator* a = (CheckingAllocator*)user;
+  size_t* header = (size_t*)ptr - 2;
+  if(header[0] != size) a->sizes_right = false;
+  a->live -= header[0];
+  free(header);
+}
+
+void testEncodeContext()
+{
+  /*growing and shrinking images, changing window sizes, interlacing and threads*/
+  static const unsigned sizes[][2] = {{100, 80}, {20, 7}, {640, 200}, {640, 200}, {1, 1}, {333, 300}, {333, 300}};
+  static const unsigned windowsizes[] = {32768, 1024, 256, 8192, 2048, 32768, 32768};
+  static const unsigned interlaces[] = {0, 1, 0, 0, 1, 1, 1};
+  static const unsigned threads[] = {1, 2, 3, 3, 1, 2, 2};
+  for(int custom = 0; custom < 2; ++custom)
+  {
+    CheckingAllocator checking = {0, 0, true};
+    LodePNGAllocator allocator = {checkingRealloc, checkingFree, &checking};
+    LodePNGEncoderContext context;
+    ASSERT_EQUALS(0u, lodepng_encoder_context_init(&context, custom ? &allocator : 0), "lodepng_encoder_context_init");
+    std::vector<unsigned char> image;
+    for(size_t i = 0; i < sizeof(sizes) / sizeof(*sizes); ++i)
+    {
+      unsigned w = sizes[i][0], h = sizes[i][1];
+      bool same = i > 0 && w == sizes[i - 1][0] && h == sizes[i - 1][1] && windowsizes[i] == windowsizes[i - 1];
+      if(!same) image = streamTestImage(w, h, i % 2 == 1);
+      LodePNGState state;
+      lodepng_state_init(&state);
+      state.encoder.zlibsettings.windowsize = windowsizes[i];
+      state.encoder.zlibsettings.numthreads = threads[i];
+      state.info_png.interlace_method = interlaces[i];
+      unsigned char* expected = 0;
+      size_t expectedsize = 0;
+      ASSERT_EQUALS(0u, lodepng_encode(&expected, &expectedsize, &image[0], w, h, &state), "lodepng_encode");
+      const unsigned char* out = 0;
+      size_t outsize = 0;
+      unsigned allocations = checking.allocations;
+      ASSERT_EQUALS(0u, lodepng_encode_context(&out, &outsize, &image[0], w, h, &state, &context), "lodepng_encode_context");
+      ASSERT_EQUALS(true, outsize == expectedsize && memcmp(out, expected, outsize) == 0, "lodepng_encode_context output equal to lodepng_encode");
+      /*the same image and window size again only reuse the buffers*/
+      if(custom && same) ASSERT_EQUALS(0u, checking.allocations - allocations, "lodepng_encode_context allocations on reuse");
+      free(expected);
+      lodepng_state_cleanup(&state);
+    }
+    lodepng_encoder_context_cleanup(&context);
+    if(custom)
+    {
+      ASSERT_EQUALS(true, checking.allocations > 0, "custom allocator used");
+      ASSERT_EQUALS(true, checking.sizes_right, "custom allocator given the allocated sizes");
+      ASSERT_EQUALS(0u, checking.live, "custom allocator all freed");
+    }
+  }
+}
+
+/*the tier can't run on this CPU if its newest instruction set is missing*/
+static bool tierSupported(int tier)
+{
+#ifdef LODEPNG_COMPILE_SIMD
+  if(tier == 1) return __builtin_cpu_supports("sse2");
+  if(tier == 2) return __builtin_cpu_supports("ssse3") && __builtin_cpu_supports("pclmul");
+  if(tier == 3) return __builtin_cpu_supports("avx2");
+  return true;
+#else /*LODEPNG_COMPILE_SIMD*/
+  (void)tierOf;
+  return tier == 0;
+#endif /*LODEPNG_COMPILE_SIMD*/
+}
+
+int main()
+{
+  for(simd_tier = 0; simd_tier < 4; ++simd_tier)
+  {
+    if(!tierSupported(simd_tier))
+    {
+      printf("%s: not supported here, skipped\n", tier_names[simd_tier]);
+      continue;
+    }
+    unsigned before = failures;
+    testFilterScanline();
+    testUnfilterScanline();
+    testCrc32();
+    testAdler32();
+    testConvertFromFloat();
+    testColorProfile();
+    testConvert();
+    printf("%s: %s\n", tier_names[simd_tier], failures == before ? "ok" : "FAILED");
+  }
+
+  /*deflate and inflate have no SIMD code of their own, they run once with every tier the CPU has*/
+  simd_tier = 3;
+  unsigned before = failures;
+  testDeflateRoundTrip();
+  testInflateCorrupt();
+  printf("deflate and inflate: %s\n", failures == before ? "ok" : "FAILED");
+
+  before = failures;
+  testStreamEncoder();
+  testDecodeInto();
+  testEncodeContext();
+  printf("encode and decode: %s\n", failures == before ? "ok" : "FAILED");
+
+  printf("%u checks, %u failed\n", checks, failures);
+  return failures == 0 ? 0 : 1;
+}
@@ -2,6 +2,15 @@
 #include <iostream>
 #include <assert.h>
 #include <vector>
+#include <functional>
+#include <string.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <chrono>
+#include <cmath>
+#include <algorithm>
 
 #include "lodepng.h"
 
@@ -13,76 +22,271 @@
 #include "Vulkan/VulkanCommandBuffer.h"
 #include "Vulkan/VulkanFence.h"
 #include "Vulkan/VulkanSubmit.h"
+#include "Vulkan/VulkanTileScheduler.h"
+#include "Vulkan/VulkanTileExecutor.h"
 
 struct Pixel
 {
     float r, g, b, a;
 };
+
+//Output formats of shader.comp, passed to the kernel as specialization constant 0
+enum OutputFormat
+{
+    OUTPUT_FLOAT_RGBA   = 0,    //Pixel per pixel, for high dynamic range use
+    OUTPUT_PACKED_RGBA8 = 1,    //packUnorm4x8, one uint per pixel
+    OUTPUT_INDEX8       = 2,    //iteration count, one byte per pixel, colored by the palette
+    OUTPUT_PALETTE      = 3,    //the palette of OUTPUT_INDEX8, one packed RGBA8 color per iteration count
+    OUTPUT_ESCAPE16     = 4     //smooth escape time as 8.8 fixed point uint16, colored on the host and kept to recolor
+};
+
 uint32_t WIDTH = 3200;
 uint32_t HEIGHT = 2400;
+uint32_t TILE_WIDTH = 1024;
+uint32_t TILE_HEIGHT = 512;
+uint32_t TILE_SLOTS = 3; //tile buffers on the GPU, tiles render while older ones are read back
+uint32_t ENCODE_QUEUE_DEPTH = 2; //read back tiles waiting for the encoder before rendering stalls
 uint32_t work_groups = 32;
+OutputFormat output_format = OUTPUT_INDEX8;
+uint32_t PALETTE_SIZE = 129; //iteration counts 0..M of shader.comp, all colors the image can have
+uint32_t ESCAPE_TIME_COUNT = (PALETTE_SIZE - 1) * 256 + 1; //escape times 0..M in 8.8 fixed point
+float RECOLOR_GAMMA = 2.2f; //gamma of the histogram equalized recolor written after an OUTPUT_ESCAPE16 render
+uint32_t IMAGE_CHANNELS = output_format == OUTPUT_INDEX8 ? 1 : 3; //palette indices, or RGB8 since the shader's alpha is always 1
+bool FILTER_ON_GPU = false; //filter.comp filters the PNG scanlines after each render, needs OUTPUT_PACKED_RGBA8, off lodepng filters on the CPU
+
+uint32_t GetPixelSize(OutputFormat format);
+std::vector<unsigned char> RenderPalette(ComputeEngine::SupportedDevice gpu);
+std::vector<unsigned char> BuildColorTable(const std::vector<unsigned char>& palette, float gamma, const std::vector<uint32_t>* histogram);
+std::vector<uint32_t> CountEscapeTimes(const std::vector<uint16_t>& escape_times);
+void ColorizeEscapeTimes(const uint16_t* escape_times, size_t count, const std::vector<unsigned char>& color_table, unsigned char* rgb);
+void ReadbackTile(const ComputeEngine::RenderedTile& tile, OutputFormat format, std::vector<unsigned char>& data);
+void ReadbackTile(const ComputeEngine::RenderedTile& tile, OutputFormat format, std::vector<unsigned char>& data)
+{
+    //Filtered on the GPU already, the scanlines only have to leave the mapped memory
+    if (tile.filtered_data != nullptr)
+    {
+        data.resize((size_t)tile.filtered_row_pitch * tile.info.height);
+        memcpy(&data[0], tile.filtered_data, data.size());
+        return;
+    }
+
+    size_t row_size = (size_t)tile.info.width * IMAGE_CHANNELS;
+    data.resize(row_size * tile.info.height);
+
+    //Palette indices only lose the padding of their rows
+    if (format == OUTPUT_INDEX8)
+    {
+        for (uint32_t y = 0; y < tile.info.height; y++)
+            memcpy(&data[y * row_size], (const unsigned char*)tile.data + (size_t)y * tile.row_pitch, row_size);
+        return;
+    }
+
+    //Convert straight from the mapped tile to the PNG's RGB8, lodepng then filters the rows as they are
+    LodePNGColorMode rgb;
+    lodepng_color_mode_init(&rgb);
+    rgb.colortype = LCT_RGB;
+    rgb.bitdepth = 8;
+    if (format == OUTPUT_FLOAT_RGBA)
+    {
+        //Clamped and rounded with SIMD, in bands of rows on every core
+        lodepng_convert_from_float(&data[0], row_size, (const float*)tile.data, tile.row_pitch,
+            tile.info.width, tile.info.height, &rgb, 0);
+        return;
+    }
+
+    // packUnorm4x8 puts red in the lowest byte, so on a little-endian host
+    // packed rows already are RGBA8 and only lose their alpha.
+    LodePNGColorMode rgba;
+    lodepng_color_mode_init(&rgba);
+    for (uint32_t y = 0; y < tile.info.height; y++)
+    {
+        const unsigned char* row = (const unsigned char*)tile.data + (size_t)y * tile.row_pitch;
+        lodepng_convert(&data[y * row_size], row, &rgb, &rgba, tile.info.width, 1);
+    }
+}
+
+void CopyTileToBand(const ComputeEngine::TileWork& work, std::vector<unsigned char>& band)
+{
+    size_t row_size = (size_t)work.info.width * IMAGE_CHANNELS;
+    for (uint32_t y = 0; y < work.info.height; y++)
+    {
+        size_t offset = ((size_t)y * work.info.image_width + work.info.offset_x) * IMAGE_CHANNELS;
+        memcpy(&band[offset], &work.data[y * row_size], row_size);
+    }
+}
 
-void SaveRenderedImage(uint32_t bufferSize, VkDevice device, VkDeviceMemory bufferMemory);
+void CopyTileToEscapeTimes(const ComputeEngine::RenderedTile& tile, std::vector<uint16_t>& escape_times)
+{
+    size_t row_size = (size_t)tile.info.width * sizeof(uint16_t);
+    for (uint32_t y = 0; y < tile.info.height; y++)
+    {
+        size_t offset = (size_t)(tile.info.offset_y + y) * tile.info.image_width + tile.info.offset_x;
+        memcpy(&escape_times[offset], (const unsigned char*)tile.data + (size_t)y * tile.row_pitch, row_size);
+    }
+}
 
 int main()
 {
     //Init Vulkan
     ComputeEngine::VulkanInstance instance = ComputeEngine::CreateVulkanInstance();
     //Init Compute Devices (GPUs)
-    std::vector<ComputeEngine::SupportedDevice> gpus = ComputeEngine::CreateDevices(instance.vulkan_instance);
+    std::vector<ComputeEngine::SupportedDevice> gpus = ComputeEngine::CreateDevices(instance.vulkan_instance, instance.api_version);
 
 
     std::cout << "Supported GPUs: " << std::endl;
     for (int i = 0; i < gpus.size(); i++)
     {
-        std::cout << "      " << gpus[i].device_properties.deviceName << std::endl;
+        std::cout << "      " << gpus[i].device_properties.deviceName
+            << " (Vulkan " << VK_VERSION_MAJOR(gpus[i].capabilities.api_version) << "." << VK_VERSION_MINOR(gpus[i].capabilities.api_version)
+            << ", subgroup size " << gpus[i].capabilities.subgroup_size << ")" << std::endl;
     }
 
-    //Create buffer on 1st GPU
-    ComputeEngine::VulkanBuffer buffer_object =  ComputeEngine::CreateBuffer(
-        gpus[0],
-        sizeof(Pixel) * WIDTH * HEIGHT, //buffer size
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
-    );
-
-    //Create descriptor layout so GPU knows how to handle buffer
-    ComputeEngine::VulkanDescriptor descriptor_set = ComputeEngine::CreateDescriptorSet(gpus[0], buffer_object, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
-
-    //Create pipeline
-    ComputeEngine::VulkanPipeline pipeline = ComputeEngine::CreatePipeline(gpus[0], descriptor_set, "comp.spv");
+    //Stream mandelbrot.png while rendering, only one band of TILE_HEIGHT rows is held on the host.
+    //The whole image is never available to choose a color type from, the shader only writes opaque colors.
+    lodepng::State png_state;
+    png_state.info_png.color.colortype = LCT_RGB;
+    png_state.info_png.color.bitdepth = 8;
+    png_state.info_raw.colortype = LCT_RGB; //the tiles are read back as RGB8 already, nothing left to convert
+    png_state.info_raw.bitdepth = 8;
+    std::vector<unsigned char> palette;
+    if (output_format == OUTPUT_INDEX8 || output_format == OUTPUT_ESCAPE16)
+        palette = RenderPalette(gpus[0]);
+    if (output_format == OUTPUT_INDEX8)
+    {
+        //The tiles are the PNG's palette indices, the PLTE chunk is rendered by the same kernel
+        png_state.info_png.color.colortype = LCT_PALETTE;
+        png_state.info_raw.colortype = LCT_PALETTE;
+        for (uint32_t i = 0; i < PALETTE_SIZE; i++)
+        {
+            lodepng_palette_add(&png_state.info_png.color, palette[i * 4], palette[i * 4 + 1], palette[i * 4 + 2], 255);
+            lodepng_palette_add(&png_state.info_raw, palette[i * 4], palette[i * 4 + 1], palette[i * 4 + 2], 255);
+        }
+    }
+    png_state.encoder.zlibsettings.numthreads = 0; //deflate on every core
+    png_state.encoder.zlibsettings.strategy = LDS_RLE; //filtered renders are mostly runs, smaller and ~5x faster than the default search
+    LodePNGStreamEncoder png_stream;
+    unsigned error = lodepng_stream_encoder_init_file(&png_stream, "mandelbrot.png", WIDTH, HEIGHT, &png_state);
+    if (error)
+    {
+        //Nothing is rendered when the file can't be written
+        std::cout << "encoder error " << error << ": " << lodepng_error_text(error) << std::endl;
+        lodepng_stream_encoder_cleanup(&png_stream);
+        ComputeEngine::DestroyDevices(gpus);
+        ComputeEngine::DestroyVulkanInstance(instance);
+        return 1;
+    }
 
-    //Create command buffer
-    ComputeEngine::VulkanCommandBuffer command_buffer = ComputeEngine::CreateCommandBuffer(
-        gpus[0], pipeline, descriptor_set,
-        (uint32_t)ceil(WIDTH / float(work_groups)), (uint32_t)ceil(HEIGHT / float(work_groups)), 1 //gpu work groups x,y,z
+    //Create tile scheduler on 1st GPU, GPU memory is bounded by TILE_SLOTS tiles instead of the image size.
+    //PNG filter types are chosen per image row, so filtering on the GPU renders bands of whole rows.
+    assert((!FILTER_ON_GPU || output_format == OUTPUT_PACKED_RGBA8) && "filter.comp reads packed RGBA8 tiles");
+    ComputeEngine::VulkanTileScheduler scheduler = ComputeEngine::CreateTileScheduler(
+        gpus[0], FILTER_ON_GPU ? WIDTH : TILE_WIDTH, TILE_HEIGHT, GetPixelSize(output_format), TILE_SLOTS, FILTER_ON_GPU ? IMAGE_CHANNELS : 0
     );
 
-    //Create fence
-    VkFence fence = ComputeEngine::CreateFence(gpus[0]);
+    //Create pipeline, all tile slots share the same descriptor layout
+    ComputeEngine::VulkanPipeline pipeline = ComputeEngine::CreatePipeline(gpus[0], scheduler.slots[0].descriptor, "comp.spv", {
+        { 0, output_format } //OUTPUT_FORMAT
+    }, sizeof(ComputeEngine::TileInfo));
+    ComputeEngine::VulkanPipeline filter_pipeline;
+    if (FILTER_ON_GPU)
+    {
+        //Rows are scored with subgroup adds where the device has them, in shared memory otherwise
+        const char* filter_shader = ComputeEngine::SelectShaderVariant(gpus[0], {
+            { "filter_subgroup.spv", ComputeEngine::DEVICE_CAPABILITY_SUBGROUP_BASIC | ComputeEngine::DEVICE_CAPABILITY_SUBGROUP_ARITHMETIC },
+            { "filter.spv", 0 }
+        });
+        filter_pipeline = ComputeEngine::CreatePipeline(gpus[0], scheduler.slots[0].descriptor, filter_shader, {
+            { 0, IMAGE_CHANNELS } //PIXEL_SIZE
+        }, sizeof(ComputeEngine::TileInfo));
+    }
 
-    //Submit command buffer to gpu so it can be computed
-    ComputeEngine::SubmitCommand(gpus[0], command_buffer, fence);
+    //Render image tile by tile, finished tiles are read back and converted to RGB8 (or arrive filtered) on this thread
+    //while the encode stage collects them into bands and compresses those on its own thread
+    std::vector<unsigned char> band(FILTER_ON_GPU ? 0 : (size_t)WIDTH * TILE_HEIGHT * IMAGE_CHANNELS);
+    //Escape times of the whole image are kept, so it can be colored again without rendering
+    std::vector<uint16_t> escape_times(output_format == OUTPUT_ESCAPE16 ? (size_t)WIDTH * HEIGHT : 0);
+    std::vector<unsigned char> color_table;
+    if (output_format == OUTPUT_ESCAPE16)
+        color_table = BuildColorTable(palette, 1.0f, nullptr);
+    ComputeEngine::StageTimings timings = ComputeEngine::RenderTilesPipelined(
+        gpus[0], scheduler, pipeline, FILTER_ON_GPU ? &filter_pipeline : nullptr, WIDTH, HEIGHT, work_groups, ENCODE_QUEUE_DEPTH,
+        [&](const ComputeEngine::RenderedTile& tile, std::vector<unsigned char>& data)
+        {
+            //Tiles cover different pixels, so they go straight to the escape times while older bands are encoded
+            if (output_format == OUTPUT_ESCAPE16)
+            {
+                CopyTileToEscapeTimes(tile, escape_times);
+                return;
+            }
+            ReadbackTile(tile, output_format, data);
+        },
+        [&](ComputeEngine::TileWork& work) -> bool
+        {
+            //Color complete bands of escape times with the palette, interpolated by their smooth fraction
+            if (output_format == OUTPUT_ESCAPE16)
+            {
+                if (work.info.offset_x + work.info.width == work.info.image_width)
+                {
+                    ColorizeEscapeTimes(&escape_times[(size_t)work.info.offset_y * WIDTH], (size_t)WIDTH * work.info.height, color_table, &band[0]);
+                    return lodepng_stream_encoder_add_rows(&png_stream, &band[0], work.info.height) == 0;
+                }
+                return true;
+            }
 
-    //Use fence to wait for gpu command to finish
-    vkWaitForFences(gpus[0].device, 1, &fence, VK_TRUE, 10);
+            //Filtered tiles are whole bands already, lodepng only deflates them
+            if (FILTER_ON_GPU)
+            {
+                return lodepng_stream_encoder_add_filtered_rows(&png_stream, &work.data[0],
+                    ComputeEngine::GetFilteredRowPitch(work.info.width, IMAGE_CHANNELS), work.info.height) == 0;
+            }
 
-    //Save Rendered Image
-    SaveRenderedImage(sizeof(Pixel) * WIDTH * HEIGHT, gpus[0].device, buffer_object.device_memory);
+            CopyTileToBand(work, band);
+            //Tiles arrive row by row, the band is complete with its right-most tile.
+            //The first error stops the render, the stream keeps it and finish returns it.
+            if (work.info.offset_x + work.info.width == work.info.image_width)
+                return lodepng_stream_encoder_add_rows(&png_stream, &band[0], work.info.height) == 0;
+            return true;
+        }
+    );
+    ComputeEngine::PrintStageTimings(timings);
 
-    //Destroy fence
-    ComputeEngine::DestroyFence(gpus[0], fence);
+    //Finish the image data and close the file
+    error = lodepng_stream_encoder_finish(&png_stream);
+    if (error)
+        std::cout << "encoder error " << error << ": " << lodepng_error_text(error) << std::endl;
+    lodepng_stream_encoder_cleanup(&png_stream);
 
-    //Destroy command buffer
-    ComputeEngine::DestroyCommandBuffer(gpus[0], command_buffer);
+    //Recolor with histogram equalization and gamma from the kept escape times, without rendering again
+    if (output_format == OUTPUT_ESCAPE16)
+    {
+        //Nothing is recolored when the file can't be written
+        LodePNGStreamEncoder recolor_stream;
+        error = lodepng_stream_encoder_init_file(&recolor_stream, "mandelbrot_equalized.png", WIDTH, HEIGHT, &png_state);
+        if (!error)
+        {
+            std::chrono::steady_clock::time_point recolor_start = std::chrono::steady_clock::now();
+            std::vector<uint32_t> histogram = CountEscapeTimes(escape_times);
+            std::vector<unsigned char> equalized_table = BuildColorTable(palette, RECOLOR_GAMMA, &histogram);
+            std::vector<unsigned char> image((size_t)WIDTH * HEIGHT * IMAGE_CHANNELS);
+            ColorizeEscapeTimes(&escape_times[0], escape_times.size(), equalized_table, &image[0]);
+            std::cout << "Recolored in " << ComputeEngine::SecondsSince(recolor_start) * 1000.0 << " ms" << std::endl;
 
-    //Destroy pipeline
-    ComputeEngine::DestroyPipeline(gpus[0], pipeline);
+            error = lodepng_stream_encoder_add_rows(&recolor_stream, &image[0], HEIGHT);
+            if (!error)
+                error = lodepng_stream_encoder_finish(&recolor_stream);
+        }
+        if (error)
+            std::cout << "encoder error " << error << ": " << lodepng_error_text(error) << std::endl;
+        lodepng_stream_encoder_cleanup(&recolor_stream);
+    }
 
-    //Descript descriptor sets
-    ComputeEngine::DestroyDescriptorSet(gpus[0], descriptor_set);
+    //Destroy pipelines
+    ComputeEngine::DestroyPipeline(gpus[0], pipeline);
+    if (FILTER_ON_GPU)
+        ComputeEngine::DestroyPipeline(gpus[0], filter_pipeline);
 
-    //Destroy Buffer
-    ComputeEngine::DestroyBuffer(gpus[0], buffer_object);
+    //Destroy tile scheduler (buffers, descriptors, command buffers and fences)
+    ComputeEngine::DestroyTileScheduler(gpus[0], scheduler);
 
     //De-init Compute Devices (GPUs)
     ComputeEngine::DestroyDevices(gpus);
@@ -93,27 +297,100 @@ int main()
     return 0;
 }
 
-void SaveRenderedImage(uint32_t bufferSize, VkDevice device, VkDeviceMemory bufferMemory)
+uint32_t GetPixelSize(OutputFormat format)
+{
+    if (format == OUTPUT_INDEX8)
+        return sizeof(unsigned char);
+    if (format == OUTPUT_ESCAPE16)
+        return sizeof(uint16_t);
+    return format == OUTPUT_FLOAT_RGBA ? sizeof(Pixel) : sizeof(uint32_t);
+}
+
+std::vector<unsigned char> RenderPalette(ComputeEngine::SupportedDevice gpu)
 {
-    void* mappedMemory = NULL;
-    // Map the buffer memory, so that we can read from it on the CPU.
-    vkMapMemory(device, bufferMemory, 0, bufferSize, 0, &mappedMemory);
-    Pixel* pmappedMemory = (Pixel *)mappedMemory;
-
-    // Get the color data from the buffer, and cast it to bytes.
-    // We save the data to a vector.
-    std::vector<unsigned char> image;
-    image.reserve(WIDTH * HEIGHT * 4);
-    for (int i = 0; i < WIDTH*HEIGHT; i += 1) {
-        image.push_back((unsigned char)(255.0f * (pmappedMemory[i].r)));
-        image.push_back((unsigned char)(255.0f * (pmappedMemory[i].g)));
-        image.push_back((unsigned char)(255.0f * (pmappedMemory[i].b)));
-        image.push_back((unsigned char)(255.0f * (pmappedMemory[i].a)));
+    //The palette is a tile of PALETTE_SIZE by 1 pixels, pixel x gets the color of iteration count x
+    ComputeEngine::VulkanBuffer buffer = ComputeEngine::CreateBuffer(gpu, PALETTE_SIZE * sizeof(uint32_t),
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    ComputeEngine::VulkanDescriptor descriptor = ComputeEngine::CreateDescriptorSet(gpu, buffer, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+    ComputeEngine::VulkanPipeline pipeline = ComputeEngine::CreatePipeline(gpu, descriptor, "comp.spv", {
+        { 0, OUTPUT_PALETTE } //OUTPUT_FORMAT
+    }, sizeof(ComputeEngine::TileInfo));
+    ComputeEngine::TileInfo tile = { 0, 0, PALETTE_SIZE, 1, PALETTE_SIZE, 1 };
+
+    //Render it and wait for the GPU
+    ComputeEngine::VulkanCommandBuffer command_buffer = ComputeEngine::CreateCommandBuffer(gpu);
+    ComputeEngine::RecordCommandBuffer(command_buffer, pipeline, descriptor, &tile, sizeof(ComputeEngine::TileInfo),
+        (PALETTE_SIZE + work_groups - 1) / work_groups, 1, 1);
+    VkFence fence = ComputeEngine::CreateFence(gpu);
+    ComputeEngine::SubmitCommand(gpu, command_buffer, fence);
+    VkResult result = vkWaitForFences(gpu.device, 1, &fence, VK_TRUE, UINT64_MAX);
+    assert(result == VK_SUCCESS && "Could not wait for palette fence");
+
+    //packUnorm4x8 puts red in the lowest byte, so the palette is read back as RGBA8
+    std::vector<unsigned char> palette(PALETTE_SIZE * sizeof(uint32_t));
+    void* mapped_memory = NULL;
+    result = vkMapMemory(gpu.device, buffer.device_memory, 0, VK_WHOLE_SIZE, 0, &mapped_memory);
+    assert(result == VK_SUCCESS && "Could not map palette buffer");
+    memcpy(&palette[0], mapped_memory, palette.size());
+    vkUnmapMemory(gpu.device, buffer.device_memory);
+
+    ComputeEngine::DestroyFence(gpu, fence);
+    ComputeEngine::DestroyCommandBuffer(gpu, command_buffer);
+    ComputeEngine::DestroyPipeline(gpu, pipeline);
+    ComputeEngine::DestroyDescriptorSet(gpu, descriptor);
+    ComputeEngine::DestroyBuffer(gpu, buffer);
+    return palette;
+}
+
+std::vector<unsigned char> BuildColorTable(const std::vector<unsigned char>& palette, float gamma, const std::vector<uint32_t>* histogram)
+{
+    //Histogram equalization moves every escape time to its share of all pixels, spreading them evenly over the palette
+    uint64_t total = 0, cumulative = 0;
+    if (histogram != nullptr)
+    {
+        for (uint32_t i = 0; i < ESCAPE_TIME_COUNT; i++)
+            total += (*histogram)[i];
     }
-    // Done reading, so unmap.
-    vkUnmapMemory(device, bufferMemory);
 
-    // Now we save the acquired color data to a .png.
-    unsigned error = lodepng::encode("mandelbrot.png", image, WIDTH, HEIGHT);
-    if (error) printf("encoder error %d: %s", error, lodepng_error_text(error));
+    //RGB8 color of every escape time, coloring a pixel is then a single lookup
+    std::vector<unsigned char> color_table(ESCAPE_TIME_COUNT * 3);
+    for (uint32_t i = 0; i < ESCAPE_TIME_COUNT; i++)
+    {
+        double position = i / 256.0;
+        if (total > 0)
+        {
+            cumulative += (*histogram)[i];
+            position = (double)cumulative / total * (PALETTE_SIZE - 1);
+        }
+
+        //Interpolate between the palette colors of the iteration counts around the escape time
+        uint32_t index = std::min((uint32_t)position, PALETTE_SIZE - 1);
+        uint32_t next = std::min(index + 1, PALETTE_SIZE - 1);
+        double fraction = position - index;
+        for (uint32_t channel = 0; channel < 3; channel++)
+        {
+            double value = (palette[index * 4 + channel] * (1.0 - fraction) + palette[next * 4 + channel] * fraction) / 255.0;
+            color_table[i * 3 + channel] = (unsigned char)(pow(value, 1.0 / gamma) * 255.0 + 0.5);
+        }
+    }
+    return color_table;
+}
+
+std::vector<uint32_t> CountEscapeTimes(const std::vector<uint16_t>& escape_times)
+{
+    std::vector<uint32_t> histogram(ESCAPE_TIME_COUNT, 0);
+    for (size_t i = 0; i < escape_times.size(); i++)
+        histogram[std::min((uint32_t)escape_times[i], ESCAPE_TIME_COUNT - 1)]++;
+    return histogram;
+}
+
+void ColorizeEscapeTimes(const uint16_t* escape_times, size_t count, const std::vector<unsigned char>& color_table, unsigned char* rgb)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        const unsigned char* color = &color_table[std::min((uint32_t)escape_times[i], ESCAPE_TIME_COUNT - 1) * 3];
+        rgb[i * 3] = color[0];
+        rgb[i * 3 + 1] = color[1];
+        rgb[i * 3 + 2] = color[2];
+    }
 }
\ No newline at end of file